@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <script/signingprovider.h>
 #include <test/util/transaction_utils.h>
 
@@ -51,4 +52,74 @@ static void CCoinsCaching(benchmark::Bench& bench)
     ECC_Stop();
 }
 
+/** A cache holding 2^19 coins, and a random selection of 4096 of their outpoints. */
+static void SetupLookups(CCoinsViewCache& coins, std::vector<COutPoint>& lookups)
+{
+    FastRandomContext rng{/*fDeterministic=*/true};
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < (1 << 19); ++i) {
+        outpoints.emplace_back(rng.rand256(), i & 3);
+        coins.AddCoin(outpoints.back(), Coin{CTxOut{COIN, CScript{} << OP_1}, 1, false}, false);
+    }
+    for (int i = 0; i < 4096; ++i) {
+        lookups.push_back(outpoints[rng.randrange(outpoints.size())]);
+    }
+}
+
+static void CCoinsCachingLookup(benchmark::Bench& bench)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    std::vector<COutPoint> lookups;
+    SetupLookups(coins, lookups);
+
+    bench.batch(lookups.size()).unit("coin").run([&] {
+        for (const COutPoint& outpoint : lookups) {
+            bool found = coins.HaveCoin(outpoint);
+            assert(found);
+        }
+    });
+}
+
+static void CCoinsCachingFetchCoins(benchmark::Bench& bench)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    std::vector<COutPoint> lookups;
+    SetupLookups(coins, lookups);
+
+    bench.batch(lookups.size()).unit("coin").run([&] {
+        coins.FetchCoins(lookups);
+    });
+}
+
+/** Fill an empty cache with several million coins, as during initial sync. */
+static void CCoinsCachingFill(benchmark::Bench& bench)
+{
+    constexpr uint32_t NUM_COINS{1 << 22};
+    FastRandomContext rng{/*fDeterministic=*/true};
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(NUM_COINS);
+    for (uint32_t i = 0; i < NUM_COINS; ++i) {
+        outpoints.emplace_back(rng.rand256(), i & 3);
+    }
+    const CTxOut txout{COIN, CScript{} << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG};
+
+    CCoinsView coinsDummy;
+    bench.batch(NUM_COINS).unit("coin").epochs(1).epochIterations(1).run([&] {
+        CCoinsViewCache coins(&coinsDummy);
+        for (const COutPoint& outpoint : outpoints) {
+            coins.AddCoin(outpoint, Coin{txout, 1, false}, false);
+        }
+        for (size_t i = 0; i < outpoints.size(); i += 16) {
+            bool found = coins.HaveCoinInCache(outpoints[i]);
+            assert(found);
+        }
+        assert(coins.GetCacheSize() == NUM_COINS);
+    });
+}
+
 BENCHMARK(CCoinsCaching);
+BENCHMARK(CCoinsCachingLookup);
+BENCHMARK(CCoinsCachingFetchCoins);
+BENCHMARK(CCoinsCachingFill);
@@ -8,6 +8,8 @@
 #include <chainparams.h>
 #include <consensus/validation.h>
 #include <streams.h>
+#include <util/system.h>
+#include <util/threadpool.h>
 #include <validation.h>
 
 // These are the two major time-sinks which happen after we have fully received
@@ -49,5 +51,46 @@ static void DeserializeAndCheckBlockTest(benchmark::Bench& bench)
     });
 }
 
+static void DeserializeBlockParallelTxHashingTest(benchmark::Bench& bench)
+{
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+
+    ThreadPool pool{"bench"};
+    pool.Start(GetNumCores() - 1);
+    bench.unit("block").run([&] {
+        CBlock block;
+        stream >> ParallelTxHashing{block, &pool};
+        bool rewound = stream.Rewind(benchmark::data::block413567.size());
+        assert(rewound);
+    });
+}
+
+static void DeserializeAndCheckBlockParallelTxHashingTest(benchmark::Bench& bench)
+{
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+
+    ArgsManager bench_args;
+    const auto chainParams = CreateChainParams(bench_args, CBaseChainParams::MAIN);
+
+    ThreadPool pool{"bench"};
+    pool.Start(GetNumCores() - 1);
+    bench.unit("block").run([&] {
+        CBlock block;
+        stream >> ParallelTxHashing{block, &pool};
+        bool rewound = stream.Rewind(benchmark::data::block413567.size());
+        assert(rewound);
+
+        BlockValidationState validationState;
+        bool checked = CheckBlock(block, validationState, chainParams->GetConsensus());
+        assert(checked);
+    });
+}
+
 BENCHMARK(DeserializeBlockTest);
 BENCHMARK(DeserializeAndCheckBlockTest);
+BENCHMARK(DeserializeBlockParallelTxHashingTest);
+BENCHMARK(DeserializeAndCheckBlockParallelTxHashingTest);
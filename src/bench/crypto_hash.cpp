@@ -54,6 +54,23 @@ static void SHA3_256_1M(benchmark::Bench& bench)
     });
 }
 
+static void KECCAK256_1M(benchmark::Bench& bench)
+{
+    uint8_t hash[Keccak256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE,0);
+    bench.batch(in.size()).unit("byte").run([&] {
+        Keccak256().Write(in).Finalize(hash);
+    });
+}
+
+static void KeccakF1600(benchmark::Bench& bench)
+{
+    uint64_t state[25] = {0};
+    bench.run([&] {
+        KeccakF(state);
+    });
+}
+
 static void SHA256_32b(benchmark::Bench& bench)
 {
     std::vector<uint8_t> in(32,0);
@@ -64,6 +81,36 @@ static void SHA256_32b(benchmark::Bench& bench)
     });
 }
 
+static void KECCAK256_32b(benchmark::Bench& bench)
+{
+    std::vector<uint8_t> in(32,0);
+    bench.batch(in.size()).unit("byte").run([&] {
+        Keccak256()
+            .Write(in)
+            .Finalize(in);
+    });
+}
+
+static void KECCAK256_80b(benchmark::Bench& bench)
+{
+    // The size of a serialized block header.
+    std::vector<uint8_t> in(80,0);
+    uint8_t hash[Keccak256::OUTPUT_SIZE];
+    bench.batch(in.size()).unit("byte").run([&] {
+        Keccak256().Write(in).Finalize(hash);
+        in[0] = hash[0];
+    });
+}
+
+static void KECCAK256BATCH80_1024(benchmark::Bench& bench)
+{
+    std::vector<uint8_t> in(80 * 1024, 0);
+    std::vector<uint8_t> out(32 * 1024);
+    bench.batch(in.size()).unit("byte").run([&] {
+        Keccak256Batch(out.data(), in.data(), 80, 1024);
+    });
+}
+
 static void SHA256D64_1024(benchmark::Bench& bench)
 {
     std::vector<uint8_t> in(64 * 1024, 0);
@@ -90,6 +137,41 @@ static void SipHash_32b(benchmark::Bench& bench)
     });
 }
 
+static void SipHash_32b_4way(benchmark::Bench& bench)
+{
+    uint256 x[4];
+    const uint256* const vals[4] = {&x[0], &x[1], &x[2], &x[3]};
+    uint64_t k1 = 0;
+    bench.batch(4).unit("hash").run([&] {
+        uint64_t out[4];
+        SipHashUint256_4way(0, ++k1, vals, out);
+        for (int i = 0; i < 4; ++i) *((uint64_t*)x[i].begin()) = out[i];
+    });
+}
+
+static void SipHashExtra_36b(benchmark::Bench& bench)
+{
+    uint256 x;
+    uint32_t n = 0;
+    uint64_t k1 = 0;
+    bench.run([&] {
+        *((uint64_t*)x.begin()) = SipHashUint256Extra(0, ++k1, x, ++n);
+    });
+}
+
+static void SipHashExtra_36b_4way(benchmark::Bench& bench)
+{
+    uint256 x[4];
+    const uint256* const vals[4] = {&x[0], &x[1], &x[2], &x[3]};
+    uint32_t n[4] = {0, 1, 2, 3};
+    uint64_t k1 = 0;
+    bench.batch(4).unit("hash").run([&] {
+        uint64_t out[4];
+        SipHashUint256Extra_4way(0, ++k1, vals, n, out);
+        for (int i = 0; i < 4; ++i) *((uint64_t*)x[i].begin()) = out[i];
+    });
+}
+
 static void FastRandom_32bit(benchmark::Bench& bench)
 {
     FastRandomContext rng(true);
@@ -155,10 +237,18 @@ BENCHMARK(SHA1);
 BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 BENCHMARK(SHA3_256_1M);
+BENCHMARK(KECCAK256_1M);
+BENCHMARK(KeccakF1600);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(KECCAK256_32b);
+BENCHMARK(KECCAK256_80b);
 BENCHMARK(SipHash_32b);
+BENCHMARK(SipHash_32b_4way);
+BENCHMARK(SipHashExtra_36b);
+BENCHMARK(SipHashExtra_36b_4way);
 BENCHMARK(SHA256D64_1024);
+BENCHMARK(KECCAK256BATCH80_1024);
 BENCHMARK(FastRandom_32bit);
 BENCHMARK(FastRandom_1bit);
 
@@ -0,0 +1,85 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/consensus.h>
+#include <node/blockstorage.h>
+#include <test/util/mining.h>
+#include <test/util/script.h>
+#include <test/util/setup_common.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <vector>
+
+// Disconnect the last NUM_BLOCKS blocks of a chain into a throwaway view, as a
+// reorg would, reading each block and its undo data back from disk.
+static void DisconnectBlocks(benchmark::Bench& bench)
+{
+    const auto test_setup = MakeNoLogFileContext<const TestingSetup>();
+
+    constexpr int NUM_BLOCKS{100};
+    constexpr int FANOUT{50};
+
+    CScriptWitness witness;
+    witness.stack.push_back(WITNESS_STACK_ELEM_OP_TRUE);
+
+    std::vector<CTxIn> coinbases;
+    for (int i{0}; i <= COINBASE_MATURITY; ++i) {
+        coinbases.push_back(MineBlock(test_setup->m_node, P2WSH_OP_TRUE));
+    }
+
+    // Every block fans a matured coinbase out into FANOUT outputs and sweeps
+    // the outputs fanned out by its predecessor, so that its undo data holds
+    // FANOUT + 1 spent coins.
+    CTransactionRef prev_fanout;
+    for (int b{0}; b < NUM_BLOCKS; ++b) {
+        CMutableTransaction fanout;
+        fanout.vin.push_back(coinbases.at(b));
+        fanout.vin.back().scriptWitness = witness;
+        for (int o{0}; o < FANOUT; ++o) {
+            fanout.vout.emplace_back(10000, P2WSH_OP_TRUE);
+        }
+        std::vector<CTransactionRef> txs{MakeTransactionRef(fanout)};
+        if (prev_fanout) {
+            CMutableTransaction sweep;
+            for (int o{0}; o < FANOUT; ++o) {
+                sweep.vin.emplace_back(prev_fanout->GetHash(), o);
+                sweep.vin.back().scriptWitness = witness;
+            }
+            sweep.vout.emplace_back(10000, P2WSH_OP_TRUE);
+            txs.push_back(MakeTransactionRef(sweep));
+        }
+        {
+            LOCK(::cs_main);
+            for (const auto& tx : txs) {
+                const MempoolAcceptResult res = test_setup->m_node.chainman->ProcessTransaction(tx);
+                assert(res.m_result_type == MempoolAcceptResult::ResultType::VALID);
+            }
+        }
+        coinbases.push_back(MineBlock(test_setup->m_node, P2WSH_OP_TRUE));
+        prev_fanout = txs.front();
+    }
+
+    LOCK(::cs_main);
+    CChainState& chainstate = test_setup->m_node.chainman->ActiveChainstate();
+    const CBlockIndex* tip = chainstate.m_chain.Tip();
+    const CBlockIndex* fork = chainstate.m_chain[tip->nHeight - NUM_BLOCKS];
+
+    bench.batch(NUM_BLOCKS).unit("block").run([&] {
+        CCoinsViewCache view(&chainstate.CoinsTip());
+        for (const CBlockIndex* pindex = tip; pindex != fork; pindex = pindex->pprev) {
+            CBlock block;
+            bool read{ReadBlockFromDisk(block, pindex, Params().GetConsensus())};
+            assert(read);
+            DisconnectResult res{chainstate.DisconnectBlock(block, pindex, view)};
+            assert(res == DISCONNECT_OK);
+        }
+    });
+}
+
+BENCHMARK(DisconnectBlocks);
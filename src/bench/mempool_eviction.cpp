@@ -127,7 +127,7 @@ static void MempoolEviction(benchmark::Bench& bench)
         AddTx(tx5_r, 1000LL, pool);
         AddTx(tx6_r, 1100LL, pool);
         AddTx(tx7_r, 9000LL, pool);
-        pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4);
+        pool.TrimToSize((pool.DynamicMemoryUsage() - pool.FreeMemoryUsage()) * 3 / 4);
         pool.TrimToSize(GetVirtualTransactionSize(*tx1_r));
     });
 }
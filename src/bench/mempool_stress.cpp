@@ -94,7 +94,7 @@ static void ComplexMemPool(benchmark::Bench& bench)
         for (auto& tx : ordered_coins) {
             AddTx(tx, pool);
         }
-        pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4);
+        pool.TrimToSize((pool.DynamicMemoryUsage() - pool.FreeMemoryUsage()) * 3 / 4);
         pool.TrimToSize(GetVirtualTransactionSize(*ordered_coins.front()));
     });
 }
@@ -115,5 +115,44 @@ static void MempoolCheck(benchmark::Bench& bench)
     });
 }
 
+/** Chains of chain_length transactions, each spending the previous one and the first spending a confirmed coin. */
+static std::vector<CTransactionRef> CreateChains(FastRandomContext& det_rand, int num_txs, int chain_length)
+{
+    std::vector<CTransactionRef> txs;
+    txs.reserve(num_txs);
+    for (int i = 0; i < num_txs; ++i) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = i % chain_length == 0 ? COutPoint(det_rand.rand256(), 0) : COutPoint(txs.back()->GetHash(), 0);
+        tx.vin[0].scriptWitness.stack.push_back(CScriptNum(i).getvch());
+        tx.vout.resize(2);
+        for (auto& out : tx.vout) {
+            out.scriptPubKey = CScript() << CScriptNum(i) << OP_EQUAL;
+            out.nValue = 10 * COIN;
+        }
+        txs.push_back(MakeTransactionRef(tx));
+    }
+    return txs;
+}
+
+/** Fill and drain a mempool the size of a full default one, to measure the cost of entry storage. */
+static void MempoolLarge(benchmark::Bench& bench)
+{
+    FastRandomContext det_rand{true};
+    const int num_txs = bench.complexityN() > 1 ? static_cast<int>(bench.complexityN()) : 300000;
+    const std::vector<CTransactionRef> txs = CreateChains(det_rand, num_txs, /* chain_length */ 5);
+    const auto testing_setup = MakeNoLogFileContext<const TestingSetup>(CBaseChainParams::MAIN);
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    bench.batch(num_txs).unit("tx").epochs(1).epochIterations(3).run([&]() NO_THREAD_SAFETY_ANALYSIS {
+        for (const auto& tx : txs) {
+            AddTx(tx, pool);
+        }
+        pool.TrimToSize((pool.DynamicMemoryUsage() - pool.FreeMemoryUsage()) / 2);
+        pool.TrimToSize(0);
+    });
+}
+
 BENCHMARK(ComplexMemPool);
 BENCHMARK(MempoolCheck);
+BENCHMARK(MempoolLarge);
@@ -0,0 +1,107 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include <hash.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <version.h>
+
+extern "C" {
+#include <crypto/sha3/sha3.h>
+}
+
+/** Serialization hasher that feeds every field into sha3_Update, as CHashWriterKeccak used to. */
+class LegacyHashWriterKeccak
+{
+private:
+    sha3_context m_ctx;
+    const int nType;
+    const int nVersion;
+
+public:
+    LegacyHashWriterKeccak(int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn)
+    {
+        sha3_Init256(&m_ctx);
+        sha3_SetFlags(&m_ctx, SHA3_FLAGS_KECCAK);
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    void write(const char* pch, size_t size) { sha3_Update(&m_ctx, pch, size); }
+
+    uint256 GetHash()
+    {
+        uint256 result;
+        memcpy(result.begin(), sha3_Finalize(&m_ctx), 32);
+        return result;
+    }
+
+    template <typename T>
+    LegacyHashWriterKeccak& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+};
+
+static CBlock LoadBlock()
+{
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+    return block;
+}
+
+static void SerializeHashKeccakHeader(benchmark::Bench& bench)
+{
+    const CBlockHeader header = LoadBlock().GetBlockHeader();
+    bench.unit("header").run([&] {
+        uint256 hash = SerializeHashKeccak(header);
+        ankerl::nanobench::doNotOptimizeAway(hash);
+    });
+}
+
+static void SerializeHashKeccakHeaderLegacy(benchmark::Bench& bench)
+{
+    const CBlockHeader header = LoadBlock().GetBlockHeader();
+    bench.unit("header").run([&] {
+        LegacyHashWriterKeccak ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << header;
+        uint256 hash = ss.GetHash();
+        ankerl::nanobench::doNotOptimizeAway(hash);
+    });
+}
+
+static void SerializeHashKeccakTransactions(benchmark::Bench& bench)
+{
+    const CBlock block = LoadBlock();
+    bench.batch(block.vtx.size()).unit("tx").run([&] {
+        for (const auto& tx : block.vtx) {
+            uint256 hash = SerializeHashKeccak(*tx, SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS);
+            ankerl::nanobench::doNotOptimizeAway(hash);
+        }
+    });
+}
+
+static void SerializeHashKeccakTransactionsLegacy(benchmark::Bench& bench)
+{
+    const CBlock block = LoadBlock();
+    bench.batch(block.vtx.size()).unit("tx").run([&] {
+        for (const auto& tx : block.vtx) {
+            LegacyHashWriterKeccak ss(SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS);
+            ss << *tx;
+            uint256 hash = ss.GetHash();
+            ankerl::nanobench::doNotOptimizeAway(hash);
+        }
+    });
+}
+
+BENCHMARK(SerializeHashKeccakHeader);
+BENCHMARK(SerializeHashKeccakHeaderLegacy);
+BENCHMARK(SerializeHashKeccakTransactions);
+BENCHMARK(SerializeHashKeccakTransactionsLegacy);
@@ -7,12 +7,16 @@
 #include <consensus/consensus.h>
 #include <logging.h>
 #include <random.h>
+#include <script/script.h>
 #include <version.h>
 
+#include <algorithm>
+#include <cstring>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return false; }
 std::unique_ptr<CCoinsViewCursor> CCoinsView::Cursor() const { return nullptr; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -21,13 +25,92 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
     return GetCoin(outpoint, coin);
 }
 
+Coin CCoinsCacheEntry::CopyCoin() const
+{
+    return m_packed ? Unpacked(m_packed_coin) : m_coin;
+}
+
+void CCoinsCacheEntry::SetCoin(Coin&& coin)
+{
+    if (m_packed) {
+        ::new (&m_coin) Coin(std::move(coin));
+        m_packed = false;
+    } else {
+        m_coin = std::move(coin);
+    }
+}
+
+void CCoinsCacheEntry::MoveCoinFrom(CCoinsCacheEntry& other)
+{
+    if (!other.m_packed) return SetCoin(std::move(other.m_coin));
+    if (!m_packed) m_coin.~Coin();
+    m_packed_coin = other.m_packed_coin;
+    m_packed = true;
+}
+
+void CCoinsCacheEntry::CopyCoinFrom(const CCoinsCacheEntry& other)
+{
+    if (!other.m_packed) return SetCoin(Coin{other.m_coin});
+    if (!m_packed) m_coin.~Coin();
+    m_packed_coin = other.m_packed_coin;
+    m_packed = true;
+}
+
+void CCoinsCacheEntry::Pack()
+{
+    static_assert(sizeof(PackedCoin) <= sizeof(Coin), "packing a coin must not grow the cache entry");
+    if (m_packed) return;
+    const CScript& script = m_coin.out.scriptPubKey;
+    PackedCoin packed;
+    if (script.size() == 34 && (script[0] == OP_0 || (script[0] >= OP_1 && script[0] <= OP_16)) && script[1] == 32) {
+        packed.prefix = script[0];
+        std::copy(script.begin() + 2, script.end(), packed.data);
+        packed.data[32] = 0;
+    } else if (script.size() == 35 && script[0] == 33 && (script[1] == 0x02 || script[1] == 0x03) && script[34] == OP_CHECKSIG) {
+        packed.prefix = script[0];
+        std::copy(script.begin() + 1, script.begin() + 34, packed.data);
+    } else {
+        return;
+    }
+    packed.value = m_coin.out.nValue;
+    packed.code = m_coin.nHeight * uint32_t{2} + m_coin.fCoinBase;
+    m_coin.~Coin();
+    m_packed_coin = packed;
+    m_packed = true;
+}
+
+Coin CCoinsCacheEntry::Unpacked(const PackedCoin& packed)
+{
+    unsigned char script[35];
+    size_t size;
+    script[0] = packed.prefix;
+    if (packed.prefix == 33) {
+        std::memcpy(script + 1, packed.data, 33);
+        script[34] = OP_CHECKSIG;
+        size = 35;
+    } else {
+        script[1] = 32;
+        std::memcpy(script + 2, packed.data, 32);
+        size = 34;
+    }
+    return Coin(CTxOut(packed.value, CScript(script, script + size)), packed.code >> 1, packed.code & 1);
+}
+
+void CCoinsCacheEntry::Unpack()
+{
+    if (!m_packed) return;
+    Coin coin{Unpacked(m_packed_coin)};
+    ::new (&m_coin) Coin(std::move(coin));
+    m_packed = false;
+}
+
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return base->BatchWrite(mapCoins, hashBlock, erase); }
 std::unique_ptr<CCoinsViewCursor> CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
@@ -37,27 +120,59 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
+size_t CCoinsViewCache::FreeMemoryUsage() const {
+    return cacheCoins.FreeMemoryUsage();
+}
+
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
-    CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    return FetchCoin(outpoint, cacheCoins.hash_function()(outpoint));
+}
+
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint, size_t hash) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint, hash);
+    if (it != cacheCoins.end()) {
+        it->second.recent = true;
         return it;
+    }
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
-    if (ret->second.coin.IsSpent()) {
+    CCoinsMap::iterator ret = cacheCoins.try_emplace_hashed(hash, outpoint, std::move(tmp)).first;
+    if (ret->second.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.DynamicMemoryUsage();
     return ret;
 }
 
+Coin& CCoinsViewCache::UnpackCoin(CCoinsCacheEntry& entry) const
+{
+    if (entry.IsPacked()) {
+        entry.Unpack();
+        cachedCoinsUsage += entry.DynamicMemoryUsage();
+    }
+    return entry.GetCoin();
+}
+
+void CCoinsViewCache::FetchCoins(Span<const COutPoint> outpoints) const
+{
+    size_t i = 0;
+    for (; i + 4 <= outpoints.size(); i += 4) {
+        const COutPoint* const group[4] = {&outpoints[i], &outpoints[i + 1], &outpoints[i + 2], &outpoints[i + 3]};
+        size_t hashes[4];
+        cacheCoins.hash_function()(group, hashes);
+        for (const size_t hash : hashes) cacheCoins.prefetch(hash);
+        for (int j = 0; j < 4; ++j) FetchCoin(*group[j], hashes[j]);
+    }
+    for (; i < outpoints.size(); ++i) FetchCoin(outpoints[i]);
+}
+
 bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coin = it->second.coin;
+        coin = it->second.CopyCoin();
         return !coin.IsSpent();
     }
     return false;
@@ -71,10 +186,10 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
     bool fresh = false;
     if (!inserted) {
-        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        cachedCoinsUsage -= it->second.DynamicMemoryUsage();
     }
     if (!possible_overwrite) {
-        if (!it->second.coin.IsSpent()) {
+        if (!it->second.IsSpent()) {
             throw std::logic_error("Attempted to overwrite an unspent coin (when possible_overwrite is false)");
         }
         // If the coin exists in this cache as a spent coin and is DIRTY, then
@@ -92,17 +207,21 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
         // DIRTY, then it can be marked FRESH.
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
-    it->second.coin = std::move(coin);
+    it->second.SetCoin(std::move(coin));
+    it->second.Pack();
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
-    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    cachedCoinsUsage += it->second.DynamicMemoryUsage();
 }
 
 void CCoinsViewCache::EmplaceCoinInternalDANGER(COutPoint&& outpoint, Coin&& coin) {
-    cachedCoinsUsage += coin.DynamicMemoryUsage();
-    cacheCoins.emplace(
+    auto [it, inserted] = cacheCoins.emplace(
         std::piecewise_construct,
         std::forward_as_tuple(std::move(outpoint)),
         std::forward_as_tuple(std::move(coin), CCoinsCacheEntry::DIRTY));
+    if (inserted) {
+        it->second.Pack();
+        cachedCoinsUsage += it->second.DynamicMemoryUsage();
+    }
 }
 
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check_for_overwrite) {
@@ -119,15 +238,15 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool
 bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     CCoinsMap::iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) return false;
-    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    cachedCoinsUsage -= it->second.DynamicMemoryUsage();
     if (moveout) {
-        *moveout = std::move(it->second.coin);
+        *moveout = std::move(it->second.GetCoin());
     }
     if (it->second.flags & CCoinsCacheEntry::FRESH) {
         cacheCoins.erase(it);
     } else {
         it->second.flags |= CCoinsCacheEntry::DIRTY;
-        it->second.coin.Clear();
+        it->second.SetCoin(Coin());
     }
     return true;
 }
@@ -135,22 +254,22 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
 static const Coin coinEmpty;
 
 const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
-    CCoinsMap::const_iterator it = FetchCoin(outpoint);
+    CCoinsMap::iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
         return coinEmpty;
     } else {
-        return it->second.coin;
+        return UnpackCoin(it->second);
     }
 }
 
 bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
-    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+    return (it != cacheCoins.end() && !it->second.IsSpent());
 }
 
 bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
     CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
-    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+    return (it != cacheCoins.end() && !it->second.IsSpent());
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
@@ -163,8 +282,8 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, bool erase) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = erase ? mapCoins.erase(it) : std::next(it)) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
@@ -173,12 +292,17 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         if (itUs == cacheCoins.end()) {
             // The parent cache does not have an entry, while the child cache does.
             // We can ignore it if it's both spent and FRESH in the child
-            if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin.IsSpent())) {
+            if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.IsSpent())) {
                 // Create the coin in the parent cache, move the data up
                 // and mark it as dirty.
                 CCoinsCacheEntry& entry = cacheCoins[it->first];
-                entry.coin = std::move(it->second.coin);
-                cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+                if (erase) {
+                    entry.MoveCoinFrom(it->second);
+                } else {
+                    entry.CopyCoinFrom(it->second);
+                }
+                entry.Pack();
+                cachedCoinsUsage += entry.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
                 // We can mark it FRESH in the parent if it was FRESH in the child
                 // Otherwise it might have just been flushed from the parent's cache
@@ -189,7 +313,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
             }
         } else {
             // Found the entry in the parent cache
-            if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin.IsSpent()) {
+            if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.IsSpent()) {
                 // The coin was marked FRESH in the child cache, but the coin
                 // exists in the parent cache. If this ever happens, it means
                 // the FRESH flag was misapplied and there is a logic error in
@@ -197,16 +321,21 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 throw std::logic_error("FRESH flag misapplied to coin that exists in parent cache");
             }
 
-            if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent()) {
+            if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.IsSpent()) {
                 // The grandparent cache does not have an entry, and the coin
                 // has been spent. We can just delete it from the parent cache.
-                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
                 cacheCoins.erase(itUs);
             } else {
                 // A normal modification.
-                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                itUs->second.coin = std::move(it->second.coin);
-                cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
+                cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
+                if (erase) {
+                    itUs->second.MoveCoinFrom(it->second);
+                } else {
+                    itUs->second.CopyCoinFrom(it->second);
+                }
+                itUs->second.Pack();
+                cachedCoinsUsage += itUs->second.DynamicMemoryUsage();
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 // NOTE: It isn't safe to mark the coin as FRESH in the parent
                 // cache. If it already existed and was spent in the parent
@@ -226,11 +355,52 @@ bool CCoinsViewCache::Flush() {
     return fOk;
 }
 
+bool CCoinsViewCache::Sync()
+{
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, /*erase=*/false);
+    // The base now has every change, so what is left unspent here is a clean
+    // copy of it, and spent entries have nothing left to record.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.IsSpent()) {
+            cachedCoinsUsage -= it->second.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    return fOk;
+}
+
+size_t CCoinsViewCache::Trim(size_t max_usage)
+{
+    size_t evicted = 0;
+    // A CLOCK approximation of LRU: the first pass spares the entries used
+    // since the previous one, clearing their mark, and the second evicts any
+    // clean entry if the first was not enough.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+            if (DynamicMemoryUsage() - FreeMemoryUsage() <= max_usage) return evicted;
+            if (it->second.flags != 0) {
+                ++it;
+            } else if (it->second.recent) {
+                it->second.recent = false;
+                ++it;
+            } else {
+                cachedCoinsUsage -= it->second.DynamicMemoryUsage();
+                it = cacheCoins.erase(it);
+                ++evicted;
+            }
+        }
+    }
+    return evicted;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
     if (it != cacheCoins.end() && it->second.flags == 0) {
-        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        cachedCoinsUsage -= it->second.DynamicMemoryUsage();
         cacheCoins.erase(it);
     }
 }
@@ -8,9 +8,11 @@
 
 #include <compressor.h>
 #include <core_memusage.h>
+#include <flathashmap.h>
 #include <memusage.h>
 #include <primitives/transaction.h>
 #include <serialize.h>
+#include <span.h>
 #include <uint256.h>
 #include <util/hasher.h>
 
@@ -99,8 +101,37 @@ public:
  */
 struct CCoinsCacheEntry
 {
-    Coin coin; // The actual cached data.
+private:
+    /**
+     * An unspent coin whose script is a standard template too long for
+     * CScript's inline storage (a 32-byte witness program, or pay-to-pubkey
+     * with a compressed key), stored without the template's fixed bytes so
+     * that it needs no allocation of its own.
+     */
+    struct PackedCoin {
+        CAmount value;
+        //! nHeight * 2 + fCoinBase, as in the serialization of Coin.
+        uint32_t code;
+        //! First byte of the script: the witness version opcode, or the push
+        //! of the public key.
+        uint8_t prefix;
+        uint8_t data[33];
+    };
+
+    union {
+        Coin m_coin;
+        PackedCoin m_packed_coin;
+    };
+    bool m_packed{false};
+
+    static Coin Unpacked(const PackedCoin& packed);
+
+public:
     unsigned char flags;
+    //! Set whenever the entry is looked up, and cleared by
+    //! CCoinsViewCache::Trim() passing over it, so that Trim() only evicts
+    //! entries that have not been used since its previous pass.
+    bool recent{true};
 
     enum Flags {
         /**
@@ -123,12 +154,49 @@ struct CCoinsCacheEntry
         FRESH = (1 << 1),
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
-    CCoinsCacheEntry(Coin&& coin_, unsigned char flag) : coin(std::move(coin_)), flags(flag) {}
+    CCoinsCacheEntry() : m_coin(), flags(0) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : m_coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry(Coin&& coin_, unsigned char flag) : m_coin(std::move(coin_)), flags(flag) {}
+    CCoinsCacheEntry(CCoinsCacheEntry&& other) noexcept : flags(other.flags), recent(other.recent)
+    {
+        if (other.m_packed) {
+            m_packed_coin = other.m_packed_coin;
+            m_packed = true;
+        } else {
+            ::new (&m_coin) Coin(std::move(other.m_coin));
+        }
+    }
+    CCoinsCacheEntry& operator=(const CCoinsCacheEntry&) = delete;
+    ~CCoinsCacheEntry()
+    {
+        if (!m_packed) m_coin.~Coin();
+    }
+
+    /** The coin, unpacking it first if needed. */
+    Coin& GetCoin()
+    {
+        Unpack();
+        return m_coin;
+    }
+    /** A copy of the coin, leaving the entry as it is. */
+    Coin CopyCoin() const;
+    void SetCoin(Coin&& coin);
+    /** Move the coin of another entry into this one, packed or not. */
+    void MoveCoinFrom(CCoinsCacheEntry& other);
+    /** Copy the coin of another entry into this one, packed or not. */
+    void CopyCoinFrom(const CCoinsCacheEntry& other);
+
+    bool IsSpent() const { return !m_packed && m_coin.IsSpent(); }
+    bool IsPacked() const { return m_packed; }
+
+    /** Pack the coin if its script is one of the templates PackedCoin covers. */
+    void Pack();
+    void Unpack();
+
+    size_t DynamicMemoryUsage() const { return m_packed ? 0 : m_coin.DynamicMemoryUsage(); }
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+typedef FlatHashMap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -173,8 +241,10 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. If erase is false, its entries
+    //! are left in place (though their coins may have been copied from
+    //! rather than moved from) for the caller to keep using.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true);
 
     //! Get a cursor to iterate over the whole state
     virtual std::unique_ptr<CCoinsViewCursor> Cursor() const;
@@ -200,7 +270,7 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     std::unique_ptr<CCoinsViewCursor> Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -233,7 +303,7 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     std::unique_ptr<CCoinsViewCursor> Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -245,6 +315,14 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Pull the given coins into this cache, as if HaveCoin() were called on
+     * each of them in turn. The outpoints are hashed four at a time, and the
+     * hash table slots of a group are touched before any of its entries is
+     * looked up, so the memory accesses of the group overlap.
+     */
+    void FetchCoins(Span<const COutPoint> outpoints) const;
+
     /**
      * Return a reference to Coin in the cache, or coinEmpty if not found. This is
      * more efficient than GetCoin.
@@ -286,6 +364,21 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(),
+     * but keep the unspent coins in the cache, now marked as not DIRTY.
+     * Spent coins are dropped.
+     */
+    bool Sync();
+
+    /**
+     * Evict entries that are not DIRTY or FRESH until the memory usage of the
+     * cache, not counting memory held for reuse, is at most max_usage.
+     * Entries looked up since the previous Trim() are evicted only if that
+     * is not enough. Returns the number of entries evicted.
+     */
+    size_t Trim(size_t max_usage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -298,6 +391,10 @@ public:
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Calculate how much of DynamicMemoryUsage() is held for reuse by
+    //! entries erased since the cache was last emptied
+    size_t FreeMemoryUsage() const;
+
     //! Check whether all prevouts of the transaction are present in the UTXO set represented by this view
     bool HaveInputs(const CTransaction& tx) const;
 
@@ -314,6 +411,10 @@ private:
      * memory usage.
      */
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+    CCoinsMap::iterator FetchCoin(const COutPoint &outpoint, size_t hash) const;
+
+    /** Unpack the coin of one of our entries in place, accounting for its memory. */
+    Coin& UnpackCoin(CCoinsCacheEntry& entry) const;
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
@@ -4,6 +4,7 @@
 
 #include <crypto/muhash.h>
 
+#include <compat/cpuid.h>
 #include <crypto/chacha20.h>
 #include <crypto/common.h>
 #include <hash.h>
@@ -120,6 +121,80 @@ inline void square_n_mul(Num3072& in_out, const int sq, const Num3072& mul)
     in_out.Multiply(mul);
 }
 
+#if defined(USE_ASM) && defined(HAVE___INT128) && (defined(__x86_64__) || defined(__amd64__)) && defined(HAVE_GETCPUID)
+#define ENABLE_MULX_ADX
+static_assert(Num3072::LIMBS == 48, "mulx/adx kernel assumes 48 64-bit limbs");
+
+/** Whether the CPU supports the BMI2 (mulx) and ADX (adcx/adox) instructions. */
+bool HaveMulxAdx()
+{
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    if (eax < 7) return false;
+    GetCPUID(7, 0, eax, ebx, ecx, edx);
+    return ((ebx >> 8) & 1) && ((ebx >> 19) & 1);
+}
+
+bool g_use_mulx_adx = HaveMulxAdx();
+
+/**
+ * One row of a schoolbook multiplication: t[0..48] += a * b[0..47], where
+ * t[48] is zero on entry. The low halves of the products and the previous
+ * high halves are summed on the CF carry chain (adcx), while the existing
+ * contents of t are added on the independent OF chain (adox).
+ */
+#define MULX_ADX_STEP(j, hprev, hnew)               \
+    "mulx 8*" #j "(%[b]), %%r8, %%" hnew "\n\t"    \
+    "adcx %%" hprev ", %%r8\n\t"                    \
+    "adox 8*" #j "(%[t]), %%r8\n\t"                 \
+    "movq %%r8, 8*" #j "(%[t])\n\t"
+#define MULX_ADX_STEP2(j, k) MULX_ADX_STEP(j, "r9", "r10") MULX_ADX_STEP(k, "r10", "r9")
+
+inline void muladd_row_mulx_adx(limb_t* t, const limb_t* b, limb_t a)
+{
+    __asm__ volatile(
+        "xorl %%r9d, %%r9d\n\t" // clears CF and OF as well
+        MULX_ADX_STEP2(0, 1) MULX_ADX_STEP2(2, 3) MULX_ADX_STEP2(4, 5) MULX_ADX_STEP2(6, 7)
+        MULX_ADX_STEP2(8, 9) MULX_ADX_STEP2(10, 11) MULX_ADX_STEP2(12, 13) MULX_ADX_STEP2(14, 15)
+        MULX_ADX_STEP2(16, 17) MULX_ADX_STEP2(18, 19) MULX_ADX_STEP2(20, 21) MULX_ADX_STEP2(22, 23)
+        MULX_ADX_STEP2(24, 25) MULX_ADX_STEP2(26, 27) MULX_ADX_STEP2(28, 29) MULX_ADX_STEP2(30, 31)
+        MULX_ADX_STEP2(32, 33) MULX_ADX_STEP2(34, 35) MULX_ADX_STEP2(36, 37) MULX_ADX_STEP2(38, 39)
+        MULX_ADX_STEP2(40, 41) MULX_ADX_STEP2(42, 43) MULX_ADX_STEP2(44, 45) MULX_ADX_STEP2(46, 47)
+        "movl $0, %%r8d\n\t"
+        "adcx %%r8, %%r9\n\t"
+        "adox %%r8, %%r9\n\t"
+        "movq %%r9, 8*48(%[t])\n\t"
+        :
+        : [t] "r"(t), [b] "r"(b), "d"(a)
+        : "r8", "r9", "r10", "cc", "memory");
+}
+
+#undef MULX_ADX_STEP2
+#undef MULX_ADX_STEP
+
+/**
+ * out = t[0..47] + t[48..95] * MAX_PRIME_DIFF, using 2^3072 = MAX_PRIME_DIFF
+ * (mod 2^3072 - MAX_PRIME_DIFF). Returns the remaining carry (0 or 1).
+ */
+inline limb_t fold_product(limb_t (&out)[Num3072::LIMBS], const limb_t (&t)[2 * Num3072::LIMBS])
+{
+    double_limb_t c = 0;
+    for (int j = 0; j < Num3072::LIMBS; ++j) {
+        c += (double_limb_t)t[Num3072::LIMBS + j] * MAX_PRIME_DIFF + t[j];
+        out[j] = c;
+        c >>= LIMB_SIZE;
+    }
+    // The carry is below 2^22 here; fold it in once more.
+    c *= MAX_PRIME_DIFF;
+    for (int j = 0; j < Num3072::LIMBS && c; ++j) {
+        c += out[j];
+        out[j] = c;
+        c >>= LIMB_SIZE;
+    }
+    return c;
+}
+#endif
+
 } // namespace
 
 /** Indicates whether d is larger than the modulus. */
@@ -178,8 +253,28 @@ Num3072 Num3072::GetInverse() const
     return out;
 }
 
+std::string Num3072SelectKernel(bool generic)
+{
+#ifdef ENABLE_MULX_ADX
+    g_use_mulx_adx = !generic && HaveMulxAdx();
+    if (g_use_mulx_adx) return "mulx/adx";
+#endif
+    return "generic";
+}
+
 void Num3072::Multiply(const Num3072& a)
 {
+#ifdef ENABLE_MULX_ADX
+    if (g_use_mulx_adx) {
+        limb_t t[2 * LIMBS] = {0};
+        for (int i = 0; i < LIMBS; ++i) muladd_row_mulx_adx(t + i, a.limbs, this->limbs[i]);
+        const limb_t c0 = fold_product(this->limbs, t);
+        if (this->IsOverflow()) this->FullReduce();
+        if (c0) this->FullReduce();
+        return;
+    }
+#endif
+
     limb_t c0 = 0, c1 = 0, c2 = 0;
     Num3072 tmp;
 
@@ -217,6 +312,14 @@ void Num3072::Multiply(const Num3072& a)
 
 void Num3072::Square()
 {
+#ifdef ENABLE_MULX_ADX
+    // A full multiplication with the mulx/adx kernel beats the generic squaring.
+    if (g_use_mulx_adx) {
+        this->Multiply(*this);
+        return;
+    }
+#endif
+
     limb_t c0 = 0, c1 = 0, c2 = 0;
     Num3072 tmp;
 
@@ -341,6 +444,6 @@ MuHash3072& MuHash3072::Insert(Span<const unsigned char> in) noexcept {
 }
 
 MuHash3072& MuHash3072::Remove(Span<const unsigned char> in) noexcept {
-    m_numerator.Divide(ToNum3072(in));
+    m_denominator.Multiply(ToNum3072(in));
     return *this;
 }
@@ -13,6 +13,7 @@
 #include <uint256.h>
 
 #include <stdint.h>
+#include <string>
 
 class Num3072
 {
@@ -62,6 +63,12 @@ public:
     }
 };
 
+/** Use the fastest available Num3072 multiplication, or the generic one if
+ *  generic is set. Returns the name of the implementation now in use.
+ *  Not thread safe; for tests comparing the implementations.
+ */
+std::string Num3072SelectKernel(bool generic);
+
 /** A class representing MuHash sets
  *
  * MuHash is a hashing algorithm that supports adding set elements in any
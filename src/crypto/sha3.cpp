@@ -12,25 +12,49 @@
 #include <algorithm>
 #include <array> // For std::begin and std::end.
 
+#include <assert.h>
 #include <stdint.h>
 
+#include <compat/cpuid.h>
+
 // Internal implementation code.
 namespace
 {
 uint64_t Rotl(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+
+constexpr uint64_t RNDC[24] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
+    0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+    0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+    0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
+    0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
+};
+constexpr int ROUNDS = 24;
 } // namespace
 
-void KeccakF(uint64_t (&st)[25])
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+namespace keccak_bmi2
+{
+void Permute(uint64_t (&st)[25]);
+}
+
+namespace keccak_avx2
+{
+void Hash_4way(unsigned char* out, const unsigned char* in, size_t size);
+}
+
+namespace keccak_avx512
+{
+void Hash_8way(unsigned char* out, const unsigned char* in, size_t size);
+}
+#endif
+
+namespace keccak
+{
+/** Straightforward implementation, one round per loop iteration. */
+void Permute(uint64_t (&st)[25])
 {
-    static constexpr uint64_t RNDC[24] = {
-        0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
-        0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
-        0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
-        0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
-        0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
-        0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
-    };
-    static constexpr int ROUNDS = 24;
 
     for (int round = 0; round < ROUNDS; ++round) {
         uint64_t bc0, bc1, bc2, bc3, bc4, t;
@@ -108,54 +132,344 @@ void KeccakF(uint64_t (&st)[25])
     }
 }
 
-SHA3_256& SHA3_256::Write(Span<const unsigned char> data)
+} // namespace keccak
+
+namespace keccak_unrolled
 {
-    if (m_bufsize && m_bufsize + data.size() >= sizeof(m_buffer)) {
-        // Fill the buffer and process it.
-        std::copy(data.begin(), data.begin() + sizeof(m_buffer) - m_bufsize, m_buffer + m_bufsize);
-        data = data.subspan(sizeof(m_buffer) - m_bufsize);
-        m_state[m_pos++] ^= ReadLE64(m_buffer);
-        m_bufsize = 0;
-        if (m_pos == RATE_BUFFERS) {
-            KeccakF(m_state);
-            m_pos = 0;
+/** One round of Keccak-f[1600] on the 25 lanes named A##xy, writing the result to E##xy.
+ *
+ *  Lanes are named after their row (b, g, k, m, s) and column (a, e, i, o, u). The lanes be,
+ *  bi, go, ki, mi and sa are kept complemented (the "bebigokimisa" pattern from the Keccak
+ *  implementation overview, section 2.2), which lets Chi be computed with a single NOT per
+ *  row instead of five. The column parities for the next round are accumulated in Ca..Cu.
+ */
+#define KECCAK_ROUND(A, E, rc) \
+    do { \
+        Da = Cu ^ Rotl(Ce, 1); De = Ca ^ Rotl(Ci, 1); Di = Ce ^ Rotl(Co, 1); \
+        Do = Ci ^ Rotl(Cu, 1); Du = Co ^ Rotl(Ca, 1); \
+        \
+        A##ba ^= Da; Bba = A##ba; \
+        A##ge ^= De; Bbe = Rotl(A##ge, 44); \
+        A##ki ^= Di; Bbi = Rotl(A##ki, 43); \
+        A##mo ^= Do; Bbo = Rotl(A##mo, 21); \
+        A##su ^= Du; Bbu = Rotl(A##su, 14); \
+        E##ba = Bba ^ (Bbe | Bbi) ^ (rc); Ca = E##ba; \
+        E##be = Bbe ^ (~Bbi | Bbo); Ce = E##be; \
+        E##bi = Bbi ^ (Bbo & Bbu); Ci = E##bi; \
+        E##bo = Bbo ^ (Bbu | Bba); Co = E##bo; \
+        E##bu = Bbu ^ (Bba & Bbe); Cu = E##bu; \
+        \
+        A##bo ^= Do; Bga = Rotl(A##bo, 28); \
+        A##gu ^= Du; Bge = Rotl(A##gu, 20); \
+        A##ka ^= Da; Bgi = Rotl(A##ka, 3); \
+        A##me ^= De; Bgo = Rotl(A##me, 45); \
+        A##si ^= Di; Bgu = Rotl(A##si, 61); \
+        E##ga = Bga ^ (Bge | Bgi); Ca ^= E##ga; \
+        E##ge = Bge ^ (Bgi & Bgo); Ce ^= E##ge; \
+        E##gi = Bgi ^ (Bgo | ~Bgu); Ci ^= E##gi; \
+        E##go = Bgo ^ (Bgu | Bga); Co ^= E##go; \
+        E##gu = Bgu ^ (Bga & Bge); Cu ^= E##gu; \
+        \
+        A##be ^= De; Bka = Rotl(A##be, 1); \
+        A##gi ^= Di; Bke = Rotl(A##gi, 6); \
+        A##ko ^= Do; Bki = Rotl(A##ko, 25); \
+        A##mu ^= Du; Bko = Rotl(A##mu, 8); \
+        A##sa ^= Da; Bku = Rotl(A##sa, 18); \
+        E##ka = Bka ^ (Bke | Bki); Ca ^= E##ka; \
+        E##ke = Bke ^ (Bki & Bko); Ce ^= E##ke; \
+        E##ki = Bki ^ (~Bko & Bku); Ci ^= E##ki; \
+        E##ko = ~Bko ^ (Bku | Bka); Co ^= E##ko; \
+        E##ku = Bku ^ (Bka & Bke); Cu ^= E##ku; \
+        \
+        A##bu ^= Du; Bma = Rotl(A##bu, 27); \
+        A##ga ^= Da; Bme = Rotl(A##ga, 36); \
+        A##ke ^= De; Bmi = Rotl(A##ke, 10); \
+        A##mi ^= Di; Bmo = Rotl(A##mi, 15); \
+        A##so ^= Do; Bmu = Rotl(A##so, 56); \
+        E##ma = Bma ^ (Bme & Bmi); Ca ^= E##ma; \
+        E##me = Bme ^ (Bmi | Bmo); Ce ^= E##me; \
+        E##mi = Bmi ^ (~Bmo | Bmu); Ci ^= E##mi; \
+        E##mo = ~Bmo ^ (Bmu & Bma); Co ^= E##mo; \
+        E##mu = Bmu ^ (Bma | Bme); Cu ^= E##mu; \
+        \
+        A##bi ^= Di; Bsa = Rotl(A##bi, 62); \
+        A##go ^= Do; Bse = Rotl(A##go, 55); \
+        A##ku ^= Du; Bsi = Rotl(A##ku, 39); \
+        A##ma ^= Da; Bso = Rotl(A##ma, 41); \
+        A##se ^= De; Bsu = Rotl(A##se, 2); \
+        E##sa = Bsa ^ (~Bse & Bsi); Ca ^= E##sa; \
+        E##se = ~Bse ^ (Bsi | Bso); Ce ^= E##se; \
+        E##si = Bsi ^ (Bso & Bsu); Ci ^= E##si; \
+        E##so = Bso ^ (Bsu | Bsa); Co ^= E##so; \
+        E##su = Bsu ^ (Bsa & Bse); Cu ^= E##su; \
+    } while (0)
+
+/** Fully unrolled implementation using lane complementing. */
+void Permute(uint64_t (&st)[25])
+{
+    uint64_t Aba = st[0], Abe = ~st[1], Abi = ~st[2], Abo = st[3], Abu = st[4];
+    uint64_t Aga = st[5], Age = st[6], Agi = st[7], Ago = ~st[8], Agu = st[9];
+    uint64_t Aka = st[10], Ake = st[11], Aki = ~st[12], Ako = st[13], Aku = st[14];
+    uint64_t Ama = st[15], Ame = st[16], Ami = ~st[17], Amo = st[18], Amu = st[19];
+    uint64_t Asa = ~st[20], Ase = st[21], Asi = st[22], Aso = st[23], Asu = st[24];
+    uint64_t Eba, Ebe, Ebi, Ebo, Ebu, Ega, Ege, Egi, Ego, Egu, Eka, Eke, Eki, Eko, Eku;
+    uint64_t Ema, Eme, Emi, Emo, Emu, Esa, Ese, Esi, Eso, Esu;
+    uint64_t Bba, Bbe, Bbi, Bbo, Bbu, Bga, Bge, Bgi, Bgo, Bgu, Bka, Bke, Bki, Bko, Bku;
+    uint64_t Bma, Bme, Bmi, Bmo, Bmu, Bsa, Bse, Bsi, Bso, Bsu;
+    uint64_t Da, De, Di, Do, Du;
+    uint64_t Ca = Aba ^ Aga ^ Aka ^ Ama ^ Asa;
+    uint64_t Ce = Abe ^ Age ^ Ake ^ Ame ^ Ase;
+    uint64_t Ci = Abi ^ Agi ^ Aki ^ Ami ^ Asi;
+    uint64_t Co = Abo ^ Ago ^ Ako ^ Amo ^ Aso;
+    uint64_t Cu = Abu ^ Agu ^ Aku ^ Amu ^ Asu;
+
+    KECCAK_ROUND(A, E, RNDC[0]);
+    KECCAK_ROUND(E, A, RNDC[1]);
+    KECCAK_ROUND(A, E, RNDC[2]);
+    KECCAK_ROUND(E, A, RNDC[3]);
+    KECCAK_ROUND(A, E, RNDC[4]);
+    KECCAK_ROUND(E, A, RNDC[5]);
+    KECCAK_ROUND(A, E, RNDC[6]);
+    KECCAK_ROUND(E, A, RNDC[7]);
+    KECCAK_ROUND(A, E, RNDC[8]);
+    KECCAK_ROUND(E, A, RNDC[9]);
+    KECCAK_ROUND(A, E, RNDC[10]);
+    KECCAK_ROUND(E, A, RNDC[11]);
+    KECCAK_ROUND(A, E, RNDC[12]);
+    KECCAK_ROUND(E, A, RNDC[13]);
+    KECCAK_ROUND(A, E, RNDC[14]);
+    KECCAK_ROUND(E, A, RNDC[15]);
+    KECCAK_ROUND(A, E, RNDC[16]);
+    KECCAK_ROUND(E, A, RNDC[17]);
+    KECCAK_ROUND(A, E, RNDC[18]);
+    KECCAK_ROUND(E, A, RNDC[19]);
+    KECCAK_ROUND(A, E, RNDC[20]);
+    KECCAK_ROUND(E, A, RNDC[21]);
+    KECCAK_ROUND(A, E, RNDC[22]);
+    KECCAK_ROUND(E, A, RNDC[23]);
+
+    st[0] = Aba; st[1] = ~Abe; st[2] = ~Abi; st[3] = Abo; st[4] = Abu;
+    st[5] = Aga; st[6] = Age; st[7] = Agi; st[8] = ~Ago; st[9] = Agu;
+    st[10] = Aka; st[11] = Ake; st[12] = ~Aki; st[13] = Ako; st[14] = Aku;
+    st[15] = Ama; st[16] = Ame; st[17] = ~Ami; st[18] = Amo; st[19] = Amu;
+    st[20] = ~Asa; st[21] = Ase; st[22] = Asi; st[23] = Aso; st[24] = Asu;
+}
+
+#undef KECCAK_ROUND
+} // namespace keccak_unrolled
+
+namespace
+{
+typedef void (*PermuteType)(uint64_t (&)[25]);
+typedef void (*HashShortType)(unsigned char* out, const unsigned char* in, size_t size);
+
+PermuteType Permute = keccak::Permute;
+HashShortType Hash_4way = nullptr;
+HashShortType Hash_8way = nullptr;
+
+bool SelfTest()
+{
+    // Expected state after applying Keccak-f[1600] once and twice to the all-zero state,
+    // as listed in the Keccak team's KeccakF-1600-IntermediateValues.txt.
+    static const uint64_t result[2][25] = {
+        {0xf1258f7940e1dde7, 0x84d5ccf933c0478a, 0xd598261ea65aa9ee, 0xbd1547306f80494d, 0x8b284e056253d057,
+         0xff97a42d7f8e6fd4, 0x90fee5a0a44647c4, 0x8c5bda0cd6192e76, 0xad30a6f71b19059c, 0x30935ab7d08ffc64,
+         0xeb5aa93f2317d635, 0xa9a6e6260d712103, 0x81a57c16dbcf555f, 0x43b831cd0347c826, 0x01f22f1a11a5569f,
+         0x05e5635a21d9ae61, 0x64befef28cc970f2, 0x613670957bc46611, 0xb87c5a554fd00ecb, 0x8c3ee88a1ccf32c8,
+         0x940c7922ae3a2614, 0x1841f924a2c509e4, 0x16f53526e70465c2, 0x75f644e97f30a13b, 0xeaf1ff7b5ceca249},
+        {0x2d5c954df96ecb3c, 0x6a332cd07057b56d, 0x093d8d1270d76b6c, 0x8a20d9b25569d094, 0x4f9c4f99e5e7f156,
+         0xf957b9a2da65fb38, 0x85773dae1275af0d, 0xfaf4f247c3d810f7, 0x1f1b9ee6f79a8759, 0xe4fecc0fee98b425,
+         0x68ce61b6b9ce68a1, 0xdeea66c4ba8f974f, 0x33c43d836eafb1f5, 0xe00654042719dbd9, 0x7cf8a9f009831265,
+         0xfd5449a6bf174743, 0x97ddad33d8994b40, 0x48ead5fc5d0be774, 0xe3b8c8ee55b7b03c, 0x91a0226e649e42e9,
+         0x900e3129e7badd7b, 0x202a9ec5faa3cce8, 0x5b3402464e1c3db6, 0x609f4e62a44c1059, 0x20d06cd26a8fbf5c},
+    };
+
+    uint64_t state[25] = {0};
+    for (int i = 0; i < 2; ++i) {
+        Permute(state);
+        if (!std::equal(state, state + 25, result[i])) return false;
+    }
+
+    // Test the multi-way implementations, if available, against the single-way one on
+    // header-sized messages.
+    unsigned char data[8 * 80];
+    for (size_t i = 0; i < sizeof(data); ++i) data[i] = i * 7 + 3;
+    unsigned char expected[8 * Keccak256::OUTPUT_SIZE];
+    for (int i = 0; i < 8; ++i) {
+        Keccak256().Write({data + 80 * i, 80}).Finalize({expected + Keccak256::OUTPUT_SIZE * i, Keccak256::OUTPUT_SIZE});
+    }
+    if (Hash_4way) {
+        unsigned char out[4 * Keccak256::OUTPUT_SIZE];
+        Hash_4way(out, data, 80);
+        if (!std::equal(out, out + sizeof(out), expected)) return false;
+    }
+    if (Hash_8way) {
+        unsigned char out[8 * Keccak256::OUTPUT_SIZE];
+        Hash_8way(out, data, 80);
+        if (!std::equal(out, out + sizeof(out), expected)) return false;
+    }
+    return true;
+}
+
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+/** Return the OS-enabled state components from XCR0. */
+uint32_t EnabledXCR0()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return a;
+}
+#endif
+} // namespace
+
+std::string KeccakAutoDetect()
+{
+    std::string ret = "unrolled";
+    Permute = keccak_unrolled::Permute;
+#if defined(USE_ASM) && defined(HAVE_GETCPUID)
+    bool have_bmi1 = false;
+    bool have_bmi2 = false;
+    bool have_avx = false;
+    bool have_avx2 = false;
+    bool have_avx512 = false;
+    bool enabled_avx = false;
+    bool enabled_avx512 = false;
+
+    (void)EnabledXCR0;
+    (void)have_bmi1;
+    (void)have_bmi2;
+    (void)have_avx2;
+    (void)have_avx512;
+    (void)enabled_avx;
+    (void)enabled_avx512;
+
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    if (eax >= 7) {
+        GetCPUID(1, 0, eax, ebx, ecx, edx);
+        bool have_xsave = (ecx >> 27) & 1;
+        have_avx = (ecx >> 28) & 1;
+        if (have_xsave && have_avx) {
+            // XMM and YMM state, plus opmask and both halves of ZMM state for AVX-512.
+            uint32_t xcr0 = EnabledXCR0();
+            enabled_avx = (xcr0 & 0x06) == 0x06;
+            enabled_avx512 = (xcr0 & 0xe6) == 0xe6;
         }
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        have_bmi1 = (ebx >> 3) & 1;
+        have_avx2 = (ebx >> 5) & 1;
+        have_bmi2 = (ebx >> 8) & 1;
+        have_avx512 = (ebx >> 16) & 1;
     }
-    while (data.size() >= sizeof(m_buffer)) {
-        // Process chunks directly from the buffer.
-        m_state[m_pos++] ^= ReadLE64(data.data());
-        data = data.subspan(8);
-        if (m_pos == RATE_BUFFERS) {
-            KeccakF(m_state);
-            m_pos = 0;
+
+#if defined(ENABLE_BMI2) && !defined(BUILD_BGL_INTERNAL)
+    if (have_bmi1 && have_bmi2) {
+        Permute = keccak_bmi2::Permute;
+        ret = "bmi2";
+    }
+#endif
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BGL_INTERNAL)
+    if (have_avx2 && have_avx && enabled_avx) {
+        Hash_4way = keccak_avx2::Hash_4way;
+        ret += ",avx2(4way)";
+    }
+#endif
+
+#if defined(ENABLE_AVX512) && !defined(BUILD_BGL_INTERNAL)
+    if (have_avx512 && enabled_avx512) {
+        Hash_8way = keccak_avx512::Hash_8way;
+        ret += ",avx512(8way)";
+    }
+#endif
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
+
+void KeccakF(uint64_t (&st)[25])
+{
+    Permute(st);
+}
+
+void Keccak256Batch(unsigned char* output, const unsigned char* input, size_t size, size_t blocks)
+{
+    assert(size < Keccak256::RATE);
+    if (Hash_8way) {
+        while (blocks >= 8) {
+            Hash_8way(output, input, size);
+            output += 8 * Keccak256::OUTPUT_SIZE;
+            input += 8 * size;
+            blocks -= 8;
         }
     }
-    if (data.size()) {
-        // Keep the remainder in the buffer.
-        std::copy(data.begin(), data.end(), m_buffer + m_bufsize);
-        m_bufsize += data.size();
+    if (Hash_4way) {
+        while (blocks >= 4) {
+            Hash_4way(output, input, size);
+            output += 4 * Keccak256::OUTPUT_SIZE;
+            input += 4 * size;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        Keccak256().Write({input, size}).Finalize({output, Keccak256::OUTPUT_SIZE});
+        output += Keccak256::OUTPUT_SIZE;
+        input += size;
+        --blocks;
     }
-    return *this;
 }
 
-SHA3_256& SHA3_256::Finalize(Span<unsigned char> output)
+template <unsigned char SUFFIX>
+void Keccak256Sponge<SUFFIX>::Absorb(const unsigned char* block)
 {
-    assert(output.size() == OUTPUT_SIZE);
-    std::fill(m_buffer + m_bufsize, m_buffer + sizeof(m_buffer), 0);
-    m_buffer[m_bufsize] ^= 0x06;
-    m_state[m_pos] ^= ReadLE64(m_buffer);
-    m_state[RATE_BUFFERS - 1] ^= 0x8000000000000000;
+    for (unsigned i = 0; i < RATE / 8; ++i) {
+        m_state[i] ^= ReadLE64(block + 8 * i);
+    }
     KeccakF(m_state);
+}
+
+template <unsigned char SUFFIX>
+void Keccak256Sponge<SUFFIX>::WriteSlow(Span<const unsigned char> data)
+{
+    if (m_bufsize) {
+        // Fill the buffer and process it.
+        const size_t fill = RATE - m_bufsize;
+        std::copy(data.begin(), data.begin() + fill, m_buffer + m_bufsize);
+        Absorb(m_buffer);
+        data = data.subspan(fill);
+    }
+    while (data.size() >= RATE) {
+        // Process full blocks directly from the input.
+        Absorb(data.data());
+        data = data.subspan(RATE);
+    }
+    // Keep the remainder in the buffer.
+    std::copy(data.begin(), data.end(), m_buffer);
+    m_bufsize = data.size();
+}
+
+template <unsigned char SUFFIX>
+Keccak256Sponge<SUFFIX>& Keccak256Sponge<SUFFIX>::Finalize(Span<unsigned char> output)
+{
+    assert(output.size() == OUTPUT_SIZE);
+    std::fill(m_buffer + m_bufsize, m_buffer + RATE, 0);
+    m_buffer[m_bufsize] ^= SUFFIX;
+    m_buffer[RATE - 1] ^= 0x80;
+    Absorb(m_buffer);
     for (unsigned i = 0; i < 4; ++i) {
         WriteLE64(output.data() + 8 * i, m_state[i]);
     }
     return *this;
 }
 
-SHA3_256& SHA3_256::Reset()
+template <unsigned char SUFFIX>
+Keccak256Sponge<SUFFIX>& Keccak256Sponge<SUFFIX>::Reset()
 {
     m_bufsize = 0;
-    m_pos = 0;
     std::fill(std::begin(m_state), std::end(m_state), 0);
     return *this;
 }
+
+template class Keccak256Sponge<0x06>;
+template class Keccak256Sponge<0x01>;
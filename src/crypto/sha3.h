@@ -7,35 +7,73 @@
 
 #include <span.h>
 
+#include <algorithm>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 //! The Keccak-f[1600] transform.
 void KeccakF(uint64_t (&st)[25]);
 
-class SHA3_256
+/** Autodetect the best available Keccak-f[1600] implementation.
+ *  Returns the name of the implementation.
+ */
+std::string KeccakAutoDetect();
+
+/** A Keccak sponge with a 1088-bit rate and a 256-bit output.
+ *
+ *  SUFFIX is the domain separation byte appended to the message: 0x06 gives FIPS 202 SHA3-256,
+ *  0x01 gives the original Keccak-256 submission that BGL uses for block and transaction hashes.
+ *
+ *  Input is staged in a buffer of one full rate block, so the many small writes produced by
+ *  serialization are plain copies; the state is only touched once per 136 bytes.
+ */
+template <unsigned char SUFFIX>
+class Keccak256Sponge
 {
-private:
-    uint64_t m_state[25] = {0};
-    unsigned char m_buffer[8];
-    unsigned m_bufsize = 0;
-    unsigned m_pos = 0;
+public:
+    //! Sponge rate in bytes.
+    static constexpr size_t RATE = 136;
+    static constexpr size_t OUTPUT_SIZE = 32;
 
-    //! Sponge rate in bits.
-    static constexpr unsigned RATE_BITS = 1088;
+private:
+    static_assert(RATE % 8 == 0, "Rate must be a multiple of 8 bytes");
 
-    //! Sponge rate expressed as a multiple of the buffer size.
-    static constexpr unsigned RATE_BUFFERS = RATE_BITS / (8 * sizeof(m_buffer));
+    uint64_t m_state[25] = {0};
+    unsigned char m_buffer[RATE];
+    size_t m_bufsize = 0;
 
-    static_assert(RATE_BITS % (8 * sizeof(m_buffer)) == 0, "Rate must be a multiple of 8 bytes");
+    //! XOR one rate block into the state and permute it.
+    void Absorb(const unsigned char* block);
+    void WriteSlow(Span<const unsigned char> data);
 
 public:
-    static constexpr size_t OUTPUT_SIZE = 32;
+    Keccak256Sponge() {}
+
+    Keccak256Sponge& Write(Span<const unsigned char> data)
+    {
+        if (m_bufsize + data.size() < RATE) {
+            std::copy(data.begin(), data.end(), m_buffer + m_bufsize);
+            m_bufsize += data.size();
+        } else {
+            WriteSlow(data);
+        }
+        return *this;
+    }
 
-    SHA3_256() {}
-    SHA3_256& Write(Span<const unsigned char> data);
-    SHA3_256& Finalize(Span<unsigned char> output);
-    SHA3_256& Reset();
+    Keccak256Sponge& Finalize(Span<unsigned char> output);
+    Keccak256Sponge& Reset();
 };
 
+using SHA3_256 = Keccak256Sponge<0x06>;
+using Keccak256 = Keccak256Sponge<0x01>;
+
+/** Compute multiple Keccak-256 hashes of equally sized short messages, e.g. block headers.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*size byte input buffer
+ *  size:    the size of each message, which must fit in a single 136-byte rate block
+ *  blocks:  the number of hashes to compute.
+ */
+void Keccak256Batch(unsigned char* output, const unsigned char* input, size_t size, size_t blocks);
+
 #endif // BGL_CRYPTO_SHA3_H
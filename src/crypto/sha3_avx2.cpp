@@ -0,0 +1,155 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include <crypto/common.h>
+
+namespace keccak_avx2 {
+namespace {
+
+constexpr uint64_t RNDC[24] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
+    0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+    0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+    0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
+    0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
+};
+
+constexpr size_t RATE = 136;
+
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+__m256i inline Chi(__m256i x, __m256i y, __m256i z) { return Xor(x, _mm256_andnot_si256(y, z)); }
+template <int N> __m256i inline Rotl(__m256i x) { return _mm256_or_si256(_mm256_slli_epi64(x, N), _mm256_srli_epi64(x, 64 - N)); }
+
+/** Load lane i of four padded message blocks into one vector. */
+__m256i inline Read4(const unsigned char (&blocks)[4][RATE], int i)
+{
+    return _mm256_set_epi64x(ReadLE64(blocks[3] + 8 * i), ReadLE64(blocks[2] + 8 * i), ReadLE64(blocks[1] + 8 * i), ReadLE64(blocks[0] + 8 * i));
+}
+
+/** Write lane i of four states to the four 32-byte outputs. */
+void inline Write4(unsigned char* out, int i, __m256i v)
+{
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256((__m256i*)lanes, v);
+    WriteLE64(out + 8 * i, lanes[0]);
+    WriteLE64(out + 32 + 8 * i, lanes[1]);
+    WriteLE64(out + 64 + 8 * i, lanes[2]);
+    WriteLE64(out + 96 + 8 * i, lanes[3]);
+}
+
+}
+
+/** One round of Keccak-f[1600] on four interleaved states; see sha3.cpp for the lane naming. */
+#define KECCAK_ROUND(A, E, rc) \
+    do { \
+        Da = Xor(Cu, Rotl<1>(Ce)); De = Xor(Ca, Rotl<1>(Ci)); Di = Xor(Ce, Rotl<1>(Co)); \
+        Do = Xor(Ci, Rotl<1>(Cu)); Du = Xor(Co, Rotl<1>(Ca)); \
+        \
+        Bba = Xor(A##ba, Da); \
+        Bbe = Rotl<44>(Xor(A##ge, De)); \
+        Bbi = Rotl<43>(Xor(A##ki, Di)); \
+        Bbo = Rotl<21>(Xor(A##mo, Do)); \
+        Bbu = Rotl<14>(Xor(A##su, Du)); \
+        E##ba = Xor(Chi(Bba, Bbe, Bbi), _mm256_set1_epi64x(rc)); Ca = E##ba; \
+        E##be = Chi(Bbe, Bbi, Bbo); Ce = E##be; \
+        E##bi = Chi(Bbi, Bbo, Bbu); Ci = E##bi; \
+        E##bo = Chi(Bbo, Bbu, Bba); Co = E##bo; \
+        E##bu = Chi(Bbu, Bba, Bbe); Cu = E##bu; \
+        \
+        Bga = Rotl<28>(Xor(A##bo, Do)); \
+        Bge = Rotl<20>(Xor(A##gu, Du)); \
+        Bgi = Rotl<3>(Xor(A##ka, Da)); \
+        Bgo = Rotl<45>(Xor(A##me, De)); \
+        Bgu = Rotl<61>(Xor(A##si, Di)); \
+        E##ga = Chi(Bga, Bge, Bgi); Ca = Xor(Ca, E##ga); \
+        E##ge = Chi(Bge, Bgi, Bgo); Ce = Xor(Ce, E##ge); \
+        E##gi = Chi(Bgi, Bgo, Bgu); Ci = Xor(Ci, E##gi); \
+        E##go = Chi(Bgo, Bgu, Bga); Co = Xor(Co, E##go); \
+        E##gu = Chi(Bgu, Bga, Bge); Cu = Xor(Cu, E##gu); \
+        \
+        Bka = Rotl<1>(Xor(A##be, De)); \
+        Bke = Rotl<6>(Xor(A##gi, Di)); \
+        Bki = Rotl<25>(Xor(A##ko, Do)); \
+        Bko = Rotl<8>(Xor(A##mu, Du)); \
+        Bku = Rotl<18>(Xor(A##sa, Da)); \
+        E##ka = Chi(Bka, Bke, Bki); Ca = Xor(Ca, E##ka); \
+        E##ke = Chi(Bke, Bki, Bko); Ce = Xor(Ce, E##ke); \
+        E##ki = Chi(Bki, Bko, Bku); Ci = Xor(Ci, E##ki); \
+        E##ko = Chi(Bko, Bku, Bka); Co = Xor(Co, E##ko); \
+        E##ku = Chi(Bku, Bka, Bke); Cu = Xor(Cu, E##ku); \
+        \
+        Bma = Rotl<27>(Xor(A##bu, Du)); \
+        Bme = Rotl<36>(Xor(A##ga, Da)); \
+        Bmi = Rotl<10>(Xor(A##ke, De)); \
+        Bmo = Rotl<15>(Xor(A##mi, Di)); \
+        Bmu = Rotl<56>(Xor(A##so, Do)); \
+        E##ma = Chi(Bma, Bme, Bmi); Ca = Xor(Ca, E##ma); \
+        E##me = Chi(Bme, Bmi, Bmo); Ce = Xor(Ce, E##me); \
+        E##mi = Chi(Bmi, Bmo, Bmu); Ci = Xor(Ci, E##mi); \
+        E##mo = Chi(Bmo, Bmu, Bma); Co = Xor(Co, E##mo); \
+        E##mu = Chi(Bmu, Bma, Bme); Cu = Xor(Cu, E##mu); \
+        \
+        Bsa = Rotl<62>(Xor(A##bi, Di)); \
+        Bse = Rotl<55>(Xor(A##go, Do)); \
+        Bsi = Rotl<39>(Xor(A##ku, Du)); \
+        Bso = Rotl<41>(Xor(A##ma, Da)); \
+        Bsu = Rotl<2>(Xor(A##se, De)); \
+        E##sa = Chi(Bsa, Bse, Bsi); Ca = Xor(Ca, E##sa); \
+        E##se = Chi(Bse, Bsi, Bso); Ce = Xor(Ce, E##se); \
+        E##si = Chi(Bsi, Bso, Bsu); Ci = Xor(Ci, E##si); \
+        E##so = Chi(Bso, Bsu, Bsa); Co = Xor(Co, E##so); \
+        E##su = Chi(Bsu, Bsa, Bse); Cu = Xor(Cu, E##su); \
+    } while (0)
+
+void Hash_4way(unsigned char* out, const unsigned char* in, size_t size)
+{
+    // Pad each message into a single rate block (Keccak padding: 0x01 ... 0x80).
+    unsigned char blocks[4][RATE] = {};
+    for (int i = 0; i < 4; ++i) {
+        memcpy(blocks[i], in + i * size, size);
+        blocks[i][size] ^= 0x01;
+        blocks[i][RATE - 1] ^= 0x80;
+    }
+
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i Aba = Read4(blocks, 0), Abe = Read4(blocks, 1), Abi = Read4(blocks, 2), Abo = Read4(blocks, 3), Abu = Read4(blocks, 4);
+    __m256i Aga = Read4(blocks, 5), Age = Read4(blocks, 6), Agi = Read4(blocks, 7), Ago = Read4(blocks, 8), Agu = Read4(blocks, 9);
+    __m256i Aka = Read4(blocks, 10), Ake = Read4(blocks, 11), Aki = Read4(blocks, 12), Ako = Read4(blocks, 13), Aku = Read4(blocks, 14);
+    __m256i Ama = Read4(blocks, 15), Ame = Read4(blocks, 16), Ami = zero, Amo = zero, Amu = zero;
+    __m256i Asa = zero, Ase = zero, Asi = zero, Aso = zero, Asu = zero;
+    __m256i Eba, Ebe, Ebi, Ebo, Ebu, Ega, Ege, Egi, Ego, Egu, Eka, Eke, Eki, Eko, Eku;
+    __m256i Ema, Eme, Emi, Emo, Emu, Esa, Ese, Esi, Eso, Esu;
+    __m256i Bba, Bbe, Bbi, Bbo, Bbu, Bga, Bge, Bgi, Bgo, Bgu, Bka, Bke, Bki, Bko, Bku;
+    __m256i Bma, Bme, Bmi, Bmo, Bmu, Bsa, Bse, Bsi, Bso, Bsu;
+    __m256i Da, De, Di, Do, Du;
+    __m256i Ca = Xor(Xor(Aba, Aga, Aka), Ama);
+    __m256i Ce = Xor(Xor(Abe, Age, Ake), Ame);
+    __m256i Ci = Xor(Abi, Agi, Aki);
+    __m256i Co = Xor(Abo, Ago, Ako);
+    __m256i Cu = Xor(Abu, Agu, Aku);
+
+    for (int round = 0; round < 24; round += 2) {
+        KECCAK_ROUND(A, E, RNDC[round]);
+        KECCAK_ROUND(E, A, RNDC[round + 1]);
+    }
+
+    Write4(out, 0, Aba);
+    Write4(out, 1, Abe);
+    Write4(out, 2, Abi);
+    Write4(out, 3, Abo);
+}
+
+#undef KECCAK_ROUND
+
+}
+
+#endif
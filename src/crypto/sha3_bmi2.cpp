@@ -0,0 +1,145 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Fully unrolled Keccak-f[1600], meant to be compiled with -mbmi -mbmi2 so that Chi maps onto
+// ANDN and the lane rotations onto RORX. With ANDN available, lane complementing buys nothing.
+
+#ifdef ENABLE_BMI2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace keccak_bmi2 {
+namespace {
+
+inline uint64_t Rotl(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+
+constexpr uint64_t RNDC[24] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
+    0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+    0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+    0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
+    0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
+};
+
+}
+
+/** One round of Keccak-f[1600] on the lanes A##xy, writing to E##xy; see sha3.cpp for the naming. */
+#define KECCAK_ROUND(A, E, rc) \
+    do { \
+        Da = Cu ^ Rotl(Ce, 1); De = Ca ^ Rotl(Ci, 1); Di = Ce ^ Rotl(Co, 1); \
+        Do = Ci ^ Rotl(Cu, 1); Du = Co ^ Rotl(Ca, 1); \
+        \
+        Bba = A##ba ^ Da; \
+        Bbe = Rotl(A##ge ^ De, 44); \
+        Bbi = Rotl(A##ki ^ Di, 43); \
+        Bbo = Rotl(A##mo ^ Do, 21); \
+        Bbu = Rotl(A##su ^ Du, 14); \
+        E##ba = Bba ^ (~Bbe & Bbi) ^ (rc); Ca = E##ba; \
+        E##be = Bbe ^ (~Bbi & Bbo); Ce = E##be; \
+        E##bi = Bbi ^ (~Bbo & Bbu); Ci = E##bi; \
+        E##bo = Bbo ^ (~Bbu & Bba); Co = E##bo; \
+        E##bu = Bbu ^ (~Bba & Bbe); Cu = E##bu; \
+        \
+        Bga = Rotl(A##bo ^ Do, 28); \
+        Bge = Rotl(A##gu ^ Du, 20); \
+        Bgi = Rotl(A##ka ^ Da, 3); \
+        Bgo = Rotl(A##me ^ De, 45); \
+        Bgu = Rotl(A##si ^ Di, 61); \
+        E##ga = Bga ^ (~Bge & Bgi); Ca ^= E##ga; \
+        E##ge = Bge ^ (~Bgi & Bgo); Ce ^= E##ge; \
+        E##gi = Bgi ^ (~Bgo & Bgu); Ci ^= E##gi; \
+        E##go = Bgo ^ (~Bgu & Bga); Co ^= E##go; \
+        E##gu = Bgu ^ (~Bga & Bge); Cu ^= E##gu; \
+        \
+        Bka = Rotl(A##be ^ De, 1); \
+        Bke = Rotl(A##gi ^ Di, 6); \
+        Bki = Rotl(A##ko ^ Do, 25); \
+        Bko = Rotl(A##mu ^ Du, 8); \
+        Bku = Rotl(A##sa ^ Da, 18); \
+        E##ka = Bka ^ (~Bke & Bki); Ca ^= E##ka; \
+        E##ke = Bke ^ (~Bki & Bko); Ce ^= E##ke; \
+        E##ki = Bki ^ (~Bko & Bku); Ci ^= E##ki; \
+        E##ko = Bko ^ (~Bku & Bka); Co ^= E##ko; \
+        E##ku = Bku ^ (~Bka & Bke); Cu ^= E##ku; \
+        \
+        Bma = Rotl(A##bu ^ Du, 27); \
+        Bme = Rotl(A##ga ^ Da, 36); \
+        Bmi = Rotl(A##ke ^ De, 10); \
+        Bmo = Rotl(A##mi ^ Di, 15); \
+        Bmu = Rotl(A##so ^ Do, 56); \
+        E##ma = Bma ^ (~Bme & Bmi); Ca ^= E##ma; \
+        E##me = Bme ^ (~Bmi & Bmo); Ce ^= E##me; \
+        E##mi = Bmi ^ (~Bmo & Bmu); Ci ^= E##mi; \
+        E##mo = Bmo ^ (~Bmu & Bma); Co ^= E##mo; \
+        E##mu = Bmu ^ (~Bma & Bme); Cu ^= E##mu; \
+        \
+        Bsa = Rotl(A##bi ^ Di, 62); \
+        Bse = Rotl(A##go ^ Do, 55); \
+        Bsi = Rotl(A##ku ^ Du, 39); \
+        Bso = Rotl(A##ma ^ Da, 41); \
+        Bsu = Rotl(A##se ^ De, 2); \
+        E##sa = Bsa ^ (~Bse & Bsi); Ca ^= E##sa; \
+        E##se = Bse ^ (~Bsi & Bso); Ce ^= E##se; \
+        E##si = Bsi ^ (~Bso & Bsu); Ci ^= E##si; \
+        E##so = Bso ^ (~Bsu & Bsa); Co ^= E##so; \
+        E##su = Bsu ^ (~Bsa & Bse); Cu ^= E##su; \
+    } while (0)
+
+void Permute(uint64_t (&st)[25])
+{
+    uint64_t Aba = st[0], Abe = st[1], Abi = st[2], Abo = st[3], Abu = st[4];
+    uint64_t Aga = st[5], Age = st[6], Agi = st[7], Ago = st[8], Agu = st[9];
+    uint64_t Aka = st[10], Ake = st[11], Aki = st[12], Ako = st[13], Aku = st[14];
+    uint64_t Ama = st[15], Ame = st[16], Ami = st[17], Amo = st[18], Amu = st[19];
+    uint64_t Asa = st[20], Ase = st[21], Asi = st[22], Aso = st[23], Asu = st[24];
+    uint64_t Eba, Ebe, Ebi, Ebo, Ebu, Ega, Ege, Egi, Ego, Egu, Eka, Eke, Eki, Eko, Eku;
+    uint64_t Ema, Eme, Emi, Emo, Emu, Esa, Ese, Esi, Eso, Esu;
+    uint64_t Bba, Bbe, Bbi, Bbo, Bbu, Bga, Bge, Bgi, Bgo, Bgu, Bka, Bke, Bki, Bko, Bku;
+    uint64_t Bma, Bme, Bmi, Bmo, Bmu, Bsa, Bse, Bsi, Bso, Bsu;
+    uint64_t Da, De, Di, Do, Du;
+    uint64_t Ca = Aba ^ Aga ^ Aka ^ Ama ^ Asa;
+    uint64_t Ce = Abe ^ Age ^ Ake ^ Ame ^ Ase;
+    uint64_t Ci = Abi ^ Agi ^ Aki ^ Ami ^ Asi;
+    uint64_t Co = Abo ^ Ago ^ Ako ^ Amo ^ Aso;
+    uint64_t Cu = Abu ^ Agu ^ Aku ^ Amu ^ Asu;
+
+    KECCAK_ROUND(A, E, RNDC[0]);
+    KECCAK_ROUND(E, A, RNDC[1]);
+    KECCAK_ROUND(A, E, RNDC[2]);
+    KECCAK_ROUND(E, A, RNDC[3]);
+    KECCAK_ROUND(A, E, RNDC[4]);
+    KECCAK_ROUND(E, A, RNDC[5]);
+    KECCAK_ROUND(A, E, RNDC[6]);
+    KECCAK_ROUND(E, A, RNDC[7]);
+    KECCAK_ROUND(A, E, RNDC[8]);
+    KECCAK_ROUND(E, A, RNDC[9]);
+    KECCAK_ROUND(A, E, RNDC[10]);
+    KECCAK_ROUND(E, A, RNDC[11]);
+    KECCAK_ROUND(A, E, RNDC[12]);
+    KECCAK_ROUND(E, A, RNDC[13]);
+    KECCAK_ROUND(A, E, RNDC[14]);
+    KECCAK_ROUND(E, A, RNDC[15]);
+    KECCAK_ROUND(A, E, RNDC[16]);
+    KECCAK_ROUND(E, A, RNDC[17]);
+    KECCAK_ROUND(A, E, RNDC[18]);
+    KECCAK_ROUND(E, A, RNDC[19]);
+    KECCAK_ROUND(A, E, RNDC[20]);
+    KECCAK_ROUND(E, A, RNDC[21]);
+    KECCAK_ROUND(A, E, RNDC[22]);
+    KECCAK_ROUND(E, A, RNDC[23]);
+
+    st[0] = Aba; st[1] = Abe; st[2] = Abi; st[3] = Abo; st[4] = Abu;
+    st[5] = Aga; st[6] = Age; st[7] = Agi; st[8] = Ago; st[9] = Agu;
+    st[10] = Aka; st[11] = Ake; st[12] = Aki; st[13] = Ako; st[14] = Aku;
+    st[15] = Ama; st[16] = Ame; st[17] = Ami; st[18] = Amo; st[19] = Amu;
+    st[20] = Asa; st[21] = Ase; st[22] = Asi; st[23] = Aso; st[24] = Asu;
+}
+
+#undef KECCAK_ROUND
+
+}
+
+#endif
@@ -4,6 +4,9 @@
 
 #include <crypto/siphash.h>
 
+#include <compat/cpuid.h>
+#include <crypto/common.h>
+
 #define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
 
 #define SIPROUND do { \
@@ -171,3 +174,53 @@ uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint3
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+namespace siphash_avx2
+{
+void SipHashUint256_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], uint64_t (&out)[4]);
+void SipHashUint256Extra_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], const uint32_t (&extras)[4], uint64_t (&out)[4]);
+}
+
+namespace {
+
+/** Whether the 4-way AVX2 SipHash implementation can be used on this CPU. */
+bool UseSipHashAVX2()
+{
+#if defined(USE_ASM) && defined(HAVE_GETCPUID) && defined(ENABLE_AVX2) && !defined(BUILD_BGL_INTERNAL)
+    static const bool use_avx2 = [] {
+        uint32_t eax, ebx, ecx, edx;
+        GetCPUID(0, 0, eax, ebx, ecx, edx);
+        if (eax < 7) return false;
+        GetCPUID(1, 0, eax, ebx, ecx, edx);
+        const bool have_xsave = (ecx >> 27) & 1;
+        const bool have_avx = (ecx >> 28) & 1;
+        if (!have_xsave || !have_avx) return false;
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 6) != 6) return false;
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        return ((ebx >> 5) & 1) != 0;
+    }();
+    return use_avx2;
+#else
+    return false;
+#endif
+}
+
+} // namespace
+
+void SipHashUint256_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], uint64_t (&out)[4])
+{
+#if defined(ENABLE_AVX2) && !defined(BUILD_BGL_INTERNAL)
+    if (UseSipHashAVX2()) return siphash_avx2::SipHashUint256_4way(k0, k1, vals, out);
+#endif
+    for (int i = 0; i < 4; ++i) out[i] = SipHashUint256(k0, k1, *vals[i]);
+}
+
+void SipHashUint256Extra_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], const uint32_t (&extras)[4], uint64_t (&out)[4])
+{
+#if defined(ENABLE_AVX2) && !defined(BUILD_BGL_INTERNAL)
+    if (UseSipHashAVX2()) return siphash_avx2::SipHashUint256Extra_4way(k0, k1, vals, extras, out);
+#endif
+    for (int i = 0; i < 4; ++i) out[i] = SipHashUint256Extra(k0, k1, *vals[i], extras[i]);
+}
@@ -44,4 +44,13 @@ public:
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
+/** Compute SipHashUint256 of four values at once.
+ *
+ *  On CPUs with AVX2 the four hashes are computed in the lanes of one vector;
+ *  elsewhere this is equivalent to four SipHashUint256 calls.
+ */
+void SipHashUint256_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], uint64_t (&out)[4]);
+/** Compute SipHashUint256Extra of four (value, extra) pairs at once. */
+void SipHashUint256Extra_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], const uint32_t (&extras)[4], uint64_t (&out)[4]);
+
 #endif // BGL_CRYPTO_SIPHASH_H
@@ -0,0 +1,84 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <uint256.h>
+
+namespace siphash_avx2 {
+namespace {
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+template <int N> __m256i inline Rotl(__m256i x) { return _mm256_or_si256(_mm256_slli_epi64(x, N), _mm256_srli_epi64(x, 64 - N)); }
+/** Rotating by 32 bits swaps the 32-bit halves of every lane. */
+template <> __m256i inline Rotl<32>(__m256i x) { return _mm256_shuffle_epi32(x, 0xb1); }
+__m256i inline K(uint64_t x) { return _mm256_set1_epi64x(x); }
+
+void inline SipRound(__m256i& v0, __m256i& v1, __m256i& v2, __m256i& v3)
+{
+    v0 = Add(v0, v1); v1 = Rotl<13>(v1); v1 = Xor(v1, v0);
+    v0 = Rotl<32>(v0);
+    v2 = Add(v2, v3); v3 = Rotl<16>(v3); v3 = Xor(v3, v2);
+    v0 = Add(v0, v3); v3 = Rotl<21>(v3); v3 = Xor(v3, v0);
+    v2 = Add(v2, v1); v1 = Rotl<17>(v1); v1 = Xor(v1, v2);
+    v2 = Rotl<32>(v2);
+}
+
+/** Load 64-bit word i of four uint256 values into one vector. */
+__m256i inline Read4(const uint256* const (&vals)[4], int i)
+{
+    return _mm256_set_epi64x(vals[3]->GetUint64(i), vals[2]->GetUint64(i), vals[1]->GetUint64(i), vals[0]->GetUint64(i));
+}
+
+/** Hash the four values, with `last` as the final (length-tagged) message word of each lane. */
+void inline Hash4(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], __m256i last, uint64_t (&out)[4])
+{
+    __m256i d = Read4(vals, 0);
+    __m256i v0 = K(0x736f6d6570736575ULL ^ k0);
+    __m256i v1 = K(0x646f72616e646f6dULL ^ k1);
+    __m256i v2 = K(0x6c7967656e657261ULL ^ k0);
+    __m256i v3 = Xor(K(0x7465646279746573ULL ^ k1), d);
+
+    for (int i = 1; i < 4; ++i) {
+        SipRound(v0, v1, v2, v3);
+        SipRound(v0, v1, v2, v3);
+        v0 = Xor(v0, d);
+        d = Read4(vals, i);
+        v3 = Xor(v3, d);
+    }
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    v0 = Xor(v0, d);
+    v3 = Xor(v3, last);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    v0 = Xor(v0, last);
+    v2 = Xor(v2, K(0xFF));
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    _mm256_storeu_si256((__m256i*)out, Xor(Xor(v0, v1), Xor(v2, v3)));
+}
+
+} // namespace
+
+void SipHashUint256_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], uint64_t (&out)[4])
+{
+    Hash4(k0, k1, vals, K(((uint64_t)4) << 59), out);
+}
+
+void SipHashUint256Extra_4way(uint64_t k0, uint64_t k1, const uint256* const (&vals)[4], const uint32_t (&extras)[4], uint64_t (&out)[4])
+{
+    const __m256i last = _mm256_or_si256(K(((uint64_t)36) << 56), _mm256_set_epi64x(extras[3], extras[2], extras[1], extras[0]));
+    Hash4(k0, k1, vals, last, out);
+}
+
+} // namespace siphash_avx2
+
+#endif
@@ -0,0 +1,338 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BGL_FLATHASHMAP_H
+#define BGL_FLATHASHMAP_H
+
+#include <memusage.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash map using open addressing over a flat table of slots, with the entries
+ * themselves allocated from a pool of fixed-size chunks.
+ *
+ * Each slot holds the pool index of its entry and a tag of hash bits, so a
+ * lookup only touches an entry whose tag matches. Entries never move once
+ * inserted: pointers and references to them stay valid until they are erased,
+ * as with std::unordered_map. Iterators are invalidated by inserting, which may
+ * grow the table, but erasing only invalidates iterators to the erased entry.
+ *
+ * The map owns all its memory in a few large allocations, so
+ * DynamicMemoryUsage() accounts for it exactly instead of estimating malloc
+ * overhead per node. Erased entries are reused by later insertions, and only
+ * clear() releases the pool.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual = std::equal_to<Key>>
+class FlatHashMap
+{
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+
+    //! Number of entries allocated at once by the pool.
+    static constexpr size_t CHUNK_ENTRIES{64};
+    //! Smallest table size allocated.
+    static constexpr size_t MIN_CAPACITY{16};
+
+private:
+    struct Slot {
+        uint32_t index;
+        //! EMPTY, DELETED, or hash bits of the entry at index.
+        uint32_t tag;
+    };
+    static constexpr uint32_t EMPTY{0};
+    static constexpr uint32_t DELETED{1};
+    static constexpr uint32_t NO_INDEX{std::numeric_limits<uint32_t>::max()};
+
+    struct Entry {
+        alignas(value_type) unsigned char data[sizeof(value_type)];
+    };
+
+    Hash m_hash;
+    KeyEqual m_equal;
+
+    std::vector<std::unique_ptr<Entry[]>> m_chunks;
+    //! Number of pool entries ever handed out.
+    uint32_t m_pool_used{0};
+    //! Head of the list of erased pool entries, linked through their storage.
+    uint32_t m_free{NO_INDEX};
+
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_capacity{0};
+    size_t m_size{0};
+    size_t m_deleted{0};
+
+    static uint32_t MakeTag(size_t hash)
+    {
+        // Full slots use tags of 2 and up.
+        return uint32_t((uint64_t{hash} * 0x9e3779b97f4a7c15ULL) >> 32) | 2;
+    }
+
+    unsigned char* Storage(uint32_t index) const { return m_chunks[index / CHUNK_ENTRIES][index % CHUNK_ENTRIES].data; }
+    value_type& Value(uint32_t index) const { return *std::launder(reinterpret_cast<value_type*>(Storage(index))); }
+
+    uint32_t AllocateEntry()
+    {
+        if (m_free != NO_INDEX) {
+            const uint32_t index{m_free};
+            std::memcpy(&m_free, Storage(index), sizeof(m_free));
+            return index;
+        }
+        if (m_pool_used == m_chunks.size() * CHUNK_ENTRIES) {
+            m_chunks.emplace_back(new Entry[CHUNK_ENTRIES]);
+        }
+        return m_pool_used++;
+    }
+
+    void FreeEntry(uint32_t index)
+    {
+        std::memcpy(Storage(index), &m_free, sizeof(m_free));
+        m_free = index;
+    }
+
+    /** Position of the slot holding key, or m_capacity if there is none. */
+    size_t FindSlot(const Key& key, size_t hash) const
+    {
+        if (m_size == 0) return m_capacity;
+        const uint32_t tag{MakeTag(hash)};
+        const size_t mask{m_capacity - 1};
+        for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+            const Slot& slot = m_slots[pos];
+            if (slot.tag == EMPTY) return m_capacity;
+            if (slot.tag == tag && m_equal(Value(slot.index).first, key)) return pos;
+        }
+    }
+
+    /** Rebuild the table with new_capacity slots, dropping deleted markers. */
+    void Rehash(size_t new_capacity)
+    {
+        std::unique_ptr<Slot[]> slots{new Slot[new_capacity]()};
+        const size_t mask{new_capacity - 1};
+        for (size_t i = 0; i < m_capacity; ++i) {
+            const Slot& slot = m_slots[i];
+            if (slot.tag <= DELETED) continue;
+            size_t pos = m_hash(Value(slot.index).first) & mask;
+            while (slots[pos].tag != EMPTY) pos = (pos + 1) & mask;
+            slots[pos] = slot;
+        }
+        m_slots = std::move(slots);
+        m_capacity = new_capacity;
+        m_deleted = 0;
+    }
+
+    /** Make room for one more entry, keeping the table at most 7/8 full. */
+    void ReserveOne()
+    {
+        if ((m_size + m_deleted + 1) * 8 <= m_capacity * 7) return;
+        if (m_capacity == 0) return Rehash(MIN_CAPACITY);
+        // If the table is mostly deleted markers, rehashing in place frees them.
+        Rehash((m_size + 1) * 16 > m_capacity * 7 ? m_capacity * 2 : m_capacity);
+    }
+
+    template <bool Const>
+    class Iterator
+    {
+        using Map = std::conditional_t<Const, const FlatHashMap, FlatHashMap>;
+        Map* m_map{nullptr};
+        size_t m_pos{0};
+
+        friend class FlatHashMap;
+        friend class Iterator<!Const>;
+
+        Iterator(Map* map, size_t pos) : m_map(map), m_pos(pos) { SkipFree(); }
+
+        void SkipFree()
+        {
+            while (m_pos < m_map->m_capacity && m_map->m_slots[m_pos].tag <= DELETED) ++m_pos;
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FlatHashMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        Iterator() = default;
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iterator(const Iterator<false>& other) : m_map(other.m_map), m_pos(other.m_pos) {}
+
+        reference operator*() const { return m_map->Value(m_map->m_slots[m_pos].index); }
+        pointer operator->() const { return &**this; }
+
+        Iterator& operator++()
+        {
+            ++m_pos;
+            SkipFree();
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator copy{*this};
+            ++*this;
+            return copy;
+        }
+
+        friend bool operator==(const Iterator& a, const Iterator& b) { return a.m_pos == b.m_pos; }
+        friend bool operator!=(const Iterator& a, const Iterator& b) { return a.m_pos != b.m_pos; }
+    };
+
+public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    explicit FlatHashMap(const Hash& hash = Hash(), const KeyEqual& equal = KeyEqual()) : m_hash(hash), m_equal(equal) {}
+    FlatHashMap(const FlatHashMap&) = delete;
+    FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+    ~FlatHashMap() { clear(); }
+
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, m_capacity}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, m_capacity}; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    hasher hash_function() const { return m_hash; }
+
+    /** Hint the CPU to start loading the slot a key with this hash probes first. */
+    void prefetch(size_t hash) const
+    {
+#if defined(__GNUC__)
+        if (m_capacity) __builtin_prefetch(&m_slots[hash & (m_capacity - 1)], 0, 3);
+#endif
+    }
+
+    iterator find(const Key& key, size_t hash) { return {this, FindSlot(key, hash)}; }
+    const_iterator find(const Key& key, size_t hash) const { return {this, FindSlot(key, hash)}; }
+    iterator find(const Key& key) { return find(key, m_hash(key)); }
+    const_iterator find(const Key& key) const { return find(key, m_hash(key)); }
+    size_t count(const Key& key) const { return FindSlot(key, m_hash(key)) != m_capacity; }
+
+    /** Insert an entry for key constructed from args, unless key is already present. */
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace_hashed(size_t hash, const Key& key, Args&&... args)
+    {
+        const size_t found{FindSlot(key, hash)};
+        if (found != m_capacity) return {iterator{this, found}, false};
+
+        ReserveOne();
+        const uint32_t index{AllocateEntry()};
+        try {
+            ::new (Storage(index)) value_type(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        } catch (...) {
+            FreeEntry(index);
+            throw;
+        }
+        const size_t mask{m_capacity - 1};
+        size_t pos = hash & mask;
+        while (m_slots[pos].tag > DELETED) pos = (pos + 1) & mask;
+        if (m_slots[pos].tag == DELETED) --m_deleted;
+        m_slots[pos] = Slot{index, MakeTag(hash)};
+        ++m_size;
+        return {iterator{this, pos}, true};
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args)
+    {
+        return try_emplace_hashed(m_hash(key), key, std::forward<Args>(args)...);
+    }
+
+    template <typename KeyArgs, typename ValueArgs>
+    std::pair<iterator, bool> emplace(std::piecewise_construct_t, KeyArgs&& key_args, ValueArgs&& value_args)
+    {
+        const Key key{std::make_from_tuple<Key>(std::forward<KeyArgs>(key_args))};
+        return std::apply([&](auto&&... args) { return try_emplace(key, std::forward<decltype(args)>(args)...); }, std::forward<ValueArgs>(value_args));
+    }
+
+    template <typename V>
+    std::pair<iterator, bool> emplace(const Key& key, V&& value)
+    {
+        return try_emplace(key, std::forward<V>(value));
+    }
+
+    T& operator[](const Key& key) { return try_emplace(key).first->second; }
+
+    /** Erase the entry at it, returning an iterator to the next one. */
+    iterator erase(const_iterator it)
+    {
+        const size_t pos{it.m_pos};
+        Slot& slot = m_slots[pos];
+        Value(slot.index).~value_type();
+        FreeEntry(slot.index);
+        --m_size;
+        // A probe for any other key stops at an empty slot right after this
+        // one anyway, so the slot can become empty instead of deleted.
+        if (m_slots[(pos + 1) & (m_capacity - 1)].tag == EMPTY) {
+            slot.tag = EMPTY;
+        } else {
+            slot.tag = DELETED;
+            ++m_deleted;
+        }
+        return {this, pos + 1};
+    }
+
+    size_t erase(const Key& key)
+    {
+        const size_t pos{FindSlot(key, m_hash(key))};
+        if (pos == m_capacity) return 0;
+        erase(const_iterator{this, pos});
+        return 1;
+    }
+
+    /** Destroy all entries and release the pool, keeping the table allocated. */
+    void clear()
+    {
+        for (size_t i = 0; i < m_capacity; ++i) {
+            Slot& slot = m_slots[i];
+            if (slot.tag > DELETED) Value(slot.index).~value_type();
+            slot.tag = EMPTY;
+        }
+        m_chunks.clear();
+        m_chunks.shrink_to_fit();
+        m_pool_used = 0;
+        m_free = NO_INDEX;
+        m_size = 0;
+        m_deleted = 0;
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return m_chunks.size() * memusage::MallocUsage(sizeof(Entry) * CHUNK_ENTRIES) +
+               memusage::MallocUsage(sizeof(m_chunks[0]) * m_chunks.capacity()) +
+               memusage::MallocUsage(sizeof(Slot) * m_capacity);
+    }
+
+    /** Memory of pool entries freed by erase, which insertions reuse before allocating more. */
+    size_t FreeMemoryUsage() const { return (m_pool_used - m_size) * sizeof(Entry); }
+};
+
+namespace memusage {
+template <typename K, typename V, typename H, typename E>
+static inline size_t DynamicUsage(const FlatHashMap<K, V, H, E>& m)
+{
+    return m.DynamicMemoryUsage();
+}
+} // namespace memusage
+
+#endif // BGL_FLATHASHMAP_H
@@ -10,6 +10,7 @@
 #include <crypto/common.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha256.h>
+#include <crypto/sha3.h>
 #include <prevector.h>
 #include <serialize.h>
 #include <uint256.h>
@@ -20,10 +21,6 @@
 
 #include "logging.h"
 
-extern "C" {
-#include <crypto/sha3/sha3.h>
-}
-
 typedef uint256 ChainCode;
 
 /** A hasher class for Bitcoin's 256-bit hash (double SHA-256). */
@@ -73,35 +70,24 @@ public:
     }
 };
 
-/** A SHA3 hasher class specifically for blocks and transactions of BGL. */
+/** A Keccak-256 hasher class specifically for blocks and transactions of BGL. */
 class CHash256Keccak {
 private:
-    sha3_context sha3context;
+    Keccak256 keccak;
 public:
-    static const size_t OUTPUT_SIZE = CSHA256::OUTPUT_SIZE;
-
-    CHash256Keccak() {
-        sha3_Init256(&sha3context);
-        sha3_SetFlags(&sha3context, SHA3_FLAGS_KECCAK);
-    }
+    static const size_t OUTPUT_SIZE = Keccak256::OUTPUT_SIZE;
 
     void Finalize(unsigned char hash[OUTPUT_SIZE]) {
-        void const *buf;
-        buf = sha3_Finalize(&sha3context);
-
-        for (int i = 0; i < 32; i++)
-        {
-            hash[i] = ((const unsigned char *) buf)[i];
-        }
+        keccak.Finalize({hash, OUTPUT_SIZE});
     }
 
     CHash256Keccak& Write(const unsigned char *data, size_t len) {
-        sha3_Update(&sha3context, data, len);
+        keccak.Write({data, len});
         return *this;
     }
 
     CHash256Keccak& Reset() {
-        sha3_Init256(&sha3context);
+        keccak.Reset();
         return *this;
     }
 };
@@ -13,16 +13,23 @@
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
+#include <crypto/sha3.h>
 #include <deploymentstatus.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <pow.h>
 #include <primitives/transaction.h>
+#include <scheduler.h>
+#include <streams.h>
 #include <timedata.h>
 #include <util/moneystr.h>
 #include <util/system.h>
 
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
 #include <utility>
 
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
@@ -85,6 +92,24 @@ static BlockAssembler::Options DefaultOptions()
 BlockAssembler::BlockAssembler(CChainState& chainstate, const CTxMemPool& mempool, const CChainParams& params)
     : BlockAssembler(chainstate, mempool, params, DefaultOptions()) {}
 
+/** Create the coinbase transaction of a template collecting fees on top of pindexPrev. */
+static void SetCoinbase(CBlockTemplate& block_template, const CScript& scriptPubKeyIn, CAmount fees, const CBlockIndex* pindexPrev, const Consensus::Params& consensus)
+{
+    const int nHeight = pindexPrev->nHeight + 1;
+    CBlock& block = block_template.block;
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = fees / 10 + GetBlockSubsidy(nHeight, consensus);
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    block_template.vchCoinbaseCommitment = GenerateCoinbaseCommitment(block, pindexPrev, consensus);
+    block_template.vTxFees[0] = -fees;
+    block_template.vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*block.vtx[0]);
+}
+
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
@@ -147,24 +172,18 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    if (m_mempool.TracksClusters()) {
+        addChunkTxs(nPackagesSelected);
+    } else {
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
     m_last_block_num_txs = nBlockTx;
     m_last_block_weight = nBlockWeight;
 
-    // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees / 10 + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    SetCoinbase(*pblocktemplate, scriptPubKeyIn, nFees, pindexPrev, chainparams.GetConsensus());
 
     LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
@@ -173,7 +192,6 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
     BlockValidationState state;
     if (!TestBlockValidity(state, chainparams, m_chainstate, *pblock, pindexPrev, false, false)) {
@@ -435,6 +453,335 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+void BlockAssembler::addChunkTxs(int& nPackagesSelected)
+{
+    // The next chunk of each cluster, highest feerate on top.
+    using Candidate = std::pair<const CTxMemPool::Cluster*, size_t>;
+    const auto lower_feerate = [](const Candidate& a, const Candidate& b) {
+        return a.first->chunks[a.second].LowerFeeRate(b.first->chunks[b.second]);
+    };
+    std::vector<Candidate> candidates;
+    for (const auto& [id, cluster] : m_mempool.GetClusters()) {
+        candidates.emplace_back(&cluster, 0);
+    }
+    std::make_heap(candidates.begin(), candidates.end(), lower_feerate);
+
+    // Same heuristic as addPackageTxs to finish quickly once the block is nearly full.
+    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+    int64_t nConsecutiveFailed = 0;
+
+    while (!candidates.empty()) {
+        std::pop_heap(candidates.begin(), candidates.end(), lower_feerate);
+        const auto [cluster, chunk_index] = candidates.back();
+        candidates.pop_back();
+        const CTxMemPool::ClusterChunk& chunk = cluster->chunks[chunk_index];
+
+        if (chunk.fee < blockMinFeeRate.GetFee(chunk.size)) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+
+        const size_t begin{chunk_index > 0 ? cluster->chunks[chunk_index - 1].end : 0};
+        CTxMemPool::setEntries package;
+        int64_t packageSigOpsCost = 0;
+        for (size_t i = begin; i < chunk.end; ++i) {
+            package.insert(cluster->txs[i]);
+            packageSigOpsCost += cluster->txs[i]->GetSigOpCost();
+        }
+
+        // Later chunks of a cluster may depend on this one, so a chunk that
+        // does not make it leaves out the rest of its cluster.
+        if (!TestPackage(chunk.size, packageSigOpsCost)) {
+            ++nConsecutiveFailed;
+            if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockWeight >
+                    nBlockMaxWeight - 4000) {
+                // Give up if we're close to full and haven't succeeded in a while
+                break;
+            }
+            continue;
+        }
+        if (!TestPackageTransactions(package)) continue;
+
+        nConsecutiveFailed = 0;
+        for (size_t i = begin; i < chunk.end; ++i) {
+            AddToBlock(cluster->txs[i]);
+        }
+        ++nPackagesSelected;
+
+        if (chunk_index + 1 < cluster->chunks.size()) {
+            candidates.emplace_back(cluster, chunk_index + 1);
+            std::push_heap(candidates.begin(), candidates.end(), lower_feerate);
+        }
+    }
+}
+
+static BlockAssembler::Options ClampOptions(BlockAssembler::Options options)
+{
+    options.nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
+    return options;
+}
+
+/** Wake up getblocktemplate long polls so they look at the template again. */
+static void NotifyLongPolls()
+{
+    {
+        LOCK(g_best_block_mutex);
+    }
+    g_best_block_cv.notify_all();
+}
+
+BlockTemplateMaintainer::BlockTemplateMaintainer(ChainstateManager& chainman, const CTxMemPool& mempool, const CChainParams& params, const BlockAssembler::Options& options, unsigned int fee_increase_percent)
+    : m_chainman(chainman),
+      m_mempool(mempool),
+      m_params(params),
+      m_options(ClampOptions(options)),
+      m_fee_increase_percent(fee_increase_percent) {}
+
+BlockTemplateMaintainer::BlockTemplateMaintainer(ChainstateManager& chainman, const CTxMemPool& mempool, const CChainParams& params, unsigned int fee_increase_percent)
+    : BlockTemplateMaintainer(chainman, mempool, params, DefaultOptions(), fee_increase_percent) {}
+
+BlockTemplateMaintainer::~BlockTemplateMaintainer()
+{
+    Stop();
+}
+
+void BlockTemplateMaintainer::Start(CScheduler& scheduler)
+{
+    m_pool.Start(1);
+    WITH_LOCK(m_mutex, m_running = true);
+    // Without news too, to rebuild a template that could be improved.
+    scheduler.scheduleEvery([this] { Schedule(); }, REBUILD_INTERVAL);
+}
+
+void BlockTemplateMaintainer::Stop()
+{
+    WITH_LOCK(m_mutex, m_running = false);
+    m_pool.Stop();
+}
+
+void BlockTemplateMaintainer::Schedule()
+{
+    {
+        LOCK(m_mutex);
+        if (!m_running || m_scheduled) return;
+        m_scheduled = true;
+    }
+    m_pool.Submit([this] {
+        {
+            LOCK(m_mutex);
+            m_scheduled = false;
+            // Once stopped, a call that raced with Stop() runs on the caller.
+            if (!m_running) return;
+        }
+        ProcessPending();
+    });
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateMaintainer::Build(const CBlockIndex*& prev)
+{
+    LOCK(::cs_main);
+    prev = m_chainman.ActiveChain().Tip();
+    return BlockAssembler(m_chainman.ActiveChainstate(), m_mempool, m_params, m_options).CreateNewBlock(CScript() << OP_TRUE);
+}
+
+bool BlockTemplateMaintainer::Announce(bool force)
+{
+    if (!force && (m_fees <= m_announced_fees || m_fees < m_announced_fees + m_announced_fees * m_fee_increase_percent / 100)) {
+        return false;
+    }
+    m_announced_fees = m_fees;
+    ++m_sequence;
+    return true;
+}
+
+bool BlockTemplateMaintainer::Store(std::unique_ptr<CBlockTemplate> block_template, const CBlockIndex* prev, bool invalidated)
+{
+    const bool new_tip{prev != m_template_prev};
+    m_template = std::move(block_template);
+    m_template_prev = prev;
+    m_template_txids.clear();
+    // Same reserve for the coinbase as BlockAssembler::resetBlock()
+    m_weight = 4000;
+    m_sigops = 400;
+    const std::vector<CTransactionRef>& vtx{m_template->block.vtx};
+    for (size_t i = 1; i < vtx.size(); ++i) {
+        m_template_txids.insert(vtx[i]->GetHash());
+        m_weight += GetTransactionWeight(*vtx[i]);
+        m_sigops += m_template->vTxSigOpsCost[i];
+    }
+    m_fees = -m_template->vTxFees[0];
+    m_coinbase_stale = false;
+    m_improvable = false;
+    m_last_build = std::chrono::steady_clock::now();
+    if (new_tip) {
+        // Long polls already return for the new tip itself.
+        m_announced_fees = m_fees;
+        return false;
+    }
+    return Announce(invalidated);
+}
+
+bool BlockTemplateMaintainer::Append(const std::vector<CTransactionRef>& txs)
+{
+    LOCK2(::cs_main, m_mempool.cs);
+    LOCK(m_mutex);
+    const CBlockIndex* tip{m_chainman.ActiveChain().Tip()};
+    if (!m_template || m_template_prev != tip) return false;
+
+    // Same checks as BlockAssembler::TestPackageTransactions()
+    const int height{tip->nHeight + 1};
+    const int64_t lock_time_cutoff{(STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                   ? tip->GetMedianTimePast()
+                                   : m_template->block.GetBlockTime()};
+    const bool include_witness{DeploymentActiveAfter(tip, m_params.GetConsensus(), Consensus::DEPLOYMENT_SEGWIT)};
+
+    bool appended{false};
+    for (const CTransactionRef& tx : txs) {
+        if (m_template_txids.count(tx->GetHash())) continue;
+        const std::optional<CTxMemPool::txiter> it{m_mempool.GetIter(tx->GetHash())};
+        // Gone again; if it took template transactions along, they trigger a rebuild.
+        if (!it) continue;
+        const CTxMemPoolEntry& entry{**it};
+        if (!IsFinalTx(entry.GetTx(), height, lock_time_cutoff) || (!include_witness && entry.GetTx().HasWitness())) continue;
+        if (entry.GetModifiedFee() < m_options.blockMinFeeRate.GetFee(entry.GetTxSize())) continue;
+
+        const auto& parents{entry.GetMemPoolParentsConst()};
+        const bool parents_included{std::all_of(parents.begin(), parents.end(), [&](const CTxMemPoolEntry& parent) EXCLUSIVE_LOCKS_REQUIRED(m_mutex) {
+            return m_template_txids.count(parent.GetTx().GetHash()) > 0;
+        })};
+        if (!parents_included ||
+            m_weight + WITNESS_SCALE_FACTOR * entry.GetTxSize() >= m_options.nBlockMaxWeight ||
+            m_sigops + entry.GetSigOpCost() >= MAX_BLOCK_SIGOPS_COST) {
+            // Selecting by ancestor feerate may do better than the template.
+            m_improvable = true;
+            continue;
+        }
+
+        m_template->block.vtx.emplace_back(entry.GetSharedTx());
+        m_template->vTxFees.push_back(entry.GetFee());
+        m_template->vTxSigOpsCost.push_back(entry.GetSigOpCost());
+        m_template_txids.insert(entry.GetTx().GetHash());
+        m_weight += entry.GetTxWeight();
+        m_sigops += entry.GetSigOpCost();
+        m_fees += entry.GetFee();
+        appended = true;
+    }
+    if (!appended) return false;
+    m_coinbase_stale = true;
+    return Announce(/*force=*/false);
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateMaintainer::Copy()
+{
+    if (m_coinbase_stale) {
+        SetCoinbase(*m_template, CScript() << OP_TRUE, m_fees, m_template_prev, m_params.GetConsensus());
+        m_coinbase_stale = false;
+    }
+    return std::make_unique<CBlockTemplate>(*m_template);
+}
+
+void BlockTemplateMaintainer::ProcessPending()
+{
+    std::vector<CTransactionRef> added;
+    bool rebuild;
+    bool invalidated;
+    {
+        LOCK(m_mutex);
+        if (!m_active) return;
+        invalidated = m_invalidated;
+        rebuild = !m_template || m_new_tip || m_invalidated ||
+                  (m_improvable && std::chrono::steady_clock::now() >= m_last_build + REBUILD_INTERVAL);
+        m_new_tip = false;
+        m_invalidated = false;
+        added.swap(m_added);
+    }
+
+    bool changed{false};
+    if (rebuild) {
+        // Transactions added meanwhile are selected by the rebuild or appended next time.
+        const CBlockIndex* prev{nullptr};
+        std::unique_ptr<CBlockTemplate> block_template;
+        try {
+            block_template = Build(prev);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        LOCK(m_mutex);
+        if (block_template) {
+            changed = Store(std::move(block_template), prev, invalidated);
+        } else {
+            // Leave it to the next request to build one, and report the failure.
+            m_template.reset();
+            m_template_prev = nullptr;
+            m_template_txids.clear();
+        }
+    } else if (!added.empty()) {
+        changed = Append(added);
+    }
+    if (changed) NotifyLongPolls();
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateMaintainer::GetTemplate(const CBlockIndex* tip)
+{
+    AssertLockHeld(::cs_main);
+    bool stale{false};
+    {
+        LOCK2(m_mempool.cs, m_mutex);
+        m_active = true;
+        if (m_template && m_template_prev == tip) {
+            // Removals may not have been processed yet.
+            stale = !std::all_of(m_template_txids.begin(), m_template_txids.end(), [&](const uint256& txid) {
+                return m_mempool.exists(GenTxid::Txid(txid));
+            });
+            if (!stale) return Copy();
+        }
+    }
+
+    const CBlockIndex* prev{nullptr};
+    std::unique_ptr<CBlockTemplate> block_template{Build(prev)};
+    std::unique_ptr<CBlockTemplate> result;
+    bool changed;
+    {
+        LOCK(m_mutex);
+        changed = Store(std::move(block_template), prev, stale);
+        result = Copy();
+    }
+    if (changed) NotifyLongPolls();
+    return result;
+}
+
+void BlockTemplateMaintainer::TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence)
+{
+    {
+        LOCK(m_mutex);
+        if (!m_active) return;
+        m_added.push_back(tx);
+    }
+    Schedule();
+}
+
+void BlockTemplateMaintainer::TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence)
+{
+    // Transactions mined in the new tip are dealt with in UpdatedBlockTip.
+    if (reason == MemPoolRemovalReason::BLOCK) return;
+    {
+        LOCK(m_mutex);
+        if (!m_active || !m_template_txids.count(tx->GetHash())) return;
+        m_invalidated = true;
+    }
+    Schedule();
+}
+
+void BlockTemplateMaintainer::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    {
+        LOCK(m_mutex);
+        if (!m_active) return;
+        m_new_tip = true;
+    }
+    Schedule();
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -453,3 +800,74 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+bool GrindBlockNonce(CBlockHeader& header, const Consensus::Params& params, uint64_t& max_tries, int num_threads, const std::function<bool()>& interrupt, uint64_t& hashes)
+{
+    //! Serialized header size; the nonce is its last 4 bytes.
+    static constexpr size_t HEADER_SIZE{80};
+    //! Candidates hashed per Keccak256Batch call.
+    static constexpr size_t BATCH{8};
+    //! Nonces handed to a worker at a time.
+    static constexpr uint64_t CHUNK{4096};
+
+    const uint32_t start{header.nNonce};
+    const uint64_t count{std::min<uint64_t>(max_tries, std::numeric_limits<uint32_t>::max() - start)};
+
+    std::vector<unsigned char> serialized;
+    CVectorWriter{SER_GETHASH, PROTOCOL_VERSION, serialized, 0, header};
+    assert(serialized.size() == HEADER_SIZE);
+
+    std::atomic<uint64_t> next_chunk{0};
+    // Offset of the lowest valid nonce found so far, or count if there is none.
+    std::atomic<uint64_t> found{count};
+    std::atomic<uint64_t> hashed{0};
+    std::atomic<bool> interrupted{false};
+
+    auto worker = [&] {
+        std::vector<unsigned char> candidates(BATCH * HEADER_SIZE);
+        for (size_t i = 0; i < BATCH; ++i) {
+            std::copy(serialized.begin(), serialized.end(), candidates.begin() + i * HEADER_SIZE);
+        }
+        unsigned char out[BATCH * Keccak256::OUTPUT_SIZE];
+        while (true) {
+            const uint64_t begin{next_chunk.fetch_add(CHUNK)};
+            if (begin >= found.load()) break;
+            if (interrupted.load() || interrupt()) {
+                interrupted = true;
+                break;
+            }
+            const uint64_t end{std::min(begin + CHUNK, count)};
+            for (uint64_t pos = begin; pos < end && pos < found.load(std::memory_order_relaxed); pos += BATCH) {
+                const size_t n = std::min<uint64_t>(BATCH, end - pos);
+                for (size_t i = 0; i < n; ++i) {
+                    WriteLE32(candidates.data() + i * HEADER_SIZE + HEADER_SIZE - 4, start + pos + i);
+                }
+                Keccak256Batch(out, candidates.data(), HEADER_SIZE, n);
+                hashed += n;
+                for (size_t i = 0; i < n; ++i) {
+                    uint256 hash;
+                    std::copy(out + i * Keccak256::OUTPUT_SIZE, out + (i + 1) * Keccak256::OUTPUT_SIZE, hash.begin());
+                    if (!CheckProofOfWork(hash, header.nBits, params)) continue;
+                    uint64_t lowest{found.load()};
+                    while (pos + i < lowest && !found.compare_exchange_weak(lowest, pos + i)) {}
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    hashes = hashed;
+    if (interrupted) return false;
+    max_tries -= found;
+    header.nNonce = start + found;
+    return found < count;
+}
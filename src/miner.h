@@ -7,23 +7,36 @@
 #define BGL_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
+#include <util/hasher.h>
+#include <util/threadpool.h>
 #include <validation.h>
+#include <validationinterface.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <stdint.h>
+#include <unordered_set>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 
 class CBlockIndex;
 class CChainParams;
+class CScheduler;
 class CScript;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genproclimit, the number of threads the generate RPCs use to search for a nonce */
+static const int DEFAULT_GENERATE_THREADS = 1;
+/** Default for -longpollfeeincrease, the percentage by which template fees must rise to end a getblocktemplate long poll */
+static const unsigned int DEFAULT_LONGPOLL_FEE_INCREASE = 5;
 
 struct CBlockTemplate
 {
@@ -176,6 +189,9 @@ private:
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int& nPackagesSelected, int& nDescendantsUpdated) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
+    /** Add transactions by taking the chunks of the mempool's cluster
+      * linearizations in feerate order, instead of walking ancestors. */
+    void addChunkTxs(int& nPackagesSelected) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -198,10 +214,123 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
 };
 
+/**
+ * Keeps a block template for getblocktemplate up to date as the mempool and
+ * the chain change, so that requests copy a ready template instead of
+ * selecting transactions while holding cs_main and the mempool lock.
+ *
+ * A transaction entering the mempool is appended to the template if its
+ * in-mempool parents are already in it and it fits. Anything else is left to
+ * a rebuild with BlockAssembler: right away after a new tip or when a
+ * template transaction leaves the mempool, and at most once every
+ * REBUILD_INTERVAL when a transaction that was not appended might improve
+ * the template. Nothing is tracked until a template is first requested.
+ */
+class BlockTemplateMaintainer final : public CValidationInterface
+{
+public:
+    //! Minimum time between rebuilds made only to improve the template.
+    static constexpr std::chrono::seconds REBUILD_INTERVAL{5};
+
+    BlockTemplateMaintainer(ChainstateManager& chainman, const CTxMemPool& mempool, const CChainParams& params, unsigned int fee_increase_percent);
+    BlockTemplateMaintainer(ChainstateManager& chainman, const CTxMemPool& mempool, const CChainParams& params, const BlockAssembler::Options& options, unsigned int fee_increase_percent);
+    ~BlockTemplateMaintainer();
+
+    /** Start keeping the template up to date, with scheduler looking for improvements every REBUILD_INTERVAL. */
+    void Start(CScheduler& scheduler) LOCKS_EXCLUDED(m_mutex);
+    /** Stop keeping the template up to date, if started. */
+    void Stop() LOCKS_EXCLUDED(m_mutex);
+
+    /**
+     * Get a copy of the template, which pays to OP_TRUE like other
+     * getblocktemplate templates. Builds it here if there is none on top of tip.
+     */
+    std::unique_ptr<CBlockTemplate> GetTemplate(const CBlockIndex* tip) EXCLUSIVE_LOCKS_REQUIRED(::cs_main) LOCKS_EXCLUDED(m_mutex);
+
+    /**
+     * Counts the times the template's fees rose by the -longpollfeeincrease
+     * percentage, or the template stopped being valid. Each change notifies
+     * g_best_block_cv, so that getblocktemplate long polls wake up.
+     */
+    uint64_t GetSequence() const { return m_sequence; }
+
+    /** Apply the changes seen since the last call. Done on a thread of its own once started. */
+    void ProcessPending() LOCKS_EXCLUDED(m_mutex, ::cs_main);
+
+protected:
+    void TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) override;
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+
+private:
+    ChainstateManager& m_chainman;
+    const CTxMemPool& m_mempool;
+    const CChainParams& m_params;
+    BlockAssembler::Options m_options;
+    const unsigned int m_fee_increase_percent;
+
+    Mutex m_mutex;
+    //! Set by the first GetTemplate() call.
+    bool m_active GUARDED_BY(m_mutex){false};
+    //! The template; its coinbase is out of date while m_coinbase_stale.
+    std::unique_ptr<CBlockTemplate> m_template GUARDED_BY(m_mutex);
+    const CBlockIndex* m_template_prev GUARDED_BY(m_mutex){nullptr};
+    std::unordered_set<uint256, SaltedTxidHasher> m_template_txids GUARDED_BY(m_mutex);
+    //! Block weight and sigops cost, with the reserve for the coinbase.
+    uint64_t m_weight GUARDED_BY(m_mutex){0};
+    int64_t m_sigops GUARDED_BY(m_mutex){0};
+    CAmount m_fees GUARDED_BY(m_mutex){0};
+    bool m_coinbase_stale GUARDED_BY(m_mutex){false};
+    std::chrono::steady_clock::time_point m_last_build GUARDED_BY(m_mutex);
+    //! Template fees when m_sequence last changed.
+    CAmount m_announced_fees GUARDED_BY(m_mutex){0};
+    std::atomic<uint64_t> m_sequence{0};
+
+    //! Changes not yet applied.
+    std::vector<CTransactionRef> m_added GUARDED_BY(m_mutex);
+    bool m_new_tip GUARDED_BY(m_mutex){false};
+    bool m_invalidated GUARDED_BY(m_mutex){false};
+    bool m_improvable GUARDED_BY(m_mutex){false};
+
+    //! Between Start() and Stop().
+    bool m_running GUARDED_BY(m_mutex){false};
+    //! A ProcessPending() call is queued on m_pool.
+    bool m_scheduled GUARDED_BY(m_mutex){false};
+    ThreadPool m_pool{"blocktemplate"};
+
+    /** Build a template from scratch, returning it and the block it builds on. */
+    std::unique_ptr<CBlockTemplate> Build(const CBlockIndex*& prev) LOCKS_EXCLUDED(m_mutex);
+    /** Replace the template. Returns whether m_sequence changed. */
+    bool Store(std::unique_ptr<CBlockTemplate> block_template, const CBlockIndex* prev, bool invalidated) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    /** Append the transactions that can be. Returns whether m_sequence changed. */
+    bool Append(const std::vector<CTransactionRef>& txs) LOCKS_EXCLUDED(m_mutex);
+    bool Announce(bool force) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    std::unique_ptr<CBlockTemplate> Copy() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    /** Queue a ProcessPending() call unless one is queued already. */
+    void Schedule() LOCKS_EXCLUDED(m_mutex);
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/**
+ * Search for a nonce that satisfies the header's proof of work, starting at header.nNonce.
+ *
+ * The header is serialized once and candidates, which differ only in their trailing nonce, are
+ * hashed in batches with Keccak256Batch. The nonce range is handed out in chunks, in order, to
+ * num_threads workers, so the lowest valid nonce is found whatever the number of threads.
+ *
+ * @param[in,out] header     On success nNonce holds the valid nonce; otherwise it is advanced
+ *                           past the nonces that were tried.
+ * @param[in,out] max_tries  Upper bound on the nonces to try; decreased by the number tried
+ *                           before the valid one.
+ * @param[in]     interrupt  Polled between chunks; the search is abandoned once it returns true.
+ * @param[out]    hashes     Number of header hashes computed, for hashrate reporting.
+ * @returns whether a valid nonce was found.
+ */
+bool GrindBlockNonce(CBlockHeader& header, const Consensus::Params& params, uint64_t& max_tries, int num_threads, const std::function<bool()>& interrupt, uint64_t& hashes);
+
 /** Update an old GenerateCoinbaseCommitment from CreateNewBlock after the block txs have changed */
 void RegenerateCommitments(CBlock& block, ChainstateManager& chainman);
 
@@ -32,15 +32,19 @@
 #include <txmempool.h>
 #include <txorphanage.h>
 #include <txrequest.h>
+#include <txvalidationqueue.h>
 #include <util/check.h> // For NDEBUG compile time check
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/thread.h>
 #include <util/trace.h>
 #include <validation.h>
 
 #include <algorithm>
+#include <condition_variable>
 #include <memory>
 #include <optional>
+#include <thread>
 #include <typeinfo>
 
 /** How long to cache transactions in mapRelay for normal relay */
@@ -85,11 +89,19 @@ static constexpr int32_t MAX_PEER_TX_REQUEST_IN_FLIGHT = 100;
  *  rate (by our own policy, see INVENTORY_BROADCAST_PER_SECOND) for several minutes, while not receiving
  *  the actual transaction (from any peer) in response to requests for them. */
 static constexpr int32_t MAX_PEER_TX_ANNOUNCEMENTS = 5000;
+/** Maximum number of transactions from a peer waiting for, or in, validation. Until some are done, the peer's
+ *  further messages are left unprocessed and requesting transactions from it is put off. */
+static constexpr size_t MAX_PEER_TX_VALIDATION_QUEUE{100};
+/** Maximum total serialized size of the transactions from a peer waiting for, or in, validation. */
+static constexpr size_t MAX_PEER_TX_VALIDATION_BYTES{1000000};
+/** Number of transactions the validation thread takes from the queue at once, round-robin over peers. */
+static constexpr size_t TX_VALIDATION_BATCH_SIZE{16};
 /** How long to delay requesting transactions via txids, if we have wtxid-relaying peers */
 static constexpr auto TXID_RELAY_DELAY = std::chrono::seconds{2};
 /** How long to delay requesting transactions from non-preferred peers */
 static constexpr auto NONPREF_PEER_TX_DELAY = std::chrono::seconds{2};
-/** How long to delay requesting transactions from overloaded peers (see MAX_PEER_TX_REQUEST_IN_FLIGHT). */
+/** How long to delay requesting transactions from overloaded peers (see MAX_PEER_TX_REQUEST_IN_FLIGHT and
+ *  MAX_PEER_TX_VALIDATION_QUEUE). */
 static constexpr auto OVERLOADED_PEER_TX_DELAY = std::chrono::seconds{2};
 /** How long to wait (in microseconds) before downloading a transaction from an additional peer */
 static constexpr std::chrono::microseconds GETDATA_TX_INTERVAL{std::chrono::seconds{60}};
@@ -317,6 +329,8 @@ public:
     void SendPings() override;
     void RelayTransaction(const uint256& txid, const uint256& wtxid) override;
     void SetBestHeight(int height) override { m_best_height = height; };
+    void StartTxValidation() override;
+    void StopTxValidation() override;
     void Misbehaving(const NodeId pnode, const int howmuch, const std::string& message) override;
     void ProcessMessage(CNode& pfrom, const std::string& msg_type, CDataStream& vRecv,
                         const std::chrono::microseconds time_received, const std::atomic<bool>& interruptMsgProc) override;
@@ -371,6 +385,25 @@ private:
     bool MaybeDiscourageAndDisconnect(CNode& pnode, Peer& peer);
 
     void ProcessOrphanTx(std::set<uint256>& orphan_work_set) EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans);
+
+    /**
+     * Submit a transaction received from a peer to the mempool and act on the
+     * outcome: relay it and reconsider its orphans if it was accepted, keep it
+     * as an orphan if its inputs are missing, or remember the rejection and
+     * maybe punish the peer otherwise. The peer may have disconnected already.
+     *
+     * @param[in] precheck  Failed result of CheckTransactionForMempool(), if that
+     *                      already ran; the transaction is then not submitted.
+     */
+    void ProcessTxFromPeer(NodeId nodeid, const CTransactionRef& ptx, const TxValidationState& precheck = {})
+        EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans);
+
+    /** Main loop of the transaction validation thread. */
+    void ThreadTxValidation() EXCLUSIVE_LOCKS_REQUIRED(!m_tx_validation_mutex);
+
+    /** Whether the next message of a peer, of type msg_type, has to wait for its transactions to be validated. */
+    bool WaitsForTxValidation(NodeId nodeid, const std::string& msg_type) EXCLUSIVE_LOCKS_REQUIRED(!m_tx_validation_mutex);
+
     /** Process a single headers message from a peer. */
     void ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
                                const std::vector<CBlockHeader>& headers,
@@ -417,6 +450,17 @@ private:
     CTxMemPool& m_mempool;
     TxRequestTracker m_txrequest GUARDED_BY(::cs_main);
 
+    /** Transactions received from peers, waiting for the transaction
+     *  validation thread. May be locked while holding cs_main, not the other
+     *  way round. */
+    Mutex m_tx_validation_mutex;
+    std::condition_variable m_tx_validation_cv;
+    TxValidationQueue m_tx_validation_queue GUARDED_BY(m_tx_validation_mutex){MAX_PEER_TX_VALIDATION_QUEUE, MAX_PEER_TX_VALIDATION_BYTES};
+    /** Whether received transactions go to m_tx_validation_queue rather than being validated right away. */
+    bool m_tx_validation_running GUARDED_BY(m_tx_validation_mutex){false};
+    bool m_tx_validation_interrupt GUARDED_BY(m_tx_validation_mutex){false};
+    std::thread m_tx_validation_thread;
+
     /** The height of the best chain */
     std::atomic<int> m_best_height{-1};
 
@@ -1218,6 +1262,7 @@ void PeerManagerImpl::FinalizeNode(const CNode& node)
     }
     WITH_LOCK(g_cs_orphans, m_orphanage.EraseForPeer(nodeid));
     m_txrequest.DisconnectedPeer(nodeid);
+    WITH_LOCK(m_tx_validation_mutex, m_tx_validation_queue.DisconnectedPeer(nodeid));
     nPreferredDownload -= state->fPreferredDownload;
     m_peers_downloading_from -= (state->nBlocksInFlight != 0);
     assert(m_peers_downloading_from >= 0);
@@ -1447,6 +1492,83 @@ PeerManagerImpl::PeerManagerImpl(const CChainParams& chainparams, CConnman& conn
 {
 }
 
+void PeerManagerImpl::StartTxValidation()
+{
+    assert(!m_tx_validation_thread.joinable());
+    WITH_LOCK(m_tx_validation_mutex, m_tx_validation_running = true);
+    m_tx_validation_thread = std::thread(&util::TraceThread, "txvalidation", [this] { ThreadTxValidation(); });
+}
+
+void PeerManagerImpl::StopTxValidation()
+{
+    if (!m_tx_validation_thread.joinable()) return;
+    WITH_LOCK(m_tx_validation_mutex, m_tx_validation_interrupt = true);
+    m_tx_validation_cv.notify_all();
+    m_tx_validation_thread.join();
+
+    LOCK(m_tx_validation_mutex);
+    m_tx_validation_running = false;
+    m_tx_validation_interrupt = false;
+    for (const auto& entry : m_tx_validation_queue.PopBatch(m_tx_validation_queue.Size())) {
+        m_tx_validation_queue.Finish(entry);
+    }
+}
+
+void PeerManagerImpl::ThreadTxValidation()
+{
+    while (true) {
+        std::vector<TxValidationQueue::Entry> batch;
+        {
+            WAIT_LOCK(m_tx_validation_mutex, lock);
+            m_tx_validation_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_tx_validation_mutex) {
+                return m_tx_validation_interrupt || m_tx_validation_queue.Size() > 0;
+            });
+            if (m_tx_validation_interrupt) return;
+            batch = m_tx_validation_queue.PopBatch(TX_VALIDATION_BATCH_SIZE);
+        }
+
+        // Weed out what fails on its own before taking any lock.
+        std::vector<TxValidationState> prechecks(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            CheckTransactionForMempool(*batch[i].tx, prechecks[i]);
+        }
+
+        // Take the locks per transaction, so that the message handler gets
+        // its turn in between.
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const TxValidationQueue::Entry& entry = batch[i];
+            {
+                LOCK2(cs_main, g_cs_orphans);
+                ProcessTxFromPeer(entry.peer, entry.tx, prechecks[i]);
+            }
+            // Reconsider the orphans this made valid, one at a time, before
+            // the peer's next message is processed.
+            if (PeerRef peer = GetPeerRef(entry.peer)) {
+                while (true) {
+                    LOCK2(cs_main, g_cs_orphans);
+                    if (peer->m_orphan_work_set.empty()) break;
+                    ProcessOrphanTx(peer->m_orphan_work_set);
+                }
+            }
+            WITH_LOCK(m_tx_validation_mutex, m_tx_validation_queue.Finish(entry));
+        }
+
+        // Peers may have messages waiting for their transactions to be done.
+        m_connman.WakeMessageHandler();
+    }
+}
+
+bool PeerManagerImpl::WaitsForTxValidation(NodeId nodeid, const std::string& msg_type)
+{
+    LOCK(m_tx_validation_mutex);
+    // Transactions join those queued unless the peer is at its limits.
+    // Anything else waits until they are all done, so the peer sees the
+    // effects of its transactions in the order it sent them; a ping sent
+    // after them is only answered once they are in the mempool.
+    if (msg_type == NetMsgType::TX) return m_tx_validation_queue.IsFull(nodeid);
+    return m_tx_validation_queue.Count(nodeid) > 0;
+}
+
 void PeerManagerImpl::StartScheduledTasks(CScheduler& scheduler)
 {
     // Stale tip checking and peer eviction are on two different timers, but we
@@ -2048,6 +2170,7 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
 
     bool received_new_header = false;
     const CBlockIndex *pindexLast = nullptr;
+    const std::vector<uint256> hashes{HashBlockHeaders(headers)};
     {
         LOCK(cs_main);
         CNodeState *nodestate = State(pfrom.GetId());
@@ -2064,14 +2187,14 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
             nodestate->nUnconnectingHeaders++;
             m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::GETHEADERS, m_chainman.ActiveChain().GetLocator(pindexBestHeader), uint256()));
             LogPrint(BCLog::NET, "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
-                    headers[0].GetHash().ToString(),
+                    hashes[0].ToString(),
                     headers[0].hashPrevBlock.ToString(),
                     pindexBestHeader->nHeight,
                     pfrom.GetId(), nodestate->nUnconnectingHeaders);
             // Set hashLastUnknownBlock for this peer, so that if we
             // eventually get the headers - even from a different peer -
             // we can use this peer to download.
-            UpdateBlockAvailability(pfrom.GetId(), headers.back().GetHash());
+            UpdateBlockAvailability(pfrom.GetId(), hashes.back());
 
             if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0) {
                 Misbehaving(pfrom.GetId(), 20, strprintf("%d non-connecting headers", nodestate->nUnconnectingHeaders));
@@ -2080,12 +2203,12 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
         }
 
         uint256 hashLastBlock;
-        for (const CBlockHeader& header : headers) {
-            if (!hashLastBlock.IsNull() && header.hashPrevBlock != hashLastBlock) {
+        for (size_t i = 0; i < headers.size(); ++i) {
+            if (!hashLastBlock.IsNull() && headers[i].hashPrevBlock != hashLastBlock) {
                 Misbehaving(pfrom.GetId(), 20, "non-continuous headers sequence");
                 return;
             }
-            hashLastBlock = header.GetHash();
+            hashLastBlock = hashes[i];
         }
 
         // If we don't have the last header, then they'll have given us
@@ -2096,7 +2219,7 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
     }
 
     BlockValidationState state;
-    if (!m_chainman.ProcessNewBlockHeaders(headers, state, m_chainparams, &pindexLast)) {
+    if (!m_chainman.ProcessNewBlockHeaders(headers, hashes, state, m_chainparams, &pindexLast)) {
         if (state.IsInvalid()) {
             MaybePunishNodeForBlock(pfrom.GetId(), state, via_compact_block, "invalid header received");
             return;
@@ -2302,6 +2425,179 @@ void PeerManagerImpl::ProcessOrphanTx(std::set<uint256>& orphan_work_set)
     }
 }
 
+void PeerManagerImpl::ProcessTxFromPeer(NodeId nodeid, const CTransactionRef& ptx, const TxValidationState& precheck)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(g_cs_orphans);
+
+    const CTransaction& tx = *ptx;
+
+    // The peer may have disconnected while its transaction waited for
+    // validation; its orphans are then still worth reconsidering.
+    PeerRef peer = GetPeerRef(nodeid);
+    std::set<uint256> disconnected_work_set;
+    std::set<uint256>& orphan_work_set = peer ? peer->m_orphan_work_set : disconnected_work_set;
+
+    const MempoolAcceptResult result = precheck.IsValid() ? m_chainman.ProcessTransaction(ptx) :
+                                                             MempoolAcceptResult::Failure(precheck);
+    const TxValidationState& state = result.m_state;
+
+    if (result.m_result_type == MempoolAcceptResult::ResultType::VALID) {
+        // As this version of the transaction was acceptable, we can forget about any
+        // requests for it.
+        m_txrequest.ForgetTxHash(tx.GetHash());
+        m_txrequest.ForgetTxHash(tx.GetWitnessHash());
+        _RelayTransaction(tx.GetHash(), tx.GetWitnessHash());
+        m_orphanage.AddChildrenToWorkSet(tx, orphan_work_set);
+
+        m_connman.ForNode(nodeid, [](CNode* pnode) {
+            pnode->nLastTXTime = GetTime();
+            return true;
+        });
+
+        LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            nodeid,
+            tx.GetHash().ToString(),
+            m_mempool.size(), m_mempool.DynamicMemoryUsage() / 1000);
+
+        for (const CTransactionRef& removedTx : result.m_replaced_transactions.value()) {
+            AddToCompactExtraTransactions(removedTx);
+        }
+
+        // Recursively process any orphan transactions that depended on this one
+        ProcessOrphanTx(orphan_work_set);
+        // Nobody else gets to the rest if the peer has gone.
+        if (!peer) {
+            while (!orphan_work_set.empty()) ProcessOrphanTx(orphan_work_set);
+        }
+    }
+    else if (state.GetResult() == TxValidationResult::TX_MISSING_INPUTS)
+    {
+        bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
+
+        // Deduplicate parent txids, so that we don't have to loop over
+        // the same parent txid more than once down below.
+        std::vector<uint256> unique_parents;
+        unique_parents.reserve(tx.vin.size());
+        for (const CTxIn& txin : tx.vin) {
+            // We start with all parents, and then remove duplicates below.
+            unique_parents.push_back(txin.prevout.hash);
+        }
+        std::sort(unique_parents.begin(), unique_parents.end());
+        unique_parents.erase(std::unique(unique_parents.begin(), unique_parents.end()), unique_parents.end());
+        for (const uint256& parent_txid : unique_parents) {
+            if (m_recent_rejects.contains(parent_txid)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            const auto current_time = GetTime<std::chrono::microseconds>();
+
+            m_connman.ForNode(nodeid, [&](CNode* pnode) EXCLUSIVE_LOCKS_REQUIRED(::cs_main) {
+                AssertLockHeld(::cs_main);
+                for (const uint256& parent_txid : unique_parents) {
+                    // Here, we only have the txid (and not wtxid) of the
+                    // inputs, so we only request in txid mode, even for
+                    // wtxidrelay peers.
+                    // Eventually we should replace this with an improved
+                    // protocol for getting all unconfirmed parents.
+                    const auto gtxid{GenTxid::Txid(parent_txid)};
+                    pnode->AddKnownTx(parent_txid);
+                    if (!AlreadyHaveTx(gtxid)) AddTxAnnouncement(*pnode, gtxid, current_time);
+                }
+                return true;
+            });
+
+            // Orphans of a peer that has gone are not kept, as nothing would
+            // erase them before they expire.
+            if (peer && m_orphanage.AddTx(ptx, nodeid)) {
+                AddToCompactExtraTransactions(ptx);
+            }
+
+            // Once added to the orphan pool, a tx is considered AlreadyHave, and we shouldn't request it anymore.
+            m_txrequest.ForgetTxHash(tx.GetHash());
+            m_txrequest.ForgetTxHash(tx.GetWitnessHash());
+
+            // DoS prevention: do not allow m_orphanage to grow unbounded (see CVE-2012-3789)
+            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetIntArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            unsigned int nEvicted = m_orphanage.LimitOrphans(nMaxOrphanTx);
+            if (nEvicted > 0) {
+                LogPrint(BCLog::MEMPOOL, "orphanage overflow, removed %u tx\n", nEvicted);
+            }
+        } else {
+            LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
+            // We will continue to reject this tx since it has rejected
+            // parents so avoid re-requesting it from other peers.
+            // Here we add both the txid and the wtxid, as we know that
+            // regardless of what witness is provided, we will not accept
+            // this, so we don't need to allow for redownload of this txid
+            // from any of our non-wtxidrelay peers.
+            m_recent_rejects.insert(tx.GetHash());
+            m_recent_rejects.insert(tx.GetWitnessHash());
+            m_txrequest.ForgetTxHash(tx.GetHash());
+            m_txrequest.ForgetTxHash(tx.GetWitnessHash());
+        }
+    } else {
+        if (state.GetResult() != TxValidationResult::TX_WITNESS_STRIPPED) {
+            // We can add the wtxid of this transaction to our reject filter.
+            // Do not add txids of witness transactions or witness-stripped
+            // transactions to the filter, as they can have been malleated;
+            // adding such txids to the reject filter would potentially
+            // interfere with relay of valid transactions from peers that
+            // do not support wtxid-based relay. See
+            // https://github.com/bitcoin/bitcoin/issues/8279 for details.
+            // We can remove this restriction (and always add wtxids to
+            // the filter even for witness stripped transactions) once
+            // wtxid-based relay is broadly deployed.
+            // See also comments in https://github.com/bitcoin/bitcoin/pull/18044#discussion_r443419034
+            // for concerns around weakening security of unupgraded nodes
+            // if we start doing this too early.
+            m_recent_rejects.insert(tx.GetWitnessHash());
+            m_txrequest.ForgetTxHash(tx.GetWitnessHash());
+            // If the transaction failed for TX_INPUTS_NOT_STANDARD,
+            // then we know that the witness was irrelevant to the policy
+            // failure, since this check depends only on the txid
+            // (the scriptPubKey being spent is covered by the txid).
+            // Add the txid to the reject filter to prevent repeated
+            // processing of this transaction in the event that child
+            // transactions are later received (resulting in
+            // parent-fetching by txid via the orphan-handling logic).
+            if (state.GetResult() == TxValidationResult::TX_INPUTS_NOT_STANDARD && tx.GetWitnessHash() != tx.GetHash()) {
+                m_recent_rejects.insert(tx.GetHash());
+                m_txrequest.ForgetTxHash(tx.GetHash());
+            }
+            if (RecursiveDynamicUsage(*ptx) < 100000) {
+                AddToCompactExtraTransactions(ptx);
+            }
+        }
+    }
+
+    // If a tx has been detected by m_recent_rejects, we will have reached
+    // this point and the tx will have been ignored. Because we haven't
+    // submitted the tx to our mempool, we won't have computed a DoS
+    // score for it or determined exactly why we consider it invalid.
+    //
+    // This means we won't penalize any peer subsequently relaying a DoSy
+    // tx (even if we penalized the first peer who gave it to us) because
+    // we have to account for m_recent_rejects showing false positives. In
+    // other words, we shouldn't penalize a peer if we aren't *sure* they
+    // submitted a DoSy tx.
+    //
+    // Note that m_recent_rejects doesn't just record DoSy or invalid
+    // transactions, but any tx not accepted by the mempool, which may be
+    // due to node policy (vs. consensus). So we can't blanket penalize a
+    // peer simply for relaying a tx that our m_recent_rejects has caught,
+    // regardless of false positives.
+
+    if (state.IsInvalid()) {
+        LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            nodeid,
+            state.ToString());
+        MaybePunishNodeForTx(nodeid, state);
+    }
+}
+
 bool PeerManagerImpl::PrepareBlockFilterRequest(CNode& peer,
                                                 BlockFilterType filter_type, uint32_t start_height,
                                                 const uint256& stop_hash, uint32_t max_height_diff,
@@ -3258,150 +3554,20 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
             return;
         }
 
-        const MempoolAcceptResult result = m_chainman.ProcessTransaction(ptx);
-        const TxValidationState& state = result.m_state;
-
-        if (result.m_result_type == MempoolAcceptResult::ResultType::VALID) {
-            // As this version of the transaction was acceptable, we can forget about any
-            // requests for it.
-            m_txrequest.ForgetTxHash(tx.GetHash());
-            m_txrequest.ForgetTxHash(tx.GetWitnessHash());
-            _RelayTransaction(tx.GetHash(), tx.GetWitnessHash());
-            m_orphanage.AddChildrenToWorkSet(tx, peer->m_orphan_work_set);
-
-            pfrom.nLastTXTime = GetTime();
-
-            LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom.GetId(),
-                tx.GetHash().ToString(),
-                m_mempool.size(), m_mempool.DynamicMemoryUsage() / 1000);
-
-            for (const CTransactionRef& removedTx : result.m_replaced_transactions.value()) {
-                AddToCompactExtraTransactions(removedTx);
-            }
-
-            // Recursively process any orphan transactions that depended on this one
-            ProcessOrphanTx(peer->m_orphan_work_set);
-        }
-        else if (state.GetResult() == TxValidationResult::TX_MISSING_INPUTS)
+        // With the transaction validation thread running, leave the rest to it
+        // and carry on with other peers' messages. ProcessMessages() holds
+        // back this peer's later messages until it is done.
         {
-            bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
-
-            // Deduplicate parent txids, so that we don't have to loop over
-            // the same parent txid more than once down below.
-            std::vector<uint256> unique_parents;
-            unique_parents.reserve(tx.vin.size());
-            for (const CTxIn& txin : tx.vin) {
-                // We start with all parents, and then remove duplicates below.
-                unique_parents.push_back(txin.prevout.hash);
-            }
-            std::sort(unique_parents.begin(), unique_parents.end());
-            unique_parents.erase(std::unique(unique_parents.begin(), unique_parents.end()), unique_parents.end());
-            for (const uint256& parent_txid : unique_parents) {
-                if (m_recent_rejects.contains(parent_txid)) {
-                    fRejectedParents = true;
-                    break;
-                }
-            }
-            if (!fRejectedParents) {
-                const auto current_time = GetTime<std::chrono::microseconds>();
-
-                for (const uint256& parent_txid : unique_parents) {
-                    // Here, we only have the txid (and not wtxid) of the
-                    // inputs, so we only request in txid mode, even for
-                    // wtxidrelay peers.
-                    // Eventually we should replace this with an improved
-                    // protocol for getting all unconfirmed parents.
-                    const auto gtxid{GenTxid::Txid(parent_txid)};
-                    pfrom.AddKnownTx(parent_txid);
-                    if (!AlreadyHaveTx(gtxid)) AddTxAnnouncement(pfrom, gtxid, current_time);
-                }
-
-                if (m_orphanage.AddTx(ptx, pfrom.GetId())) {
-                    AddToCompactExtraTransactions(ptx);
-                }
-
-                // Once added to the orphan pool, a tx is considered AlreadyHave, and we shouldn't request it anymore.
-                m_txrequest.ForgetTxHash(tx.GetHash());
-                m_txrequest.ForgetTxHash(tx.GetWitnessHash());
-
-                // DoS prevention: do not allow m_orphanage to grow unbounded (see CVE-2012-3789)
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetIntArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = m_orphanage.LimitOrphans(nMaxOrphanTx);
-                if (nEvicted > 0) {
-                    LogPrint(BCLog::MEMPOOL, "orphanage overflow, removed %u tx\n", nEvicted);
-                }
-            } else {
-                LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                // Here we add both the txid and the wtxid, as we know that
-                // regardless of what witness is provided, we will not accept
-                // this, so we don't need to allow for redownload of this txid
-                // from any of our non-wtxidrelay peers.
-                m_recent_rejects.insert(tx.GetHash());
-                m_recent_rejects.insert(tx.GetWitnessHash());
-                m_txrequest.ForgetTxHash(tx.GetHash());
-                m_txrequest.ForgetTxHash(tx.GetWitnessHash());
-            }
-        } else {
-            if (state.GetResult() != TxValidationResult::TX_WITNESS_STRIPPED) {
-                // We can add the wtxid of this transaction to our reject filter.
-                // Do not add txids of witness transactions or witness-stripped
-                // transactions to the filter, as they can have been malleated;
-                // adding such txids to the reject filter would potentially
-                // interfere with relay of valid transactions from peers that
-                // do not support wtxid-based relay. See
-                // https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                // We can remove this restriction (and always add wtxids to
-                // the filter even for witness stripped transactions) once
-                // wtxid-based relay is broadly deployed.
-                // See also comments in https://github.com/bitcoin/bitcoin/pull/18044#discussion_r443419034
-                // for concerns around weakening security of unupgraded nodes
-                // if we start doing this too early.
-                m_recent_rejects.insert(tx.GetWitnessHash());
-                m_txrequest.ForgetTxHash(tx.GetWitnessHash());
-                // If the transaction failed for TX_INPUTS_NOT_STANDARD,
-                // then we know that the witness was irrelevant to the policy
-                // failure, since this check depends only on the txid
-                // (the scriptPubKey being spent is covered by the txid).
-                // Add the txid to the reject filter to prevent repeated
-                // processing of this transaction in the event that child
-                // transactions are later received (resulting in
-                // parent-fetching by txid via the orphan-handling logic).
-                if (state.GetResult() == TxValidationResult::TX_INPUTS_NOT_STANDARD && tx.GetWitnessHash() != tx.GetHash()) {
-                    m_recent_rejects.insert(tx.GetHash());
-                    m_txrequest.ForgetTxHash(tx.GetHash());
-                }
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
-                }
+            LOCK(m_tx_validation_mutex);
+            if (m_tx_validation_running) {
+                // A copy of this transaction from another peer may be waiting
+                // already, in which case this one is dropped.
+                if (m_tx_validation_queue.Push(pfrom.GetId(), ptx)) m_tx_validation_cv.notify_one();
+                return;
             }
         }
 
-        // If a tx has been detected by m_recent_rejects, we will have reached
-        // this point and the tx will have been ignored. Because we haven't
-        // submitted the tx to our mempool, we won't have computed a DoS
-        // score for it or determined exactly why we consider it invalid.
-        //
-        // This means we won't penalize any peer subsequently relaying a DoSy
-        // tx (even if we penalized the first peer who gave it to us) because
-        // we have to account for m_recent_rejects showing false positives. In
-        // other words, we shouldn't penalize a peer if we aren't *sure* they
-        // submitted a DoSy tx.
-        //
-        // Note that m_recent_rejects doesn't just record DoSy or invalid
-        // transactions, but any tx not accepted by the mempool, which may be
-        // due to node policy (vs. consensus). So we can't blanket penalize a
-        // peer simply for relaying a tx that our m_recent_rejects has caught,
-        // regardless of false positives.
-
-        if (state.IsInvalid()) {
-            LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom.GetId(),
-                state.ToString());
-            MaybePunishNodeForTx(pfrom.GetId(), state);
-        }
+        ProcessTxFromPeer(pfrom.GetId(), ptx);
         return;
     }
 
@@ -3730,7 +3896,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         }
 
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-        vRecv >> *pblock;
+        vRecv >> ParallelTxHashing{*pblock};
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom.GetId());
 
@@ -4087,6 +4253,9 @@ bool PeerManagerImpl::ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt
     {
         LOCK(pfrom->cs_vProcessMsg);
         if (pfrom->vProcessMsg.empty()) return false;
+        // The transaction validation thread wakes us up once this peer's
+        // transactions are done.
+        if (WaitsForTxValidation(pfrom->GetId(), pfrom->vProcessMsg.front().m_command)) return false;
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
         pfrom->nProcessQueueSize -= msgs.front().m_raw_message_size;
@@ -4950,8 +5119,18 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
             LogPrint(BCLog::NET, "timeout of inflight %s %s from peer=%d\n", entry.second.IsWtxid() ? "wtx" : "tx",
                 entry.second.GetHash().ToString(), entry.first);
         }
+        // What is being validated already needs no request. A peer whose
+        // transactions back up in validation is asked later instead, which
+        // lets the tracker turn to another peer that announced it meanwhile.
+        const bool tx_validation_full{WITH_LOCK(m_tx_validation_mutex, return m_tx_validation_queue.IsFull(pto->GetId()))};
         for (const GenTxid& gtxid : requestable) {
-            if (!AlreadyHaveTx(gtxid)) {
+            if (WITH_LOCK(m_tx_validation_mutex, return m_tx_validation_queue.Contains(gtxid.GetHash()))) {
+                m_txrequest.ReceivedResponse(pto->GetId(), gtxid.GetHash());
+            } else if (!AlreadyHaveTx(gtxid)) {
+                if (tx_validation_full) {
+                    m_txrequest.DelayTx(pto->GetId(), gtxid.GetHash(), current_time + OVERLOADED_PEER_TX_DELAY);
+                    continue;
+                }
                 LogPrint(BCLog::NET, "Requesting %s %s peer=%d\n", gtxid.IsWtxid() ? "wtx" : "tx",
                     gtxid.GetHash().ToString(), pto->GetId());
                 vGetData.emplace_back(gtxid.IsWtxid() ? MSG_WTX : (MSG_TX | GetFetchFlags(*pto)), gtxid.GetHash());
@@ -60,6 +60,14 @@ public:
     /** Set the best height */
     virtual void SetBestHeight(int height) = 0;
 
+    /** Start validating transactions received from peers on a thread of their
+     *  own. Until then they are validated as they are received. */
+    virtual void StartTxValidation() = 0;
+
+    /** Stop the transaction validation thread, dropping the transactions it
+     *  has not got to yet. */
+    virtual void StopTxValidation() = 0;
+
     /**
      * Increment peer's misbehavior score. If the new value >= DISCOURAGEMENT_THRESHOLD, mark the node
      * to be discouraged, meaning the peer might be disconnected and added to the discouragement filter.
@@ -0,0 +1,74 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/blockfile_writer.h>
+
+#include <logging.h>
+#include <shutdown.h>
+#include <tinyformat.h>
+
+#include <cstdio>
+
+BlockFileWriter::BlockFileWriter()
+{
+    m_pool.Start(1);
+}
+
+BlockFileWriter::~BlockFileWriter()
+{
+    m_pool.Stop();
+}
+
+bool BlockFileWriter::WriteNow(FlatFileSeq& seq, const FlatFilePos& pos, const std::vector<unsigned char>& data)
+{
+    FILE* file = seq.Open(pos);
+    if (!file) return false;
+    const bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+void BlockFileWriter::Queue(const FlatFileSeq& seq, const FlatFilePos& pos, std::vector<unsigned char>&& data)
+{
+    WAIT_LOCK(m_mutex, lock);
+    // Always accept a write into an empty queue, however large.
+    m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_done_below == m_next_id || m_queued_bytes + data.size() <= MAX_QUEUED_BYTES; });
+    const uint64_t id{m_next_id++};
+    m_last_queued[seq.FileName(pos)] = id;
+    m_queued_bytes += data.size();
+    // Submitted under m_mutex so that writes reach the pool in id order. The
+    // pool runs until destruction, so the write is never run right here.
+    m_pool.Submit([this, seq = FlatFileSeq{seq}, pos, data = std::move(data), id]() mutable { Write(seq, pos, data, id); });
+}
+
+void BlockFileWriter::WaitForFile(const FlatFileSeq& seq, const FlatFilePos& pos)
+{
+    WAIT_LOCK(m_mutex, lock);
+    const auto it = m_last_queued.find(seq.FileName(pos));
+    if (it == m_last_queued.end()) return;
+    const uint64_t id{it->second};
+    m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_done_below > id; });
+}
+
+void BlockFileWriter::WaitForAll()
+{
+    WAIT_LOCK(m_mutex, lock);
+    const uint64_t id{m_next_id};
+    m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_done_below >= id; });
+}
+
+void BlockFileWriter::Write(FlatFileSeq& seq, const FlatFilePos& pos, const std::vector<unsigned char>& data, uint64_t id)
+{
+    if (!WriteNow(seq, pos, data)) {
+        AbortNode(strprintf("Failed to write %u bytes at %s to %s", data.size(), pos.ToString(), fs::PathToString(seq.FileName(pos))));
+    }
+
+    {
+        LOCK(m_mutex);
+        const auto it = m_last_queued.find(seq.FileName(pos));
+        if (it != m_last_queued.end() && it->second == id) m_last_queued.erase(it);
+        m_done_below = id + 1;
+        m_queued_bytes -= data.size();
+    }
+    m_cv.notify_all();
+}
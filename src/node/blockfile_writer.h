@@ -0,0 +1,65 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BGL_NODE_BLOCKFILE_WRITER_H
+#define BGL_NODE_BLOCKFILE_WRITER_H
+
+#include <flatfile.h>
+#include <fs.h>
+#include <sync.h>
+#include <util/threadpool.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/**
+ * Background thread writing serialized block and undo data to their flat
+ * files, so that accepting and connecting blocks does not wait on the disk.
+ *
+ * Writes land in the order they were queued. Anything reading, flushing or
+ * truncating a file must first wait for the writes queued for it, and
+ * anything recording the position of queued data in a database must first
+ * wait for all writes.
+ */
+class BlockFileWriter
+{
+private:
+    Mutex m_mutex;
+    std::condition_variable m_cv;
+    size_t m_queued_bytes GUARDED_BY(m_mutex){0};
+    //! Sequence number of the last write queued for each file.
+    std::map<fs::path, uint64_t> m_last_queued GUARDED_BY(m_mutex);
+    uint64_t m_next_id GUARDED_BY(m_mutex){1};
+    //! Every write with a lower sequence number has landed.
+    uint64_t m_done_below GUARDED_BY(m_mutex){1};
+
+    //! A single thread, so that writes land in the order they were queued.
+    ThreadPool m_pool{"blockwrite"};
+
+    void Write(FlatFileSeq& seq, const FlatFilePos& pos, const std::vector<unsigned char>& data, uint64_t id) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+
+public:
+    //! Queued bytes beyond which queueing more waits for the writes to catch up.
+    static constexpr size_t MAX_QUEUED_BYTES{64 << 20};
+
+    BlockFileWriter();
+    /** Finish all queued writes and stop the thread. */
+    ~BlockFileWriter();
+
+    /** Write data at pos in its file now, returning whether it succeeded. */
+    static bool WriteNow(FlatFileSeq& seq, const FlatFilePos& pos, const std::vector<unsigned char>& data);
+
+    /** Queue data to be written at pos in its file. */
+    void Queue(const FlatFileSeq& seq, const FlatFilePos& pos, std::vector<unsigned char>&& data) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+
+    /** Wait until the writes queued so far for the file at pos have landed. */
+    void WaitForFile(const FlatFileSeq& seq, const FlatFilePos& pos) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+
+    /** Wait until all writes queued so far have landed. */
+    void WaitForAll() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+};
+
+#endif // BGL_NODE_BLOCKFILE_WRITER_H
@@ -11,6 +11,7 @@
 #include <flatfile.h>
 #include <fs.h>
 #include <hash.h>
+#include <node/blockfile_writer.h>
 #include <pow.h>
 #include <shutdown.h>
 #include <signet.h>
@@ -20,6 +21,8 @@
 #include <util/system.h>
 #include <validation.h>
 
+#include <memory>
+
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
@@ -41,6 +44,9 @@ std::set<CBlockIndex*> setDirtyBlockIndex;
 
 /** Dirty block file entries. */
 std::set<int> setDirtyFileInfo;
+
+/** Writes block and undo data in the background while running. */
+static std::unique_ptr<BlockFileWriter> g_block_file_writer;
 // } // namespace
 
 static FILE* OpenUndoFile(const FlatFilePos& pos, bool fReadOnly = false);
@@ -107,32 +113,55 @@ CBlockFileInfo* GetBlockFileInfo(size_t n)
     return &vinfoBlockFile.at(n);
 }
 
-static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+void StartBlockFileWriter()
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull()) {
-        return error("%s: OpenUndoFile failed", __func__);
-    }
+    assert(!g_block_file_writer);
+    g_block_file_writer = std::make_unique<BlockFileWriter>();
+}
 
-    // Write index header
-    unsigned int nSize = GetSerializeSize(blockundo, fileout.GetVersion());
-    fileout << messageStart << nSize;
+void StopBlockFileWriter()
+{
+    g_block_file_writer.reset();
+}
 
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0) {
-        return error("%s: ftell failed", __func__);
+/**
+ * Write data at pos in a file of seq, through the block file writer if it is
+ * running. Otherwise the write is done right away, and may fail.
+ */
+static bool WriteToFile(FlatFileSeq seq, const FlatFilePos& pos, std::vector<unsigned char>&& data)
+{
+    if (g_block_file_writer) {
+        g_block_file_writer->Queue(seq, pos, std::move(data));
+        return true;
     }
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    return BlockFileWriter::WriteNow(seq, pos, data);
+}
+
+/** Wait for the data queued for the file at pos to be written, if any. */
+static void WaitForWrites(const FlatFileSeq& seq, const FlatFilePos& pos)
+{
+    if (g_block_file_writer) g_block_file_writer->WaitForFile(seq, pos);
+}
+
+static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Serialize index header, undo data and checksum
+    std::vector<unsigned char> data;
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, data, 0);
+    unsigned int nSize = GetSerializeSize(blockundo, writer.GetVersion());
+    writer << messageStart << nSize << blockundo;
 
     // calculate & write checksum
     CHashWriterKeccak hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
-    hasher << blockundo;
-    fileout << hasher.GetHash();
+    hasher.write((const char*)data.data() + 8, nSize);
+    writer << hasher.GetHash();
 
+    if (!WriteToFile(UndoFileSeq(), pos, std::move(data))) {
+        return error("%s: failed to write to %s", __func__, pos.ToString());
+    }
+    // The undo data follows the index header
+    pos.nPos += 8;
     return true;
 }
 
@@ -143,34 +172,58 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
         return error("%s: no undo data available", __func__);
     }
 
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (pos.nPos < sizeof(uint32_t)) {
+        return error("%s: invalid undo data position %s", __func__, pos.ToString());
+    }
+
+    // Open history file to read, at the size field of the index header
+    CAutoFile filein(OpenUndoFile(FlatFilePos(pos.nFile, pos.nPos - sizeof(uint32_t)), true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull()) {
         return error("%s: OpenUndoFile failed", __func__);
     }
 
-    // Read block
-    uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    // Read the undo data and its checksum with a single read, rather than
+    // through a CHashVerifier issuing one small read per field.
+    unsigned int undo_size;
+    std::vector<unsigned char> undo_data;
     try {
-        verifier << pindex->pprev->GetBlockHash();
-        verifier >> blockundo;
-        filein >> hashChecksum;
+        filein >> undo_size;
+        if (undo_size > MAX_SIZE) {
+            return error("%s: undo data size %u too large", __func__, undo_size);
+        }
+        undo_data.resize(undo_size + uint256::size());
+        filein.read((char*)undo_data.data(), undo_data.size());
     } catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        return error("%s: I/O error - %s", __func__, e.what());
     }
 
-    // Verify checksum
-    if (hashChecksum != verifier.GetHash()) {
+    // Verify checksum, hashing the undo data in one go
+    CHashWriterKeccak hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << pindex->pprev->GetBlockHash();
+    hasher.write((const char*)undo_data.data(), undo_size);
+    const uint256 checksum{hasher.GetHash()};
+    if (memcmp(checksum.begin(), undo_data.data() + undo_size, uint256::size()) != 0) {
         return error("%s: Checksum mismatch", __func__);
     }
 
+    // Read block undo, which must account for exactly the checksummed bytes
+    try {
+        VectorReader reader(SER_DISK, CLIENT_VERSION, undo_data, 0);
+        reader >> blockundo;
+        if (reader.size() != uint256::size()) {
+            return error("%s: undo data size mismatch", __func__);
+        }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s", __func__, e.what());
+    }
+
     return true;
 }
 
 static void FlushUndoFile(int block_file, bool finalize = false)
 {
     FlatFilePos undo_pos_old(block_file, vinfoBlockFile[block_file].nUndoSize);
+    WaitForWrites(UndoFileSeq(), undo_pos_old);
     if (!UndoFileSeq().Flush(undo_pos_old, finalize)) {
         AbortNode("Flushing undo file to disk failed. This is likely the result of an I/O error.");
     }
@@ -179,6 +232,9 @@ static void FlushUndoFile(int block_file, bool finalize = false)
 void FlushBlockFile(bool fFinalize = false, bool finalize_undo = false)
 {
     LOCK(cs_LastBlockFile);
+    // Whatever is flushed next may refer to any data queued so far, such as
+    // undo data queued for an earlier file.
+    if (g_block_file_writer) g_block_file_writer->WaitForAll();
     FlatFilePos block_pos_old(nLastBlockFile, vinfoBlockFile[nLastBlockFile].nSize);
     if (!BlockFileSeq().Flush(block_pos_old, fFinalize)) {
         AbortNode("Flushing block file to disk failed. This is likely the result of an I/O error.");
@@ -221,12 +277,14 @@ static FlatFileSeq UndoFileSeq()
 
 FILE* OpenBlockFile(const FlatFilePos& pos, bool fReadOnly)
 {
+    WaitForWrites(BlockFileSeq(), pos);
     return BlockFileSeq().Open(pos, fReadOnly);
 }
 
 /** Open an undo file (rev?????.dat) */
 static FILE* OpenUndoFile(const FlatFilePos& pos, bool fReadOnly)
 {
+    WaitForWrites(UndoFileSeq(), pos);
     return UndoFileSeq().Open(pos, fReadOnly);
 }
 
@@ -314,24 +372,17 @@ static bool FindUndoPos(BlockValidationState& state, int nFile, FlatFilePos& pos
 
 static bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull()) {
-        return error("WriteBlockToDisk: OpenBlockFile failed");
-    }
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(block, fileout.GetVersion());
-    fileout << messageStart << nSize;
+    // Serialize index header and block
+    std::vector<unsigned char> data;
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, data, 0);
+    unsigned int nSize = GetSerializeSize(block, writer.GetVersion());
+    writer << messageStart << nSize << block;
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0) {
-        return error("WriteBlockToDisk: ftell failed");
+    if (!WriteToFile(BlockFileSeq(), pos, std::move(data))) {
+        return error("WriteBlockToDisk: failed to write to %s", pos.ToString());
     }
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
-
+    // The block follows the index header
+    pos.nPos += 8;
     return true;
 }
 
@@ -50,7 +50,15 @@ bool IsBlockPruned(const CBlockIndex* pblockindex);
 
 void CleanupBlockRevFiles();
 
-/** Open a block file (blk?????.dat) */
+/**
+ * Start writing block and undo data in a background thread. Until then, and
+ * after StopBlockFileWriter(), it is written right away.
+ */
+void StartBlockFileWriter();
+/** Finish the queued block and undo writes and stop the background thread. */
+void StopBlockFileWriter();
+
+/** Open a block file (blk?????.dat), once the data queued for it is written */
 FILE* OpenBlockFile(const FlatFilePos& pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 fs::path GetBlockPosFilename(const FlatFilePos& pos);
@@ -0,0 +1,127 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/coins_prefetch.h>
+
+#include <node/blockstorage.h>
+#include <primitives/block.h>
+
+#include <exception>
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView* view, const CCoinsView& db) : CCoinsViewBacked(view), m_db(db) {}
+
+CCoinsViewPrefetch::~CCoinsViewPrefetch()
+{
+    ++m_epoch;
+    m_pool.Stop();
+}
+
+void CCoinsViewPrefetch::Prefetch(const FlatFilePos& pos, const Consensus::Params& consensus_params)
+{
+    {
+        LOCK(m_mutex);
+        if (pos == m_last_queued || m_pending >= MAX_QUEUED_BLOCKS) return;
+        m_last_queued = pos;
+        ++m_pending;
+        if (m_pool.WorkerCount() == 0) m_pool.Start(1);
+    }
+    m_pool.Submit([this, pos, &consensus_params, epoch = m_epoch.load()] { PrefetchBlock(pos, consensus_params, epoch); });
+}
+
+void CCoinsViewPrefetch::Reset()
+{
+    WAIT_LOCK(m_mutex, lock);
+    m_last_queued.SetNull();
+    ++m_epoch;
+    m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_pending == 0; });
+    ++m_generation;
+    for (auto& coins : m_coins) coins.clear();
+}
+
+void CCoinsViewPrefetch::WaitForPrefetch()
+{
+    WAIT_LOCK(m_mutex, lock);
+    m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_pending == 0; });
+}
+
+void CCoinsViewPrefetch::Invalidate()
+{
+    LOCK(m_mutex);
+    ++m_generation;
+    for (auto& coins : m_coins) coins.clear();
+}
+
+void CCoinsViewPrefetch::PrefetchBlock(const FlatFilePos& pos, const Consensus::Params& consensus_params, uint64_t epoch)
+{
+    bool skip{epoch != m_epoch};
+    if (!skip) {
+        LOCK(m_mutex);
+        // Keep the coins of the block before this one around until it is
+        // connected, and forget any older ones.
+        m_current ^= 1;
+        m_coins[m_current].clear();
+    }
+
+    CBlock block;
+    if (!skip && ReadBlockFromDisk(block, pos, consensus_params)) {
+        try {
+            for (const auto& tx : block.vtx) {
+                if (epoch != m_epoch) break;
+                if (tx->IsCoinBase()) continue;
+                for (const CTxIn& txin : tx->vin) {
+                    if (epoch != m_epoch) break;
+                    const uint64_t generation{m_generation};
+                    Coin coin;
+                    if (!m_db.GetCoin(txin.prevout, coin)) continue;
+                    LOCK(m_mutex);
+                    if (generation == m_generation) m_coins[m_current].emplace(txin.prevout, std::move(coin));
+                }
+            }
+        } catch (const std::exception&) {
+            // Whatever is left is looked up through the base view, which
+            // reports the error.
+        }
+    }
+
+    LOCK(m_mutex);
+    --m_pending;
+    m_cv.notify_all();
+}
+
+bool CCoinsViewPrefetch::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        LOCK(m_mutex);
+        for (auto& coins : m_coins) {
+            auto it = coins.find(outpoint);
+            if (it != coins.end()) {
+                coin = std::move(it->second);
+                coins.erase(it);
+                return true;
+            }
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewPrefetch::HaveCoin(const COutPoint& outpoint) const
+{
+    {
+        LOCK(m_mutex);
+        for (const auto& coins : m_coins) {
+            if (coins.count(outpoint)) return true;
+        }
+    }
+    return base->HaveCoin(outpoint);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase)
+{
+    // Coins read from the database while it is being written may be stale
+    // either way, so drop them both before and after the write.
+    Invalidate();
+    const bool ret{base->BatchWrite(mapCoins, hashBlock, erase)};
+    Invalidate();
+    return ret;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BGL_NODE_COINS_PREFETCH_H
+#define BGL_NODE_COINS_PREFETCH_H
+
+#include <coins.h>
+#include <flatfile.h>
+#include <primitives/transaction.h>
+#include <sync.h>
+#include <util/hasher.h>
+#include <util/threadpool.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <unordered_map>
+
+namespace Consensus {
+struct Params;
+}
+
+/**
+ * Coins view layer serving coins that a background thread looked up ahead of
+ * time, so that the database reads for the inputs of the next block overlap
+ * with the validation of the current one.
+ *
+ * The background thread reads blocks and coins directly from disk without
+ * taking cs_main. It only keeps coins that exist in the database, and all of
+ * them are dropped whenever coins are written through this view. A coin
+ * served from here therefore always matches the database underneath. A
+ * lookup that fails in the background is only a miss: the same lookup made
+ * through the base view then reports the error.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    using PrefetchedCoins = std::unordered_map<COutPoint, Coin, SaltedOutpointHasher>;
+
+    //! Database the background thread reads coins from.
+    const CCoinsView& m_db;
+
+    mutable Mutex m_mutex;
+    std::condition_variable m_cv;
+    //! Coins of the block prefetched last, at m_current, and of the one
+    //! before it. Each coin is handed out at most once.
+    mutable PrefetchedCoins m_coins[2] GUARDED_BY(m_mutex);
+    size_t m_current GUARDED_BY(m_mutex){0};
+    FlatFilePos m_last_queued GUARDED_BY(m_mutex);
+    //! Blocks queued or being prefetched.
+    size_t m_pending GUARDED_BY(m_mutex){0};
+
+    //! Bumped whenever the coins in the database may change. Coins read under
+    //! an older generation are discarded.
+    std::atomic<uint64_t> m_generation{0};
+    //! Bumped by Reset(). Blocks queued under an older one are skipped.
+    std::atomic<uint64_t> m_epoch{0};
+
+    ThreadPool m_pool{"coinsprefetch"};
+
+    void Invalidate();
+    void PrefetchBlock(const FlatFilePos& pos, const Consensus::Params& consensus_params, uint64_t epoch);
+
+public:
+    //! Maximum number of blocks waiting to be prefetched.
+    static constexpr size_t MAX_QUEUED_BLOCKS{4};
+
+    CCoinsViewPrefetch(CCoinsView* view, const CCoinsView& db);
+    ~CCoinsViewPrefetch();
+
+    /** Queue the inputs of the block stored at pos for prefetching. */
+    void Prefetch(const FlatFilePos& pos, const Consensus::Params& consensus_params);
+
+    /** Drop all queued work and prefetched coins, waiting for the block being prefetched. */
+    void Reset();
+
+    /** Wait until all queued blocks have been prefetched. */
+    void WaitForPrefetch();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase = true) override;
+};
+
+#endif // BGL_NODE_COINS_PREFETCH_H
@@ -12,9 +12,14 @@
 #include <serialize.h>
 #include <uint256.h>
 #include <util/system.h>
+#include <util/threadpool.h>
 #include <validation.h>
 
+#include <algorithm>
+#include <deque>
+#include <future>
 #include <map>
+#include <memory>
 
 // Database-independent metric indicating the UTXO set size
 uint64_t GetBogoSize(const CScript& script_pub_key)
@@ -67,12 +72,115 @@ static void ApplyHash(CHashWriterKeccak& ss, const uint256& hash, const std::map
 
 static void ApplyHash(std::nullptr_t, const uint256& hash, const std::map<uint32_t, Coin>& outputs) {}
 
-static void ApplyHash(MuHash3072& muhash, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+SerializedUTXOHasher::SerializedUTXOHasher(const uint256& best_block)
 {
-    for (auto it = outputs.begin(); it != outputs.end(); ++it) {
-        COutPoint outpoint = COutPoint(hash, it->first);
-        Coin coin = it->second;
-        muhash.Insert(MakeUCharSpan(TxOutSer(outpoint, coin)));
+    m_ss << best_block;
+}
+
+bool SerializedUTXOHasher::Add(const COutPoint& outpoint, const Coin& coin)
+{
+    if (!m_ordered) return false;
+    if (!m_outputs.empty() && outpoint.hash != m_txid) {
+        if (outpoint.hash < m_txid) return m_ordered = false;
+        ApplyHash(m_ss, m_txid, m_outputs);
+        m_outputs.clear();
+    }
+    m_txid = outpoint.hash;
+    return m_ordered = m_outputs.emplace(outpoint.n, coin).second;
+}
+
+uint256 SerializedUTXOHasher::Finalize()
+{
+    if (!m_outputs.empty()) {
+        ApplyHash(m_ss, m_txid, m_outputs);
+        m_outputs.clear();
+    }
+    return m_ss.GetHash();
+}
+
+/**
+ * MuHash3072 accumulator that hashes batches of UTXO set entries on the block
+ * work pool. Since the MuHash group operation is commutative, each batch gets
+ * a running product of its own, which is multiplied into the total once the
+ * batch is done.
+ */
+class ParallelMuHash
+{
+private:
+    //! Number of entries hashed by one task
+    static constexpr size_t BATCH_SIZE{512};
+    using Batch = std::vector<std::pair<COutPoint, Coin>>;
+
+    struct Task {
+        Batch batch;
+        MuHash3072 muhash;
+        std::future<void> done;
+    };
+
+    ThreadPool& m_pool;
+    //! Tasks in submission order, at most m_max_pending of them
+    std::deque<std::unique_ptr<Task>> m_pending;
+    const size_t m_max_pending;
+    MuHash3072 m_muhash;
+    Batch m_batch;
+
+    void Collect()
+    {
+        Task& task{*m_pending.front()};
+        task.done.get();
+        m_muhash *= task.muhash;
+        m_pending.pop_front();
+    }
+
+    void Flush()
+    {
+        if (m_batch.empty()) return;
+        auto task{std::make_unique<Task>()};
+        task->batch = std::move(m_batch);
+        Task& submitted{*task};
+        submitted.done = m_pool.Submit([&submitted] {
+            for (const auto& [outpoint, coin] : submitted.batch) {
+                submitted.muhash.Insert(MakeUCharSpan(TxOutSer(outpoint, coin)));
+            }
+        });
+        m_pending.push_back(std::move(task));
+        // Bound the memory held by batches waiting to be hashed.
+        while (m_pending.size() > m_max_pending) Collect();
+        m_batch.clear();
+        m_batch.reserve(BATCH_SIZE);
+    }
+
+public:
+    explicit ParallelMuHash(ThreadPool& pool)
+        : m_pool{pool}, m_max_pending{2 * std::max<size_t>(pool.WorkerCount(), 1)}
+    {
+        m_batch.reserve(BATCH_SIZE);
+    }
+
+    ~ParallelMuHash()
+    {
+        // Tasks refer to their entry in m_pending.
+        for (const auto& task : m_pending) task->done.wait();
+    }
+
+    void Insert(const COutPoint& outpoint, const Coin& coin)
+    {
+        m_batch.emplace_back(outpoint, coin);
+        if (m_batch.size() >= BATCH_SIZE) Flush();
+    }
+
+    void Finalize(uint256& out)
+    {
+        Flush();
+        while (!m_pending.empty()) Collect();
+        m_muhash.Finalize(out);
+    }
+};
+
+static void ApplyHash(ParallelMuHash& muhash, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    for (const auto& [n, coin] : outputs) {
+        muhash.Insert(COutPoint(hash, n), coin);
     }
 }
 
@@ -89,7 +197,7 @@ static void ApplyStats(CCoinsStats& stats, const uint256& hash, const std::map<u
 
 //! Calculate statistics about the unspent transaction output set
 template <typename T>
-static bool GetUTXOStats(CCoinsView* view, BlockManager& blockman, CCoinsStats& stats, T hash_obj, const std::function<void()>& interruption_point, const CBlockIndex* pindex)
+static bool GetUTXOStats(CCoinsView* view, BlockManager& blockman, CCoinsStats& stats, T&& hash_obj, const std::function<void()>& interruption_point, const CBlockIndex* pindex)
 {
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
     assert(pcursor);
@@ -150,7 +258,7 @@ bool GetUTXOStats(CCoinsView* view, BlockManager& blockman, CCoinsStats& stats,
         return GetUTXOStats(view, blockman, stats, ss, interruption_point, pindex);
     }
     case(CoinStatsHashType::MUHASH): {
-        MuHash3072 muhash;
+        ParallelMuHash muhash{BlockWorkPool()};
         return GetUTXOStats(view, blockman, stats, muhash, interruption_point, pindex);
     }
     case(CoinStatsHashType::NONE): {
@@ -166,14 +274,14 @@ static void PrepareHash(CHashWriterKeccak& ss, const CCoinsStats& stats)
     ss << stats.hashBlock;
 }
 // MuHash does not need the prepare step
-static void PrepareHash(MuHash3072& muhash, CCoinsStats& stats) {}
+static void PrepareHash(ParallelMuHash& muhash, CCoinsStats& stats) {}
 static void PrepareHash(std::nullptr_t, CCoinsStats& stats) {}
 
 static void FinalizeHash(CHashWriterKeccak& ss, CCoinsStats& stats)
 {
     stats.hashSerialized = ss.GetHash();
 }
-static void FinalizeHash(MuHash3072& muhash, CCoinsStats& stats)
+static void FinalizeHash(ParallelMuHash& muhash, CCoinsStats& stats)
 {
     uint256 out;
     muhash.Finalize(out);
@@ -9,11 +9,13 @@
 #include <chain.h>
 #include <coins.h>
 #include <consensus/amount.h>
+#include <hash.h>
 #include <streams.h>
 #include <uint256.h>
 
 #include <cstdint>
 #include <functional>
+#include <map>
 
 class BlockManager;
 class CCoinsView;
@@ -71,6 +73,33 @@ struct CCoinsStats
 //! Calculate statistics about the unspent transaction output set
 bool GetUTXOStats(CCoinsView* view, BlockManager& blockman, CCoinsStats& stats, const std::function<void()>& interruption_point = {}, const CBlockIndex* pindex = nullptr);
 
+/**
+ * Computes the HASH_SERIALIZED hash of a UTXO set from its coins as they are
+ * listed by a coins database cursor or a UTXO snapshot: grouped by txid, in
+ * ascending txid order. Gives the same hash as GetUTXOStats on a database at
+ * best_block holding exactly those coins.
+ */
+class SerializedUTXOHasher
+{
+private:
+    CHashWriterKeccak m_ss{SER_GETHASH, PROTOCOL_VERSION};
+    uint256 m_txid;
+    //! Unspent outputs of m_txid seen so far.
+    std::map<uint32_t, Coin> m_outputs;
+    bool m_ordered{true};
+
+public:
+    explicit SerializedUTXOHasher(const uint256& best_block);
+
+    /** Add the next coin. Returns false once a coin arrived out of order or repeated an outpoint. */
+    bool Add(const COutPoint& outpoint, const Coin& coin);
+
+    /** Whether all coins so far were in order and unique; the hash is meaningless otherwise. */
+    bool Ordered() const { return m_ordered; }
+
+    uint256 Finalize();
+};
+
 uint64_t GetBogoSize(const CScript& script_pub_key);
 
 CDataStream TxOutSer(const COutPoint& outpoint, const Coin& coin);
@@ -13,6 +13,7 @@
 class ArgsManager;
 class BanMan;
 class AddrMan;
+class BlockTemplateMaintainer;
 class CBlockPolicyEstimator;
 class CConnman;
 class CScheduler;
@@ -46,6 +47,7 @@ struct NodeContext {
     std::unique_ptr<PeerManager> peerman;
     std::unique_ptr<ChainstateManager> chainman;
     std::unique_ptr<BanMan> banman;
+    std::unique_ptr<BlockTemplateMaintainer> block_template;
     ArgsManager* args{nullptr}; // Currently a raw pointer because the memory is not managed by this struct
     std::unique_ptr<interfaces::Chain> chain;
     //! List of all chain clients (wallet processes or other client) connected to node.
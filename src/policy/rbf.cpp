@@ -122,10 +122,12 @@ std::optional<std::string> EntriesAndTxidsDisjoint(const CTxMemPool::setEntries&
     return std::nullopt;
 }
 
-std::optional<std::string> PaysMoreThanConflicts(const CTxMemPool::setEntries& iters_conflicting,
+std::optional<std::string> PaysMoreThanConflicts(const CTxMemPool& pool,
+                                                 const CTxMemPool::setEntries& iters_conflicting,
                                                  CFeeRate replacement_feerate,
                                                  const uint256& txid)
 {
+    AssertLockHeld(pool.cs);
     for (const auto& mi : iters_conflicting) {
         // Don't allow the replacement to reduce the feerate of the
         // mempool.
@@ -140,8 +142,10 @@ std::optional<std::string> PaysMoreThanConflicts(const CTxMemPool::setEntries& i
         // replaced, not their indirect descendants. While that does
         // mean high feerate children are ignored when deciding whether
         // or not to replace, we do require the replacement to pay more
-        // overall fees too, mitigating most cases.
-        CFeeRate original_feerate(mi->GetModifiedFee(), mi->GetTxSize());
+        // overall fees too, mitigating most cases. When the mempool
+        // tracks clusters, the feerate of the chunk a transaction is
+        // mined in accounts for such children.
+        CFeeRate original_feerate = pool.GetMiningFeeRate(mi);
         if (replacement_feerate <= original_feerate)
         {
             return strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
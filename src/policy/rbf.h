@@ -75,13 +75,15 @@ std::optional<std::string> EntriesAndTxidsDisjoint(const CTxMemPool::setEntries&
                                                    const std::set<uint256>& direct_conflicts,
                                                    const uint256& txid);
 
-/** Check that the feerate of the replacement transaction(s) is higher than the feerate of each
- * of the transactions in iters_conflicting.
+/** Check that the feerate of the replacement transaction(s) is higher than the feerate each
+ * of the transactions in iters_conflicting is mined at (see CTxMemPool::GetMiningFeeRate).
+ * @param[in]   pool               The mempool of the conflicts.
  * @param[in]   iters_conflicting  The set of mempool entries.
  * @returns error message if fees insufficient, otherwise std::nullopt.
  */
-std::optional<std::string> PaysMoreThanConflicts(const CTxMemPool::setEntries& iters_conflicting,
-                                                 CFeeRate replacement_feerate, const uint256& txid);
+std::optional<std::string> PaysMoreThanConflicts(const CTxMemPool& pool,
+                                                 const CTxMemPool::setEntries& iters_conflicting,
+                                                 CFeeRate replacement_feerate, const uint256& txid) EXCLUSIVE_LOCKS_REQUIRED(pool.cs);
 
 /** Enforce BIP125 Rule #3 "The replacement transaction pays an absolute fee of at least the sum
  * paid by the original transactions." Enforce BIP125 Rule #4 "The replacement transaction must also
@@ -5,7 +5,9 @@
 
 #include <primitives/block.h>
 
+#include <crypto/sha3.h>
 #include <hash.h>
+#include <streams.h>
 #include <tinyformat.h>
 
 uint256 CBlockHeader::GetHash() const
@@ -13,6 +15,27 @@ uint256 CBlockHeader::GetHash() const
     return SerializeHashKeccak(*this);
 }
 
+std::vector<uint256> GetBlockHeaderHashes(Span<const CBlockHeader> headers)
+{
+    static constexpr size_t HEADER_SIZE = 80;
+    std::vector<unsigned char> data;
+    data.reserve(headers.size() * HEADER_SIZE);
+    CVectorWriter writer(SER_GETHASH, PROTOCOL_VERSION, data, 0);
+    for (const CBlockHeader& header : headers) {
+        writer << header;
+    }
+    assert(data.size() == headers.size() * HEADER_SIZE);
+
+    std::vector<unsigned char> out(headers.size() * Keccak256::OUTPUT_SIZE);
+    Keccak256Batch(out.data(), data.data(), HEADER_SIZE, headers.size());
+
+    std::vector<uint256> hashes(headers.size());
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        std::copy(out.begin() + i * Keccak256::OUTPUT_SIZE, out.begin() + (i + 1) * Keccak256::OUTPUT_SIZE, hashes[i].begin());
+    }
+    return hashes;
+}
+
 std::string CBlockHeader::ToString() const
 {
     std::stringstream s;
@@ -8,6 +8,7 @@
 
 #include <primitives/transaction.h>
 #include <serialize.h>
+#include <span.h>
 #include <uint256.h>
 
 /** Nodes collect new transactions into a block, hash them into a hash tree,
@@ -60,6 +61,10 @@ public:
     std::string ToString() const;
 };
 
+/** Compute the hashes of many block headers at once, using the multi-way Keccak-256
+ *  implementations when available. Equivalent to calling GetHash() on each header. */
+std::vector<uint256> GetBlockHeaderHashes(Span<const CBlockHeader> headers);
+
 
 class CBlock : public CBlockHeader
 {
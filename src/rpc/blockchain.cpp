@@ -2649,6 +2649,74 @@ UniValue CreateUTXOSnapshot(NodeContext& node, CChainState& chainstate, CAutoFil
     return result;
 }
 
+static RPCHelpMan loadtxoutset()
+{
+    return RPCHelpMan{
+        "loadtxoutset",
+        "\nLoad a serialized UTXO set written by dumptxoutset into a second chainstate, which becomes\n"
+        "the active one and syncs to the network's tip. The snapshot must be based on a block with\n"
+        "assumeutxo data for this chain, and its header must already be known. Its contents are\n"
+        "checked against the expected hash before the chainstate is used.\n"
+        "The snapshot chainstate is not yet loaded again after a restart.\n",
+        {
+            {"path",
+                RPCArg::Type::STR,
+                RPCArg::Optional::NO,
+                /* default_val */ "",
+                "path to the snapshot file. If relative, will be prefixed by datadir."},
+        },
+        RPCResult{
+            RPCResult::Type::OBJ, "", "",
+                {
+                    {RPCResult::Type::NUM, "coins_loaded", "the number of coins loaded from the snapshot"},
+                    {RPCResult::Type::STR_HEX, "base_hash", "the hash of the base of the snapshot"},
+                    {RPCResult::Type::NUM, "base_height", "the height of the base of the snapshot"},
+                    {RPCResult::Type::STR, "path", "the absolute path that the snapshot was loaded from"},
+                }
+        },
+        RPCExamples{
+            HelpExampleCli("loadtxoutset", "utxo.dat")
+        },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    ChainstateManager& chainman = EnsureAnyChainman(request.context);
+    const fs::path path = fsbridge::AbsPathJoin(gArgs.GetDataDirNet(), fs::u8path(request.params[0].get_str()));
+
+    FILE* file{fsbridge::fopen(path, "rb")};
+    CAutoFile afile{file, SER_DISK, CLIENT_VERSION};
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open file " + path.u8string() + " for reading");
+    }
+
+    SnapshotMetadata metadata;
+    try {
+        afile >> metadata;
+    } catch (const std::ios_base::failure&) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Unable to read snapshot metadata from " + path.u8string());
+    }
+
+    const CBlockIndex* base{WITH_LOCK(::cs_main, return chainman.m_blockman.LookupBlockIndex(metadata.m_base_blockhash))};
+    if (!base) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Snapshot base block " + metadata.m_base_blockhash.ToString() + " is not in the headers chain");
+    }
+    if (!ExpectedAssumeutxo(base->nHeight, Params())) {
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("No assumeutxo data for snapshot base height %d", base->nHeight));
+    }
+
+    if (!chainman.ActivateSnapshot(afile, metadata, /* in_memory */ false)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to load UTXO snapshot " + path.u8string() + ", see debug.log for details");
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("coins_loaded", metadata.m_coins_count);
+    result.pushKV("base_hash", base->GetBlockHash().ToString());
+    result.pushKV("base_height", base->nHeight);
+    result.pushKV("path", path.u8string());
+    return result;
+},
+    };
+}
+
 void RegisterBlockchainRPCCommands(CRPCTable &t)
 {
 // clang-format off
@@ -2688,6 +2756,7 @@ static const CRPCCommand commands[] =
     { "hidden",              &waitforblockheight,                },
     { "hidden",              &syncwithvalidationinterfacequeue,  },
     { "hidden",              &dumptxoutset,                      },
+    { "hidden",              &loadtxoutset,                      },
 };
 // clang-format on
     for (const auto& c : commands) {
@@ -38,6 +38,7 @@
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <chrono>
 #include <memory>
 #include <stdint.h>
 
@@ -109,7 +110,21 @@ static RPCHelpMan getnetworkhashps()
     };
 }
 
-static bool GenerateBlock(ChainstateManager& chainman, CBlock& block, uint64_t& max_tries, unsigned int& extra_nonce, uint256& block_hash)
+/** Number of threads to grind nonces with, from -genproclimit. */
+static int GetGenerateThreads()
+{
+    const int threads = gArgs.GetIntArg("-genproclimit", DEFAULT_GENERATE_THREADS);
+    return threads <= 0 ? std::max(GetNumCores(), 1) : threads;
+}
+
+/** Hashes per second, given the number of hashes and the time they took. */
+static double GetHashesPerSecond(uint64_t hashes, std::chrono::steady_clock::duration elapsed)
+{
+    const double seconds{std::chrono::duration<double>(elapsed).count()};
+    return seconds > 0 ? hashes / seconds : 0;
+}
+
+static bool GenerateBlock(ChainstateManager& chainman, CBlock& block, uint64_t& max_tries, unsigned int& extra_nonce, uint256& block_hash, uint64_t& hashes)
 {
     block_hash.SetNull();
 
@@ -120,14 +135,14 @@ static bool GenerateBlock(ChainstateManager& chainman, CBlock& block, uint64_t&
 
     CChainParams chainparams(Params());
 
-    while (max_tries > 0 && block.nNonce < std::numeric_limits<uint32_t>::max() && !CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus()) && !ShutdownRequested()) {
-        ++block.nNonce;
-        --max_tries;
-    }
+    uint64_t block_hashes{0};
+    const bool found{GrindBlockNonce(block, chainparams.GetConsensus(), max_tries, GetGenerateThreads(), ShutdownRequested, block_hashes)};
+    hashes += block_hashes;
     if (max_tries == 0 || ShutdownRequested()) {
         return false;
     }
-    if (block.nNonce == std::numeric_limits<uint32_t>::max()) {
+    if (!found) {
+        // Nonce space exhausted; the caller retries with a new extra nonce.
         return true;
     }
 
@@ -151,6 +166,8 @@ static UniValue generateBlocks(ChainstateManager& chainman, const CTxMemPool& me
         nHeightEnd = nHeight+nGenerate;
     }
     unsigned int nExtraNonce = 0;
+    uint64_t hashes{0};
+    const auto start_time{std::chrono::steady_clock::now()};
     UniValue blockHashes(UniValue::VARR);
     while (nHeight < nHeightEnd && !ShutdownRequested())
     {
@@ -160,7 +177,7 @@ static UniValue generateBlocks(ChainstateManager& chainman, const CTxMemPool& me
         CBlock *pblock = &pblocktemplate->block;
 
         uint256 block_hash;
-        if (!GenerateBlock(chainman, *pblock, nMaxTries, nExtraNonce, block_hash)) {
+        if (!GenerateBlock(chainman, *pblock, nMaxTries, nExtraNonce, block_hash, hashes)) {
             break;
         }
 
@@ -169,6 +186,7 @@ static UniValue generateBlocks(ChainstateManager& chainman, const CTxMemPool& me
             blockHashes.push_back(block_hash.GetHex());
         }
     }
+    LogPrint(BCLog::RPC, "Generated %u blocks with %u hashes (%.0f hashes/s)\n", blockHashes.size(), hashes, GetHashesPerSecond(hashes, std::chrono::steady_clock::now() - start_time));
     return blockHashes;
 }
 
@@ -310,6 +328,8 @@ static RPCHelpMan generateblock()
             RPCResult::Type::OBJ, "", "",
             {
                 {RPCResult::Type::STR_HEX, "hash", "hash of generated block"},
+                {RPCResult::Type::NUM, "hashes", "number of header hashes computed"},
+                {RPCResult::Type::NUM, "hashps", "achieved hashes per second"},
             }
         },
         RPCExamples{
@@ -391,13 +411,17 @@ static RPCHelpMan generateblock()
     uint256 block_hash;
     uint64_t max_tries{DEFAULT_MAX_TRIES};
     unsigned int extra_nonce{0};
+    uint64_t hashes{0};
+    const auto start_time{std::chrono::steady_clock::now()};
 
-    if (!GenerateBlock(chainman, block, max_tries, extra_nonce, block_hash) || block_hash.IsNull()) {
+    if (!GenerateBlock(chainman, block, max_tries, extra_nonce, block_hash, hashes) || block_hash.IsNull()) {
         throw JSONRPCError(RPC_MISC_ERROR, "Failed to make block.");
     }
 
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("hash", block_hash.GetHex());
+    obj.pushKV("hashes", hashes);
+    obj.pushKV("hashps", GetHashesPerSecond(hashes, std::chrono::steady_clock::now() - start_time));
     return obj;
 },
     };
@@ -688,6 +712,8 @@ static RPCHelpMan getblocktemplate()
 
     static unsigned int nTransactionsUpdatedLast;
     const CTxMemPool& mempool = EnsureMemPool(node);
+    // When the node maintains the template, long poll ids count its fee increases instead of mempool updates
+    BlockTemplateMaintainer* const maintainer = node.block_template.get();
 
     if (!lpval.isNull())
     {
@@ -719,8 +745,14 @@ static RPCHelpMan getblocktemplate()
             WAIT_LOCK(g_best_block_mutex, lock);
             while (g_best_block == hashWatchedChain && IsRPCRunning())
             {
+                if (maintainer && static_cast<unsigned int>(maintainer->GetSequence()) != nTransactionsUpdatedLastLP)
+                    break;
                 if (g_best_block_cv.wait_until(lock, checktxtime) == std::cv_status::timeout)
                 {
+                    if (maintainer) {
+                        checktxtime += std::chrono::seconds(10);
+                        continue;
+                    }
                     // Timeout: Check transactions for update
                     // without holding the mempool lock to avoid deadlocks
                     if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
@@ -752,7 +784,14 @@ static RPCHelpMan getblocktemplate()
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
     static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    if (pindexPrev != active_chain.Tip() ||
+    if (maintainer) {
+        pindexPrev = nullptr;
+        // Store the sequence before getting the template, to avoid races
+        nTransactionsUpdatedLast = static_cast<unsigned int>(maintainer->GetSequence());
+        CBlockIndex* pindexPrevNew = active_chain.Tip();
+        pblocktemplate = maintainer->GetTemplate(pindexPrevNew);
+        pindexPrev = pindexPrevNew;
+    } else if (pindexPrev != active_chain.Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -23,6 +23,7 @@
 #include <util/strencodings.h>
 #include <util/syscall_sandbox.h>
 #include <util/system.h>
+#include <validation.h>
 
 #include <optional>
 #include <stdint.h>
@@ -465,6 +466,25 @@ static RPCHelpMan mockscheduler()
     };
 }
 
+static UniValue RPCCoinsCacheInfo(ChainstateManager& chainman)
+{
+    LOCK(cs_main);
+    CChainState& chainstate = chainman.ActiveChainstate();
+    const CoinsFlushStats& stats = chainstate.m_coins_flush_stats;
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("usage", uint64_t(chainstate.CoinsTip().DynamicMemoryUsage()));
+    obj.pushKV("free", uint64_t(chainstate.CoinsTip().FreeMemoryUsage()));
+    obj.pushKV("max", uint64_t(chainstate.m_coinstip_cache_size_bytes));
+    obj.pushKV("coins", uint64_t(chainstate.CoinsTip().GetCacheSize()));
+    obj.pushKV("full_flushes", stats.full_flushes);
+    obj.pushKV("partial_flushes", stats.partial_flushes);
+    obj.pushKV("last_flush_duration", count_microseconds(stats.last_duration) / 1000.0);
+    obj.pushKV("last_flush_coins", uint64_t(stats.last_coins));
+    obj.pushKV("last_flush_usage", uint64_t(stats.last_usage_bytes));
+    obj.pushKV("last_flush_evicted", uint64_t(stats.last_evicted));
+    return obj;
+}
+
 static UniValue RPCLockedMemoryInfo()
 {
     LockedPool::Stats stats = LockedPoolManager::Instance().stats();
@@ -522,6 +542,19 @@ static RPCHelpMan getmemoryinfo()
                                 {RPCResult::Type::NUM, "chunks_used", "Number allocated chunks"},
                                 {RPCResult::Type::NUM, "chunks_free", "Number unused chunks"},
                             }},
+                            {RPCResult::Type::OBJ, "coins_cache", "Information about the cache of the UTXO set of the active chainstate",
+                            {
+                                {RPCResult::Type::NUM, "usage", "Number of bytes used"},
+                                {RPCResult::Type::NUM, "free", "Number of bytes of usage held for reuse by coins since erased"},
+                                {RPCResult::Type::NUM, "max", "Number of bytes the cache is sized for"},
+                                {RPCResult::Type::NUM, "coins", "Number of coins cached"},
+                                {RPCResult::Type::NUM, "full_flushes", "Number of writes to disk that emptied the cache"},
+                                {RPCResult::Type::NUM, "partial_flushes", "Number of writes to disk that kept the unspent coins cached"},
+                                {RPCResult::Type::NUM, "last_flush_duration", "Milliseconds taken by the last write to disk, eviction included"},
+                                {RPCResult::Type::NUM, "last_flush_coins", "Number of coins cached when the last write started"},
+                                {RPCResult::Type::NUM, "last_flush_usage", "Number of bytes used when the last write started"},
+                                {RPCResult::Type::NUM, "last_flush_evicted", "Number of coins evicted after the last write"},
+                            }},
                         }
                     },
                     RPCResult{"mode \"mallocinfo\"",
@@ -538,6 +571,7 @@ static RPCHelpMan getmemoryinfo()
     if (mode == "stats") {
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("locked", RPCLockedMemoryInfo());
+        obj.pushKV("coins_cache", RPCCoinsCacheInfo(EnsureAnyChainman(request.context)));
         return obj;
     } else if (mode == "mallocinfo") {
 #ifdef HAVE_MALLOC_INFO
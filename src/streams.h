@@ -194,6 +194,14 @@ public:
         memcpy(dst, m_data.data() + m_pos, n);
         m_pos = pos_next;
     }
+
+    void ignore(size_t n)
+    {
+        if (n > size()) {
+            throw std::ios_base::failure("VectorReader::ignore(): end of data");
+        }
+        m_pos += n;
+    }
 };
 
 /** Double ended buffer combining vector and stream-like interfaces.
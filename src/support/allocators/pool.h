@@ -0,0 +1,192 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BGL_SUPPORT_ALLOCATORS_POOL_H
+#define BGL_SUPPORT_ALLOCATORS_POOL_H
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * A memory resource for many small allocations of a few distinct sizes, such
+ * as the nodes of a node based container.
+ *
+ * Memory is carved out of large chunks, which are only given back to the
+ * system when the resource is destroyed. A freed block is put on the free list
+ * for its size and handed out again by the next allocation of that size, so a
+ * container whose elements are constantly replaced keeps reusing the same
+ * memory instead of going through the general purpose allocator every time,
+ * and its nodes stay close together.
+ *
+ * Requests larger than MAX_BLOCK_SIZE_BYTES, or with an alignment stricter
+ * than ALIGN_BYTES, are passed through to ::operator new.
+ *
+ * The resource is not thread safe; access must be serialized by its owner.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource final
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+
+    //! Free blocks are linked through their own memory.
+    struct ListNode {
+        ListNode* m_next;
+    };
+
+    //! Granularity of block sizes. Every block is large and aligned enough to hold a ListNode.
+    static constexpr std::size_t ELEM_ALIGN_BYTES = std::max(alignof(ListNode), ALIGN_BYTES);
+    static_assert(ELEM_ALIGN_BYTES <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "chunks would not be aligned enough");
+    static_assert(MAX_BLOCK_SIZE_BYTES >= ELEM_ALIGN_BYTES, "MAX_BLOCK_SIZE_BYTES too small");
+
+    const std::size_t m_chunk_size_bytes;
+    std::vector<std::unique_ptr<std::byte[]>> m_chunks;
+    //! Free list heads, indexed by block size in multiples of ELEM_ALIGN_BYTES.
+    std::array<ListNode*, (MAX_BLOCK_SIZE_BYTES + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + 1> m_free_lists{};
+    //! Part of the newest chunk that has not been handed out yet.
+    std::byte* m_available_begin{nullptr};
+    std::byte* m_available_end{nullptr};
+    std::size_t m_used_bytes{0};
+    std::size_t m_pass_through_bytes{0};
+
+    static constexpr std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return std::max<std::size_t>(1, (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES);
+    }
+
+    static constexpr bool IsPooled(std::size_t bytes, std::size_t alignment)
+    {
+        return bytes <= MAX_BLOCK_SIZE_BYTES && alignment <= ELEM_ALIGN_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t num_alignments) noexcept
+    {
+        m_free_lists[num_alignments] = new (p) ListNode{m_free_lists[num_alignments]};
+    }
+
+    void AllocateChunk()
+    {
+        // Whatever is left of the current chunk is too small for the request
+        // at hand, but may still serve a smaller one later.
+        const std::size_t remaining = m_available_end - m_available_begin;
+        if (remaining > 0) PushFree(m_available_begin, remaining / ELEM_ALIGN_BYTES);
+
+        m_chunks.emplace_back(new std::byte[m_chunk_size_bytes]);
+        m_available_begin = m_chunks.back().get();
+        m_available_end = m_available_begin + m_chunk_size_bytes;
+    }
+
+public:
+    static constexpr std::size_t DEFAULT_CHUNK_SIZE_BYTES{256 << 10};
+
+    explicit PoolResource(std::size_t chunk_size_bytes = DEFAULT_CHUNK_SIZE_BYTES)
+        : m_chunk_size_bytes{chunk_size_bytes / ELEM_ALIGN_BYTES * ELEM_ALIGN_BYTES}
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment)) {
+            void* p = ::operator new(bytes, std::align_val_t{alignment});
+            m_used_bytes += bytes;
+            m_pass_through_bytes += bytes;
+            return p;
+        }
+        const std::size_t num_alignments = NumElemAlignBytes(bytes);
+        const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+        void* p;
+        if (ListNode* node = m_free_lists[num_alignments]) {
+            m_free_lists[num_alignments] = node->m_next;
+            p = node;
+        } else {
+            if (static_cast<std::size_t>(m_available_end - m_available_begin) < round_bytes) AllocateChunk();
+            p = std::exchange(m_available_begin, m_available_begin + round_bytes);
+        }
+        m_used_bytes += round_bytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsPooled(bytes, alignment)) {
+            ::operator delete(p, std::align_val_t{alignment});
+            m_used_bytes -= bytes;
+            m_pass_through_bytes -= bytes;
+            return;
+        }
+        const std::size_t num_alignments = NumElemAlignBytes(bytes);
+        PushFree(p, num_alignments);
+        m_used_bytes -= num_alignments * ELEM_ALIGN_BYTES;
+    }
+
+    /** Bytes currently handed out, including pass-through allocations. Free blocks are not counted. */
+    std::size_t UsedBytes() const { return m_used_bytes; }
+
+    /** Bytes reserved from the system for the pool, whether in use or not. */
+    std::size_t ChunkBytes() const { return m_chunks.size() * m_chunk_size_bytes; }
+
+    /** Bytes held from the system: the chunks plus pass-through allocations. */
+    std::size_t AllocatedBytes() const { return ChunkBytes() + m_pass_through_bytes; }
+};
+
+/**
+ * Allocator handing out memory from a PoolResource, for use by standard and
+ * boost containers. Copies, including rebound ones, share the resource, which
+ * must outlive every container using it.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+    using ResourceType = PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>;
+
+    template <typename U>
+    struct rebind {
+        using other = PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>;
+    };
+
+    PoolAllocator(ResourceType* resource) noexcept : m_resource{resource} {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource{other.resource()} {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+
+private:
+    ResourceType* m_resource;
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BGL_SUPPORT_ALLOCATORS_POOL_H
@@ -2,10 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <support/allocators/pool.h>
 #include <support/lockedpool.h>
 #include <util/system.h>
 
 #include <limits>
+#include <list>
 #include <memory>
 #include <stdexcept>
 #include <utility>
@@ -235,4 +237,56 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+
+    void* a = resource.Allocate(24, 8);
+    void* b = resource.Allocate(20, 8); // rounded up to 24
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 48U);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.AllocatedBytes(), 1024U);
+
+    // A freed block is handed out again by the next request of the same size class
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 24U);
+    BOOST_CHECK(resource.Allocate(17, 8) == a);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 48U);
+
+    // Oversized and over-aligned requests bypass the pool, but are still counted
+    void* big = resource.Allocate(1000, 8);
+    void* aligned = resource.Allocate(32, 64);
+    BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(aligned) % 64, 0U);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 48U + 1000U + 32U);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.AllocatedBytes(), 1024U + 1000U + 32U);
+    resource.Deallocate(big, 1000, 8);
+    resource.Deallocate(aligned, 32, 64);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 48U);
+    BOOST_CHECK_EQUAL(resource.AllocatedBytes(), 1024U);
+
+    // Running out of the first chunk allocates more
+    std::vector<void*> blocks;
+    for (int i = 0; i < 64; ++i) blocks.push_back(resource.Allocate(64, 8));
+    BOOST_CHECK(resource.ChunkBytes() >= 64 * 64 + 48);
+    for (void* p : blocks) resource.Deallocate(p, 64, 8);
+    resource.Deallocate(a, 24, 8);
+    resource.Deallocate(b, 24, 8);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 0U);
+
+    // Nodes of a container are recycled instead of growing the pool
+    using Allocator = PoolAllocator<uint64_t, 64, 8>;
+    std::list<uint64_t, Allocator> list{Allocator{&resource}};
+    size_t list_chunk_bytes{0};
+    for (int round = 0; round < 3; ++round) {
+        for (uint64_t i = 0; i < 50; ++i) list.push_back(i);
+        BOOST_CHECK(resource.UsedBytes() >= 50 * 3 * sizeof(uint64_t));
+        list.clear();
+        BOOST_CHECK_EQUAL(resource.UsedBytes(), 0U);
+        if (round == 0) list_chunk_bytes = resource.ChunkBytes();
+        BOOST_CHECK_EQUAL(resource.ChunkBytes(), list_chunk_bytes);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,97 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <consensus/amount.h>
+#include <consensus/merkle.h>
+#include <primitives/block.h>
+#include <span.h>
+#include <streams.h>
+#include <util/threadpool.h>
+#include <validation.h>
+#include <version.h>
+
+#include <test/util/setup_common.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockhashing_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(parallel_tx_hashing)
+{
+    // Build a block large enough to be split across threads, with a mix of
+    // witness and non-witness transactions.
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1234;
+    for (size_t i = 0; i < 3 * MIN_PARALLEL_TX_HASHING_TXS + 7; ++i) {
+        CMutableTransaction tx;
+        tx.vin.resize(1 + InsecureRandRange(3));
+        for (auto& in : tx.vin) {
+            in.prevout = COutPoint(InsecureRand256(), InsecureRand32());
+            if (InsecureRandBool()) in.scriptWitness.stack.push_back(g_insecure_rand_ctx.randbytes(InsecureRandRange(100)));
+        }
+        tx.vout.resize(1 + InsecureRandRange(3));
+        for (auto& out : tx.vout) {
+            out.nValue = InsecureRandRange(MAX_MONEY);
+            const auto script{g_insecure_rand_ctx.randbytes(InsecureRandRange(40))};
+            out.scriptPubKey = CScript(script.begin(), script.end());
+        }
+        block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    for (const int num_workers : {-1, 0, 1, 3, 63}) {
+        // No pool at all for -1.
+        ThreadPool pool{"test"};
+        pool.Start(num_workers);
+        for (const size_t num_txs : {size_t{0}, size_t{1}, MIN_PARALLEL_TX_HASHING_TXS - 1, MIN_PARALLEL_TX_HASHING_TXS, block.vtx.size()}) {
+            CBlock expected{block.GetBlockHeader()};
+            expected.vtx.assign(block.vtx.begin(), block.vtx.begin() + num_txs);
+            CDataStream in(SER_NETWORK, PROTOCOL_VERSION);
+            in << expected;
+            CBlock parsed;
+            in >> ParallelTxHashing{parsed, num_workers < 0 ? nullptr : &pool};
+            BOOST_CHECK(in.empty());
+            BOOST_CHECK_EQUAL(parsed.GetHash(), expected.GetHash());
+            BOOST_REQUIRE_EQUAL(parsed.vtx.size(), num_txs);
+            for (size_t i = 0; i < num_txs; ++i) {
+                BOOST_CHECK_EQUAL(parsed.vtx[i]->GetHash(), expected.vtx[i]->GetHash());
+                BOOST_CHECK_EQUAL(parsed.vtx[i]->GetWitnessHash(), expected.vtx[i]->GetWitnessHash());
+            }
+            if (num_txs == 0) continue;
+            BOOST_CHECK_EQUAL(BlockMerkleRoot(parsed), BlockMerkleRoot(expected));
+            BOOST_CHECK_EQUAL(BlockWitnessMerkleRoot(parsed), BlockWitnessMerkleRoot(expected));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(parallel_header_hashing)
+{
+    std::vector<CBlockHeader> headers(3 * MIN_PARALLEL_HEADER_HASHING + 7);
+    for (auto& header : headers) {
+        header.nVersion = InsecureRand32();
+        header.hashPrevBlock = InsecureRand256();
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = InsecureRand32();
+        header.nBits = InsecureRand32();
+        header.nNonce = InsecureRand32();
+    }
+
+    for (const int num_workers : {-1, 0, 1, 3, 63}) {
+        // No pool at all for -1.
+        ThreadPool pool{"test"};
+        pool.Start(num_workers);
+        for (const size_t count : {size_t{0}, size_t{1}, MIN_PARALLEL_HEADER_HASHING - 1, MIN_PARALLEL_HEADER_HASHING, headers.size()}) {
+            const std::vector<uint256> hashes{HashBlockHeaders(Span<const CBlockHeader>{headers}.first(count), num_workers < 0 ? nullptr : &pool)};
+            BOOST_REQUIRE_EQUAL(hashes.size(), count);
+            for (size_t i = 0; i < count; ++i) {
+                BOOST_CHECK_EQUAL(hashes[i], headers[i].GetHash());
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,16 +3,25 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <attributes.h>
+#include <chain.h>
+#include <chainparams.h>
 #include <clientversion.h>
 #include <coins.h>
+#include <consensus/validation.h>
+#include <node/coins_prefetch.h>
+#include <node/coinstats.h>
 #include <script/standard.h>
 #include <streams.h>
 #include <test/util/setup_common.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <util/strencodings.h>
+#include <validation.h>
 
+#include <algorithm>
 #include <map>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -53,18 +62,17 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase = true) override
     {
-        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = erase ? mapCoins.erase(it) : std::next(it)) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coin;
-                if (it->second.coin.IsSpent() && InsecureRandRange(3) == 0) {
+                map_[it->first] = it->second.CopyCoin();
+                if (it->second.IsSpent() && InsecureRandRange(3) == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -83,7 +91,7 @@ public:
         size_t ret = memusage::DynamicUsage(cacheCoins);
         size_t count = 0;
         for (const auto& entry : cacheCoins) {
-            ret += entry.second.coin.DynamicMemoryUsage();
+            ret += entry.second.DynamicMemoryUsage();
             ++count;
         }
         BOOST_CHECK_EQUAL(GetCacheSize(), count);
@@ -211,7 +219,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             // Every 100 iterations, flush an intermediate cache
             if (stack.size() > 1 && InsecureRandBool() == 0) {
                 unsigned int flushIndex = InsecureRandRange(stack.size() - 1);
-                BOOST_CHECK(stack[flushIndex]->Flush());
+                if (InsecureRandRange(4) == 0) {
+                    BOOST_CHECK(stack[flushIndex]->Sync());
+                    stack[flushIndex]->Trim(stack[flushIndex]->DynamicMemoryUsage() / 2);
+                } else {
+                    BOOST_CHECK(stack[flushIndex]->Flush());
+                }
             }
         }
         if (InsecureRandRange(100) == 0) {
@@ -447,7 +460,12 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             // Every 100 iterations, flush an intermediate cache
             if (stack.size() > 1 && InsecureRandBool() == 0) {
                 unsigned int flushIndex = InsecureRandRange(stack.size() - 1);
-                BOOST_CHECK(stack[flushIndex]->Flush());
+                if (InsecureRandRange(4) == 0) {
+                    BOOST_CHECK(stack[flushIndex]->Sync());
+                    stack[flushIndex]->Trim(stack[flushIndex]->DynamicMemoryUsage() / 2);
+                } else {
+                    BOOST_CHECK(stack[flushIndex]->Flush());
+                }
             }
         }
         if (InsecureRandRange(100) == 0) {
@@ -567,10 +585,12 @@ static size_t InsertCoinsMapEntry(CCoinsMap& map, CAmount value, char flags)
     assert(flags != NO_ENTRY);
     CCoinsCacheEntry entry;
     entry.flags = flags;
-    SetCoinsValue(value, entry.coin);
+    Coin coin;
+    SetCoinsValue(value, coin);
+    entry.SetCoin(std::move(coin));
     auto inserted = map.emplace(OUTPOINT, std::move(entry));
     assert(inserted.second);
-    return inserted.first->second.coin.DynamicMemoryUsage();
+    return inserted.first->second.DynamicMemoryUsage();
 }
 
 void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
@@ -580,10 +600,10 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
         value = ABSENT;
         flags = NO_ENTRY;
     } else {
-        if (it->second.coin.IsSpent()) {
+        if (it->second.IsSpent()) {
             value = SPENT;
         } else {
-            value = it->second.coin.out.nValue;
+            value = it->second.CopyCoin().out.nValue;
         }
         flags = it->second.flags;
         assert(flags != NO_ENTRY);
@@ -662,6 +682,41 @@ BOOST_AUTO_TEST_CASE(ccoins_access)
     CheckAccessCoin(VALUE1, VALUE2, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_fetch)
+{
+    CCoinsViewTest root;
+    CCoinsViewCacheTest base{&root};
+    CCoinsViewCacheTest cache{&base};
+
+    // A group size that is not a multiple of four exercises the tail as well.
+    std::vector<COutPoint> present, outpoints;
+    for (uint32_t i = 0; i < 103; ++i) {
+        const COutPoint outpoint{InsecureRand256(), i};
+        base.AddCoin(outpoint, Coin{CTxOut{i + 1, CScript{}}, 1, false}, false);
+        present.push_back(outpoint);
+        outpoints.push_back(outpoint);
+        if (i % 5 == 0) outpoints.emplace_back(InsecureRand256(), i);
+    }
+    Shuffle(outpoints.begin(), outpoints.end(), g_insecure_rand_ctx);
+
+    cache.FetchCoins(outpoints);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), present.size());
+    for (const COutPoint& outpoint : outpoints) {
+        const bool is_present = std::find(present.begin(), present.end(), outpoint) != present.end();
+        BOOST_CHECK_EQUAL(cache.HaveCoinInCache(outpoint), is_present);
+        if (is_present) {
+            BOOST_CHECK_EQUAL(cache.map().find(outpoint)->second.flags, 0);
+            BOOST_CHECK_EQUAL(cache.AccessCoin(outpoint).out.nValue, outpoint.n + 1);
+        }
+    }
+
+    // Fetching coins that are already cached does not change them.
+    cache.FetchCoins(present);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), present.size());
+}
+
 static void CheckSpendCoins(CAmount base_value, CAmount cache_value, CAmount expected_value, char cache_flags, char expected_flags)
 {
     SingleEntryCacheTest test(base_value, cache_value, cache_flags);
@@ -861,4 +916,235 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_packed)
+{
+    const uint256 program{InsecureRand256()};
+    std::vector<unsigned char> pubkey(33);
+    pubkey[0] = 0x03;
+    std::copy(program.begin(), program.end(), pubkey.begin() + 1);
+
+    // Scripts the cache stores packed, and ones it cannot or need not pack.
+    const std::vector<std::pair<CScript, bool>> scripts{
+        {CScript() << OP_0 << ToByteVector(program), true},
+        {CScript() << OP_1 << ToByteVector(program), true},
+        {CScript() << OP_16 << ToByteVector(program), true},
+        {CScript() << pubkey << OP_CHECKSIG, true},
+        {CScript() << OP_0 << std::vector<unsigned char>(20, 7), false},
+        {CScript() << OP_2 << ToByteVector(program), false},
+        {CScript() << OP_1 << std::vector<unsigned char>(33, 7), false},
+        {CScript() << OP_1 << ToByteVector(program) << OP_DROP, false},
+        {CScript() << std::vector<unsigned char>(33, 7) << OP_CHECKSIG, false},
+        {CScript() << std::vector<unsigned char>(40, 7), false},
+    };
+
+    CCoinsView root;
+    CCoinsViewCacheTest base{&root};
+    std::vector<Coin> coins;
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        CCoinsViewCacheTest cache{&base};
+        const COutPoint outpoint{program, uint32_t(i)};
+        const Coin coin{CTxOut{CAmount(InsecureRand32()), scripts[i].first}, int(InsecureRandRange(1 << 30)), InsecureRandBool()};
+        coins.push_back(coin);
+
+        const size_t usage{cache.DynamicMemoryUsage()};
+        cache.AddCoin(outpoint, Coin{coin}, false);
+        BOOST_CHECK_EQUAL(cache.map().find(outpoint)->second.IsPacked(), scripts[i].second);
+        if (scripts[i].second) {
+            BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), usage + memusage::DynamicUsage(cache.map()) - memusage::DynamicUsage(CCoinsMap{}));
+        }
+        cache.SelfTest();
+
+        Coin copy;
+        BOOST_CHECK(cache.GetCoin(outpoint, copy));
+        BOOST_CHECK(copy == coin);
+        BOOST_CHECK_EQUAL(cache.map().find(outpoint)->second.IsPacked(), scripts[i].second);
+
+        // Packed coins stay packed when flushed to the parent cache.
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK_EQUAL(base.map().find(outpoint)->second.IsPacked(), scripts[i].second);
+        base.SelfTest();
+    }
+
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        const COutPoint outpoint{program, uint32_t(i)};
+        BOOST_CHECK(base.AccessCoin(outpoint) == coins[i]);
+        BOOST_CHECK(!base.map().find(outpoint)->second.IsPacked());
+        base.SelfTest();
+
+        Coin spent;
+        BOOST_CHECK(base.SpendCoin(outpoint, &spent));
+        BOOST_CHECK(spent == coins[i]);
+        base.SelfTest();
+    }
+    BOOST_CHECK_EQUAL(base.GetCacheSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache{&base};
+    const uint256 txid{InsecureRand256()};
+    const auto coin_value = [](uint32_t n) { return CAmount{1000} + n; };
+    for (uint32_t n = 0; n < 100; ++n) {
+        cache.AddCoin(COutPoint{txid, n}, Coin{CTxOut{coin_value(n), CScript() << OP_TRUE}, 1, false}, false);
+    }
+    cache.SetBestBlock(InsecureRand256());
+
+    // Syncing writes every coin but keeps them all cached, now clean.
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 100U);
+    for (const auto& [outpoint, entry] : cache.map()) {
+        BOOST_CHECK_EQUAL(entry.flags, 0);
+        Coin coin;
+        BOOST_CHECK(base.GetCoin(outpoint, coin));
+        BOOST_CHECK_EQUAL(coin.out.nValue, coin_value(outpoint.n));
+    }
+    cache.SelfTest();
+
+    // A coin spent after syncing is erased from the base and dropped from
+    // the cache by the next sync.
+    BOOST_CHECK(cache.SpendCoin(COutPoint{txid, 0}));
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 99U);
+    BOOST_CHECK(!cache.HaveCoin(COutPoint{txid, 0}));
+    cache.SelfTest();
+
+    // Trimming evicts the coins that have not been used recently first, and
+    // never a dirty one.
+    for (auto& [outpoint, entry] : cache.map()) entry.recent = false;
+    for (uint32_t n = 1; n < 50; ++n) BOOST_CHECK(cache.HaveCoin(COutPoint{txid, n}));
+    cache.AddCoin(COutPoint{txid, 100}, Coin{CTxOut{coin_value(100), CScript() << OP_TRUE}, 1, false}, false);
+    BOOST_CHECK_EQUAL(cache.Trim(cache.DynamicMemoryUsage()), 0U);
+    const size_t used{cache.DynamicMemoryUsage() - cache.FreeMemoryUsage()};
+    BOOST_CHECK_EQUAL(cache.Trim(used - 50 * sizeof(CCoinsMap::value_type)), 50U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 50U);
+    for (uint32_t n = 1; n <= 100; ++n) {
+        BOOST_CHECK_EQUAL(cache.HaveCoinInCache(COutPoint{txid, n}), n < 50 || n == 100);
+    }
+    cache.SelfTest();
+
+    BOOST_CHECK_EQUAL(cache.Trim(0), 49U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.map().find(COutPoint{txid, 100})->second.flags & CCoinsCacheEntry::DIRTY);
+
+    // Evicted coins are still available from the base.
+    BOOST_CHECK_EQUAL(cache.AccessCoin(COutPoint{txid, 70}).out.nValue, coin_value(70));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(serialized_utxo_hasher)
+{
+    // Several outputs per txid, with output indexes whose database keys do
+    // not sort in numeric order.
+    std::vector<std::pair<COutPoint, Coin>> coins;
+    for (int i = 0; i < 50; ++i) {
+        const uint256 txid{InsecureRand256()};
+        for (const uint32_t n : {0u, 1u, 127u, 128u, 16511u, 16512u}) {
+            if (InsecureRandBool()) continue;
+            coins.emplace_back(COutPoint{txid, n}, Coin{CTxOut{CAmount(InsecureRandRange(1000000)), CScript() << InsecureRand32()}, int(InsecureRandRange(1000)), InsecureRandBool()});
+        }
+    }
+    std::sort(coins.begin(), coins.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    CCoinsViewDB db{m_path_root / "coins", 1 << 20, /*fMemory=*/true, /*fWipe=*/false};
+    BOOST_REQUIRE(db.WriteCoins(coins));
+    const uint256 best_block{InsecureRand256()};
+    CCoinsMap no_coins;
+    BOOST_REQUIRE(db.BatchWrite(no_coins, best_block));
+
+    CBlockIndex index;
+    index.phashBlock = &best_block;
+    BlockManager blockman;
+    CCoinsStats stats{CoinStatsHashType::HASH_SERIALIZED};
+    BOOST_REQUIRE(GetUTXOStats(&db, blockman, stats, [] {}, &index));
+    BOOST_CHECK_EQUAL(stats.coins_count, coins.size());
+
+    // Coins in outpoint order and in database order hash the same as the database.
+    SerializedUTXOHasher sorted{best_block};
+    for (const auto& [outpoint, coin] : coins) BOOST_CHECK(sorted.Add(outpoint, coin));
+    BOOST_CHECK(sorted.Ordered());
+    BOOST_CHECK_EQUAL(sorted.Finalize(), stats.hashSerialized);
+
+    SerializedUTXOHasher listed{best_block};
+    for (auto cursor{db.Cursor()}; cursor->Valid(); cursor->Next()) {
+        COutPoint outpoint;
+        Coin coin;
+        BOOST_REQUIRE(cursor->GetKey(outpoint) && cursor->GetValue(coin));
+        BOOST_CHECK(listed.Add(outpoint, coin));
+    }
+    BOOST_CHECK_EQUAL(listed.Finalize(), stats.hashSerialized);
+
+    // Txids out of order, or a repeated outpoint, leave the hash meaningless.
+    SerializedUTXOHasher reversed{best_block};
+    bool added{true};
+    for (auto it = coins.rbegin(); it != coins.rend(); ++it) added &= reversed.Add(it->first, it->second);
+    BOOST_CHECK(!added);
+    BOOST_CHECK(!reversed.Ordered());
+
+    SerializedUTXOHasher repeated{best_block};
+    BOOST_CHECK(repeated.Add(coins[0].first, coins[0].second));
+    BOOST_CHECK(!repeated.Add(coins[0].first, coins[0].second));
+    BOOST_CHECK(!repeated.Ordered());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_prefetch, TestChain100Setup)
+{
+    // Store a block spending a mature coinbase, and disconnect it again so
+    // that the coin it spends is back in the database.
+    const CScript script{GetScriptForRawPubKey(coinbaseKey.GetPubKey())};
+    const CMutableTransaction spend{CreateValidMempoolTransaction(m_coinbase_txns[0], 0, 0, coinbaseKey, script, 1 * COIN, /* submit */ false)};
+    const COutPoint prevout{spend.vin[0].prevout};
+    const uint256 block_hash{CreateAndProcessBlock({spend}, script).GetHash()};
+
+    CChainState& chainstate{m_node.chainman->ActiveChainstate()};
+    CBlockIndex* pindex{WITH_LOCK(::cs_main, return m_node.chainman->m_blockman.LookupBlockIndex(block_hash))};
+    BlockValidationState state;
+    BOOST_REQUIRE(chainstate.InvalidateBlock(state, pindex));
+    chainstate.ForceFlushStateToDisk();
+    const FlatFilePos pos{WITH_LOCK(::cs_main, return pindex->GetBlockPos())};
+
+    // Serve prefetched coins on top of an empty view, so that anything found
+    // must have come from the prefetch thread.
+    CCoinsView empty;
+    CCoinsViewPrefetch prefetch(&empty, WITH_LOCK(::cs_main, return std::ref(chainstate.CoinsDB())));
+    prefetch.Prefetch(pos, Params().GetConsensus());
+    prefetch.WaitForPrefetch();
+    Coin coin;
+    BOOST_CHECK(prefetch.HaveCoin(prevout));
+    BOOST_CHECK(prefetch.GetCoin(prevout, coin));
+    BOOST_CHECK(coin.out == m_coinbase_txns[0]->vout[0]);
+
+    // Each prefetched coin is handed out once.
+    BOOST_CHECK(!prefetch.GetCoin(prevout, coin));
+
+    // Writing through the view drops prefetched coins.
+    prefetch.Reset();
+    prefetch.Prefetch(pos, Params().GetConsensus());
+    prefetch.WaitForPrefetch();
+    BOOST_CHECK(prefetch.HaveCoin(prevout));
+    CCoinsMap coins;
+    prefetch.BatchWrite(coins, {});
+    BOOST_CHECK(!prefetch.HaveCoin(prevout));
+
+    // So does a reset.
+    prefetch.Reset();
+    prefetch.Prefetch(pos, Params().GetConsensus());
+    prefetch.WaitForPrefetch();
+    BOOST_CHECK(prefetch.HaveCoin(prevout));
+    prefetch.Reset();
+    BOOST_CHECK(!prefetch.GetCoin(prevout, coin));
+
+    // A failed lookup is left for the base view to report.
+    class FailingView : public CCoinsView
+    {
+    public:
+        bool GetCoin(const COutPoint&, Coin&) const override { throw std::runtime_error{"database read failed"}; }
+    };
+    const FailingView failing;
+    CCoinsViewPrefetch failing_prefetch(&empty, failing);
+    failing_prefetch.Prefetch(pos, Params().GetConsensus());
+    failing_prefetch.WaitForPrefetch();
+    BOOST_CHECK(!failing_prefetch.HaveCoin(prevout));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
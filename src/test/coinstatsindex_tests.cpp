@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <index/coinstatsindex.h>
+#include <node/coinstats.h>
 #include <test/util/setup_common.h>
 #include <util/time.h>
 #include <validation.h>
@@ -70,6 +71,18 @@ BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync, TestChain100Setup)
 
     BOOST_CHECK(block_index != new_block_index);
 
+    // The index must agree with a full scan of the UTXO set.
+    CCoinsStats scan_coin_stats{CoinStatsHashType::MUHASH};
+    scan_coin_stats.index_requested = false;
+    {
+        LOCK(cs_main);
+        CChainState& chainstate = m_node.chainman->ActiveChainstate();
+        chainstate.ForceFlushStateToDisk();
+        BOOST_REQUIRE(GetUTXOStats(&chainstate.CoinsDB(), chainstate.m_blockman, scan_coin_stats, [] {}, new_block_index));
+    }
+    BOOST_CHECK_EQUAL(scan_coin_stats.hashSerialized, new_coin_stats.hashSerialized);
+    BOOST_CHECK_EQUAL(scan_coin_stats.nTransactionOutputs, new_coin_stats.nTransactionOutputs);
+
     // Shutdown sequence (c.f. Shutdown() in init.cpp)
     coin_stats_index.Stop();
 
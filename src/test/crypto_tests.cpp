@@ -15,15 +15,22 @@
 #include <crypto/sha3.h>
 #include <crypto/sha512.h>
 #include <crypto/muhash.h>
+#include <hash.h>
+#include <primitives/block.h>
 #include <random.h>
 #include <streams.h>
 #include <test/util/setup_common.h>
 #include <util/strencodings.h>
 
+#include <limits>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
 
+extern "C" {
+#include <crypto/sha3/sha3.h>
+}
+
 BOOST_FIXTURE_TEST_SUITE(crypto_tests, BasicTestingSetup)
 
 template<typename Hasher, typename In, typename Out>
@@ -859,6 +866,72 @@ BOOST_AUTO_TEST_CASE(sha3_256_tests)
     TestSHA3_256("72c57c359e10684d0517e46653a02d18d29eff803eb009e4d5eb9e95add9ad1a4ac1f38a70296f3a369a16985ca3c957de2084cdc9bdd8994eb59b8815e0debad4ec1f001feac089820db8becdaf896aaf95721e8674e5d476b43bd2b873a7d135cd685f545b438210f9319e4dcd55986c85303c1ddf18dc746fe63a409df0a998ed376eb683e16c09e6e9018504152b3e7628ef350659fb716e058a5263a18823d2f2f6ee6a8091945a48ae1c5cb1694cf2c1fe76ef9177953afe8899cfa2b7fe0603bfa3180937dadfb66fbbdd119bbf8063338aa4a699075a3bfdbae8db7e5211d0917e9665a702fc9b0a0a901d08bea97654162d82a9f05622b060b634244779c33427eb7a29353a5f48b07cbefa72f3622ac5900bef77b71d6b314296f304c8426f451f32049b1f6af156a9dab702e8907d3cd72bb2c50493f4d593e731b285b70c803b74825b3524cda3205a8897106615260ac93c01c5ec14f5b11127783989d1824527e99e04f6a340e827b559f24db9292fcdd354838f9339a5fa1d7f6b2087f04835828b13463dd40927866f16ae33ed501ec0e6c4e63948768c5aeea3e4f6754985954bea7d61088c44430204ef491b74a64bde1358cecb2cad28ee6a3de5b752ff6a051104d88478653339457ac45ba44cbb65f54d1969d047cda746931d5e6a8b48e211416aefd5729f3d60b56b54e7f85aa2f42de3cb69419240c24e67139a11790a709edef2ac52cf35dd0a08af45926ebe9761f498ff83bfe263d6897ee97943a4b982fe3404ef0b4a45e06113c60340e0664f14799bf59cb4b3934b465fabefd87155905ee5309ba41e9e402973311831ea600b16437f71df39ee77130490c4d0227e5d1757fdc66af3ae6b9953053ed9aafca0160209858a7d4dd38fe10e0cb153672d08633ed6c54977aa0a6e67f9ff2f8c9d22dd7b21de08192960fd0e0da68d77c8d810db11dcaa61c725cd4092cbff76c8e1debd8d0361bb3f2e607911d45716f53067bdc0d89dd4889177765166a424e9fc0cb711201099dda213355e6639ac7eb86eca2ae0ab38b7f674f37ef8a6fcca1a6f52f55d9e1dcd631d2c3c82bba129172feb991d5af51afecd9d61a88b6832e4107480e392aed61a8644f551665ebff6b20953b635737a4f895e429fddcfe801f606fbda74b3bf6f5767d0fac14907fcfd0aa1d4c11b9e91b01d68052399b51a29f1ae6acd965109977c14a555cbcbd21ad8cb9f8853506d4bc21c01e62d61d7b21be1b923be54914e6b0a7ca84dd11f1159193e1184568a6134a6bbadf5b4df986edcf2019390ae841cfaa44435e28ce877d3dae4177992fa5d4e5c005876dbe3d1e63bec7dcc0942762b48b1ecc6c1a918409a8a72812a1e245c0c67be6e729c2b49bc6ee4d24a8f63e78e75db45655c26a9a78aff36fcd67117f26b8f654dca664b9f0e30681874cb749e1a692720078856286c2560b0292cc837933423147569350955c9571bf8941ba128fd339cb4268f46b94bc6ee203eb7026813706ea51c4f24c91866fc23a724bf2501327e6ae89c29f8db315dc28d2c7c719514036367e018f4835f63fdecd71f9bdced7132b6c4f8b13c69a517026fcd3622d67cb632320d5e7308f78f4b7cea11f6291b137851dc6cd6366f2785c71c3f237f81a7658b2a8d512b61e0ad5a4710b7b124151689fcb2116063fbff7e9115fed7b93de834970b838e49f8f8ba5f1f874c354078b5810a55ae289a56da563f1da6cd80a3757d6073fa55e016e45ac6cec1f69d871c92fd0ae9670c74249045e6b464787f9504128736309fed205f8df4d90e332908581298d9c75a3fa36ab0c3c9272e62de53ab290c803d67b696fd615c260a47bffad16746f18ba1a10a061bacbea9369693b3c042eec36bed289d7d12e52bca8aa1c2dff88ca7816498d25626d0f1e106ebb0b4a12138e00f3df5b1c2f49d98b1756e69b641b7c6353d99dbff050f4d76842c6cf1c2a4b062fc8e6336fa689b7c9d5c6b4ab8c15a5c20e514ff070a602d85ae52fa7810c22f8eeffd34a095b93342144f7a98d024216b3d68ed7bea047517bfcd83ec83febd1ba0e5858e2bdc1d8b1f7b0f89e90ccc432a3f930cb8209462e64556c5054c56ca2a85f16b32eb83a10459d13516faa4d23302b7607b9bd38dab2239ac9e9440c314433fdfb3ceadab4b4f87415ed6f240e017221f3b5f7ac196cdf54957bec42fe6893994b46de3d27dc7fb58ca88feb5b9e79cf20053d12530ac524337b22a3629bea52f40b06d3e2128f32060f9105847daed81d35f20e2002817434659baff64494c5b5c7f9216bfda38412a0f70511159dc73bb6bae1f8eaa0ef08d99bcb31f94f6be12c29c83df45926430b366c99fca3270c15fc4056398fdf3135b7779e3066a006961d1ac0ad1c83179ce39e87a96b722ec23aabc065badf3e188347a360772ca6a447abac7e6a44f0d4632d52926332e44a0a86bff5ce699fd063bdda3ffd4c41b53ded49fecec67f40599b934e16e3fd1bc063ad7026f8d71bfd4cbaf56599586774723194b692036f1b6bb242e2ffb9c600b5215b412764599476ce475c9e5b396fbcebd6be323dcf4d0048077400aac7500db41dc95fc7f7edbe7c9c2ec5ea89943fe13b42217eef530bbd023671509e12dfce4e1c1c82955d965e6a68aa66f6967dba48feda572db1f099d9a6dc4bc8edade852b5e824a06890dc48a6a6510ecaf8cf7620d757290e3166d431abecc624fa9ac2234d2eb783308ead45544910c633a94964b2ef5fbc409cb8835ac4147d384e12e0a5e13951f7de0ee13eafcb0ca0c04946d7804040c0a3cd088352424b097adb7aad1ca4495952f3e6c0158c02d2bcec33bfda69301434a84d9027ce02c0b9725dad118", "d894b86261436362e64241e61f6b3e6589daf64dc641f60570c4c0bf3b1f2ca3");
 }
 
+BOOST_AUTO_TEST_CASE(keccak256_tests)
+{
+    // Keccak-256 as used for BGL block and transaction hashes (original Keccak padding).
+    unsigned char out[Keccak256::OUTPUT_SIZE];
+    Keccak256().Finalize(out);
+    BOOST_CHECK_EQUAL(HexStr(out), "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470");
+    Keccak256().Write(MakeUCharSpan(std::string{"abc"})).Finalize(out);
+    BOOST_CHECK_EQUAL(HexStr(out), "4e03657aea45a94fc7d47ba826c8d667c0d1e6e33a64a036ec44f58fa12d6c45");
+
+    // Compare against the reference C implementation for random lengths around the rate and random splits.
+    for (int i = 0; i < 1000; ++i) {
+        const std::vector<unsigned char> data = g_insecure_rand_ctx.randbytes(InsecureRandRange(3 * 136));
+        unsigned char expected[Keccak256::OUTPUT_SIZE];
+        sha3_HashBuffer(256, SHA3_FLAGS_KECCAK, data.data(), data.size(), expected, sizeof(expected));
+
+        const size_t split = InsecureRandRange(data.size() + 1);
+        Keccak256 keccak;
+        keccak.Write(MakeSpan(data).first(split)).Write(MakeSpan(data).subspan(split)).Finalize(out);
+        BOOST_CHECK(std::equal(std::begin(out), std::end(out), expected));
+
+        // Small writes, as produced by serialization.
+        keccak.Reset();
+        for (size_t pos = 0; pos < data.size();) {
+            const size_t len = std::min<size_t>(InsecureRandRange(9), data.size() - pos);
+            keccak.Write(MakeSpan(data).subspan(pos, len));
+            pos += len;
+        }
+        keccak.Finalize(out);
+        BOOST_CHECK(std::equal(std::begin(out), std::end(out), expected));
+
+        uint256 hash;
+        CHash256Keccak().Write(data.data(), data.size()).Finalize(hash.begin());
+        BOOST_CHECK(std::equal(hash.begin(), hash.end(), expected));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(keccak256_batch)
+{
+    for (size_t size : {0, 32, 64, 80, 135}) {
+        for (int i = 0; i <= 20; ++i) {
+            const std::vector<unsigned char> in = g_insecure_rand_ctx.randbytes(size * i);
+            std::vector<unsigned char> out1(32 * i), out2(32 * i);
+            for (int j = 0; j < i; ++j) {
+                Keccak256().Write(MakeSpan(in).subspan(size * j, size)).Finalize(MakeSpan(out1).subspan(32 * j, 32));
+            }
+            Keccak256Batch(out2.data(), in.data(), size, i);
+            BOOST_CHECK(out1 == out2);
+        }
+    }
+
+    std::vector<CBlockHeader> headers(19);
+    for (CBlockHeader& header : headers) {
+        header.nVersion = InsecureRand32();
+        header.hashPrevBlock = InsecureRand256();
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = InsecureRand32();
+        header.nBits = InsecureRand32();
+        header.nNonce = InsecureRand32();
+    }
+    const std::vector<uint256> hashes = GetBlockHeaderHashes(headers);
+    BOOST_REQUIRE_EQUAL(hashes.size(), headers.size());
+    for (size_t i = 0; i < headers.size(); ++i) {
+        BOOST_CHECK(hashes[i] == headers[i].GetHash());
+    }
+}
+
 static MuHash3072 FromInt(unsigned char i) {
     unsigned char tmp[32] = {i, 0};
     return MuHash3072(tmp);
@@ -947,4 +1020,120 @@ BOOST_AUTO_TEST_CASE(muhash_tests)
     BOOST_CHECK_EQUAL(HexStr(out4), "3a31e6903aff0de9f62f9a9f7f8b861de76ce2cda09822b90014319ae5dc2271");
 }
 
+static Num3072 RandomNum3072()
+{
+    unsigned char data[Num3072::BYTE_SIZE];
+    const std::vector<unsigned char> bytes{g_insecure_rand_ctx.randbytes(sizeof(data))};
+    std::copy(bytes.begin(), bytes.end(), data);
+    // Keep the value below the modulus 2^3072 - 1103717.
+    data[Num3072::BYTE_SIZE - 1] &= 0x7f;
+    return Num3072(data);
+}
+
+static bool EqualNum3072(const Num3072& a, const Num3072& b)
+{
+    return std::equal(std::begin(a.limbs), std::end(a.limbs), std::begin(b.limbs));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_num3072_arithmetic)
+{
+    // p - 1, i.e. -1 modulo p = 2^3072 - 1103717.
+    unsigned char minus_one_data[Num3072::BYTE_SIZE];
+    std::fill(std::begin(minus_one_data), std::end(minus_one_data), 0xff);
+    WriteLE32(minus_one_data, 0xffffffff - 1103717);
+    const Num3072 minus_one{minus_one_data};
+    const Num3072 one;
+
+    Num3072 x = minus_one;
+    x.Multiply(minus_one);
+    BOOST_CHECK(EqualNum3072(x, one));
+    x = minus_one;
+    x.Square();
+    BOOST_CHECK(EqualNum3072(x, one));
+
+    for (int i = 0; i < 100; ++i) {
+        const Num3072 a = RandomNum3072();
+        const Num3072 b = RandomNum3072();
+        const Num3072 c = RandomNum3072();
+
+        // a * 1 == a
+        Num3072 r = a;
+        r.Multiply(one);
+        BOOST_CHECK(EqualNum3072(r, a));
+
+        // a * b == b * a
+        Num3072 ab = a, ba = b;
+        ab.Multiply(b);
+        ba.Multiply(a);
+        BOOST_CHECK(EqualNum3072(ab, ba));
+
+        // (a * b) * c == a * (b * c)
+        Num3072 bc = b;
+        bc.Multiply(c);
+        Num3072 ab_c = ab, a_bc = a;
+        ab_c.Multiply(c);
+        a_bc.Multiply(bc);
+        BOOST_CHECK(EqualNum3072(ab_c, a_bc));
+
+        // a^2 == a * a, and (-a)^2 == a^2
+        Num3072 sq = a, aa = a, neg_sq = a;
+        sq.Square();
+        aa.Multiply(a);
+        BOOST_CHECK(EqualNum3072(sq, aa));
+        neg_sq.Multiply(minus_one);
+        neg_sq.Square();
+        BOOST_CHECK(EqualNum3072(neg_sq, sq));
+
+        // (a * b) / b == a
+        ab.Divide(b);
+        BOOST_CHECK(EqualNum3072(ab, a));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(muhash_num3072_kernels)
+{
+    const std::string kernel{Num3072SelectKernel(/*generic=*/false)};
+    BOOST_TEST_MESSAGE("Using Num3072 multiplication: " << kernel);
+
+    // Edge values: p - 1, p, p + 1, all limbs set, and zero, next to random
+    // ones. Values from p upwards are valid, if not fully reduced, inputs.
+    constexpr Num3072::limb_t MAX_LIMB{std::numeric_limits<Num3072::limb_t>::max()};
+    std::vector<Num3072> values;
+    for (const Num3072::limb_t low : {MAX_LIMB - 1103717, MAX_LIMB - 1103716, MAX_LIMB - 1103715, MAX_LIMB}) {
+        Num3072 num;
+        std::fill(std::begin(num.limbs), std::end(num.limbs), MAX_LIMB);
+        num.limbs[0] = low;
+        values.push_back(num);
+    }
+    Num3072 zero;
+    zero.limbs[0] = 0;
+    values.push_back(zero);
+    values.push_back(Num3072{});
+    for (int i = 0; i < 50; ++i) values.push_back(RandomNum3072());
+    Num3072 top;
+    std::fill(std::begin(top.limbs), std::end(top.limbs), 0);
+    top.limbs[Num3072::LIMBS - 1] = MAX_LIMB;
+    values.push_back(top);
+
+    // Both implementations give identical limbs for every product and square.
+    for (const Num3072& a : values) {
+        for (const Num3072& b : values) {
+            Num3072SelectKernel(/*generic=*/true);
+            Num3072 expected = a;
+            expected.Multiply(b);
+            Num3072SelectKernel(/*generic=*/false);
+            Num3072 product = a;
+            product.Multiply(b);
+            BOOST_CHECK(EqualNum3072(product, expected));
+        }
+        Num3072SelectKernel(/*generic=*/true);
+        Num3072 expected = a;
+        expected.Square();
+        Num3072SelectKernel(/*generic=*/false);
+        Num3072 square = a;
+        square.Square();
+        BOOST_CHECK(EqualNum3072(square, expected));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
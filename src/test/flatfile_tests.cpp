@@ -4,6 +4,7 @@
 
 #include <clientversion.h>
 #include <flatfile.h>
+#include <node/blockfile_writer.h>
 #include <streams.h>
 #include <test/util/setup_common.h>
 #include <util/system.h>
@@ -123,4 +124,42 @@ BOOST_AUTO_TEST_CASE(flatfile_flush)
     BOOST_CHECK_EQUAL(fs::file_size(seq.FileName(FlatFilePos(0, 1))), 1U);
 }
 
+BOOST_AUTO_TEST_CASE(flatfile_writer)
+{
+    const auto data_dir = m_args.GetDataDirBase();
+    FlatFileSeq seq(data_dir, "a", 100);
+
+    // Writes land in order, so later ones to the same place win, and waiting
+    // for a file covers every write queued for it.
+    std::vector<unsigned char> expected(1000);
+    {
+        BlockFileWriter writer;
+        for (unsigned char round = 0; round < 3; ++round) {
+            for (size_t i = 0; i < expected.size(); ++i) expected[i] = round + i;
+            std::vector<unsigned char> data{expected};
+            writer.Queue(seq, FlatFilePos(0, 0), std::move(data));
+            writer.Queue(seq, FlatFilePos(1, 10), {round});
+        }
+        writer.WaitForFile(seq, FlatFilePos(0, 0));
+        BOOST_CHECK_EQUAL(fs::file_size(seq.FileName(FlatFilePos(0, 0))), expected.size());
+
+        // Stopping the writer finishes the queued writes.
+        writer.Queue(seq, FlatFilePos(2, 0), {7, 8, 9});
+    }
+
+    std::vector<unsigned char> read(expected.size());
+    {
+        CAutoFile file(seq.Open(FlatFilePos(0, 0), true), SER_DISK, CLIENT_VERSION);
+        file.read((char*)read.data(), read.size());
+    }
+    BOOST_CHECK(read == expected);
+    {
+        CAutoFile file(seq.Open(FlatFilePos(1, 10), true), SER_DISK, CLIENT_VERSION);
+        uint8_t round;
+        file >> round;
+        BOOST_CHECK_EQUAL(round, 2);
+    }
+    BOOST_CHECK_EQUAL(fs::file_size(seq.FileName(FlatFilePos(2, 0))), 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
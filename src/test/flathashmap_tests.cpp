@@ -0,0 +1,136 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <flathashmap.h>
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace {
+//! Deliberately weak hash, so that probe sequences collide and wrap around.
+struct WeakHasher {
+    size_t operator()(uint32_t key) const { return key % 61; }
+};
+using TestMap = FlatHashMap<uint32_t, std::string, WeakHasher>;
+
+void CheckEqual(const TestMap& map, const std::map<uint32_t, std::string>& expected)
+{
+    BOOST_REQUIRE_EQUAL(map.size(), expected.size());
+    size_t count{0};
+    for (const auto& [key, value] : map) {
+        const auto it = expected.find(key);
+        BOOST_REQUIRE(it != expected.end());
+        BOOST_CHECK_EQUAL(value, it->second);
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+    for (const auto& [key, value] : expected) {
+        const auto it = map.find(key);
+        BOOST_REQUIRE(it != map.end());
+        BOOST_CHECK_EQUAL(it->second, value);
+    }
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(flathashmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(flathashmap_random_ops)
+{
+    TestMap map;
+    std::map<uint32_t, std::string> expected;
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(map.find(1) == map.end());
+
+    for (int i = 0; i < 20000; ++i) {
+        const uint32_t key = InsecureRandRange(1000);
+        switch (InsecureRandRange(4)) {
+        case 0: {
+            const std::string value{std::to_string(InsecureRand32())};
+            const auto [it, inserted] = map.try_emplace(key, value);
+            const auto [expected_it, expected_inserted] = expected.try_emplace(key, value);
+            BOOST_CHECK_EQUAL(inserted, expected_inserted);
+            BOOST_CHECK_EQUAL(it->first, key);
+            BOOST_CHECK_EQUAL(it->second, expected_it->second);
+            break;
+        }
+        case 1:
+            map[key] = expected[key] = std::to_string(i);
+            break;
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+            break;
+        case 3:
+            BOOST_CHECK_EQUAL(map.count(key), expected.count(key));
+            break;
+        }
+        if (i % 1000 == 0) CheckEqual(map, expected);
+    }
+    CheckEqual(map, expected);
+
+    // Erase while iterating.
+    for (auto it = map.begin(); it != map.end();) {
+        if (it->first % 3 == 0) {
+            expected.erase(it->first);
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    CheckEqual(map, expected);
+
+    map.clear();
+    expected.clear();
+    CheckEqual(map, expected);
+    BOOST_CHECK(map.begin() == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_stable_references)
+{
+    // Entries never move, not even when the table grows, and erased entries
+    // are reused.
+    TestMap map;
+    std::vector<std::pair<uint32_t, const std::string*>> refs;
+    for (uint32_t key = 0; key < 5000; ++key) {
+        const auto [it, inserted] = map.try_emplace(key, std::to_string(key));
+        BOOST_REQUIRE(inserted);
+        refs.emplace_back(key, &it->second);
+    }
+    for (const auto& [key, ref] : refs) {
+        BOOST_CHECK_EQUAL(&map.find(key)->second, ref);
+        BOOST_CHECK_EQUAL(*ref, std::to_string(key));
+    }
+
+    const size_t usage{map.DynamicMemoryUsage()};
+    BOOST_CHECK_EQUAL(map.FreeMemoryUsage(), 0U);
+    map.erase(0);
+    const size_t entry_usage{map.FreeMemoryUsage()};
+    BOOST_CHECK_GT(entry_usage, 0U);
+    for (uint32_t key = 2; key < 5000; key += 2) map.erase(key);
+    BOOST_CHECK_EQUAL(map.FreeMemoryUsage(), 2500 * entry_usage);
+    for (uint32_t key = 5000; key < 7500; ++key) map.try_emplace(key, std::to_string(key));
+    BOOST_CHECK_EQUAL(map.size(), 5000U);
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), usage);
+    BOOST_CHECK_EQUAL(map.FreeMemoryUsage(), 0U);
+    for (uint32_t key = 1; key < 5000; key += 2) {
+        BOOST_CHECK_EQUAL(&map.find(key)->second, refs[key].second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_move_only_values)
+{
+    FlatHashMap<uint32_t, std::unique_ptr<int>, WeakHasher> map;
+    map.emplace(std::piecewise_construct, std::forward_as_tuple(7), std::forward_as_tuple(std::make_unique<int>(42)));
+    map.emplace(8, std::make_unique<int>(43));
+    BOOST_CHECK_EQUAL(*map.find(7)->second, 42);
+    BOOST_CHECK_EQUAL(*map.find(8)->second, 43);
+    BOOST_CHECK(!map.emplace(7, std::make_unique<int>(0)).second);
+    BOOST_CHECK_EQUAL(*map.find(7)->second, 42);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -75,6 +75,12 @@ FUZZ_TARGET_INIT(coins_view, initialize_coins_view)
             [&] {
                 (void)coins_view_cache.Flush();
             },
+            [&] {
+                (void)coins_view_cache.Sync();
+            },
+            [&] {
+                (void)coins_view_cache.Trim(fuzzed_data_provider.ConsumeIntegral<size_t>());
+            },
             [&] {
                 coins_view_cache.SetBestBlock(ConsumeUInt256(fuzzed_data_provider));
             },
@@ -118,13 +124,13 @@ FUZZ_TARGET_INIT(coins_view, initialize_coins_view)
                     CCoinsCacheEntry coins_cache_entry;
                     coins_cache_entry.flags = fuzzed_data_provider.ConsumeIntegral<unsigned char>();
                     if (fuzzed_data_provider.ConsumeBool()) {
-                        coins_cache_entry.coin = random_coin;
+                        coins_cache_entry.SetCoin(Coin{random_coin});
                     } else {
                         const std::optional<Coin> opt_coin = ConsumeDeserializable<Coin>(fuzzed_data_provider);
                         if (!opt_coin) {
                             return;
                         }
-                        coins_cache_entry.coin = *opt_coin;
+                        coins_cache_entry.SetCoin(Coin{*opt_coin});
                     }
                     coins_map.emplace(random_out_point, std::move(coins_cache_entry));
                 }
@@ -228,6 +228,20 @@ public:
         m_tracker.RequestedTx(peer, TXHASHES[txhash], exptime);
     }
 
+    void DelayTx(int peer, int txhash, std::chrono::microseconds reqtime)
+    {
+        // Apply to naive structure: if a CANDIDATE announcement exists for peer/txhash, change its reqtime.
+        if (m_announcements[txhash][peer].m_state == State::CANDIDATE) {
+            m_announcements[txhash][peer].m_time = reqtime;
+        }
+
+        // Add event so that AdvanceToEvent can quickly jump to the point where its reqtime passes.
+        if (reqtime > m_now) m_events.push(reqtime);
+
+        // Call TxRequestTracker's implementation.
+        m_tracker.DelayTx(peer, TXHASHES[txhash], reqtime);
+    }
+
     void ReceivedResponse(int peer, int txhash)
     {
         // Apply to naive structure: convert anything to COMPLETED.
@@ -318,7 +332,7 @@ FUZZ_TARGET(txrequest)
     // Decode the input as a sequence of instructions with parameters
     auto it = buffer.begin();
     while (it != buffer.end()) {
-        int cmd = *(it++) % 11;
+        int cmd = *(it++) % 12;
         int peer, txidnum, delaynum;
         switch (cmd) {
         case 0: // Make time jump to the next event (m_time of CANDIDATE or REQUESTED)
@@ -366,6 +380,12 @@ FUZZ_TARGET(txrequest)
             txidnum = it == buffer.end() ? 0 : *(it++);
             tester.ReceivedResponse(peer, txidnum % MAX_TXHASHES);
             break;
+        case 11: // Postponed request from peer
+            peer = it == buffer.end() ? 0 : *(it++) % MAX_PEERS;
+            txidnum = it == buffer.end() ? 0 : *(it++);
+            delaynum = it == buffer.end() ? 0 : *(it++);
+            tester.DelayTx(peer, txidnum % MAX_TXHASHES, tester.Now() + DELAYS[delaynum]);
+            break;
         default:
             assert(false);
         }
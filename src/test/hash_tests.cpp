@@ -145,6 +145,26 @@ BOOST_AUTO_TEST_CASE(siphash)
         BOOST_CHECK_EQUAL(SipHashUint256(k1, k2, x), sip256.Finalize());
         BOOST_CHECK_EQUAL(SipHashUint256Extra(k1, k2, x, n), sip288.Finalize());
     }
+
+    // Check consistency between SipHashUint256[Extra] and their 4-way versions.
+    for (int i = 0; i < 16; ++i) {
+        uint64_t k1 = ctx.rand64();
+        uint64_t k2 = ctx.rand64();
+        uint256 x[4];
+        uint32_t n[4];
+        for (int j = 0; j < 4; ++j) {
+            x[j] = InsecureRand256();
+            n[j] = ctx.rand32();
+        }
+        const uint256* const vals[4] = {&x[0], &x[1], &x[2], &x[3]};
+        uint64_t out[4], out_extra[4];
+        SipHashUint256_4way(k1, k2, vals, out);
+        SipHashUint256Extra_4way(k1, k2, vals, n, out_extra);
+        for (int j = 0; j < 4; ++j) {
+            BOOST_CHECK_EQUAL(out[j], SipHashUint256(k1, k2, x[j]));
+            BOOST_CHECK_EQUAL(out_extra[j], SipHashUint256Extra(k1, k2, x[j], n[j]));
+        }
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -426,6 +426,8 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     CTxMemPool pool;
     LOCK2(cs_main, pool.cs);
     TestMemPoolEntryHelper entry;
+    // Memory kept for reuse after removals is not trimmed for.
+    const auto used = [&] { return pool.DynamicMemoryUsage() - pool.FreeMemoryUsage(); };
 
     CMutableTransaction tx1 = CMutableTransaction();
     tx1.vin.resize(1);
@@ -447,7 +449,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx1.GetHash())));
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx2.GetHash())));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4); // should remove the lower-feerate transaction
+    pool.TrimToSize(used() * 3 / 4); // should remove the lower-feerate transaction
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx1.GetHash())));
     BOOST_CHECK(!pool.exists(GenTxid::Txid(tx2.GetHash())));
 
@@ -461,7 +463,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     tx3.vout[0].nValue = 10 * COIN;
     pool.addUnchecked(entry.Fee(20000LL).FromTx(tx3));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4); // tx3 should pay for tx2 (CPFP)
+    pool.TrimToSize(used() * 3 / 4); // tx3 should pay for tx2 (CPFP)
     BOOST_CHECK(!pool.exists(GenTxid::Txid(tx1.GetHash())));
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx2.GetHash())));
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx3.GetHash())));
@@ -528,7 +530,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(entry.Fee(9000LL).FromTx(tx7));
 
     // we only require this to remove, at max, 2 txn, because it's not clear what we're really optimizing for aside from that
-    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    pool.TrimToSize(used() - 1);
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx4.GetHash())));
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx6.GetHash())));
     BOOST_CHECK(!pool.exists(GenTxid::Txid(tx7.GetHash())));
@@ -537,7 +539,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
         pool.addUnchecked(entry.Fee(1000LL).FromTx(tx5));
     pool.addUnchecked(entry.Fee(9000LL).FromTx(tx7));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    pool.TrimToSize(used() / 2); // should maximize mempool size by only removing 5/7
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx4.GetHash())));
     BOOST_CHECK(!pool.exists(GenTxid::Txid(tx5.GetHash())));
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx6.GetHash())));
@@ -557,11 +559,11 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     // ... then feerate should drop 1/2 each halflife
 
     SetMockTime(42 + 2*CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE/2);
-    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 5 / 2).GetFeePerK(), llround((maxFeeRateRemoved.GetFeePerK() + 1000)/4.0));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(used() * 5 / 2).GetFeePerK(), llround((maxFeeRateRemoved.GetFeePerK() + 1000)/4.0));
     // ... with a 1/2 halflife when mempool is < 1/2 its target size
 
     SetMockTime(42 + 2*CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE/2 + CTxMemPool::ROLLING_FEE_HALFLIFE/4);
-    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 9 / 2).GetFeePerK(), llround((maxFeeRateRemoved.GetFeePerK() + 1000)/8.0));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(used() * 9 / 2).GetFeePerK(), llround((maxFeeRateRemoved.GetFeePerK() + 1000)/8.0));
     // ... with a 1/4 halflife when mempool is < 1/4 its target size
 
     SetMockTime(42 + 7*CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE/2 + CTxMemPool::ROLLING_FEE_HALFLIFE/4);
@@ -786,4 +788,127 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 4ULL);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool{/* estimator */ nullptr, /* check_ratio */ 0, /* track_clusters */ true};
+    LOCK2(::cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // a has a high-fee child b and a low-fee child d; c stands alone.
+    CTransactionRef a = make_tx(/* output_values */ {10 * COIN, 10 * COIN, 10 * COIN});
+    CTransactionRef b = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {a}, /* input_indices */ {0});
+    CTransactionRef c = make_tx(/* output_values */ {5 * COIN});
+    CTransactionRef d = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {a}, /* input_indices */ {1});
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(a));
+    pool.addUnchecked(entry.Fee(20000LL).FromTx(b));
+    pool.addUnchecked(entry.Fee(5000LL).FromTx(c));
+    pool.addUnchecked(entry.Fee(100LL).FromTx(d));
+    const auto vsize = [](const CTransactionRef& tx) { return GetVirtualTransactionSize(*tx); };
+
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 2U);
+    const CTxMemPool::Cluster& cluster = pool.GetClusters().at(pool.GetIter(a->GetHash()).value()->m_cluster_id);
+    BOOST_REQUIRE_EQUAL(cluster.txs.size(), 3U);
+    BOOST_CHECK(cluster.txs[0]->GetTx().GetHash() == a->GetHash());
+    BOOST_CHECK(cluster.txs[1]->GetTx().GetHash() == b->GetHash());
+    BOOST_CHECK(cluster.txs[2]->GetTx().GetHash() == d->GetHash());
+    BOOST_REQUIRE_EQUAL(cluster.chunks.size(), 2U);
+    BOOST_CHECK_EQUAL(cluster.chunks[0].end, 2U);
+    BOOST_CHECK_EQUAL(cluster.chunks[0].fee, 21000);
+    for (size_t i = 0; i < cluster.txs.size(); ++i) BOOST_CHECK_EQUAL(cluster.txs[i]->m_cluster_pos, i);
+
+    // b pays for a, and replacing a means beating the feerate of both.
+    BOOST_CHECK(pool.GetMiningFeeRate(pool.GetIter(a->GetHash()).value()) == CFeeRate(21000, vsize(a) + vsize(b)));
+    BOOST_CHECK(pool.GetMiningFeeRate(pool.GetIter(d->GetHash()).value()) == CFeeRate(100, vsize(d)));
+
+    // The last chunk with the lowest feerate is evicted first.
+    pool.TrimToSize(pool.DynamicMemoryUsage() - pool.FreeMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(GenTxid::Txid(a->GetHash())));
+    BOOST_CHECK(pool.exists(GenTxid::Txid(b->GetHash())));
+    BOOST_CHECK(pool.exists(GenTxid::Txid(c->GetHash())));
+    BOOST_CHECK(!pool.exists(GenTxid::Txid(d->GetHash())));
+
+    // Without b, a is mined at its own feerate.
+    pool.removeRecursive(*b, REMOVAL_REASON_DUMMY);
+    BOOST_CHECK(pool.GetMiningFeeRate(pool.GetIter(a->GetHash()).value()) == CFeeRate(1000, vsize(a)));
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 2U);
+
+    // Spending both a and c merges their clusters.
+    CTransactionRef e = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {a, c}, /* input_indices */ {2, 0});
+    pool.addUnchecked(entry.Fee(50000LL).FromTx(e));
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 1U);
+    BOOST_CHECK_EQUAL(pool.GetClusters().begin()->second.txs.size(), 3U);
+    BOOST_CHECK(pool.GetMiningFeeRate(pool.GetIter(a->GetHash()).value()) == CFeeRate(56000, vsize(a) + vsize(c) + vsize(e)));
+
+    // Mining a keeps c and e connected through e, and mining c leaves e alone.
+    pool.removeForBlock({a}, 1);
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 1U);
+    BOOST_CHECK_EQUAL(pool.GetClusters().begin()->second.txs.size(), 2U);
+    pool.removeForBlock({c}, 1);
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 1U);
+    BOOST_CHECK(pool.GetMiningFeeRate(pool.GetIter(e->GetHash()).value()) == CFeeRate(50000, vsize(e)));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterSizeTest)
+{
+    CTxMemPool pool{/* estimator */ nullptr, /* check_ratio */ 0, /* track_clusters */ true};
+    LOCK2(::cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // a and its child b form one cluster, c another.
+    CTransactionRef a = make_tx(/* output_values */ {10 * COIN, 10 * COIN});
+    CTransactionRef b = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {a}, /* input_indices */ {0});
+    CTransactionRef c = make_tx(/* output_values */ {5 * COIN});
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(a));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(b));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(c));
+    const CTxMemPool::txiter it_a = pool.GetIter(a->GetHash()).value();
+    const CTxMemPool::txiter it_b = pool.GetIter(b->GetHash()).value();
+    const CTxMemPool::txiter it_c = pool.GetIter(c->GetHash()).value();
+
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({}, 1, {}), 1U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({it_a}, 1, {}), 3U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({it_a, it_b}, 1, {}), 3U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({it_a, it_c}, 2, {}), 5U);
+    // Replaced transactions leave the cluster, unless they are elsewhere.
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({it_a}, 1, {it_b}), 2U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({it_a}, 1, {it_c}), 3U);
+
+    // Removing a splits b from the rest, and b keeps its position up to date.
+    pool.removeForBlock({a}, 1);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({it_c}, 1, {}), 2U);
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 2U);
+    for (const auto& [id, cluster] : pool.GetClusters()) {
+        BOOST_REQUIRE_EQUAL(cluster.txs.size(), 1U);
+        BOOST_CHECK_EQUAL(cluster.txs[0]->m_cluster_pos, 0U);
+    }
+
+    // Without clusters, nothing is counted.
+    CTxMemPool untracked;
+    LOCK(untracked.cs);
+    BOOST_CHECK_EQUAL(untracked.CalculateClusterSize({}, 1, {}), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolMemoryUsageTest)
+{
+    CTxMemPool pool;
+    LOCK2(::cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // The entry pool's chunks count as soon as they are allocated.
+    CTransactionRef a = make_tx(/* output_values */ {10 * COIN});
+    pool.addUnchecked(entry.FromTx(a));
+    const size_t usage{pool.DynamicMemoryUsage()};
+    BOOST_CHECK_GE(usage, CTxMemPool::EntryResource::DEFAULT_CHUNK_SIZE_BYTES);
+    const size_t free{pool.FreeMemoryUsage()};
+    BOOST_CHECK_LT(free, usage);
+
+    // A removed entry's node stays allocated for the next one to reuse.
+    pool.removeRecursive(*a, REMOVAL_REASON_DUMMY);
+    BOOST_CHECK_GT(pool.FreeMemoryUsage(), free);
+    CTransactionRef b = make_tx(/* output_values */ {5 * COIN});
+    pool.addUnchecked(entry.FromTx(b));
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), usage);
+    BOOST_CHECK_EQUAL(pool.FreeMemoryUsage(), free);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
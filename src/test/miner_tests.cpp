@@ -9,6 +9,7 @@
 #include <consensus/tx_verify.h>
 #include <miner.h>
 #include <policy/policy.h>
+#include <pow.h>
 #include <script/standard.h>
 #include <txmempool.h>
 #include <uint256.h>
@@ -16,6 +17,7 @@
 #include <util/system.h>
 #include <util/time.h>
 #include <validation.h>
+#include <validationinterface.h>
 #include <versionbits.h>
 
 #include <test/util/setup_common.h>
@@ -526,4 +528,99 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(grind_block_nonce)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = InsecureRand256();
+    header.hashMerkleRoot = InsecureRand256();
+    header.nTime = 1600000000;
+    header.nBits = 0x1f0fffff; // Roughly one in 4096 hashes is valid.
+    header.nNonce = 1000;
+
+    // Reference: the lowest valid nonce, found one hash at a time.
+    CBlockHeader expected = header;
+    while (!CheckProofOfWork(expected.GetHash(), expected.nBits, params)) ++expected.nNonce;
+
+    const auto no_interrupt = [] { return false; };
+    for (int threads : {1, 3}) {
+        CBlockHeader ground = header;
+        uint64_t max_tries{1000000};
+        uint64_t hashes{0};
+        BOOST_CHECK(GrindBlockNonce(ground, params, max_tries, threads, no_interrupt, hashes));
+        BOOST_CHECK_EQUAL(ground.nNonce, expected.nNonce);
+        BOOST_CHECK_EQUAL(max_tries, 1000000U - (expected.nNonce - header.nNonce));
+        BOOST_CHECK(hashes > expected.nNonce - header.nNonce);
+    }
+
+    // Running out of tries leaves the nonce just past the last one tried.
+    CBlockHeader ground = header;
+    uint64_t max_tries{expected.nNonce - header.nNonce};
+    uint64_t hashes{0};
+    BOOST_CHECK(!GrindBlockNonce(ground, params, max_tries, 2, no_interrupt, hashes));
+    BOOST_CHECK_EQUAL(max_tries, 0U);
+    BOOST_CHECK_EQUAL(ground.nNonce, expected.nNonce);
+
+    // An interrupted search gives up.
+    ground = header;
+    max_tries = 1000000;
+    BOOST_CHECK(!GrindBlockNonce(ground, params, max_tries, 2, [] { return true; }, hashes));
+    BOOST_CHECK_EQUAL(hashes, 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE(block_template_maintainer, TestChain100Setup)
+{
+    BlockTemplateMaintainer maintainer{*m_node.chainman, *m_node.mempool, Params(), /* fee_increase_percent */ 0};
+    RegisterValidationInterface(&maintainer);
+    const auto get_template = [&] {
+        LOCK(cs_main);
+        return maintainer.GetTemplate(m_node.chainman->ActiveChain().Tip());
+    };
+    const auto process = [&] {
+        SyncWithValidationInterfaceQueue();
+        maintainer.ProcessPending();
+    };
+
+    std::unique_ptr<CBlockTemplate> block_template{get_template()};
+    BOOST_CHECK_EQUAL(block_template->block.vtx.size(), 1U);
+    uint64_t sequence{maintainer.GetSequence()};
+
+    // A parent and its child are appended to the template in order.
+    const CScript dest{GetScriptForRawPubKey(coinbaseKey.GetPubKey())};
+    const CAmount fee{10000};
+    const CTransactionRef parent{MakeTransactionRef(CreateValidMempoolTransaction(m_coinbase_txns[0], 0, 1, coinbaseKey, dest, m_coinbase_txns[0]->vout[0].nValue - fee))};
+    const CTransactionRef child{MakeTransactionRef(CreateValidMempoolTransaction(parent, 0, 101, coinbaseKey, dest, parent->vout[0].nValue - fee))};
+    process();
+    BOOST_CHECK(maintainer.GetSequence() > sequence);
+    sequence = maintainer.GetSequence();
+    block_template = get_template();
+    BOOST_REQUIRE_EQUAL(block_template->block.vtx.size(), 3U);
+    BOOST_CHECK(block_template->block.vtx[1]->GetHash() == parent->GetHash());
+    BOOST_CHECK(block_template->block.vtx[2]->GetHash() == child->GetHash());
+    BOOST_CHECK_EQUAL(block_template->vTxFees[0], -2 * fee);
+    {
+        LOCK(cs_main);
+        BlockValidationState state;
+        BOOST_CHECK(TestBlockValidity(state, Params(), m_node.chainman->ActiveChainstate(), block_template->block, m_node.chainman->ActiveChain().Tip(), false, false));
+    }
+
+    // Losing a template transaction rebuilds the template.
+    WITH_LOCK(m_node.mempool->cs, m_node.mempool->removeRecursive(*child, MemPoolRemovalReason::CONFLICT));
+    process();
+    BOOST_CHECK(maintainer.GetSequence() > sequence);
+    block_template = get_template();
+    BOOST_REQUIRE_EQUAL(block_template->block.vtx.size(), 2U);
+    BOOST_CHECK(block_template->block.vtx[1]->GetHash() == parent->GetHash());
+
+    // The template follows a new tip.
+    const CBlock block{CreateAndProcessBlock({}, dest)};
+    process();
+    block_template = get_template();
+    BOOST_CHECK(block_template->block.hashPrevBlock == block.GetHash());
+    BOOST_CHECK_EQUAL(block_template->block.vtx.size(), 2U);
+
+    UnregisterValidationInterface(&maintainer);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -110,6 +110,15 @@ BOOST_AUTO_TEST_CASE(streams_vector_reader)
     // Reading after end of byte vector throws an error even if the reader is
     // not totally empty.
     BOOST_CHECK_THROW(new_reader >> d, std::ios_base::failure);
+
+    // Skip bytes without reading them.
+    VectorReader skip_reader(SER_NETWORK, INIT_PROTO_VERSION, vch, 0);
+    skip_reader.ignore(2);
+    skip_reader >> a;
+    BOOST_CHECK_EQUAL(a, 3);
+    BOOST_CHECK_THROW(skip_reader.ignore(3), std::ios_base::failure);
+    skip_reader.ignore(2);
+    BOOST_CHECK(skip_reader.empty());
 }
 
 BOOST_AUTO_TEST_CASE(streams_vector_reader_rvalue)
@@ -0,0 +1,117 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <sync.h>
+#include <util/threadpool.h>
+
+#include <test/util/setup_common.h>
+
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(threadpool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(run_tasks)
+{
+    ThreadPool pool{"test"};
+    pool.Start(4);
+    BOOST_CHECK_EQUAL(pool.WorkerCount(), 4U);
+
+    std::atomic<int> sum{0};
+    std::vector<std::future<void>> results;
+    for (int i = 1; i <= 100; ++i) {
+        results.push_back(pool.Submit([&sum, i] { sum += i; }));
+    }
+    for (auto& result : results) result.get();
+    BOOST_CHECK_EQUAL(sum, 5050);
+}
+
+BOOST_AUTO_TEST_CASE(one_thread_in_order)
+{
+    ThreadPool pool{"test"};
+    pool.Start(1);
+
+    Mutex mutex;
+    std::vector<int> order;
+    std::thread::id worker;
+    std::vector<std::future<void>> results;
+    for (int i = 0; i < 50; ++i) {
+        results.push_back(pool.Submit([&, i] {
+            LOCK(mutex);
+            if (order.empty()) worker = std::this_thread::get_id();
+            BOOST_CHECK(worker == std::this_thread::get_id());
+            order.push_back(i);
+        }));
+    }
+    for (auto& result : results) result.get();
+    BOOST_CHECK(worker != std::this_thread::get_id());
+    for (int i = 0; i < 50; ++i) {
+        BOOST_CHECK_EQUAL(order.at(i), i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stopped_runs_inline)
+{
+    ThreadPool pool{"test"};
+    const auto run_here{[&] {
+        std::thread::id ran_on;
+        auto result{pool.Submit([&] { ran_on = std::this_thread::get_id(); })};
+        BOOST_CHECK(result.wait_for(std::chrono::seconds{0}) == std::future_status::ready);
+        return ran_on == std::this_thread::get_id();
+    }};
+
+    // Before Start(), with no threads, and after Stop().
+    BOOST_CHECK_EQUAL(pool.WorkerCount(), 0U);
+    BOOST_CHECK(run_here());
+    pool.Start(0);
+    BOOST_CHECK(run_here());
+    pool.Start(2);
+    pool.Stop();
+    BOOST_CHECK_EQUAL(pool.WorkerCount(), 0U);
+    BOOST_CHECK(run_here());
+
+    // And it can be started again.
+    pool.Start(1);
+    std::thread::id ran_on;
+    pool.Submit([&] { ran_on = std::this_thread::get_id(); }).get();
+    BOOST_CHECK(ran_on != std::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(stop_finishes_queued)
+{
+    ThreadPool pool{"test"};
+    pool.Start(1);
+
+    // Hold the thread until everything is queued.
+    std::promise<void> release;
+    auto held{release.get_future().share()};
+    std::atomic<int> done{0};
+    pool.Submit([held] { held.wait(); });
+    for (int i = 0; i < 10; ++i) {
+        pool.Submit([&done] { ++done; });
+    }
+    release.set_value();
+    pool.Stop();
+    BOOST_CHECK_EQUAL(done, 10);
+}
+
+BOOST_AUTO_TEST_CASE(exceptions)
+{
+    ThreadPool pool{"test"};
+    pool.Start(2);
+    auto result{pool.Submit([] { throw std::runtime_error{"task failed"}; })};
+    BOOST_CHECK_THROW(result.get(), std::runtime_error);
+
+    // The thread carries on with the next task.
+    bool ran{false};
+    pool.Submit([&ran] { ran = true; }).get();
+    BOOST_CHECK(ran);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
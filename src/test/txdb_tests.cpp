@@ -0,0 +1,95 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <fs.h>
+#include <txdb.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <test/util/setup_common.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(block_index_snapshot)
+{
+    LOCK(cs_main);
+    const auto& consensus{Params().GetConsensus()};
+    std::vector<const CBlockIndex*> index;
+    for (const auto& [_, pindex] : m_node.chainman->m_blockman.m_block_index) {
+        index.push_back(pindex);
+    }
+    std::sort(index.begin(), index.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+
+    // The test setup's block tree database lives in memory, which never uses a snapshot.
+    CBlockTreeDB db(1 << 20, /*fMemory=*/false, /*fWipe=*/true);
+    BOOST_REQUIRE(db.WriteBatchSync({}, 0, index));
+    const fs::path snapshot_path{gArgs.GetDataDirNet() / "blocks" / "index.snapshot"};
+
+    // Load the index into a new block manager, and compare it with the original.
+    const auto check_load = [&](bool from_snapshot) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+        BlockManager blockman;
+        const auto insert{[&](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return blockman.InsertBlockIndex(hash); }};
+        BOOST_CHECK_EQUAL(db.LoadBlockIndexSnapshot(consensus, insert), from_snapshot);
+        if (!from_snapshot) {
+            BOOST_CHECK(blockman.m_block_index.empty());
+            BOOST_CHECK(db.LoadBlockIndexGuts(consensus, insert));
+        }
+        BOOST_REQUIRE_EQUAL(blockman.m_block_index.size(), index.size());
+        for (const CBlockIndex* pindex : index) {
+            const CBlockIndex* copy{blockman.LookupBlockIndex(pindex->GetBlockHash())};
+            BOOST_REQUIRE(copy);
+            BOOST_CHECK_EQUAL(copy->GetBlockHeader().GetHash(), pindex->GetBlockHash());
+            BOOST_CHECK_EQUAL(copy->nHeight, pindex->nHeight);
+            BOOST_CHECK_EQUAL(copy->nStatus, pindex->nStatus);
+            BOOST_CHECK_EQUAL(copy->nTx, pindex->nTx);
+            BOOST_CHECK_EQUAL(copy->GetBlockPos().ToString(), pindex->GetBlockPos().ToString());
+            BOOST_CHECK_EQUAL(copy->GetUndoPos().ToString(), pindex->GetUndoPos().ToString());
+        }
+        blockman.Unload();
+    };
+
+    check_load(/*from_snapshot=*/false);
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(index));
+    check_load(/*from_snapshot=*/true);
+
+    // A damaged snapshot is ignored.
+    FILE* file{fsbridge::fopen(snapshot_path, "rb+")};
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fseek(file, 100, SEEK_SET), 0);
+    const int byte{fgetc(file)};
+    BOOST_REQUIRE_EQUAL(fseek(file, 100, SEEK_SET), 0);
+    BOOST_REQUIRE_EQUAL(fputc(byte ^ 1, file), byte ^ 1);
+    fclose(file);
+    check_load(/*from_snapshot=*/false);
+
+    // So is one written before the last change to the index.
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(index));
+    check_load(/*from_snapshot=*/true);
+    BOOST_REQUIRE(db.WriteBatchSync({}, 0, {}));
+    check_load(/*from_snapshot=*/false);
+
+    // An older version leaves the snapshot in place when it stores a block,
+    // but it does update the last block file's info, or move on to a new file.
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(index));
+    check_load(/*from_snapshot=*/true);
+    CBlockFileInfo info;
+    info.nBlocks = 1;
+    BOOST_REQUIRE(db.Write(std::make_pair(uint8_t{'f'}, 0), info));
+    check_load(/*from_snapshot=*/false);
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(index));
+    check_load(/*from_snapshot=*/true);
+    BOOST_REQUIRE(db.Write(uint8_t{'l'}, 1));
+    check_load(/*from_snapshot=*/false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
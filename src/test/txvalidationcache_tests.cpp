@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <consensus/amount.h>
 #include <consensus/validation.h>
 #include <key.h>
 #include <script/sign.h>
@@ -13,6 +14,8 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <thread>
+
 struct Dersig100Setup : public TestChain100Setup {
     Dersig100Setup()
         : TestChain100Setup{{"-testactivationheight=dersig@102"}} {}
@@ -21,7 +24,7 @@ struct Dersig100Setup : public TestChain100Setup {
 bool CheckInputScripts(const CTransaction& tx, TxValidationState& state,
                        const CCoinsViewCache& inputs, unsigned int flags, bool cacheSigStore,
                        bool cacheFullScriptStore, PrecomputedTransactionData& txdata,
-                       std::vector<CScriptCheck>* pvChecks) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+                       std::vector<CScriptCheck>* pvChecks, DeferredTxData* deferred = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 BOOST_AUTO_TEST_SUITE(txvalidationcache_tests)
 
@@ -102,6 +105,69 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, Dersig100Setup)
     BOOST_CHECK_EQUAL(m_node.mempool->size(), 0U);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_script_checks, Dersig100Setup)
+{
+    // A transaction with enough inputs has its scripts checked on the mempool
+    // script check threads. A failure must still be reported as such, with the
+    // reason a serial check would give.
+    BOOST_REQUIRE(g_parallel_script_checks);
+    const unsigned int num_inputs{MIN_PARALLEL_MEMPOOL_SCRIPT_CHECKS + 4};
+
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    const auto ToMemPool = [this](const CMutableTransaction& tx) {
+        LOCK(cs_main);
+        return m_node.chainman->ProcessTransaction(MakeTransactionRef(tx));
+    };
+    const auto Sign = [&](CMutableTransaction& tx, unsigned int input, unsigned int signed_input) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, signed_input, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[input].scriptSig = CScript() << vchSig;
+    };
+
+    // Split a mature coinbase output into as many coins as we want inputs, and confirm them.
+    CMutableTransaction fan_out;
+    fan_out.nVersion = 1;
+    fan_out.vin.resize(1);
+    fan_out.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    fan_out.vout.resize(num_inputs);
+    for (CTxOut& out : fan_out.vout) {
+        out.nValue = 11 * CENT;
+        out.scriptPubKey = scriptPubKey;
+    }
+    Sign(fan_out, 0, 0);
+    CreateAndProcessBlock({fan_out}, scriptPubKey);
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(m_node.chainman->ActiveChainstate().CoinsTip().HaveCoin(COutPoint(fan_out.GetHash(), 0)));
+    }
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(num_inputs);
+    for (unsigned int i = 0; i < num_inputs; ++i) {
+        spend.vin[i].prevout = COutPoint(fan_out.GetHash(), i);
+    }
+    spend.vout.resize(1);
+    spend.vout[0].nValue = num_inputs * 10 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    for (unsigned int i = 0; i < num_inputs; ++i) Sign(spend, i, i);
+
+    // The last input carries a signature for another input.
+    CMutableTransaction bad_spend{spend};
+    Sign(bad_spend, num_inputs - 1, 0);
+    const MempoolAcceptResult bad_result{ToMemPool(bad_spend)};
+    BOOST_CHECK(bad_result.m_result_type == MempoolAcceptResult::ResultType::INVALID);
+    BOOST_CHECK(bad_result.m_state.GetResult() == TxValidationResult::TX_CONSENSUS);
+    BOOST_CHECK_EQUAL(bad_result.m_state.GetRejectReason().rfind("mandatory-script-verify-flag-failed", 0), 0U);
+
+    const MempoolAcceptResult result{ToMemPool(spend)};
+    BOOST_CHECK(result.m_result_type == MempoolAcceptResult::ResultType::VALID);
+    BOOST_CHECK(m_node.mempool->exists(GenTxid::Txid(spend.GetHash())));
+}
+
 // Run CheckInputScripts (using CoinsTip()) on the given transaction, for all script
 // flags.  Test that CheckInputScripts passes for all flags that don't overlap with
 // the failing_flags argument, but otherwise fails.
@@ -383,4 +449,47 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, Dersig100Setup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(deferred_txdata, BasicTestingSetup)
+{
+    // Spend a mix of witness v0 and v1 outputs, so that both the BIP143 and
+    // the BIP341 midstates get computed.
+    CMutableTransaction mtx;
+    std::vector<CTxOut> spent_outputs;
+    for (int i = 0; i < 6; ++i) {
+        mtx.vin.emplace_back(COutPoint(InsecureRand256(), i));
+        mtx.vin.back().nSequence = InsecureRand32();
+        mtx.vin.back().scriptWitness.stack.push_back(g_insecure_rand_ctx.randbytes(64));
+        const uint256 program{InsecureRand256()};
+        spent_outputs.emplace_back(InsecureRandRange(MAX_MONEY), CScript() << (i % 2 ? OP_1 : OP_0) << ToByteVector(program));
+    }
+    mtx.vout.emplace_back(InsecureRandRange(MAX_MONEY), CScript() << OP_TRUE);
+    const CTransaction tx{mtx};
+
+    PrecomputedTransactionData expected;
+    expected.Init(tx, std::vector<CTxOut>{spent_outputs});
+
+    // Race several threads to initialize the same transaction data.
+    PrecomputedTransactionData txdata;
+    DeferredTxData deferred;
+    deferred.m_spent_outputs = spent_outputs;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&] { deferred.Init(tx, txdata); });
+    }
+    for (auto& thread : threads) thread.join();
+
+    BOOST_CHECK(txdata.m_spent_outputs_ready);
+    BOOST_CHECK(txdata.m_bip143_segwit_ready);
+    BOOST_CHECK(txdata.m_bip341_taproot_ready);
+    BOOST_CHECK(txdata.m_spent_outputs == spent_outputs);
+    BOOST_CHECK_EQUAL(txdata.hashPrevouts, expected.hashPrevouts);
+    BOOST_CHECK_EQUAL(txdata.hashSequence, expected.hashSequence);
+    BOOST_CHECK_EQUAL(txdata.hashOutputs, expected.hashOutputs);
+    BOOST_CHECK_EQUAL(txdata.m_prevouts_single_hash, expected.m_prevouts_single_hash);
+    BOOST_CHECK_EQUAL(txdata.m_sequences_single_hash, expected.m_sequences_single_hash);
+    BOOST_CHECK_EQUAL(txdata.m_outputs_single_hash, expected.m_outputs_single_hash);
+    BOOST_CHECK_EQUAL(txdata.m_spent_amounts_single_hash, expected.m_spent_amounts_single_hash);
+    BOOST_CHECK_EQUAL(txdata.m_spent_scripts_single_hash, expected.m_spent_scripts_single_hash);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
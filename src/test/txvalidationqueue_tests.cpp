@@ -0,0 +1,263 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <net.h>
+#include <net_processing.h>
+#include <primitives/transaction.h>
+#include <protocol.h>
+#include <script/standard.h>
+#include <streams.h>
+#include <txmempool.h>
+#include <txvalidationqueue.h>
+#include <util/time.h>
+#include <version.h>
+
+#include <test/util/net.h>
+#include <test/util/setup_common.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txvalidationqueue_tests, BasicTestingSetup)
+
+namespace {
+
+/** A transaction told apart by n, with a witness if witness is not zero. */
+CTransactionRef MakeTx(uint32_t n, unsigned char witness = 0)
+{
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(COutPoint{uint256::ONE, n});
+    if (witness) mtx.vin[0].scriptWitness.stack.push_back({witness});
+    mtx.vout.emplace_back(1, CScript{} << OP_TRUE);
+    return MakeTransactionRef(mtx);
+}
+
+std::vector<CTransactionRef> Txs(const std::vector<TxValidationQueue::Entry>& batch)
+{
+    std::vector<CTransactionRef> txs;
+    for (const auto& entry : batch) txs.push_back(entry.tx);
+    return txs;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(dedup)
+{
+    TxValidationQueue queue{100, 1000000};
+    const auto tx{MakeTx(0, 1)};
+    BOOST_CHECK(queue.Push(0, tx));
+    BOOST_CHECK(queue.Contains(tx->GetHash()));
+    BOOST_CHECK(queue.Contains(tx->GetWitnessHash()));
+
+    // The same transaction, or another witness for it, from any peer.
+    BOOST_CHECK(!queue.Push(0, tx));
+    BOOST_CHECK(!queue.Push(1, tx));
+    const auto malleated{MakeTx(0, 2)};
+    BOOST_CHECK(malleated->GetHash() == tx->GetHash());
+    BOOST_CHECK(!queue.Push(1, malleated));
+    BOOST_CHECK_EQUAL(queue.Size(), 1U);
+    BOOST_CHECK_EQUAL(queue.Count(1), 0U);
+
+    // Still held while being validated, gone once done.
+    const auto batch{queue.PopBatch(10)};
+    BOOST_CHECK_EQUAL(batch.size(), 1U);
+    BOOST_CHECK(!queue.Push(1, tx));
+    queue.Finish(batch[0]);
+    BOOST_CHECK(!queue.Contains(tx->GetHash()));
+    BOOST_CHECK(!queue.Contains(tx->GetWitnessHash()));
+    BOOST_CHECK(queue.Push(1, malleated));
+}
+
+BOOST_AUTO_TEST_CASE(round_robin)
+{
+    TxValidationQueue queue{100, 1000000};
+    std::vector<CTransactionRef> txs;
+    for (uint32_t n = 0; n < 6; ++n) txs.push_back(MakeTx(n));
+    queue.Push(0, txs[0]);
+    queue.Push(0, txs[1]);
+    queue.Push(0, txs[2]);
+    queue.Push(1, txs[3]);
+    queue.Push(2, txs[4]);
+    queue.Push(2, txs[5]);
+
+    // One transaction per peer per round, each peer's in order.
+    auto batch{queue.PopBatch(4)};
+    BOOST_CHECK(Txs(batch) == (std::vector<CTransactionRef>{txs[0], txs[3], txs[4], txs[1]}));
+    BOOST_CHECK_EQUAL(batch[3].peer, 0);
+    BOOST_CHECK_EQUAL(queue.Size(), 2U);
+
+    // The next batch resumes after the peer served last.
+    batch = queue.PopBatch(4);
+    BOOST_CHECK(Txs(batch) == (std::vector<CTransactionRef>{txs[5], txs[2]}));
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    BOOST_CHECK(queue.PopBatch(4).empty());
+}
+
+BOOST_AUTO_TEST_CASE(limits)
+{
+    TxValidationQueue queue{2, 1000000};
+    BOOST_CHECK(!queue.IsFull(0));
+    queue.Push(0, MakeTx(0));
+    BOOST_CHECK(!queue.IsFull(0));
+    queue.Push(0, MakeTx(1));
+    BOOST_CHECK(queue.IsFull(0));
+    BOOST_CHECK(!queue.IsFull(1));
+
+    // Transactions being validated count until they are done.
+    const auto batch{queue.PopBatch(1)};
+    BOOST_CHECK(queue.IsFull(0));
+    BOOST_CHECK_EQUAL(queue.Count(0), 2U);
+    queue.Finish(batch[0]);
+    BOOST_CHECK(!queue.IsFull(0));
+    BOOST_CHECK_EQUAL(queue.Count(0), 1U);
+
+    // A single transaction over the byte limit is accepted, and fills it.
+    TxValidationQueue small{100, 10};
+    BOOST_CHECK(small.Push(0, MakeTx(0)));
+    BOOST_CHECK(small.IsFull(0));
+}
+
+BOOST_AUTO_TEST_CASE(disconnect)
+{
+    TxValidationQueue queue{100, 1000000};
+    const auto tx0{MakeTx(0)};
+    const auto tx1{MakeTx(1)};
+    const auto tx2{MakeTx(2)};
+    queue.Push(0, tx0);
+    queue.Push(0, tx1);
+    queue.Push(1, tx2);
+    const auto batch{queue.PopBatch(1)};
+    BOOST_CHECK(batch[0].tx == tx0);
+
+    // Queued transactions are dropped, the one being validated is kept.
+    queue.DisconnectedPeer(0);
+    BOOST_CHECK_EQUAL(queue.Size(), 1U);
+    BOOST_CHECK_EQUAL(queue.Count(0), 1U);
+    BOOST_CHECK(queue.Contains(tx0->GetHash()));
+    BOOST_CHECK(!queue.Contains(tx1->GetHash()));
+    queue.Finish(batch[0]);
+    BOOST_CHECK_EQUAL(queue.Count(0), 0U);
+    BOOST_CHECK(!queue.Contains(tx0->GetHash()));
+
+    // Other peers are unaffected.
+    BOOST_CHECK(Txs(queue.PopBatch(10)) == std::vector<CTransactionRef>{tx2});
+}
+
+BOOST_FIXTURE_TEST_CASE(validation_thread, TestChain100Setup)
+{
+    auto connman{std::make_unique<ConnmanTestMsg>(0x1337, 0x1337, *m_node.addrman)};
+    auto peerman{PeerManager::make(Params(), *connman, *m_node.addrman, nullptr,
+                                   *m_node.chainman, *m_node.mempool, false)};
+    CNode node{0, ServiceFlags(NODE_NETWORK | NODE_WITNESS), INVALID_SOCKET, CAddress{}, /* nKeyedNetGroupIn */ 0, /* nLocalHostNonceIn */ 0, CAddress(), /* pszDest */ "", ConnectionType::INBOUND, /* inbound_onion */ false};
+    node.SetCommonVersion(PROTOCOL_VERSION);
+    peerman->InitializeNode(&node);
+    node.nVersion = PROTOCOL_VERSION;
+    node.fSuccessfullyConnected = true;
+
+    const CScript dest{GetScriptForRawPubKey(coinbaseKey.GetPubKey())};
+    const CAmount fee{10000};
+    const CTransactionRef parent{MakeTransactionRef(CreateValidMempoolTransaction(m_coinbase_txns[0], 0, 1, coinbaseKey, dest, m_coinbase_txns[0]->vout[0].nValue - fee, /* submit */ false))};
+    const CTransactionRef child{MakeTransactionRef(CreateValidMempoolTransaction(parent, 0, 101, coinbaseKey, dest, parent->vout[0].nValue - fee, /* submit */ false))};
+    const CTransactionRef other{MakeTransactionRef(CreateValidMempoolTransaction(m_coinbase_txns[1], 0, 2, coinbaseKey, dest, m_coinbase_txns[1]->vout[0].nValue - fee, /* submit */ false))};
+
+    std::atomic<bool> interrupt{false};
+    const auto send = [&](const CTransactionRef& tx) {
+        CDataStream stream{SER_NETWORK, PROTOCOL_VERSION};
+        stream << tx;
+        peerman->ProcessMessage(node, NetMsgType::TX, stream, GetTime<std::chrono::microseconds>(), interrupt);
+    };
+    const auto in_mempool = [&](const CTransactionRef& tx) {
+        LOCK(m_node.mempool->cs);
+        return m_node.mempool->exists(GenTxid::Txid(tx->GetHash()));
+    };
+
+    // The child arrives first and is kept as an orphan. Once the thread has
+    // accepted the parent, it reconsiders the child as well.
+    peerman->StartTxValidation();
+    send(child);
+    send(parent);
+    for (int i = 0; i < 1000 && !(in_mempool(parent) && in_mempool(child)); ++i) {
+        UninterruptibleSleep(std::chrono::milliseconds{10});
+    }
+    BOOST_CHECK(in_mempool(parent));
+    BOOST_CHECK(in_mempool(child));
+
+    // Stopped, transactions are validated as they are received again.
+    peerman->StopTxValidation();
+    send(other);
+    BOOST_CHECK(in_mempool(other));
+
+    peerman->FinalizeNode(node);
+}
+
+BOOST_FIXTURE_TEST_CASE(full_queue_delays_requests, TestChain100Setup)
+{
+    auto connman{std::make_unique<ConnmanTestMsg>(0x1337, 0x1337, *m_node.addrman)};
+    auto peerman{PeerManager::make(Params(), *connman, *m_node.addrman, nullptr,
+                                   *m_node.chainman, *m_node.mempool, false)};
+    CNode node{0, ServiceFlags(NODE_NETWORK | NODE_WITNESS), INVALID_SOCKET, CAddress{}, /* nKeyedNetGroupIn */ 0, /* nLocalHostNonceIn */ 0, CAddress(), /* pszDest */ "", ConnectionType::INBOUND, /* inbound_onion */ false};
+    node.SetCommonVersion(PROTOCOL_VERSION);
+    peerman->InitializeNode(&node);
+    node.nVersion = PROTOCOL_VERSION;
+    node.fSuccessfullyConnected = true;
+
+    const CScript dest{GetScriptForRawPubKey(coinbaseKey.GetPubKey())};
+    const CAmount fee{10000};
+    const CTransactionRef last{MakeTransactionRef(CreateValidMempoolTransaction(m_coinbase_txns[0], 0, 1, coinbaseKey, dest, m_coinbase_txns[0]->vout[0].nValue - fee, /* submit */ false))};
+    const CTransactionRef wanted{MakeTx(1000)};
+
+    std::atomic<bool> interrupt{false};
+    const auto process = [&](const std::string& msg_type, CDataStream stream) {
+        peerman->ProcessMessage(node, msg_type, stream, GetTime<std::chrono::microseconds>(), interrupt);
+    };
+    const auto send = [&](const CTransactionRef& tx) {
+        process(NetMsgType::TX, CDataStream{SER_NETWORK, PROTOCOL_VERSION} << tx);
+    };
+    const auto getdata_bytes = [&] {
+        CNodeStats stats;
+        node.CopyStats(stats);
+        return stats.mapSendBytesPerMsgCmd[NetMsgType::GETDATA];
+    };
+    const auto send_messages = [&] {
+        LOCK(node.cs_sendProcessing);
+        BOOST_CHECK(peerman->SendMessages(&node));
+    };
+
+    peerman->StartTxValidation();
+    {
+        // Holding cs_main keeps the thread from finishing any transaction, so
+        // the peer stays at its limit. All but the last one are nonstandard,
+        // which is no reason to punish the peer.
+        LOCK(::cs_main);
+        for (uint32_t n = 0; n < 99; ++n) send(MakeTx(n));
+        send(last);
+
+        // The only peer that announced a transaction is not asked for it
+        // while at its limit...
+        process(NetMsgType::INV, CDataStream{SER_NETWORK, PROTOCOL_VERSION} << std::vector<CInv>{CInv{MSG_TX, wanted->GetHash()}});
+        SetMockTime(GetTime<std::chrono::seconds>() + std::chrono::seconds{3});
+        send_messages();
+        BOOST_CHECK_EQUAL(getdata_bytes(), 0U);
+    }
+
+    // ...but once its transactions are done.
+    for (int i = 0; i < 1000 && !WITH_LOCK(m_node.mempool->cs, return m_node.mempool->exists(GenTxid::Txid(last->GetHash()))); ++i) {
+        UninterruptibleSleep(std::chrono::milliseconds{10});
+    }
+    send_messages();
+    BOOST_CHECK_EQUAL(getdata_bytes(), 0U);
+    SetMockTime(GetTime<std::chrono::seconds>() + std::chrono::seconds{3});
+    send_messages();
+    BOOST_CHECK(getdata_bytes() > 0);
+
+    peerman->StopTxValidation();
+    peerman->FinalizeNode(node);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
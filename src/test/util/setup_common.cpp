@@ -11,11 +11,13 @@
 #include <consensus/params.h>
 #include <consensus/validation.h>
 #include <crypto/sha256.h>
+#include <crypto/sha3.h>
 #include <init.h>
 #include <interfaces/chain.h>
 #include <miner.h>
 #include <net.h>
 #include <net_processing.h>
+#include <node/blockstorage.h>
 #include <noui.h>
 #include <policy/fees.h>
 #include <pow.h>
@@ -108,6 +110,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName, const std::ve
     AppInitParameterInteraction(*m_node.args);
     LogInstance().StartLogging();
     SHA256AutoDetect();
+    KeccakAutoDetect();
     ECC_Start();
     SetupEnvironment();
     SetupNetworking();
@@ -150,12 +153,14 @@ ChainTestingSetup::ChainTestingSetup(const std::string& chainName, const std::ve
     constexpr int script_check_threads = 2;
     StartScriptCheckWorkerThreads(script_check_threads);
     g_parallel_script_checks = true;
+    StartBlockFileWriter();
 }
 
 ChainTestingSetup::~ChainTestingSetup()
 {
     if (m_node.scheduler) m_node.scheduler->stop();
     StopScriptCheckWorkerThreads();
+    StopBlockFileWriter();
     GetMainSignals().FlushBackgroundCallbacks();
     GetMainSignals().UnregisterBackgroundSignalScheduler();
     m_node.connman.reset();
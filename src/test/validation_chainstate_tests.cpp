@@ -6,9 +6,13 @@
 #include <random.h>
 #include <uint256.h>
 #include <consensus/validation.h>
+#include <node/blockstorage.h>
+#include <streams.h>
 #include <sync.h>
 #include <rpc/blockchain.h>
+#include <fs.h>
 #include <test/util/chainstate.h>
+#include <test/util/mining.h>
 #include <test/util/setup_common.h>
 #include <validation.h>
 
@@ -150,4 +154,73 @@ BOOST_FIXTURE_TEST_CASE(chainstate_update_tip, TestChain100Setup)
     BOOST_CHECK_EQUAL(curr_tip, ::g_best_block);
 }
 
+BOOST_AUTO_TEST_CASE(load_external_block_file)
+{
+    const auto chain{CreateBlockChain(20, Params())};
+    const auto& magic{Params().MessageStart()};
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    const auto write_record = [&](const CBlock& block, uint32_t size) {
+        stream << magic << size << block;
+    };
+    const auto write_bytes = [&](size_t count, unsigned char byte) {
+        stream << MakeSpan(std::vector<unsigned char>(count, byte));
+    };
+    for (size_t i = 0; i < chain.size(); ++i) {
+        const CBlock& block{*chain[i]};
+        const uint32_t size(GetSerializeSize(block, CLIENT_VERSION));
+        if (i == 3) {
+            // Garbage full of message start bytes.
+            write_bytes(100, magic[0]);
+        }
+        if (i == 5) {
+            // A record claiming to be larger than its block. The next block
+            // starts inside the claimed size.
+            write_record(block, size + 100);
+            continue;
+        }
+        if (i == 8) {
+            // A record that does not deserialize, covering the next block.
+            stream << magic << uint32_t{1000};
+            write_bytes(80, 0);
+            write_bytes(9, 0xff);
+        }
+        write_record(block, size);
+    }
+    // A block cut short by the end of the file.
+    stream << magic << uint32_t(GetSerializeSize(*chain[0], CLIENT_VERSION));
+    write_bytes(50, 0);
+
+    const fs::path path{m_args.GetDataDirBase() / "bootstrap.dat"};
+    FILE* file{fsbridge::fopen(path, "wb+")};
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(stream.data(), 1, stream.size(), file), stream.size());
+    rewind(file);
+    m_node.chainman->ActiveChainstate().LoadExternalBlockFile(file);
+
+    LOCK(cs_main);
+    for (const auto& block : chain) {
+        const CBlockIndex* pindex{m_node.chainman->m_blockman.LookupBlockIndex(block->GetHash())};
+        BOOST_REQUIRE(pindex);
+        BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_DATA);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(verifydb, TestChain100Setup)
+{
+    LOCK(cs_main);
+    CChainState& chainstate{m_node.chainman->ActiveChainstate()};
+    for (int level = 0; level <= 4; ++level) {
+        BOOST_CHECK(CVerifyDB().VerifyDB(chainstate, Params(), chainstate.CoinsTip(), level, /*nCheckDepth=*/0));
+    }
+
+    // A coin created by the tip that is missing from the UTXO set is only
+    // noticed by disconnecting the tip.
+    CBlock tip;
+    BOOST_REQUIRE(ReadBlockFromDisk(tip, chainstate.m_chain.Tip(), Params().GetConsensus()));
+    CCoinsViewCache damaged(&chainstate.CoinsTip());
+    BOOST_REQUIRE(damaged.SpendCoin(COutPoint(tip.vtx[0]->GetHash(), 0)));
+    BOOST_CHECK(CVerifyDB().VerifyDB(chainstate, Params(), damaged, 2, 10));
+    BOOST_CHECK(!CVerifyDB().VerifyDB(chainstate, Params(), damaged, 3, 10));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,9 +4,12 @@
 //
 #include <chainparams.h>
 #include <consensus/validation.h>
+#include <node/coinstats.h>
 #include <node/utxo_snapshot.h>
+#include <pow.h>
 #include <random.h>
 #include <rpc/blockchain.h>
+#include <script/script.h>
 #include <sync.h>
 #include <test/util/chainstate.h>
 #include <test/util/setup_common.h>
@@ -303,4 +306,104 @@ BOOST_FIXTURE_TEST_CASE(chainstatemanager_activate_snapshot, TestChain100Setup)
         loaded_snapshot_blockhash);
 }
 
+//! Test that a snapshot which failed to load leaves no coins behind for the next one.
+BOOST_FIXTURE_TEST_CASE(chainstatemanager_snapshot_after_failed_load, TestChain100Setup)
+{
+    ChainstateManager& chainman = *Assert(m_node.chainman);
+
+    // Height 110 has a valid assumeutxo value.
+    mineBlocks(10);
+
+    const fs::path good_path{m_path_root / "good_snapshot.dat"};
+    const fs::path bad_path{m_path_root / "bad_snapshot.dat"};
+    {
+        CAutoFile outfile{fsbridge::fopen(good_path, "wb"), SER_DISK, CLIENT_VERSION};
+        CreateUTXOSnapshot(m_node, chainman.ActiveChainstate(), outfile);
+    }
+
+    // Copy the snapshot with one coin added that is not in the UTXO set.
+    {
+        CAutoFile infile{fsbridge::fopen(good_path, "rb"), SER_DISK, CLIENT_VERSION};
+        CAutoFile outfile{fsbridge::fopen(bad_path, "wb"), SER_DISK, CLIENT_VERSION};
+        SnapshotMetadata metadata;
+        infile >> metadata;
+        const uint64_t coins_count{metadata.m_coins_count};
+        ++metadata.m_coins_count;
+        outfile << metadata;
+        COutPoint outpoint;
+        Coin coin;
+        for (uint64_t i = 0; i < coins_count; ++i) {
+            infile >> outpoint >> coin;
+            outfile << outpoint << coin;
+        }
+        outfile << COutPoint{uint256::ONE, 0} << Coin{CTxOut{COIN, CScript{} << OP_TRUE}, 1, /*fCoinBaseIn=*/false};
+    }
+
+    const auto activate = [&](const fs::path& path) {
+        CAutoFile infile{fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION};
+        SnapshotMetadata metadata;
+        infile >> metadata;
+        // On disk, so that the second load reopens the database the first one wrote to.
+        return chainman.ActivateSnapshot(infile, metadata, /*in_memory=*/false);
+    };
+
+    BOOST_REQUIRE(!activate(bad_path));
+    BOOST_CHECK(!chainman.SnapshotBlockhash());
+    BOOST_REQUIRE(activate(good_path));
+    BOOST_REQUIRE(chainman.SnapshotBlockhash());
+
+    // The snapshot chainstate holds exactly the UTXO set it was made from.
+    LOCK(::cs_main);
+    CChainState& snapshot_chainstate{chainman.ActiveChainstate()};
+    CChainState* ibd_chainstate{nullptr};
+    for (CChainState* chainstate : chainman.GetAll()) {
+        if (chainstate != &snapshot_chainstate) ibd_chainstate = chainstate;
+    }
+    BOOST_REQUIRE(ibd_chainstate);
+
+    CCoinsStats ibd_stats{CoinStatsHashType::HASH_SERIALIZED};
+    CCoinsStats snapshot_stats{CoinStatsHashType::HASH_SERIALIZED};
+    BOOST_REQUIRE(GetUTXOStats(&ibd_chainstate->CoinsDB(), chainman.m_blockman, ibd_stats));
+    BOOST_REQUIRE(GetUTXOStats(&snapshot_chainstate.CoinsDB(), chainman.m_blockman, snapshot_stats));
+    BOOST_CHECK_EQUAL(snapshot_stats.hashBlock, ibd_stats.hashBlock);
+    BOOST_CHECK_EQUAL(snapshot_stats.coins_count, ibd_stats.coins_count);
+    BOOST_CHECK_EQUAL(snapshot_stats.nTotalAmount, ibd_stats.nTotalAmount);
+    BOOST_CHECK_EQUAL(snapshot_stats.hashSerialized, ibd_stats.hashSerialized);
+}
+
+BOOST_FIXTURE_TEST_CASE(process_headers_pow_failure, TestChain100Setup)
+{
+    const Consensus::Params& consensus{Params().GetConsensus()};
+    const CBlockIndex* tip{WITH_LOCK(cs_main, return m_node.chainman->ActiveChain().Tip())};
+
+    // Headers extending the tip, where the third one fails its proof of work.
+    std::vector<CBlockHeader> headers(5);
+    uint256 prev_hash{tip->GetBlockHash()};
+    for (size_t i = 0; i < headers.size(); ++i) {
+        CBlockHeader& header{headers[i]};
+        header.nVersion = tip->nVersion;
+        header.hashPrevBlock = prev_hash;
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = tip->GetBlockTime() + 1 + i;
+        header.nBits = tip->nBits;
+        while (CheckProofOfWork(header.GetHash(), header.nBits, consensus) != (i != 2)) {
+            ++header.nNonce;
+        }
+        prev_hash = header.GetHash();
+    }
+
+    BlockValidationState state;
+    const CBlockIndex* last{nullptr};
+    BOOST_CHECK(!m_node.chainman->ProcessNewBlockHeaders(headers, state, Params(), &last));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+
+    // The headers before the failing one are still accepted.
+    LOCK(cs_main);
+    BOOST_REQUIRE(last);
+    BOOST_CHECK_EQUAL(last->GetBlockHash(), headers[1].GetHash());
+    BOOST_CHECK(m_node.chainman->m_blockman.LookupBlockIndex(headers[0].GetHash()));
+    BOOST_CHECK(!m_node.chainman->m_blockman.LookupBlockIndex(headers[2].GetHash()));
+    BOOST_CHECK(!m_node.chainman->m_blockman.LookupBlockIndex(headers[3].GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 #include <txdb.h>
 
 #include <chain.h>
+#include <hash.h>
 #include <node/ui_interface.h>
 #include <pow.h>
 #include <random.h>
@@ -15,7 +16,10 @@
 #include <util/translation.h>
 #include <util/vector.h>
 
+#include <limits>
 #include <stdint.h>
+#include <tuple>
+#include <unordered_map>
 
 static constexpr uint8_t DB_COIN{'C'};
 static constexpr uint8_t DB_COINS{'c'};
@@ -27,6 +31,7 @@ static constexpr uint8_t DB_HEAD_BLOCKS{'H'};
 static constexpr uint8_t DB_FLAG{'F'};
 static constexpr uint8_t DB_REINDEX_FLAG{'R'};
 static constexpr uint8_t DB_LAST_BLOCK{'l'};
+static constexpr uint8_t DB_BLOCK_INDEX_SNAPSHOT{'s'};
 
 // Keys used in previous version that might still be found in the DB:
 static constexpr uint8_t DB_TXINDEX_BLOCK{'T'};
@@ -103,7 +108,7 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
     CDBBatch batch(*m_db);
     size_t count = 0;
     size_t changed = 0;
@@ -131,15 +136,14 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
-            if (it->second.coin.IsSpent())
+            if (it->second.IsSpent())
                 batch.Erase(entry);
             else
-                batch.Write(entry, it->second.coin);
+                batch.Write(entry, it->second.CopyCoin());
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        it = erase ? mapCoins.erase(it) : std::next(it);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             m_db->WriteBatch(batch);
@@ -164,12 +168,25 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::WriteCoins(Span<const std::pair<COutPoint, Coin>> coins)
+{
+    CDBBatch batch(*m_db);
+    for (const auto& [outpoint, coin] : coins) {
+        assert(!coin.IsSpent());
+        batch.Write(CoinEntry(&outpoint), coin);
+    }
+    LogPrint(BCLog::COINDB, "Writing batch of %u coins (%.2f MiB)\n", coins.size(), batch.SizeEstimate() * (1.0 / 1048576.0));
+    return m_db->WriteBatch(batch);
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return m_db->EstimateSize(DB_COIN, uint8_t(DB_COIN + 1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(gArgs.GetDataDirNet() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(gArgs.GetDataDirNet() / "blocks" / "index", nCacheSize, fMemory, fWipe),
+    m_snapshot_path{fMemory || !gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCK_INDEX_SNAPSHOT) ? fs::path{} : gArgs.GetDataDirNet() / "blocks" / "index.snapshot"}
+{
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -279,6 +296,8 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // Any snapshot no longer matches the block index.
+    batch.Erase(DB_BLOCK_INDEX_SNAPSHOT);
     return WriteBatch(batch, true);
 }
 
@@ -294,8 +313,214 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+namespace {
+
+//! Version of the block index snapshot file format.
+static constexpr uint32_t BLOCK_INDEX_SNAPSHOT_VERSION{1};
+//! Serialized size of a BlockIndexSnapshotRecord.
+static constexpr size_t BLOCK_INDEX_SNAPSHOT_RECORD_SIZE{108};
+
+/** Fixed-width record of one block index entry in the snapshot file. */
+struct BlockIndexSnapshotRecord {
+    static constexpr uint32_t NO_PREV{std::numeric_limits<uint32_t>::max()};
+
+    uint256 hash;
+    //! Number of the parent's record, which comes earlier in the file.
+    uint32_t prev{NO_PREV};
+    int32_t height{0};
+    uint32_t status{0};
+    uint32_t tx{0};
+    int32_t file{0};
+    uint32_t data_pos{0};
+    uint32_t undo_pos{0};
+    int32_t version{0};
+    uint256 merkle_root;
+    uint32_t time{0};
+    uint32_t bits{0};
+    uint32_t nonce{0};
+
+    SERIALIZE_METHODS(BlockIndexSnapshotRecord, obj)
+    {
+        READWRITE(obj.hash, obj.prev, obj.height, obj.status, obj.tx, obj.file, obj.data_pos, obj.undo_pos);
+        READWRITE(obj.version, obj.merkle_root, obj.time, obj.bits, obj.nonce);
+    }
+};
+
+/**
+ * Database value recording the snapshot file. Versions that do not know about
+ * the snapshot leave it in place when they change the block index, but they
+ * still rewrite the last block file number and that file's info with every
+ * block they store. The snapshot is only used while those are as they were
+ * when it was written.
+ */
+struct BlockIndexSnapshotInfo {
+    uint256 file_hash;
+    int32_t last_file{0};
+    CBlockFileInfo last_file_info;
+
+    SERIALIZE_METHODS(BlockIndexSnapshotInfo, obj)
+    {
+        READWRITE(obj.file_hash, obj.last_file, obj.last_file_info);
+    }
+};
+
+bool operator==(const CBlockFileInfo& a, const CBlockFileInfo& b)
+{
+    return std::tie(a.nBlocks, a.nSize, a.nUndoSize, a.nHeightFirst, a.nHeightLast, a.nTimeFirst, a.nTimeLast) ==
+           std::tie(b.nBlocks, b.nSize, b.nUndoSize, b.nHeightFirst, b.nHeightLast, b.nTimeFirst, b.nTimeLast);
+}
+
+} // namespace
+
+void CBlockTreeDB::ReadLastBlockFileInfo(int& last_file, CBlockFileInfo& info)
+{
+    if (!ReadLastBlockFile(last_file)) last_file = 0;
+    if (!ReadBlockFileInfo(last_file, info)) info.SetNull();
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& index)
+{
+    if (m_snapshot_path.empty()) return true;
+
+    std::unordered_map<const CBlockIndex*, uint32_t> record_numbers;
+    record_numbers.reserve(index.size());
+    std::vector<unsigned char> data;
+    data.reserve(12 + index.size() * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE);
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, data, 0);
+    writer << BLOCK_INDEX_SNAPSHOT_VERSION << uint64_t{index.size()};
+    for (const CBlockIndex* pindex : index) {
+        BlockIndexSnapshotRecord record;
+        record.hash = pindex->GetBlockHash();
+        if (pindex->pprev) {
+            const auto it = record_numbers.find(pindex->pprev);
+            if (it == record_numbers.end()) return error("%s: parent of %s comes later", __func__, record.hash.ToString());
+            record.prev = it->second;
+        }
+        record.height = pindex->nHeight;
+        record.status = pindex->nStatus;
+        record.tx = pindex->nTx;
+        record.file = pindex->nFile;
+        record.data_pos = pindex->nDataPos;
+        record.undo_pos = pindex->nUndoPos;
+        record.version = pindex->nVersion;
+        record.merkle_root = pindex->hashMerkleRoot;
+        record.time = pindex->nTime;
+        record.bits = pindex->nBits;
+        record.nonce = pindex->nNonce;
+        writer << record;
+        record_numbers.emplace(pindex, record_numbers.size());
+    }
+
+    CHashWriterSHA256 hasher(SER_DISK, CLIENT_VERSION);
+    hasher.write((const char*)data.data(), data.size());
+
+    // Replace the file before recording its hash, so that the database never
+    // refers to a file that is not completely on disk.
+    const fs::path tmp_path{m_snapshot_path + ".new"};
+    FILE* file{fsbridge::fopen(tmp_path, "wb")};
+    if (!file) return error("%s: failed to open %s", __func__, fs::PathToString(tmp_path));
+    const bool written{fwrite(data.data(), 1, data.size(), file) == data.size() && FileCommit(file)};
+    if (fclose(file) != 0 || !written) return error("%s: failed to write %s", __func__, fs::PathToString(tmp_path));
+    if (!RenameOver(tmp_path, m_snapshot_path)) return error("%s: failed to rename %s", __func__, fs::PathToString(tmp_path));
+    LogPrintf("Wrote block index snapshot of %u entries\n", index.size());
+    BlockIndexSnapshotInfo info;
+    info.file_hash = hasher.GetHash();
+    ReadLastBlockFileInfo(info.last_file, info.last_file_info);
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, info, /*fSync=*/true);
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    BlockIndexSnapshotInfo info;
+    if (m_snapshot_path.empty() || !Read(DB_BLOCK_INDEX_SNAPSHOT, info)) return false;
+    BlockIndexSnapshotInfo current;
+    ReadLastBlockFileInfo(current.last_file, current.last_file_info);
+    if (info.last_file != current.last_file || !(info.last_file_info == current.last_file_info)) {
+        LogPrintf("%s: block index snapshot predates the last block file update\n", __func__);
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+    FILE* file{fsbridge::fopen(m_snapshot_path, "rb")};
+    if (!file) {
+        LogPrintf("%s: failed to open %s\n", __func__, fs::PathToString(m_snapshot_path));
+        return false;
+    }
+    bool read{fseek(file, 0, SEEK_END) == 0};
+    const long size{read ? ftell(file) : -1};
+    if (size >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+        data.resize(size);
+        read = fread(data.data(), 1, data.size(), file) == data.size();
+    } else {
+        read = false;
+    }
+    fclose(file);
+
+    CHashWriterSHA256 hasher(SER_DISK, CLIENT_VERSION);
+    hasher.write((const char*)data.data(), data.size());
+    if (!read || hasher.GetHash() != info.file_hash) {
+        LogPrintf("%s: block index snapshot does not match the database\n", __func__);
+        return false;
+    }
+
+    // Check every record before inserting any of them.
+    std::vector<BlockIndexSnapshotRecord> records;
+    try {
+        VectorReader reader(SER_DISK, CLIENT_VERSION, data, 0);
+        uint32_t version;
+        uint64_t count;
+        reader >> version >> count;
+        if (version != BLOCK_INDEX_SNAPSHOT_VERSION || reader.size() != count * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE) {
+            LogPrintf("%s: unsupported block index snapshot\n", __func__);
+            return false;
+        }
+        records.resize(count);
+        for (auto& record : records) {
+            reader >> record;
+        }
+    } catch (const std::ios_base::failure& e) {
+        LogPrintf("%s: failed to read block index snapshot: %s\n", __func__, e.what());
+        return false;
+    }
+    data = {};
+    for (size_t i = 0; i < records.size(); ++i) {
+        const BlockIndexSnapshotRecord& record{records[i]};
+        if (record.prev != BlockIndexSnapshotRecord::NO_PREV && record.prev >= i) {
+            LogPrintf("%s: parent of %s comes later in the block index snapshot\n", __func__, record.hash.ToString());
+            return false;
+        }
+        if (!CheckProofOfWork(record.hash, record.bits, consensusParams)) {
+            LogPrintf("%s: CheckProofOfWork failed: %s\n", __func__, record.hash.ToString());
+            return false;
+        }
+    }
+
+    std::vector<CBlockIndex*> loaded;
+    loaded.reserve(records.size());
+    for (const BlockIndexSnapshotRecord& record : records) {
+        CBlockIndex* pindexNew = insertBlockIndex(record.hash);
+        pindexNew->pprev          = record.prev == BlockIndexSnapshotRecord::NO_PREV ? nullptr : loaded[record.prev];
+        pindexNew->nHeight        = record.height;
+        pindexNew->nFile          = record.file;
+        pindexNew->nDataPos       = record.data_pos;
+        pindexNew->nUndoPos       = record.undo_pos;
+        pindexNew->nVersion       = record.version;
+        pindexNew->hashMerkleRoot = record.merkle_root;
+        pindexNew->nTime          = record.time;
+        pindexNew->nBits          = record.bits;
+        pindexNew->nNonce         = record.nonce;
+        pindexNew->nStatus        = record.status;
+        pindexNew->nTx            = record.tx;
+        loaded.push_back(pindexNew);
+    }
+    LogPrintf("Loaded block index snapshot of %u entries\n", loaded.size());
+    return true;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
+    if (LoadBlockIndexSnapshot(consensusParams, insertBlockIndex)) return true;
+
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
@@ -8,6 +8,8 @@
 
 #include <coins.h>
 #include <dbwrapper.h>
+#include <fs.h>
+#include <span.h>
 
 #include <memory>
 #include <optional>
@@ -27,6 +29,8 @@ struct bilingual_str;
 static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
+//! -blockindexsnapshot default
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = true;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
 //! max. -dbcache (MiB)
@@ -64,9 +68,16 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     std::unique_ptr<CCoinsViewCursor> Cursor() const override;
 
+    /**
+     * Write unspent coins straight to the database in a single batch, leaving
+     * the best block alone. Used to bulk load a UTXO snapshot into a fresh
+     * database, whose best block is set once all coins are in.
+     */
+    bool WriteCoins(Span<const std::pair<COutPoint, Coin>> coins);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
@@ -78,6 +89,13 @@ public:
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
+private:
+    //! Flat copy of the block index records (blocks/index.snapshot), empty if not used.
+    const fs::path m_snapshot_path;
+
+    /** Read the last block file's number and info, defaulting to file 0 and null info. */
+    void ReadLastBlockFileInfo(int& last_file, CBlockFileInfo& info);
+
 public:
     explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -89,6 +107,22 @@ public:
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+
+    /**
+     * Write all block index entries, parents before children, to a flat file
+     * of fixed-width records that can be read back in one go. The database
+     * records the file's hash along with the last block file's number and
+     * info. It forgets them again on the next write to the block index, and
+     * the file is not used once the last block file's info has changed, so
+     * the file is only used while it matches the database.
+     */
+    bool WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& index);
+    /**
+     * Load the block index from the snapshot file instead of the database
+     * records. Returns false, having inserted nothing, if there is no
+     * snapshot matching the database.
+     */
+    bool LoadBlockIndexSnapshot(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
 std::optional<bilingual_str> CheckLegacyTxindex(CBlockTreeDB& block_tree_db);
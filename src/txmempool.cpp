@@ -19,6 +19,7 @@
 #include <validation.h>
 #include <validationinterface.h>
 
+#include <algorithm>
 #include <cmath>
 #include <optional>
 
@@ -62,8 +63,8 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    CTxMemPoolEntry::Children stageEntries, descendants;
-    stageEntries = updateIt->GetMemPoolChildrenConst();
+    const CTxMemPoolEntry::Children& children = updateIt->GetMemPoolChildrenConst();
+    CTxMemPoolEntry::EntryRefSet stageEntries{children.begin(), children.end()}, descendants;
 
     while (!stageEntries.empty()) {
         const CTxMemPoolEntry& descendant = *stageEntries.begin();
@@ -148,6 +149,7 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
                 }
             }
         } // release epoch guard for UpdateForDescendants
+        AddToCluster(it);
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
     }
 }
@@ -155,7 +157,7 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 bool CTxMemPool::CalculateAncestorsAndCheckLimits(size_t entry_size,
                                                   size_t entry_count,
                                                   setEntries& setAncestors,
-                                                  CTxMemPoolEntry::Parents& staged_ancestors,
+                                                  CTxMemPoolEntry::EntryRefSet& staged_ancestors,
                                                   uint64_t limitAncestorCount,
                                                   uint64_t limitAncestorSize,
                                                   uint64_t limitDescendantCount,
@@ -208,7 +210,7 @@ bool CTxMemPool::CheckPackageLimits(const Package& package,
                                     uint64_t limitDescendantSize,
                                     std::string &errString) const
 {
-    CTxMemPoolEntry::Parents staged_ancestors;
+    CTxMemPoolEntry::EntryRefSet staged_ancestors;
     size_t total_size = 0;
     for (const auto& tx : package) {
         total_size += GetVirtualTransactionSize(*tx);
@@ -245,7 +247,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry,
                                            std::string &errString,
                                            bool fSearchForParents /* = true */) const
 {
-    CTxMemPoolEntry::Parents staged_ancestors;
+    CTxMemPoolEntry::EntryRefSet staged_ancestors;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -266,7 +268,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry,
         // If we're not searching for parents, we require this to already be an
         // entry in the mempool and use the entry's cached parents.
         txiter it = mapTx.iterator_to(entry);
-        staged_ancestors = it->GetMemPoolParentsConst();
+        const CTxMemPoolEntry::Parents& parents = it->GetMemPoolParentsConst();
+        staged_ancestors.insert(parents.begin(), parents.end());
     }
 
     return CalculateAncestorsAndCheckLimits(entry.GetTxSize(), /* entry_count */ 1,
@@ -392,8 +395,8 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
     assert(int(nSigOpCostWithAncestors) >= 0);
 }
 
-CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator, int check_ratio)
-    : m_check_ratio(check_ratio), minerPolicyEstimator(estimator)
+CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator, int check_ratio, bool track_clusters)
+    : m_check_ratio(check_ratio), minerPolicyEstimator(estimator), m_track_clusters(track_clusters)
 {
     _clear(); //lock free clear
 }
@@ -454,6 +457,7 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, setEntries &setAnces
     }
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
+    AddToCluster(newit);
 
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
@@ -498,7 +502,8 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     totalTxSize -= it->GetTxSize();
     m_total_fee -= it->GetFee();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
+    cachedInnerUsage -= it->GetMemPoolParentsConst().DynamicMemoryUsage() + it->GetMemPoolChildrenConst().DynamicMemoryUsage();
+    RemoveFromCluster(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
@@ -657,6 +662,8 @@ void CTxMemPool::_clear()
 {
     mapTx.clear();
     mapNextTx.clear();
+    m_clusters.clear();
+    m_dirty_clusters.clear();
     totalTxSize = 0;
     m_total_fee = 0;
     cachedInnerUsage = 0;
@@ -686,6 +693,7 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
     CAmount check_total_fee{0};
     uint64_t innerUsage = 0;
     uint64_t prev_ancestor_count{0};
+    uint64_t cluster_tx_count{0};
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(&active_coins_tip));
 
@@ -694,7 +702,7 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
         check_total_fee += it->GetFee();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        innerUsage += memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
+        innerUsage += it->GetMemPoolParentsConst().DynamicMemoryUsage() + it->GetMemPoolChildrenConst().DynamicMemoryUsage();
         CTxMemPoolEntry::Parents setParentCheck;
         for (const CTxIn &txin : tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
@@ -760,6 +768,15 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= child_sizes + it->GetTxSize());
 
+        if (m_track_clusters) {
+            // Connected transactions share a cluster, which lists them once.
+            for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) assert(parent.m_cluster_id == it->m_cluster_id);
+            for (const CTxMemPoolEntry& child : it->GetMemPoolChildrenConst()) assert(child.m_cluster_id == it->m_cluster_id);
+            const std::vector<txiter>& cluster_txs = m_clusters.at(it->m_cluster_id).txs;
+            assert(cluster_txs.at(it->m_cluster_pos) == it);
+            cluster_tx_count += cluster_txs.size();
+        }
+
         TxValidationState dummy_state; // Not used. CheckTxInputs() should always pass
         CAmount txfee = 0;
         assert(!tx.IsCoinBase());
@@ -778,6 +795,24 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
     assert(totalTxSize == checkTotal);
     assert(m_total_fee == check_total_fee);
     assert(innerUsage == cachedInnerUsage);
+
+    if (m_track_clusters) {
+        // Each transaction added the size of its cluster above, so this only
+        // matches if clusters list nothing but their members.
+        uint64_t expected_count{0};
+        for (const auto& [id, cluster] : m_clusters) {
+            expected_count += cluster.txs.size() * cluster.txs.size();
+            if (cluster.dirty) continue;
+            // Linearizations put parents first.
+            for (size_t i = 0; i < cluster.txs.size(); ++i) {
+                for (const CTxMemPoolEntry& parent : cluster.txs[i]->GetMemPoolParentsConst()) {
+                    assert(std::find(cluster.txs.begin(), cluster.txs.begin() + i, mapTx.iterator_to(parent)) != cluster.txs.begin() + i);
+                }
+            }
+            assert(!cluster.chunks.empty() && cluster.chunks.back().end == cluster.txs.size());
+        }
+        assert(cluster_tx_count == expected_count);
+    }
 }
 
 bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb, bool wtxid)
@@ -898,6 +933,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             for (txiter descendantIt : setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
+            if (m_track_clusters) MarkClusterDirty(it->m_cluster_id);
             ++nTransactionsUpdated;
         }
     }
@@ -983,10 +1019,18 @@ void CCoinsViewMemPool::PackageAddTransaction(const CTransactionRef& tx)
     }
 }
 
+static_assert(sizeof(CTxMemPool::indexed_transaction_set::final_node_type) <= CTxMemPool::ENTRY_NODE_MAX_BYTES,
+              "mapTx nodes must be served from the pool");
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // mapTx allocates its nodes and bucket arrays from m_entry_resource, which keeps count of them.
+    return m_entry_resource.AllocatedBytes() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+}
+
+size_t CTxMemPool::FreeMemoryUsage() const {
+    LOCK(cs);
+    return m_entry_resource.AllocatedBytes() - m_entry_resource.UsedBytes();
 }
 
 void CTxMemPool::RemoveUnbroadcastTx(const uint256& txid, const bool unchecked) {
@@ -1035,23 +1079,27 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, bool validFeeEstimat
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
     AssertLockHeld(cs);
-    CTxMemPoolEntry::Children s;
-    if (add && entry->GetMemPoolChildren().insert(*child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && entry->GetMemPoolChildren().erase(*child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Children& children = entry->GetMemPoolChildren();
+    cachedInnerUsage -= children.DynamicMemoryUsage();
+    if (add) {
+        children.insert(*child);
+    } else {
+        children.erase(*child);
     }
+    cachedInnerUsage += children.DynamicMemoryUsage();
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
     AssertLockHeld(cs);
-    CTxMemPoolEntry::Parents s;
-    if (add && entry->GetMemPoolParents().insert(*parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && entry->GetMemPoolParents().erase(*parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Parents& parents = entry->GetMemPoolParents();
+    cachedInnerUsage -= parents.DynamicMemoryUsage();
+    if (add) {
+        parents.insert(*parent);
+    } else {
+        parents.erase(*parent);
     }
+    cachedInnerUsage += parents.DynamicMemoryUsage();
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
@@ -1062,9 +1110,10 @@ CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
     int64_t time = GetTime();
     if (time > lastRollingFeeUpdate + 10) {
         double halflife = ROLLING_FEE_HALFLIFE;
-        if (DynamicMemoryUsage() < sizelimit / 4)
+        const size_t usage{DynamicMemoryUsage() - FreeMemoryUsage()};
+        if (usage < sizelimit / 4)
             halflife /= 4;
-        else if (DynamicMemoryUsage() < sizelimit / 2)
+        else if (usage < sizelimit / 2)
             halflife /= 2;
 
         rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
@@ -1086,25 +1135,277 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
+/**
+ * Order a connected set of mempool transactions for a block. Like
+ * BlockAssembler::addPackageTxs, repeatedly take the transaction whose
+ * not yet ordered ancestors have the highest feerate, along with those
+ * ancestors. Then merge each position into the previous chunk while its
+ * feerate is higher, so that chunk feerates decrease.
+ */
+static void Linearize(std::vector<CTxMemPool::txiter> txs, CTxMemPool::Cluster& cluster)
+{
+    // Sorting by ancestor count puts parents first.
+    std::sort(txs.begin(), txs.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors()) return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CompareIteratorByHash()(a, b);
+    });
+    const size_t n{txs.size()};
+    std::vector<CAmount> fee(n);
+    std::vector<int64_t> size(n);
+    for (size_t i = 0; i < n; ++i) {
+        fee[i] = txs[i]->GetModifiedFee();
+        size[i] = txs[i]->GetTxSize();
+    }
+
+    std::vector<size_t> order;
+    order.reserve(n);
+    std::map<const CTxMemPoolEntry*, size_t> pos;
+    for (size_t i = 0; i < n; ++i) pos.emplace(&*txs[i], i);
+    // ancestors[i][j] is set if txs[j] is txs[i] or one of its ancestors, so only for j <= i.
+    std::vector<std::vector<bool>> ancestors(n);
+    std::vector<CAmount> ancestor_fee(n, 0);
+    std::vector<int64_t> ancestor_size(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        ancestors[i].resize(i + 1);
+        ancestors[i][i] = true;
+        for (const CTxMemPoolEntry& parent : txs[i]->GetMemPoolParentsConst()) {
+            const size_t p{pos.at(&parent)};
+            for (size_t j = 0; j <= p; ++j) {
+                if (ancestors[p][j]) ancestors[i][j] = true;
+            }
+        }
+        for (size_t j = 0; j <= i; ++j) {
+            if (!ancestors[i][j]) continue;
+            ancestor_fee[i] += fee[j];
+            ancestor_size[i] += size[j];
+        }
+    }
+
+    std::vector<bool> included(n, false);
+    while (order.size() < n) {
+        size_t best{n};
+        for (size_t i = 0; i < n; ++i) {
+            if (included[i]) continue;
+            if (best == n || double(ancestor_fee[i]) * ancestor_size[best] > double(ancestor_fee[best]) * ancestor_size[i]) best = i;
+        }
+        for (size_t j = 0; j <= best; ++j) {
+            if (!ancestors[best][j] || included[j]) continue;
+            included[j] = true;
+            order.push_back(j);
+            for (size_t d = j + 1; d < n; ++d) {
+                if (included[d] || !ancestors[d][j]) continue;
+                ancestor_fee[d] -= fee[j];
+                ancestor_size[d] -= size[j];
+            }
+        }
+    }
+
+    cluster.txs.clear();
+    cluster.chunks.clear();
+    for (size_t i : order) {
+        txs[i]->m_cluster_pos = cluster.txs.size();
+        cluster.txs.push_back(txs[i]);
+        cluster.chunks.push_back({cluster.txs.size(), fee[i], size[i]});
+        while (cluster.chunks.size() > 1) {
+            CTxMemPool::ClusterChunk& last = cluster.chunks.back();
+            CTxMemPool::ClusterChunk& prev = cluster.chunks[cluster.chunks.size() - 2];
+            if (!prev.LowerFeeRate(last)) break;
+            prev.end = last.end;
+            prev.fee += last.fee;
+            prev.size += last.size;
+            cluster.chunks.pop_back();
+        }
+    }
+    cluster.dirty = false;
+}
+
+void CTxMemPool::AddToCluster(txiter it)
+{
+    AssertLockHeld(cs);
+    if (!m_track_clusters) return;
+    std::set<uint64_t> ids;
+    if (it->m_cluster_id) ids.insert(it->m_cluster_id);
+    for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) ids.insert(parent.m_cluster_id);
+    for (const CTxMemPoolEntry& child : it->GetMemPoolChildrenConst()) ids.insert(child.m_cluster_id);
+
+    // Move the smaller clusters into the largest one.
+    uint64_t target{0};
+    for (uint64_t id : ids) {
+        if (target == 0 || m_clusters.at(id).txs.size() > m_clusters.at(target).txs.size()) target = id;
+    }
+    if (target == 0) target = m_next_cluster_id++;
+    Cluster& cluster = m_clusters[target];
+    for (uint64_t id : ids) {
+        if (id == target) continue;
+        auto merged = m_clusters.extract(id);
+        for (txiter member : merged.mapped().txs) {
+            member->m_cluster_id = target;
+            member->m_cluster_pos = cluster.txs.size();
+            cluster.txs.push_back(member);
+        }
+    }
+    if (it->m_cluster_id == 0) {
+        it->m_cluster_id = target;
+        it->m_cluster_pos = cluster.txs.size();
+        cluster.txs.push_back(it);
+    }
+    MarkClusterDirty(target);
+}
+
+void CTxMemPool::RemoveFromCluster(txiter it)
+{
+    AssertLockHeld(cs);
+    if (!m_track_clusters) return;
+    const auto cluster_it = m_clusters.find(it->m_cluster_id);
+    assert(cluster_it != m_clusters.end());
+    std::vector<txiter>& txs = cluster_it->second.txs;
+    // The last transaction takes its place until the cluster is linearized again.
+    txs[it->m_cluster_pos] = txs.back();
+    txs[it->m_cluster_pos]->m_cluster_pos = it->m_cluster_pos;
+    txs.pop_back();
+    if (txs.empty()) {
+        m_clusters.erase(cluster_it);
+        return;
+    }
+    MarkClusterDirty(it->m_cluster_id);
+}
+
+void CTxMemPool::MarkClusterDirty(uint64_t id) const
+{
+    AssertLockHeld(cs);
+    Cluster& cluster = m_clusters.at(id);
+    if (cluster.dirty) return;
+    cluster.dirty = true;
+    m_dirty_clusters.push_back(id);
+    // Unless clusters are read, forget those merged away or emptied meanwhile.
+    if (m_dirty_clusters.size() > 2 * m_clusters.size() + 64) {
+        m_dirty_clusters.erase(std::remove_if(m_dirty_clusters.begin(), m_dirty_clusters.end(), [&](uint64_t dirty_id) EXCLUSIVE_LOCKS_REQUIRED(cs) {
+            return m_clusters.count(dirty_id) == 0;
+        }), m_dirty_clusters.end());
+    }
+}
+
+std::vector<uint64_t> CTxMemPool::LinearizeCluster(uint64_t id) const
+{
+    AssertLockHeld(cs);
+    const auto cluster_it = m_clusters.find(id);
+    if (cluster_it == m_clusters.end()) return {};
+    if (!cluster_it->second.dirty) return {id};
+
+    // Removals may have split the cluster, so collect what is still connected.
+    std::set<txiter, CompareIteratorByHash> unassigned(cluster_it->second.txs.begin(), cluster_it->second.txs.end());
+    std::vector<uint64_t> ids;
+    while (!unassigned.empty()) {
+        std::vector<txiter> component{*unassigned.begin()};
+        unassigned.erase(unassigned.begin());
+        for (size_t i = 0; i < component.size(); ++i) {
+            const auto visit = [&](const CTxMemPoolEntry& entry) EXCLUSIVE_LOCKS_REQUIRED(cs) {
+                const txiter relative = mapTx.iterator_to(entry);
+                if (unassigned.erase(relative)) component.push_back(relative);
+            };
+            for (const CTxMemPoolEntry& parent : component[i]->GetMemPoolParentsConst()) visit(parent);
+            for (const CTxMemPoolEntry& child : component[i]->GetMemPoolChildrenConst()) visit(child);
+        }
+        const uint64_t component_id{ids.empty() ? id : m_next_cluster_id++};
+        for (txiter member : component) member->m_cluster_id = component_id;
+        Linearize(std::move(component), m_clusters[component_id]);
+        ids.push_back(component_id);
+    }
+    return ids;
+}
+
+const std::unordered_map<uint64_t, CTxMemPool::Cluster>& CTxMemPool::GetClusters() const
+{
+    AssertLockHeld(cs);
+    for (uint64_t id : m_dirty_clusters) {
+        LinearizeCluster(id);
+    }
+    m_dirty_clusters.clear();
+    return m_clusters;
+}
+
+size_t CTxMemPool::CalculateClusterSize(const setEntries& ancestors, size_t count, const setEntries& removing) const
+{
+    AssertLockHeld(cs);
+    if (!m_track_clusters) return 0;
+    // Removals may have split the ancestors' clusters, so linearize them first.
+    std::set<uint64_t> ids;
+    for (txiter ancestor : ancestors) {
+        LinearizeCluster(ancestor->m_cluster_id);
+        ids.insert(ancestor->m_cluster_id);
+    }
+    size_t size{count};
+    for (uint64_t id : ids) size += m_clusters.at(id).txs.size();
+    for (txiter it : removing) {
+        if (ids.count(it->m_cluster_id)) --size;
+    }
+    return size;
+}
+
+CFeeRate CTxMemPool::GetMiningFeeRate(txiter it) const
+{
+    AssertLockHeld(cs);
+    if (!m_track_clusters) return CFeeRate(it->GetModifiedFee(), it->GetTxSize());
+    LinearizeCluster(it->m_cluster_id);
+    const Cluster& cluster = m_clusters.at(it->m_cluster_id);
+    const auto chunk = std::upper_bound(cluster.chunks.begin(), cluster.chunks.end(), it->m_cluster_pos, [](size_t pos, const ClusterChunk& chunk) {
+        return pos < chunk.end;
+    });
+    return CFeeRate(chunk->fee, chunk->size);
+}
+
 void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
     AssertLockHeld(cs);
 
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
-    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+    // With clusters, a heap of the last chunk of each cluster, lowest feerate on top.
+    std::vector<std::pair<ClusterChunk, uint64_t>> tails;
+    const auto higher_feerate = [](const std::pair<ClusterChunk, uint64_t>& a, const std::pair<ClusterChunk, uint64_t>& b) {
+        return b.first.LowerFeeRate(a.first);
+    };
+    const auto push_tail = [&](uint64_t id) EXCLUSIVE_LOCKS_REQUIRED(cs) {
+        tails.emplace_back(m_clusters.at(id).chunks.back(), id);
+        std::push_heap(tails.begin(), tails.end(), higher_feerate);
+    };
+    // Memory held for removed entries is reused before the mempool allocates
+    // more, so it does not count.
+    if (m_track_clusters && DynamicMemoryUsage() - FreeMemoryUsage() > sizelimit) {
+        for (const auto& [id, cluster] : GetClusters()) {
+            tails.emplace_back(cluster.chunks.back(), id);
+        }
+        std::make_heap(tails.begin(), tails.end(), higher_feerate);
+    }
+
+    while (!mapTx.empty() && DynamicMemoryUsage() - FreeMemoryUsage() > sizelimit) {
+        setEntries stage;
+        CFeeRate removed;
+        uint64_t cluster_id{0};
+        if (m_track_clusters) {
+            // Nothing outside the last chunk depends on it.
+            std::pop_heap(tails.begin(), tails.end(), higher_feerate);
+            cluster_id = tails.back().second;
+            tails.pop_back();
+            const Cluster& cluster = m_clusters.at(cluster_id);
+            const size_t begin{cluster.chunks.size() > 1 ? cluster.chunks[cluster.chunks.size() - 2].end : 0};
+            for (size_t i = begin; i < cluster.txs.size(); ++i) {
+                CalculateDescendants(cluster.txs[i], stage);
+            }
+            removed = CFeeRate(cluster.chunks.back().fee, cluster.chunks.back().size);
+        } else {
+            indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+            removed = CFeeRate(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+            CalculateDescendants(mapTx.project<0>(it), stage);
+        }
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
         // "minimum reasonable fee rate" (ie some value under which we consider txn
         // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
         // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
         removed += incrementalRelayFee;
         trackPackageRemoved(removed);
         maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
 
-        setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -1114,6 +1415,9 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
                 txn.push_back(iter->GetTx());
         }
         RemoveStaged(stage, false, MemPoolRemovalReason::SIZELIMIT);
+        if (m_track_clusters) {
+            for (uint64_t id : LinearizeCluster(cluster_id)) push_tail(id);
+        }
         if (pvNoSpendsRemaining) {
             for (const CTransaction& tx : txn) {
                 for (const CTxIn& txin : tx.vin) {
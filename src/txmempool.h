@@ -6,11 +6,13 @@
 #ifndef BGL_TXMEMPOOL_H
 #define BGL_TXMEMPOOL_H
 
+#include <algorithm>
 #include <atomic>
 #include <map>
 #include <optional>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -20,7 +22,9 @@
 #include <policy/feerate.h>
 #include <policy/packages.h>
 #include <primitives/transaction.h>
+#include <memusage.h>
 #include <random.h>
+#include <support/allocators/pool.h>
 #include <sync.h>
 #include <util/epochguard.h>
 #include <util/hasher.h>
@@ -64,6 +68,62 @@ struct CompareIteratorByHash {
     }
 };
 
+/**
+ * Set kept as a sorted vector.
+ *
+ * Most mempool entries have only a handful of in-mempool parents and children.
+ * A tree based set spends an allocation and three pointers on each of them,
+ * while a sorted vector needs one pointer per element and a single allocation
+ * per non-empty set. Lookups are binary searches; insertion and removal move
+ * the elements behind the affected position, which is cheap for small sets.
+ * Traversals that may grow large should use a std::set instead.
+ */
+template <typename T, typename Compare>
+class SortedVectorSet
+{
+    std::vector<T> m_elements;
+
+    typename std::vector<T>::iterator LowerBound(const T& value)
+    {
+        return std::lower_bound(m_elements.begin(), m_elements.end(), value, Compare{});
+    }
+
+public:
+    using value_type = T;
+    using const_iterator = typename std::vector<T>::const_iterator;
+    using iterator = const_iterator;
+
+    const_iterator begin() const { return m_elements.begin(); }
+    const_iterator end() const { return m_elements.end(); }
+    size_t size() const { return m_elements.size(); }
+    bool empty() const { return m_elements.empty(); }
+
+    std::pair<const_iterator, bool> insert(const T& value)
+    {
+        auto it = LowerBound(value);
+        if (it != m_elements.end() && !Compare{}(value, *it)) return {it, false};
+        return {m_elements.insert(it, value), true};
+    }
+
+    size_t erase(const T& value)
+    {
+        auto it = LowerBound(value);
+        if (it == m_elements.end() || Compare{}(value, *it)) return 0;
+        m_elements.erase(it);
+        // Release the buffer of sets that become empty, typically the
+        // parents of a transaction whose parents were all mined.
+        if (m_elements.empty()) std::vector<T>().swap(m_elements);
+        return 1;
+    }
+
+    size_t count(const T& value) const
+    {
+        return std::binary_search(m_elements.begin(), m_elements.end(), value, Compare{});
+    }
+
+    size_t DynamicMemoryUsage() const { return memusage::DynamicUsage(m_elements); }
+};
+
 /** \class CTxMemPoolEntry
  *
  * CTxMemPoolEntry stores data about the corresponding transaction, as well
@@ -81,8 +141,10 @@ class CTxMemPoolEntry
 public:
     typedef std::reference_wrapper<const CTxMemPoolEntry> CTxMemPoolEntryRef;
     // two aliases, should the types ever diverge
-    typedef std::set<CTxMemPoolEntryRef, CompareIteratorByHash> Parents;
-    typedef std::set<CTxMemPoolEntryRef, CompareIteratorByHash> Children;
+    typedef SortedVectorSet<CTxMemPoolEntryRef, CompareIteratorByHash> Parents;
+    typedef SortedVectorSet<CTxMemPoolEntryRef, CompareIteratorByHash> Children;
+    //! For walks over ancestors or descendants, which can be many
+    typedef std::set<CTxMemPoolEntryRef, CompareIteratorByHash> EntryRefSet;
 
 private:
     const CTransactionRef tx;
@@ -157,6 +219,8 @@ public:
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
     mutable Epoch::Marker m_epoch_marker; //!< epoch when last touched, useful for graph algorithms
+    mutable uint64_t m_cluster_id{0}; //!< Mempool cluster of the transaction, if clusters are tracked
+    mutable size_t m_cluster_pos{0}; //!< Index in its cluster's transactions
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -501,6 +565,11 @@ public:
 
     static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
 
+    //! Upper bound on the size of a mapTx node: the entry plus the links of its five indexes.
+    static constexpr size_t ENTRY_NODE_MAX_BYTES{sizeof(CTxMemPoolEntry) + 24 * sizeof(void*)};
+    using EntryResource = PoolResource<ENTRY_NODE_MAX_BYTES, alignof(CTxMemPoolEntry)>;
+    using EntryAllocator = PoolAllocator<CTxMemPoolEntry, ENTRY_NODE_MAX_BYTES, alignof(CTxMemPoolEntry)>;
+
     typedef boost::multi_index_container<
         CTxMemPoolEntry,
         boost::multi_index::indexed_by<
@@ -530,7 +599,8 @@ public:
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
             >
-        >
+        >,
+        EntryAllocator
     > indexed_transaction_set;
 
     /**
@@ -561,7 +631,12 @@ public:
      * the mempool is consistent with the new chain tip and fully populated.
      */
     mutable RecursiveMutex cs;
-    indexed_transaction_set mapTx GUARDED_BY(cs);
+    /**
+     * Storage for the nodes of mapTx, so that entries are allocated from
+     * contiguous chunks and recycled on removal. It must outlive mapTx.
+     */
+    EntryResource m_entry_resource GUARDED_BY(cs);
+    indexed_transaction_set mapTx GUARDED_BY(cs){indexed_transaction_set::ctor_args_list{}, EntryAllocator{&m_entry_resource}};
 
     using txiter = indexed_transaction_set::nth_index<0>::type::const_iterator;
     std::vector<std::pair<uint256, txiter>> vTxHashes GUARDED_BY(cs); //!< All tx witness hashes/entries in mapTx, in random order
@@ -569,9 +644,48 @@ public:
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    /** A run of a cluster's linearization that is best mined together. */
+    struct ClusterChunk {
+        size_t end;   //!< Position in the cluster just past the chunk
+        CAmount fee;  //!< Modified fees of the chunk
+        int64_t size; //!< Virtual size of the chunk
+
+        bool LowerFeeRate(const ClusterChunk& other) const
+        {
+            return double(fee) * other.size < double(other.fee) * size;
+        }
+    };
+
+    /**
+     * Mempool transactions connected by spends. Once linearized, txs is in
+     * an order valid in a block and is split into chunks of decreasing
+     * feerate, so that mining and eviction can take whole chunks from the
+     * front and the back without walking ancestors or descendants.
+     */
+    struct Cluster {
+        std::vector<txiter> txs;
+        std::vector<ClusterChunk> chunks;
+        //! Transactions changed since the last linearization, which may also have split the cluster.
+        bool dirty{false};
+    };
+
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
+    const bool m_track_clusters;
+    mutable std::unordered_map<uint64_t, Cluster> m_clusters GUARDED_BY(cs);
+    //! Clusters to linearize before they are read; may list clusters since merged away.
+    mutable std::vector<uint64_t> m_dirty_clusters GUARDED_BY(cs);
+    mutable uint64_t m_next_cluster_id GUARDED_BY(cs){1};
+
+    /** Put a transaction in one cluster with its in-mempool parents and children, merging theirs. */
+    void AddToCluster(txiter it) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void RemoveFromCluster(txiter it) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void MarkClusterDirty(uint64_t id) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Linearize a cluster if it is dirty. Returns the clusters it now consists of. */
+    std::vector<uint64_t> LinearizeCluster(uint64_t id) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
 
     void UpdateParent(txiter entry, txiter parent, bool add) EXCLUSIVE_LOCKS_REQUIRED(cs);
     void UpdateChild(txiter entry, txiter child, bool add) EXCLUSIVE_LOCKS_REQUIRED(cs);
@@ -595,7 +709,7 @@ private:
     bool CalculateAncestorsAndCheckLimits(size_t entry_size,
                                           size_t entry_count,
                                           setEntries& setAncestors,
-                                          CTxMemPoolEntry::Parents &staged_ancestors,
+                                          CTxMemPoolEntry::EntryRefSet& staged_ancestors,
                                           uint64_t limitAncestorCount,
                                           uint64_t limitAncestorSize,
                                           uint64_t limitDescendantCount,
@@ -613,8 +727,9 @@ public:
      *
      * @param[in] estimator is used to estimate appropriate transaction fees.
      * @param[in] check_ratio is the ratio used to determine how often sanity checks will run.
+     * @param[in] track_clusters keeps linearized clusters, used for mining, eviction and replacement.
      */
-    explicit CTxMemPool(CBlockPolicyEstimator* estimator = nullptr, int check_ratio = 0);
+    explicit CTxMemPool(CBlockPolicyEstimator* estimator = nullptr, int check_ratio = 0, bool track_clusters = false);
 
     /**
      * If sanity-checking is turned on, check makes sure the pool is
@@ -720,6 +835,24 @@ public:
                             uint64_t limitDescendantSize,
                             std::string &errString) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+    bool TracksClusters() const { return m_track_clusters; }
+
+    /**
+     * Number of transactions in the cluster that count new transactions would
+     * form with their in-mempool ancestors, not counting the entries in
+     * removing. Zero unless the mempool tracks clusters.
+     */
+    size_t CalculateClusterSize(const setEntries& ancestors, size_t count, const setEntries& removing) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    /** All clusters, linearized. Empty unless the mempool tracks clusters. */
+    const std::unordered_map<uint64_t, Cluster>& GetClusters() const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    /**
+     * The feerate a transaction is mined at: that of its chunk when the
+     * mempool tracks clusters, and its own otherwise.
+     */
+    CFeeRate GetMiningFeeRate(txiter it) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
@@ -734,6 +867,8 @@ public:
     CFeeRate GetMinFee(size_t sizelimit) const;
 
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
+      *  With clusters tracked, the chunk of lowest feerate at the end of a
+      *  cluster goes first, and otherwise the package of lowest descendant score.
       *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
       */
@@ -794,6 +929,10 @@ public:
 
     size_t DynamicMemoryUsage() const;
 
+    //! Calculate how much of DynamicMemoryUsage() is held for reuse by
+    //! entries removed since the mempool was created
+    size_t FreeMemoryUsage() const;
+
     /** Adds a transaction to the unbroadcast set */
     void AddUnbroadcastTx(const uint256& txid)
     {
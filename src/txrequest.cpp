@@ -667,6 +667,25 @@ public:
         });
     }
 
+    void DelayTx(NodeId peer, const uint256& txhash, std::chrono::microseconds reqtime)
+    {
+        auto it = m_index.get<ByPeer>().find(ByPeerView{peer, true, txhash});
+        if (it == m_index.get<ByPeer>().end()) {
+            it = m_index.get<ByPeer>().find(ByPeerView{peer, false, txhash});
+            if (it == m_index.get<ByPeer>().end() || (it->GetState() != State::CANDIDATE_DELAYED &&
+                                                      it->GetState() != State::CANDIDATE_READY)) {
+                return;
+            }
+        }
+
+        // Demote it to CANDIDATE_DELAYED first, so that the next best CANDIDATE_READY (if any) takes its place if
+        // it was the CANDIDATE_BEST. SetTimePoint() promotes it again once the new reqtime has passed.
+        if (it->GetState() != State::CANDIDATE_DELAYED) {
+            ChangeAndReselect(m_index.project<ByTxHash>(it), State::CANDIDATE_DELAYED);
+        }
+        Modify<ByPeer>(it, [reqtime](Announcement& ann) { ann.m_time = reqtime; });
+    }
+
     void ReceivedResponse(NodeId peer, const uint256& txhash)
     {
         // We need to search the ByPeer index for both (peer, false, txhash) and (peer, true, txhash).
@@ -738,6 +757,11 @@ void TxRequestTracker::RequestedTx(NodeId peer, const uint256& txhash, std::chro
     m_impl->RequestedTx(peer, txhash, expiry);
 }
 
+void TxRequestTracker::DelayTx(NodeId peer, const uint256& txhash, std::chrono::microseconds reqtime)
+{
+    m_impl->DelayTx(peer, txhash, reqtime);
+}
+
 void TxRequestTracker::ReceivedResponse(NodeId peer, const uint256& txhash)
 {
     m_impl->ReceivedResponse(peer, txhash);
@@ -173,6 +173,14 @@ public:
      */
     void RequestedTx(NodeId peer, const uint256& txhash, std::chrono::microseconds expiry);
 
+    /** Postpones a CANDIDATE announcement until a later reqtime.
+     *
+     * If no CANDIDATE announcement for the provided peer and txhash exists, this call has no effect. Otherwise it
+     * gets the specified reqtime, so it will not be requested from that peer before then, and another peer's
+     * announcement for the same txhash may be selected in the meantime.
+     */
+    void DelayTx(NodeId peer, const uint256& txhash, std::chrono::microseconds reqtime);
+
     /** Converts a CANDIDATE or REQUESTED announcement to a COMPLETED one. If no such announcement exists for the
      *  provided peer and txhash, nothing happens.
      *
@@ -0,0 +1,87 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txvalidationqueue.h>
+
+#include <cassert>
+
+TxValidationQueue::TxValidationQueue(size_t max_peer_txs, size_t max_peer_bytes)
+    : m_max_peer_txs{max_peer_txs}, m_max_peer_bytes{max_peer_bytes}
+{
+}
+
+bool TxValidationQueue::IsFull(NodeId peer) const
+{
+    const auto it = m_peers.find(peer);
+    if (it == m_peers.end()) return false;
+    return it->second.count >= m_max_peer_txs || it->second.bytes >= m_max_peer_bytes;
+}
+
+bool TxValidationQueue::Push(NodeId peer, const CTransactionRef& tx)
+{
+    if (Contains(tx->GetHash()) || Contains(tx->GetWitnessHash())) return false;
+    m_hashes.insert(tx->GetHash());
+    m_hashes.insert(tx->GetWitnessHash());
+
+    PeerQueue& queue = m_peers[peer];
+    queue.txs.push_back(tx);
+    ++queue.count;
+    queue.bytes += tx->GetTotalSize();
+    ++m_size;
+    return true;
+}
+
+std::vector<TxValidationQueue::Entry> TxValidationQueue::PopBatch(size_t max_txs)
+{
+    std::vector<Entry> batch;
+    while (batch.size() < max_txs && m_size > 0) {
+        // Find the next peer after the one served last with anything queued.
+        // There is one, as m_size is not zero.
+        auto it = m_peers.upper_bound(m_last_served);
+        while (it == m_peers.end() || it->second.txs.empty()) {
+            it = it == m_peers.end() ? m_peers.begin() : std::next(it);
+        }
+        batch.push_back({it->first, std::move(it->second.txs.front())});
+        it->second.txs.pop_front();
+        --m_size;
+        m_last_served = it->first;
+    }
+    return batch;
+}
+
+void TxValidationQueue::Release(std::map<NodeId, PeerQueue>::iterator it, const CTransaction& tx)
+{
+    m_hashes.erase(tx.GetHash());
+    m_hashes.erase(tx.GetWitnessHash());
+    PeerQueue& queue = it->second;
+    assert(queue.count > 0);
+    --queue.count;
+    queue.bytes -= tx.GetTotalSize();
+    if (queue.count == 0) m_peers.erase(it);
+}
+
+void TxValidationQueue::Finish(const Entry& entry)
+{
+    const auto it = m_peers.find(entry.peer);
+    assert(it != m_peers.end());
+    Release(it, *entry.tx);
+}
+
+void TxValidationQueue::DisconnectedPeer(NodeId peer)
+{
+    auto it = m_peers.find(peer);
+    if (it == m_peers.end()) return;
+    std::deque<CTransactionRef> txs;
+    txs.swap(it->second.txs);
+    m_size -= txs.size();
+    // Only the last release can erase the peer, and only if none of its
+    // transactions are being validated.
+    for (const CTransactionRef& tx : txs) Release(it, *tx);
+}
+
+size_t TxValidationQueue::Count(NodeId peer) const
+{
+    const auto it = m_peers.find(peer);
+    return it == m_peers.end() ? 0 : it->second.count;
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BGL_TXVALIDATIONQUEUE_H
+#define BGL_TXVALIDATIONQUEUE_H
+
+#include <net.h> // For NodeId
+#include <primitives/transaction.h>
+#include <uint256.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+/** Data structure holding the transactions received from peers until they are validated.
+ *
+ * It lets transactions be validated on a thread of their own rather than the
+ * message handler thread, without one peer crowding out the others:
+ *
+ * - Each peer's transactions are handed out in the order they arrived, so a
+ *   parent sent before its child is validated first.
+ * - Batches are filled round-robin, one transaction per peer per round,
+ *   resuming after the peer that was served last.
+ * - The same transaction is never held twice: Push() refuses a transaction
+ *   whose txid or wtxid matches one queued or being validated.
+ * - A transaction counts against its peer's limits from Push() until
+ *   Finish(), so they also cover the transactions being validated. A peer at
+ *   its limits has to wait before sending more; the first transaction is
+ *   always accepted, however large.
+ *
+ * This class is not thread-safe; access must be synchronized by the caller.
+ */
+class TxValidationQueue
+{
+public:
+    struct Entry {
+        NodeId peer;
+        CTransactionRef tx;
+    };
+
+    TxValidationQueue(size_t max_peer_txs, size_t max_peer_bytes);
+
+    /** Whether peer has reached its limits. */
+    bool IsFull(NodeId peer) const;
+
+    /** Queue tx received from peer. Returns false if it is queued or being validated already. */
+    bool Push(NodeId peer, const CTransactionRef& tx);
+
+    /** Hand out up to max_txs queued transactions for validation. */
+    std::vector<Entry> PopBatch(size_t max_txs);
+
+    /** Release a transaction handed out by PopBatch() once it is validated. */
+    void Finish(const Entry& entry);
+
+    /** Drop the queued transactions of a peer. Those being validated stay until Finish(). */
+    void DisconnectedPeer(NodeId peer);
+
+    /** Whether a transaction with this txid or wtxid is queued or being validated. */
+    bool Contains(const uint256& txhash) const { return m_hashes.count(txhash) > 0; }
+
+    /** Transactions of peer that are queued or being validated. */
+    size_t Count(NodeId peer) const;
+
+    /** Transactions waiting to be handed out, over all peers. */
+    size_t Size() const { return m_size; }
+
+private:
+    struct PeerQueue {
+        std::deque<CTransactionRef> txs;
+        //! Transactions queued or being validated, and their serialized size.
+        size_t count{0};
+        size_t bytes{0};
+    };
+
+    void Release(std::map<NodeId, PeerQueue>::iterator it, const CTransaction& tx);
+
+    const size_t m_max_peer_txs;
+    const size_t m_max_peer_bytes;
+    std::map<NodeId, PeerQueue> m_peers;
+    //! Txids and wtxids of everything queued or being validated.
+    std::set<uint256> m_hashes;
+    size_t m_size{0};
+    NodeId m_last_served{-1};
+};
+
+#endif // BGL_TXVALIDATIONQUEUE_H
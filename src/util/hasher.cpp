@@ -9,8 +9,24 @@
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
+void SaltedTxidHasher::operator()(const uint256* const (&txids)[4], size_t (&out)[4]) const noexcept
+{
+    uint64_t hashes[4];
+    SipHashUint256_4way(k0, k1, txids, hashes);
+    for (int i = 0; i < 4; ++i) out[i] = hashes[i];
+}
+
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
+void SaltedOutpointHasher::operator()(const COutPoint* const (&ids)[4], size_t (&out)[4]) const noexcept
+{
+    const uint256* const hashes_in[4] = {&ids[0]->hash, &ids[1]->hash, &ids[2]->hash, &ids[3]->hash};
+    const uint32_t extras[4] = {ids[0]->n, ids[1]->n, ids[2]->n, ids[3]->n};
+    uint64_t hashes[4];
+    SipHashUint256Extra_4way(k0, k1, hashes_in, extras, hashes);
+    for (int i = 0; i < 4; ++i) out[i] = hashes[i];
+}
+
 SaltedSipHasher::SaltedSipHasher() : m_k0(GetRand(std::numeric_limits<uint64_t>::max())), m_k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
 size_t SaltedSipHasher::operator()(const Span<const unsigned char>& script) const
@@ -21,6 +21,9 @@ public:
     size_t operator()(const uint256& txid) const {
         return SipHashUint256(k0, k1, txid);
     }
+
+    /** Hash four txids at once: out[i] = (*this)(*txids[i]). */
+    void operator()(const uint256* const (&txids)[4], size_t (&out)[4]) const noexcept;
 };
 
 class SaltedOutpointHasher
@@ -44,6 +47,9 @@ public:
     size_t operator()(const COutPoint& id) const noexcept {
         return SipHashUint256Extra(k0, k1, id.hash, id.n);
     }
+
+    /** Hash four outpoints at once: out[i] = (*this)(*ids[i]). */
+    void operator()(const COutPoint* const (&ids)[4], size_t (&out)[4]) const noexcept;
 };
 
 struct FilterHeaderHasher
@@ -0,0 +1,54 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <util/threadpool.h>
+
+#include <tinyformat.h>
+#include <util/thread.h>
+
+#include <cassert>
+
+void ThreadPool::Start(int num_threads)
+{
+    assert(m_threads.empty());
+    if (num_threads <= 0) return;
+    WITH_LOCK(m_mutex, m_num_threads = num_threads);
+    for (int n = 0; n < num_threads; ++n) {
+        m_threads.emplace_back([this, name = num_threads > 1 ? strprintf("%s.%i", m_name, n) : m_name] {
+            util::TraceThread(name.c_str(), [this] { Loop(); });
+        });
+    }
+}
+
+void ThreadPool::Stop()
+{
+    {
+        LOCK(m_mutex);
+        m_request_stop = true;
+        // Tasks submitted from here on run on the submitting thread.
+        m_num_threads = 0;
+    }
+    m_cv.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+    WITH_LOCK(m_mutex, m_request_stop = false);
+}
+
+void ThreadPool::Loop()
+{
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            WAIT_LOCK(m_mutex, lock);
+            m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_request_stop || !m_tasks.empty(); });
+            // Queued tasks are finished before stopping.
+            if (m_tasks.empty()) return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BGL_UTIL_THREADPOOL_H
+#define BGL_UTIL_THREADPOOL_H
+
+#include <sync.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Long-lived worker threads running submitted tasks in submission order, for
+ * components that do part of their work in the background.
+ *
+ * A pool with one thread also finishes its tasks in submission order. A pool
+ * without threads, before Start() or after Stop(), runs a task on the thread
+ * submitting it. A task must not wait for tasks submitted after it to the
+ * same pool.
+ *
+ * Start() and Stop() must not be called concurrently; Submit() may be called
+ * from any thread at any time.
+ */
+class ThreadPool
+{
+private:
+    const std::string m_name;
+
+    Mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::packaged_task<void()>> m_tasks GUARDED_BY(m_mutex);
+    //! Threads taking tasks; zero once stopping.
+    size_t m_num_threads GUARDED_BY(m_mutex){0};
+    bool m_request_stop GUARDED_BY(m_mutex){false};
+    std::vector<std::thread> m_threads;
+
+    void Loop() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+
+public:
+    explicit ThreadPool(std::string name) : m_name{std::move(name)} {}
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool() { Stop(); }
+
+    /** Start num_threads threads, named after the pool, with a .<n> suffix if there are several. */
+    void Start(int num_threads) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+
+    /** Finish the tasks queued so far and join the threads. */
+    void Stop() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+
+    /** Number of threads taking tasks. */
+    size_t WorkerCount() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        LOCK(m_mutex);
+        return m_num_threads;
+    }
+
+    /** Queue func to run on a pool thread. The future is ready once it has run, and passes on what it throws. */
+    template <typename F>
+    std::future<void> Submit(F&& func) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        std::packaged_task<void()> task{std::forward<F>(func)};
+        std::future<void> result{task.get_future()};
+        bool queued{false};
+        {
+            LOCK(m_mutex);
+            if (m_num_threads > 0) {
+                m_tasks.push_back(std::move(task));
+                queued = true;
+            }
+        }
+        if (queued) {
+            m_cv.notify_one();
+        } else {
+            task();
+        }
+        return result;
+    }
+};
+
+#endif // BGL_UTIL_THREADPOOL_H
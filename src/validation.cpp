@@ -38,6 +38,7 @@
 #include <script/sigcache.h>
 #include <shutdown.h>
 #include <signet.h>
+#include <span.h>
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
@@ -50,14 +51,20 @@
 #include <util/rbf.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/threadnames.h>
+#include <util/threadpool.h>
 #include <util/trace.h>
 #include <util/translation.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <numeric>
 #include <optional>
 #include <string>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 
@@ -176,7 +183,8 @@ CBlockIndex* BlockManager::FindForkInGlobalIndex(const CChain& chain, const CBlo
 bool CheckInputScripts(const CTransaction& tx, TxValidationState& state,
                        const CCoinsViewCache& inputs, unsigned int flags, bool cacheSigStore,
                        bool cacheFullScriptStore, PrecomputedTransactionData& txdata,
-                       std::vector<CScriptCheck>* pvChecks = nullptr)
+                       std::vector<CScriptCheck>* pvChecks = nullptr,
+                       DeferredTxData* deferred = nullptr)
                        EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 bool CheckFinalTx(const CBlockIndex* active_chain_tip, const CTransaction &tx, int flags)
@@ -420,6 +428,38 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, TxValidationS
     return CheckInputScripts(tx, state, view, flags, /* cacheSigStore= */ true, /* cacheFullScriptStore= */ true, txdata);
 }
 
+/**
+ * Queue for the script checks of transactions being accepted to the mempool,
+ * served by the same number of threads as scriptcheckqueue. A transaction has
+ * far fewer checks than a block, hence the smaller batch size.
+ */
+static CCheckQueue<CScriptCheck> mempoolcheckqueue(16);
+
+bool CheckTransactionForMempool(const CTransaction& tx, TxValidationState& state)
+{
+    if (!CheckTransaction(tx, state)) {
+        return false; // state filled in by CheckTransaction
+    }
+
+    // Coinbase is only valid in a block, not as a loose transaction
+    if (tx.IsCoinBase())
+        return state.Invalid(TxValidationResult::TX_CONSENSUS, "coinbase");
+
+    // Rather not work on nonstandard transactions (unless -testnet/-regtest)
+    std::string reason;
+    if (fRequireStandard && !IsStandardTx(tx, reason))
+        return state.Invalid(TxValidationResult::TX_NOT_STANDARD, reason);
+
+    // Do not work on transactions that are too small.
+    // A transaction with 1 segwit input and 1 P2WPHK output has non-witness size of 82 bytes.
+    // Transactions smaller than this are not relayed to mitigate CVE-2017-12842 by not relaying
+    // 64-byte transactions.
+    if (::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) < MIN_STANDARD_TX_NONWITNESS_SIZE)
+        return state.Invalid(TxValidationResult::TX_NOT_STANDARD, "tx-size-small");
+
+    return true;
+}
+
 namespace {
 
 class MemPoolAccept
@@ -429,7 +469,8 @@ public:
         m_limit_ancestors(gArgs.GetIntArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT)),
         m_limit_ancestor_size(gArgs.GetIntArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000),
         m_limit_descendants(gArgs.GetIntArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT)),
-        m_limit_descendant_size(gArgs.GetIntArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000) {
+        m_limit_descendant_size(gArgs.GetIntArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000),
+        m_limit_cluster(gArgs.GetIntArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT)) {
     }
 
     // We put the arguments we're handed into a struct, so we can pass them
@@ -531,6 +572,14 @@ private:
     // only invoke this on transactions that have otherwise passed policy checks.
     bool PolicyScriptChecks(const ATMPArgs& args, Workspace& ws) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_pool.cs);
 
+    // Run the policy script checks of all given transactions on the mempool
+    // script check threads, and wait for them. Returns true only if every
+    // check ran and passed. Otherwise, including when there are too few
+    // inputs to be worth dispatching, PolicyScriptChecks() must be run on each
+    // transaction; any signatures verified here are in the signature cache by
+    // then, so that only repeats the work up to the failing input.
+    bool ParallelPolicyScriptChecks(Span<Workspace> workspaces) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_pool.cs);
+
     // Re-run the script checks, using consensus flags, and try to cache the
     // result in the scriptcache. This should be done after
     // PolicyScriptChecks(). This requires that all inputs either be in our
@@ -571,6 +620,8 @@ private:
     // in-mempool conflicts; see below).
     size_t m_limit_descendants;
     size_t m_limit_descendant_size;
+    // Only applied if the mempool tracks clusters.
+    const size_t m_limit_cluster;
 
     /** Whether the transaction(s) would replace any mempool transactions. If so, RBF rules apply. */
     bool m_rbf{false};
@@ -597,26 +648,10 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
     CAmount& nConflictingFees = ws.m_conflicting_fees;
     size_t& nConflictingSize = ws.m_conflicting_size;
 
-    if (!CheckTransaction(tx, state)) {
-        return false; // state filled in by CheckTransaction
+    if (!CheckTransactionForMempool(tx, state)) {
+        return false; // state filled in by CheckTransactionForMempool
     }
 
-    // Coinbase is only valid in a block, not as a loose transaction
-    if (tx.IsCoinBase())
-        return state.Invalid(TxValidationResult::TX_CONSENSUS, "coinbase");
-
-    // Rather not work on nonstandard transactions (unless -testnet/-regtest)
-    std::string reason;
-    if (fRequireStandard && !IsStandardTx(tx, reason))
-        return state.Invalid(TxValidationResult::TX_NOT_STANDARD, reason);
-
-    // Do not work on transactions that are too small.
-    // A transaction with 1 segwit input and 1 P2WPHK output has non-witness size of 82 bytes.
-    // Transactions smaller than this are not relayed to mitigate CVE-2017-12842 by not relaying
-    // 64-byte transactions.
-    if (::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) < MIN_STANDARD_TX_NONWITNESS_SIZE)
-        return state.Invalid(TxValidationResult::TX_NOT_STANDARD, "tx-size-small");
-
     // Only accept nLockTime-using transactions that can be mined in the next
     // block; we don't want our mempool filled up with transactions that can't
     // be mined yet.
@@ -823,7 +858,7 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
         // more economically rational to mine. Before we go digging through the mempool for all
         // transactions that would need to be removed (direct conflicts and all descendants), check
         // that the replacement transaction pays more than its direct conflicts.
-        if (const auto err_string{PaysMoreThanConflicts(setIterConflicting, newFeeRate, hash)}) {
+        if (const auto err_string{PaysMoreThanConflicts(m_pool, setIterConflicting, newFeeRate, hash)}) {
             return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "insufficient fee", *err_string);
         }
 
@@ -849,6 +884,14 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
             return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "insufficient fee", *err_string);
         }
     }
+
+    // Bound the clusters the mempool linearizes on every change. Whatever is
+    // replaced leaves the cluster first.
+    const size_t cluster_size{m_pool.CalculateClusterSize(setAncestors, 1, allConflicting)};
+    if (cluster_size > m_limit_cluster) {
+        return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-large-cluster",
+                             strprintf("%u transactions [limit: %u]", cluster_size, m_limit_cluster));
+    }
     return true;
 }
 
@@ -878,6 +921,25 @@ bool MemPoolAccept::PolicyScriptChecks(const ATMPArgs& args, Workspace& ws)
     return true;
 }
 
+bool MemPoolAccept::ParallelPolicyScriptChecks(Span<Workspace> workspaces)
+{
+    if (!g_parallel_script_checks) return false;
+    size_t num_inputs{0};
+    for (const Workspace& ws : workspaces) num_inputs += ws.m_ptx->vin.size();
+    if (num_inputs < MIN_PARALLEL_MEMPOOL_SCRIPT_CHECKS) return false;
+
+    // The checks refer to the transactions and their precomputed data in the
+    // workspaces, which outlive control.
+    CCheckQueueControl<CScriptCheck> control(&mempoolcheckqueue);
+    for (Workspace& ws : workspaces) {
+        std::vector<CScriptCheck> checks;
+        TxValidationState state_dummy; // Checks are only queued, nothing fails here
+        CheckInputScripts(*ws.m_ptx, state_dummy, m_view, STANDARD_SCRIPT_VERIFY_FLAGS, true, false, ws.m_precomputed_txdata, &checks);
+        control.Add(checks);
+    }
+    return control.Wait();
+}
+
 bool MemPoolAccept::ConsensusScriptChecks(const ATMPArgs& args, Workspace& ws)
 {
     const CTransaction& tx = *ws.m_ptx;
@@ -965,7 +1027,7 @@ MempoolAcceptResult MemPoolAccept::AcceptSingleTransaction(const CTransactionRef
 
     // Perform the inexpensive checks first and avoid hashing and signature verification unless
     // those checks pass, to mitigate CPU exhaustion denial-of-service attacks.
-    if (!PolicyScriptChecks(args, ws)) return MempoolAcceptResult::Failure(ws.m_state);
+    if (!ParallelPolicyScriptChecks(Span<Workspace>{&ws, 1}) && !PolicyScriptChecks(args, ws)) return MempoolAcceptResult::Failure(ws.m_state);
 
     if (!ConsensusScriptChecks(args, ws)) return MempoolAcceptResult::Failure(ws.m_state);
 
@@ -1026,8 +1088,23 @@ PackageMempoolAcceptResult MemPoolAccept::AcceptMultipleTransactions(const std::
         return PackageMempoolAcceptResult(package_state, std::move(results));
     }
 
+    // Like the limits above, the package is taken to join a single cluster.
+    if (txns.size() > 1) {
+        CTxMemPool::setEntries package_ancestors;
+        for (const Workspace& ws : workspaces) package_ancestors.insert(ws.m_ancestors.begin(), ws.m_ancestors.end());
+        const size_t cluster_size{m_pool.CalculateClusterSize(package_ancestors, txns.size(), {})};
+        if (cluster_size > m_limit_cluster) {
+            package_state.Invalid(PackageValidationResult::PCKG_POLICY, "package-mempool-limits",
+                                  strprintf("too large cluster, %u transactions [limit: %u]", cluster_size, m_limit_cluster));
+            return PackageMempoolAcceptResult(package_state, std::move(results));
+        }
+    }
+
+    // Verify the scripts of the whole package at once. Should that fail, the
+    // loop below finds the culprit.
+    const bool scripts_ok{ParallelPolicyScriptChecks(workspaces)};
     for (Workspace& ws : workspaces) {
-        if (!PolicyScriptChecks(args, ws)) {
+        if (!scripts_ok && !PolicyScriptChecks(args, ws)) {
             // Exit early to avoid doing pointless work. Update the failed tx result; the rest are unfinished.
             package_state.Invalid(PackageValidationResult::PCKG_TX, "transaction failed");
             results.emplace(ws.m_ptx->GetWitnessHash(), MempoolAcceptResult::Failure(ws.m_state));
@@ -1117,11 +1194,12 @@ CoinsViews::CoinsViews(
     bool in_memory,
     bool should_wipe) : m_dbview(
                             gArgs.GetDataDirNet() / ldb_name, cache_size_bytes, in_memory, should_wipe),
-                        m_catcherview(&m_dbview) {}
+                        m_catcherview(&m_dbview),
+                        m_prefetchview(&m_catcherview, m_dbview) {}
 
 void CoinsViews::InitCache()
 {
-    m_cacheview = std::make_unique<CCoinsViewCache>(&m_catcherview);
+    m_cacheview = std::make_unique<CCoinsViewCache>(&m_prefetchview);
 }
 
 CChainState::CChainState(
@@ -1270,6 +1348,7 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
 }
 
 bool CScriptCheck::operator()() {
+    if (deferred) deferred->Init(*ptxTo, *txdata);
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
     return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata), &error);
@@ -1324,7 +1403,7 @@ void InitScriptExecutionCache() {
 bool CheckInputScripts(const CTransaction& tx, TxValidationState& state,
                        const CCoinsViewCache& inputs, unsigned int flags, bool cacheSigStore,
                        bool cacheFullScriptStore, PrecomputedTransactionData& txdata,
-                       std::vector<CScriptCheck>* pvChecks)
+                       std::vector<CScriptCheck>* pvChecks, DeferredTxData* deferred)
 {
     if (tx.IsCoinBase()) return true;
 
@@ -1355,9 +1434,18 @@ bool CheckInputScripts(const CTransaction& tx, TxValidationState& state,
             assert(!coin.IsSpent());
             spent_outputs.emplace_back(coin.out);
         }
-        txdata.Init(tx, std::move(spent_outputs));
+        if (pvChecks && deferred) {
+            // Leave the sighash precomputation to whichever check runs first.
+            deferred->m_spent_outputs = std::move(spent_outputs);
+        } else {
+            txdata.Init(tx, std::move(spent_outputs));
+            deferred = nullptr;
+        }
+    } else {
+        deferred = nullptr;
     }
-    assert(txdata.m_spent_outputs.size() == tx.vin.size());
+    const std::vector<CTxOut>& spent_outputs = deferred ? deferred->m_spent_outputs : txdata.m_spent_outputs;
+    assert(spent_outputs.size() == tx.vin.size());
 
     for (unsigned int i = 0; i < tx.vin.size(); i++) {
 
@@ -1368,7 +1456,7 @@ bool CheckInputScripts(const CTransaction& tx, TxValidationState& state,
         // spent being checked as a part of CScriptCheck.
 
         // Verify signature
-        CScriptCheck check(txdata.m_spent_outputs[i], tx, i, flags, cacheSigStore, &txdata);
+        CScriptCheck check(spent_outputs[i], tx, i, flags, cacheSigStore, &txdata, deferred);
         if (pvChecks) {
             pvChecks->push_back(CScriptCheck());
             check.swap(pvChecks->back());
@@ -1382,7 +1470,7 @@ bool CheckInputScripts(const CTransaction& tx, TxValidationState& state,
                 // splitting the network between upgraded and
                 // non-upgraded nodes by banning CONSENSUS-failing
                 // data providers.
-                CScriptCheck check2(txdata.m_spent_outputs[i], tx, i,
+                CScriptCheck check2(spent_outputs[i], tx, i,
                         flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
                 if (check2())
                     return state.Invalid(TxValidationResult::TX_NOT_STANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1454,13 +1542,17 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
  *  When FAILED is returned, view is left in an indeterminate state. */
 DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
 {
-    bool fClean = true;
-
     CBlockUndo blockUndo;
     if (!UndoReadFromDisk(blockUndo, pindex)) {
         error("DisconnectBlock(): failure reading undo data");
         return DISCONNECT_FAILED;
     }
+    return DisconnectBlock(block, pindex, view, std::move(blockUndo));
+}
+
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CBlockUndo&& blockUndo)
+{
+    bool fClean = true;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
         error("DisconnectBlock(): block and undo data inconsistent");
@@ -1511,14 +1603,84 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
+/**
+ * Threads sharing out the work of preparing blocks for validation, such as
+ * hashing the transactions of blocks received from peers. As many as the
+ * script check threads, and started and stopped with them.
+ */
+static ThreadPool g_block_work_pool{"blockwork"};
+
 void StartScriptCheckWorkerThreads(int threads_num)
 {
     scriptcheckqueue.StartWorkerThreads(threads_num);
+    mempoolcheckqueue.StartWorkerThreads(threads_num, "mempoolch");
+    g_block_work_pool.Start(threads_num);
 }
 
 void StopScriptCheckWorkerThreads()
 {
+    g_block_work_pool.Stop();
     scriptcheckqueue.StopWorkerThreads();
+    mempoolcheckqueue.StopWorkerThreads();
+}
+
+ThreadPool& BlockWorkPool()
+{
+    return g_block_work_pool;
+}
+
+/**
+ * Call func(begin, end) on parts contiguous ranges splitting [0, count): the
+ * first one on the calling thread, the others on pool. The calling thread
+ * must not be one of the pool's.
+ */
+template <typename F>
+static void ForEachRange(ThreadPool& pool, size_t count, size_t parts, const F& func)
+{
+    std::vector<std::future<void>> results;
+    results.reserve(parts - 1);
+    for (size_t t = 1; t < parts; ++t) {
+        results.push_back(pool.Submit([&func, begin = count * t / parts, end = count * (t + 1) / parts] { func(begin, end); }));
+    }
+    func(0, count / parts);
+    for (auto& result : results) {
+        result.get();
+    }
+}
+
+std::vector<CTransactionRef> MakeBlockTransactions(std::vector<CMutableTransaction>&& txs, ThreadPool* pool)
+{
+    std::vector<CTransactionRef> vtx(txs.size());
+    auto make_range = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            vtx[i] = MakeTransactionRef(std::move(txs[i]));
+        }
+    };
+
+    const size_t count = txs.size();
+    const size_t threads = !pool || count < MIN_PARALLEL_TX_HASHING_TXS ? 1 : std::min<size_t>(1 + pool->WorkerCount(), count / (MIN_PARALLEL_TX_HASHING_TXS / 2));
+    if (threads <= 1) {
+        make_range(0, count);
+    } else {
+        ForEachRange(*pool, count, threads, make_range);
+    }
+    return vtx;
+}
+
+std::vector<uint256> HashBlockHeaders(Span<const CBlockHeader> headers, ThreadPool* pool)
+{
+    const size_t count = headers.size();
+    const size_t threads = !pool || count < MIN_PARALLEL_HEADER_HASHING ? 1 : std::min<size_t>(1 + pool->WorkerCount(), count / (MIN_PARALLEL_HEADER_HASHING / 2));
+    if (threads <= 1) return GetBlockHeaderHashes(headers);
+
+    std::vector<uint256> hashes(count);
+    auto hash_range = [&](size_t begin, size_t end) {
+        const std::vector<uint256> range_hashes{GetBlockHeaderHashes(headers.subspan(begin, end - begin))};
+        std::copy(range_hashes.begin(), range_hashes.end(), hashes.begin() + begin);
+    };
+
+    ForEachRange(*pool, count, threads, hash_range);
+    return hashes;
 }
 
 /**
@@ -1793,15 +1955,38 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     // until after `control` has run the script checks (potentially
     // in multiple threads). Preallocate the vector size so a new allocation
     // doesn't invalidate pointers into the vector, and keep txsdata in scope
-    // for as long as `control`.
+    // for as long as `control`. The same goes for txsdeferred, through which
+    // the script check threads fill in txsdata.
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && g_parallel_script_checks ? &scriptcheckqueue : nullptr);
     std::vector<PrecomputedTransactionData> txsdata(block.vtx.size());
+    std::vector<DeferredTxData> txsdeferred(block.vtx.size());
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
     int64_t nSigOpsCost = 0;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+
+    // Pull every coin spent by this block into the view in one batch, so the
+    // outpoints are hashed and probed in groups. Outputs created earlier in
+    // the block are not in the view yet and are left out.
+    {
+        std::vector<uint256> block_txids;
+        block_txids.reserve(block.vtx.size());
+        for (const auto& tx : block.vtx) block_txids.push_back(tx->GetHash());
+        std::sort(block_txids.begin(), block_txids.end());
+        std::vector<COutPoint> prevouts;
+        for (const auto& tx : block.vtx) {
+            if (tx->IsCoinBase()) continue;
+            for (const CTxIn& txin : tx->vin) {
+                if (!std::binary_search(block_txids.begin(), block_txids.end(), txin.prevout.hash)) {
+                    prevouts.push_back(txin.prevout);
+                }
+            }
+        }
+        view.FetchCoins(prevouts);
+    }
+
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
@@ -1853,7 +2038,7 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
             TxValidationState tx_state;
-            if (fScriptChecks && !CheckInputScripts(tx, tx_state, view, flags, fCacheResults, fCacheResults, txsdata[i], g_parallel_script_checks ? &vChecks : nullptr)) {
+            if (fScriptChecks && !CheckInputScripts(tx, tx_state, view, flags, fCacheResults, fCacheResults, txsdata[i], g_parallel_script_checks ? &vChecks : nullptr, &txsdeferred[i])) {
                 // Any transaction validation failure in ConnectBlock is a block consensus failure
                 state.Invalid(BlockValidationResult::BLOCK_CONSENSUS,
                               tx_state.GetRejectReason(), tx_state.GetDebugMessage());
@@ -1928,7 +2113,9 @@ CoinsCacheSizeState CChainState::GetCoinsCacheSizeState(
     size_t max_mempool_size_bytes)
 {
     const int64_t nMempoolUsage = m_mempool ? m_mempool->DynamicMemoryUsage() : 0;
-    int64_t cacheSize = CoinsTip().DynamicMemoryUsage();
+    // Memory held for entries erased since the cache was last emptied is
+    // reused before the cache allocates more, so it does not count.
+    int64_t cacheSize = CoinsTip().DynamicMemoryUsage() - CoinsTip().FreeMemoryUsage();
     int64_t nTotalSpace =
         max_coins_cache_size_bytes + std::max<int64_t>(max_mempool_size_bytes - nMempoolUsage, 0);
 
@@ -2067,8 +2254,24 @@ bool CChainState::FlushStateToDisk(
                 return AbortNode(state, "Disk space is too low!", _("Disk space is too low!"));
             }
             // Flush the chainstate (which may refer to block index entries).
-            if (!CoinsTip().Flush())
+            // Only a forced flush empties the cache: otherwise the unspent
+            // coins stay cached so that the working set survives the write,
+            // and if the cache is too large the clean coins least recently
+            // used are evicted until it is back to 3/4 of its budget.
+            const bool empty_cache = mode == FlushStateMode::ALWAYS;
+            const int64_t nFlushStart = GetTimeMicros();
+            if (!(empty_cache ? CoinsTip().Flush() : CoinsTip().Sync()))
                 return AbortNode(state, "Failed to write to coin database");
+            size_t evicted = 0;
+            if (!empty_cache && cache_state >= CoinsCacheSizeState::LARGE) {
+                evicted = CoinsTip().Trim(m_coinstip_cache_size_bytes * 3 / 4);
+                LogPrint(BCLog::COINDB, "Evicted %u coins from the cache, %.2fkB left\n", evicted, CoinsTip().DynamicMemoryUsage() / 1000.0);
+            }
+            ++(empty_cache ? m_coins_flush_stats.full_flushes : m_coins_flush_stats.partial_flushes);
+            m_coins_flush_stats.last_duration = std::chrono::microseconds{GetTimeMicros() - nFlushStart};
+            m_coins_flush_stats.last_coins = coins_count;
+            m_coins_flush_stats.last_usage_bytes = coins_mem_usage;
+            m_coins_flush_stats.last_evicted = evicted;
             nLastFlush = nNow;
             full_flush_completed = true;
         }
@@ -2481,6 +2684,11 @@ bool CChainState::ActivateBestChainStep(BlockValidationState& state, CBlockIndex
 
         // Connect new blocks.
         for (CBlockIndex* pindexConnect : reverse_iterate(vpindexToConnect)) {
+            // Read the coins spent by the next block while this one is validated.
+            const CBlockIndex* pindex_next{pindexMostWork->GetAncestor(pindexConnect->nHeight + 1)};
+            if (pindex_next && (pindex_next->nStatus & BLOCK_HAVE_DATA)) {
+                m_coins_views->m_prefetchview.Prefetch(pindex_next->GetBlockPos(), m_params.GetConsensus());
+            }
             if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
@@ -2863,18 +3071,18 @@ void CChainState::ResetBlockFailureFlags(CBlockIndex *pindex) {
     }
 }
 
-CBlockIndex* BlockManager::AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* BlockManager::AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     AssertLockHeld(cs_main);
 
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = m_block_index.find(hash);
     if (it != m_block_index.end())
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = NewBlockIndex();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -2943,15 +3151,20 @@ void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pi
     }
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, BlockValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+static bool CheckBlockHeader(const CBlockHeader& block, const uint256& hash, BlockValidationState& state, const Consensus::Params& consensusParams)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
+    if (!CheckProofOfWork(hash, block.nBits, consensusParams))
         return state.Invalid(BlockValidationResult::BLOCK_INVALID_HEADER, "high-hash", "proof of work failed");
 
     return true;
 }
 
+static bool CheckBlockHeader(const CBlockHeader& block, BlockValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+{
+    return !fCheckPOW || CheckBlockHeader(block, block.GetHash(), state, consensusParams);
+}
+
 bool CheckBlock(const CBlock& block, BlockValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -3234,11 +3447,10 @@ static bool ContextualCheckBlock(const CBlock& block, BlockValidationState& stat
     return true;
 }
 
-bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, BlockValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool check_pow)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = m_block_index.find(hash);
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
         if (miSelf != m_block_index.end()) {
@@ -3253,7 +3465,7 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus())) {
+        if (check_pow && !CheckBlockHeader(block, hash, state, chainparams.GetConsensus())) {
             LogPrint(BCLog::VALIDATION, "%s: Consensus::CheckBlockHeader: %s, %s\n", __func__, hash.ToString(), state.ToString());
             return false;
         }
@@ -3314,7 +3526,7 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
             }
         }
     }
-    CBlockIndex* pindex = AddToBlockIndex(block);
+    CBlockIndex* pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3324,14 +3536,28 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
 
 // Exposed wrapper for AcceptBlockHeader
 bool ChainstateManager::ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, BlockValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
+{
+    // Hash the whole batch before taking cs_main, so the multi-way Keccak implementations can be used.
+    return ProcessNewBlockHeaders(headers, HashBlockHeaders(headers), state, chainparams, ppindex);
+}
+
+bool ChainstateManager::ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, const std::vector<uint256>& hashes, BlockValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
     AssertLockNotHeld(cs_main);
+    assert(hashes.size() == headers.size());
+    // Check proof of work without holding cs_main. Headers from the first
+    // failure on are checked again by AcceptBlockHeader, which reports it in
+    // the same order as before.
+    size_t num_pow_valid{0};
+    while (num_pow_valid < headers.size() && CheckProofOfWork(hashes[num_pow_valid], headers[num_pow_valid].nBits, chainparams.GetConsensus())) {
+        ++num_pow_valid;
+    }
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); ++i) {
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
             bool accepted = m_blockman.AcceptBlockHeader(
-                header, state, chainparams, &pindex);
+                headers[i], hashes[i], state, chainparams, &pindex, /*check_pow=*/i >= num_pow_valid);
             ActiveChainstate().CheckBlockIndex();
 
             if (!accepted) {
@@ -3361,7 +3587,7 @@ bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, Block
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    bool accepted_header = m_blockman.AcceptBlockHeader(block, state, m_params, &pindex);
+    bool accepted_header = m_blockman.AcceptBlockHeader(block, block.GetHash(), state, m_params, &pindex);
     CheckBlockIndex();
 
     if (!accepted_header)
@@ -3647,6 +3873,17 @@ void BlockManager::FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPr
            nLastBlockWeCanPrune, count);
 }
 
+CBlockIndex* BlockManager::NewBlockIndex()
+{
+    AssertLockHeld(cs_main);
+
+    if (m_block_index_chunks.empty() || m_block_index_chunk_used == BLOCK_INDEX_CHUNK_SIZE) {
+        m_block_index_chunks.push_back(std::make_unique<CBlockIndex[]>(BLOCK_INDEX_CHUNK_SIZE));
+        m_block_index_chunk_used = 0;
+    }
+    return &m_block_index_chunks.back()[m_block_index_chunk_used++];
+}
+
 CBlockIndex * BlockManager::InsertBlockIndex(const uint256& hash)
 {
     AssertLockHeld(cs_main);
@@ -3660,7 +3897,7 @@ CBlockIndex * BlockManager::InsertBlockIndex(const uint256& hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = NewBlockIndex();
     mi = m_block_index.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -3728,11 +3965,34 @@ void BlockManager::Unload() {
     m_failed_blocks.clear();
     m_blocks_unlinked.clear();
 
-    for (const BlockMap::value_type& entry : m_block_index) {
-        delete entry.second;
+    m_block_index.clear();
+    m_block_index_chunks.clear();
+    m_block_index_chunk_used = 0;
+    m_block_index_loaded = false;
+}
+
+bool BlockManager::WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+
+    // The snapshot must match what is in the database.
+    if (!m_block_tree_db || !m_block_index_loaded || !setDirtyBlockIndex.empty()) {
+        return false;
     }
 
-    m_block_index.clear();
+    // Parents go before their children.
+    std::vector<std::pair<int, const CBlockIndex*>> sorted_by_height;
+    sorted_by_height.reserve(m_block_index.size());
+    for (const auto& [_, pindex] : m_block_index) {
+        sorted_by_height.emplace_back(pindex->nHeight, pindex);
+    }
+    std::sort(sorted_by_height.begin(), sorted_by_height.end());
+    std::vector<const CBlockIndex*> index;
+    index.reserve(sorted_by_height.size());
+    for (const auto& [_, pindex] : sorted_by_height) {
+        index.push_back(pindex);
+    }
+    return m_block_tree_db->WriteBlockIndexSnapshot(index);
 }
 
 bool BlockManager::LoadBlockIndexDB(std::set<CBlockIndex*, CBlockIndexWorkComparator>& setBlockIndexCandidates)
@@ -3827,6 +4087,127 @@ bool CChainState::LoadChainTip()
     return true;
 }
 
+/** Blocks VerifyDB reads ahead of the one it is checking. */
+static constexpr size_t VERIFYDB_READ_AHEAD{32};
+
+namespace {
+/**
+ * Reads a list of blocks, and optionally checks them and reads their undo
+ * data, on a thread pool. Hands them out in list order.
+ *
+ * The caller holds cs_main for as long as this exists, so the pool's threads
+ * read the block index entries without taking it.
+ */
+class VerifyDBReader
+{
+public:
+    struct Result {
+        CBlock block;
+        CBlockUndo undo;
+        //! Why the block failed, empty if it passed.
+        std::string error;
+    };
+
+private:
+    const std::vector<const CBlockIndex*> m_index;
+    const Consensus::Params& m_consensus;
+    const bool m_check_block;
+    const bool m_read_undo;
+
+    ThreadPool& m_pool;
+    //! Whether blocks are read ahead on m_pool, rather than by Next().
+    const bool m_read_ahead;
+    //! Read tasks submitted to m_pool so far, by the thread owning this.
+    size_t m_submitted{0};
+
+    Mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<size_t, Result> m_done GUARDED_BY(m_mutex);
+    //! Position of the next block for a task to read.
+    size_t m_next GUARDED_BY(m_mutex){0};
+    //! Position of the next block to be handed out.
+    size_t m_taken GUARDED_BY(m_mutex){0};
+    //! Read tasks submitted to m_pool that have not finished yet.
+    size_t m_pending_tasks GUARDED_BY(m_mutex){0};
+
+    Result Read(const CBlockIndex* pindex) const
+    {
+        Result result;
+        BlockValidationState state;
+        if (!ReadBlockFromDisk(result.block, pindex->GetBlockPos(), m_consensus) || result.block.GetHash() != pindex->GetBlockHash()) {
+            result.error = strprintf("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        } else if (m_check_block && !CheckBlock(result.block, state, m_consensus)) {
+            result.error = strprintf("VerifyDB: *** found bad block at %d, hash=%s (%s)\n", pindex->nHeight, pindex->GetBlockHash().ToString(), state.ToString());
+        } else if (m_read_undo && !pindex->GetUndoPos().IsNull() && !UndoReadFromDisk(result.undo, pindex)) {
+            result.error = strprintf("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        }
+        return result;
+    }
+
+    //! Read the next block nothing has started on yet, if Next() has not got to it first.
+    void ReadNext() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        std::optional<size_t> pos;
+        {
+            LOCK(m_mutex);
+            if (m_next < m_index.size()) pos = m_next++;
+        }
+        std::optional<Result> result;
+        if (pos) result = Read(m_index[*pos]);
+        {
+            LOCK(m_mutex);
+            if (result) m_done.emplace(*pos, std::move(*result));
+            --m_pending_tasks;
+        }
+        m_cv.notify_all();
+    }
+
+    void SubmitRead() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        if (m_submitted == m_index.size()) return;
+        ++m_submitted;
+        WITH_LOCK(m_mutex, ++m_pending_tasks);
+        m_pool.Submit([this] { ReadNext(); });
+    }
+
+public:
+    VerifyDBReader(std::vector<const CBlockIndex*> index, const Consensus::Params& consensus, bool check_block, bool read_undo, ThreadPool& pool)
+        : m_index{std::move(index)}, m_consensus{consensus}, m_check_block{check_block}, m_read_undo{read_undo},
+          m_pool{pool}, m_read_ahead{pool.WorkerCount() > 0}
+    {
+        if (!m_read_ahead) return;
+        for (size_t i = 0; i < VERIFYDB_READ_AHEAD; ++i) {
+            SubmitRead();
+        }
+    }
+
+    ~VerifyDBReader()
+    {
+        WAIT_LOCK(m_mutex, lock);
+        // Tasks that have not started yet have nothing left to read.
+        m_next = m_index.size();
+        m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_pending_tasks == 0; });
+    }
+
+    /** Get the block at the next position of the list, reading it here if no task has started on it. */
+    Result Next() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        // Keep VERIFYDB_READ_AHEAD reads ahead of the blocks handed out.
+        if (m_read_ahead) SubmitRead();
+        WAIT_LOCK(m_mutex, lock);
+        const size_t pos{m_taken++};
+        if (m_next == pos) {
+            ++m_next;
+            REVERSE_LOCK(lock);
+            return Read(m_index[pos]);
+        }
+        m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_done.count(pos) > 0; });
+        auto node{m_done.extract(pos)};
+        return std::move(node.mapped());
+    }
+};
+} // namespace
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks…").translated, 0, false);
@@ -3855,22 +4236,17 @@ bool CVerifyDB::VerifyDB(
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
     CCoinsViewCache coins(&coinsview);
     CBlockIndex* pindex;
-    CBlockIndex* pindexFailure = nullptr;
+    const CBlockIndex* pindexFailure = nullptr;
     int nGoodTransactions = 0;
-    BlockValidationState state;
     int reportDone = 0;
     LogPrintf("[0%%]..."); /* Continued */
 
     const bool is_snapshot_cs{!chainstate.m_from_snapshot_blockhash};
 
+    // Blocks are read, checked and have their undo data read on the block work
+    // pool, while they are disconnected here in order.
+    std::vector<const CBlockIndex*> to_check;
     for (pindex = chainstate.m_chain.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
-        const int percentageDone = std::max(1, std::min(99, (int)(((double)(chainstate.m_chain.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-        if (reportDone < percentageDone/10) {
-            // report every 10% step
-            LogPrintf("[%d%%]...", percentageDone); /* Continued */
-            reportDone = percentageDone/10;
-        }
-        uiInterface.ShowProgress(_("Verifying blocks…").translated, percentageDone, false);
         if (pindex->nHeight <= chainstate.m_chain.Height()-nCheckDepth)
             break;
         if ((fPruneMode || is_snapshot_cs) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
@@ -3879,35 +4255,40 @@ bool CVerifyDB::VerifyDB(
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
-        CBlock block;
+        to_check.push_back(pindex);
+    }
+    VerifyDBReader reader(to_check, chainparams.GetConsensus(), /*check_block=*/nCheckLevel >= 1, /*read_undo=*/nCheckLevel >= 2, BlockWorkPool());
+
+    for (const CBlockIndex* pindex_check : to_check) {
+        const int percentageDone = std::max(1, std::min(99, (int)(((double)(chainstate.m_chain.Height() - pindex_check->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
+        if (reportDone < percentageDone/10) {
+            // report every 10% step
+            LogPrintf("[%d%%]...", percentageDone); /* Continued */
+            reportDone = percentageDone/10;
+        }
+        uiInterface.ShowProgress(_("Verifying blocks…").translated, percentageDone, false);
         // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
-            return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
-                         pindex->nHeight, pindex->GetBlockHash().ToString(), state.ToString());
         // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            if (!pindex->GetUndoPos().IsNull()) {
-                if (!UndoReadFromDisk(undo, pindex)) {
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                }
-            }
+        VerifyDBReader::Result result{reader.Next()};
+        if (!result.error.empty()) {
+            return error("%s", result.error);
         }
+        const CBlock& block{result.block};
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         size_t curr_coins_usage = coins.DynamicMemoryUsage() + chainstate.CoinsTip().DynamicMemoryUsage();
 
         if (nCheckLevel >= 3 && curr_coins_usage <= chainstate.m_coinstip_cache_size_bytes) {
-            assert(coins.GetBestBlock() == pindex->GetBlockHash());
-            DisconnectResult res = chainstate.DisconnectBlock(block, pindex, coins);
+            assert(coins.GetBestBlock() == pindex_check->GetBlockHash());
+            DisconnectResult res = pindex_check->GetUndoPos().IsNull() ?
+                chainstate.DisconnectBlock(block, pindex_check, coins) :
+                chainstate.DisconnectBlock(block, pindex_check, coins, std::move(result.undo));
             if (res == DISCONNECT_FAILED) {
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex_check->nHeight, pindex_check->GetBlockHash().ToString());
             }
             if (res == DISCONNECT_UNCLEAN) {
                 nGoodTransactions = 0;
-                pindexFailure = pindex;
+                pindexFailure = pindex_check;
             } else {
                 nGoodTransactions += block.vtx.size();
             }
@@ -3922,6 +4303,13 @@ bool CVerifyDB::VerifyDB(
 
     // check level 4: try reconnecting blocks
     if (nCheckLevel >= 4) {
+        // Script checks go through the script check queue as in ConnectTip,
+        // and reading the next blocks overlaps with connecting this one.
+        std::vector<const CBlockIndex*> to_connect;
+        for (const CBlockIndex* next = chainstate.m_chain.Next(pindex); next; next = chainstate.m_chain.Next(next)) {
+            to_connect.push_back(next);
+        }
+        VerifyDBReader reconnect_reader(std::move(to_connect), chainparams.GetConsensus(), /*check_block=*/false, /*read_undo=*/false, BlockWorkPool());
         while (pindex != chainstate.m_chain.Tip()) {
             const int percentageDone = std::max(1, std::min(99, 100 - (int)(((double)(chainstate.m_chain.Height() - pindex->nHeight)) / (double)nCheckDepth * 50)));
             if (reportDone < percentageDone/10) {
@@ -3931,10 +4319,12 @@ bool CVerifyDB::VerifyDB(
             }
             uiInterface.ShowProgress(_("Verifying blocks…").translated, percentageDone, false);
             pindex = chainstate.m_chain.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!chainstate.ConnectBlock(block, state, pindex, coins)) {
+            VerifyDBReader::Result result{reconnect_reader.Next()};
+            if (!result.error.empty()) {
+                return error("%s", result.error);
+            }
+            BlockValidationState state;
+            if (!chainstate.ConnectBlock(result.block, state, pindex, coins)) {
                 return error("VerifyDB(): *** found unconnectable block at %d, hash=%s (%s)", pindex->nHeight, pindex->GetBlockHash().ToString(), state.ToString());
             }
             if (ShutdownRequested()) return true;
@@ -4099,6 +4489,7 @@ bool ChainstateManager::LoadBlockIndex()
 
         LogPrintf("Initializing databases...\n");
     }
+    m_blockman.m_block_index_loaded = true;
     return true;
 }
 
@@ -4118,7 +4509,7 @@ bool CChainState::LoadGenesisBlock()
         FlatFilePos blockPos = SaveBlockToDisk(block, 0, m_chain, m_params, nullptr);
         if (blockPos.IsNull())
             return error("%s: writing genesis block to disk failed", __func__);
-        CBlockIndex *pindex = m_blockman.AddToBlockIndex(block);
+        CBlockIndex *pindex = m_blockman.AddToBlockIndex(block, block.GetHash());
         ReceivedBlockTransactions(block, pindex, blockPos);
     } catch (const std::runtime_error& e) {
         return error("%s: failed to write genesis block: %s", __func__, e.what());
@@ -4127,53 +4518,252 @@ bool CChainState::LoadGenesisBlock()
     return true;
 }
 
+/** Bytes of a block file read ahead of the oldest block not yet handed to validation. */
+static constexpr uint64_t MAX_IMPORT_READ_AHEAD{8 << 20};
+
+namespace {
+/**
+ * Deserializes, hashes and checks the raw block records read from an imported
+ * block file on a thread pool, and hands the results back in file order.
+ */
+class BlockImportParser
+{
+public:
+    struct Record {
+        //! Position in the file of the record's message start.
+        uint64_t header_pos;
+        //! Position in the file of the serialized block.
+        uint64_t block_pos;
+        std::vector<unsigned char> raw;
+        //! Set if the record deserialized into a block.
+        std::shared_ptr<CBlock> block;
+        uint256 hash;
+        //! Position in the file to continue scanning from after this record.
+        uint64_t next_pos;
+        std::string error;
+        bool parsed{false};
+    };
+
+private:
+    const Consensus::Params& m_consensus;
+    ThreadPool& m_pool;
+    Mutex m_mutex;
+    std::condition_variable m_cv;
+    //! Records in file order; m_records[i] has sequence number m_front_seq + i.
+    std::deque<Record> m_records GUARDED_BY(m_mutex);
+    uint64_t m_front_seq GUARDED_BY(m_mutex){0};
+    //! Sequence number of the next record for a worker to parse.
+    uint64_t m_next_claim GUARDED_BY(m_mutex){0};
+    //! Tasks submitted to m_pool that have not finished yet.
+    size_t m_pending_tasks GUARDED_BY(m_mutex){0};
+
+    void Parse(Record& record) const
+    {
+        try {
+            auto block = std::make_shared<CBlock>();
+            VectorReader reader(SER_DISK, CLIENT_VERSION, record.raw, 0);
+            reader >> *block;
+            record.next_pos = record.block_pos + record.raw.size() - reader.size();
+            record.hash = block->GetHash();
+            // A successful result is cached in fChecked, so AcceptBlock does not repeat it.
+            BlockValidationState state;
+            CheckBlock(*block, state, m_consensus);
+            record.block = std::move(block);
+        } catch (const std::exception& e) {
+            record.error = e.what();
+            record.next_pos = record.header_pos + 1;
+        }
+    }
+
+    bool Unclaimed() const EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        return m_next_claim < m_front_seq + m_records.size();
+    }
+
+    //! Parse the next unclaimed record, if Pop() has not got to it first.
+    void ParseNext() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        Record* record{nullptr};
+        {
+            LOCK(m_mutex);
+            // Records are only removed once parsed, and pushing to the back
+            // of a deque leaves references to the others valid.
+            if (Unclaimed()) record = &m_records[m_next_claim++ - m_front_seq];
+        }
+        if (record) Parse(*record);
+        {
+            LOCK(m_mutex);
+            if (record) record->parsed = true;
+            --m_pending_tasks;
+        }
+        m_cv.notify_all();
+    }
+
+public:
+    BlockImportParser(const Consensus::Params& consensus, ThreadPool& pool) : m_consensus(consensus), m_pool(pool) {}
+
+    ~BlockImportParser()
+    {
+        Clear();
+        WAIT_LOCK(m_mutex, lock);
+        m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_pending_tasks == 0; });
+    }
+
+    bool Empty() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        LOCK(m_mutex);
+        return m_records.empty();
+    }
+
+    //! File position of the oldest record; there must be one.
+    uint64_t OldestPos() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        LOCK(m_mutex);
+        return m_records.front().header_pos;
+    }
+
+    void Push(Record&& record) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        {
+            LOCK(m_mutex);
+            m_records.push_back(std::move(record));
+            ++m_pending_tasks;
+        }
+        m_pool.Submit([this] { ParseNext(); });
+    }
+
+    /**
+     * Remove and return the oldest record if it has been parsed. With wait, it
+     * is parsed on the calling thread if no worker has started on it yet,
+     * otherwise the worker is waited for.
+     */
+    std::optional<Record> Pop(bool wait) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        if (m_records.empty()) return std::nullopt;
+        Record& front = m_records.front();
+        if (!front.parsed) {
+            if (!wait) return std::nullopt;
+            if (m_next_claim == m_front_seq) {
+                ++m_next_claim;
+                REVERSE_LOCK(lock);
+                Parse(front);
+            } else {
+                m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return front.parsed; });
+            }
+        }
+        std::optional<Record> ret{std::move(front)};
+        m_records.pop_front();
+        ++m_front_seq;
+        return ret;
+    }
+
+    //! Discard all records not yet popped.
+    void Clear() EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        // Workers keep references to the records they claimed until parsed.
+        const uint64_t claimed_end{m_next_claim};
+        m_next_claim = m_front_seq + m_records.size();
+        m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) {
+            for (uint64_t seq = m_front_seq; seq < claimed_end; ++seq) {
+                if (!m_records[seq - m_front_seq].parsed) return false;
+            }
+            return true;
+        });
+        m_records.clear();
+        m_front_seq = m_next_claim;
+    }
+};
+} // namespace
+
 void CChainState::LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    // Map of disk positions for blocks with unknown parent (only used for reindex).
+    // Only positions are kept; such blocks are read again once their parent is known.
     static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor.
+        // The buffer also keeps the records read ahead, so scanning can resume
+        // inside any of them that does not turn out to hold exactly one block.
+        CBufferedFile blkdat(fileIn, MAX_IMPORT_READ_AHEAD + 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_IMPORT_READ_AHEAD + MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        // Records read ahead are parsed and checked on the block work pool
+        // while earlier blocks are accepted here.
+        BlockImportParser parser{m_params.GetConsensus(), BlockWorkPool()};
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        bool scanning{true};
+        while (true) {
             if (ShutdownRequested()) return;
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(m_params.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> buf;
-                if (memcmp(buf, m_params.MessageStart(), CMessageHeader::MESSAGE_START_SIZE)) {
+            const bool read_ahead{scanning && !blkdat.eof() && (parser.Empty() || blkdat.GetPos() - parser.OldestPos() < MAX_IMPORT_READ_AHEAD)};
+            if (!read_ahead && parser.Empty()) break;
+
+            if (read_ahead) {
+                blkdat.SetPos(nRewind);
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                uint64_t header_pos = 0;
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                    blkdat.FindByte(m_params.MessageStart()[0]);
+                    header_pos = blkdat.GetPos();
+                    nRewind = header_pos+1;
+                    blkdat >> buf;
+                    if (memcmp(buf, m_params.MessageStart(), CMessageHeader::MESSAGE_START_SIZE)) {
+                        continue;
+                    }
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    scanning = false;
                     continue;
                 }
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+                try {
+                    // read block, to be parsed by the workers
+                    BlockImportParser::Record record;
+                    record.header_pos = header_pos;
+                    record.block_pos = blkdat.GetPos();
+                    record.raw.resize(nSize);
+                    blkdat.read((char*)record.raw.data(), nSize);
+                    nRewind = blkdat.GetPos();
+                    parser.Push(std::move(record));
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                }
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
-                uint256 hash = block.GetHash();
+            // Hand parsed blocks to validation in file order, waiting for the
+            // oldest one only when nothing more can be read ahead.
+            bool wait{!read_ahead};
+            while (std::optional<BlockImportParser::Record> record = parser.Pop(wait)) {
+                wait = false;
+                if (record->next_pos != record->block_pos + record->raw.size()) {
+                    // The record did not hold exactly one block: drop the records
+                    // read after it and scan again from where its block ended, or
+                    // from just past its message start if it held none.
+                    if (!record->block) {
+                        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, record->error);
+                    }
+                    parser.Clear();
+                    nRewind = record->next_pos;
+                    blkdat.SetPos(nRewind);
+                    scanning = true;
+                }
+                if (!record->block) continue;
+
+                std::shared_ptr<CBlock> pblock = std::move(record->block);
+                CBlock& block = *pblock;
+                const uint256& hash = record->hash;
+                if (dbp)
+                    dbp->nPos = record->block_pos;
                 {
                     LOCK(cs_main);
                     // detect out of order blocks, and store them for later
@@ -4193,6 +4783,8 @@ void CChainState::LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                           nLoaded++;
                       }
                       if (state.IsError()) {
+                          parser.Clear();
+                          scanning = false;
                           break;
                       }
                     } else if (hash != m_params.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
@@ -4204,6 +4796,8 @@ void CChainState::LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                 if (hash == m_params.GetConsensus().hashGenesisBlock) {
                     BlockValidationState state;
                     if (!ActivateBestChain(state, nullptr)) {
+                        parser.Clear();
+                        scanning = false;
                         break;
                     }
                 }
@@ -4235,8 +4829,6 @@ void CChainState::LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                         NotifyHeaderTip(*this);
                     }
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
@@ -4485,6 +5077,8 @@ bool CChainState::ResizeCoinsCaches(size_t coinstip_size, size_t coinsdb_size)
     size_t old_coinstip_size = m_coinstip_cache_size_bytes;
     m_coinstip_cache_size_bytes = coinstip_size;
     m_coinsdb_cache_size_bytes = coinsdb_size;
+    // The prefetch thread reads from the database being replaced.
+    m_coins_views->m_prefetchview.Reset();
     CoinsDB().ResizeCache(coinsdb_size);
 
     LogPrintf("[%s] resized coinsdb cache to %.1f MiB\n",
@@ -4783,9 +5377,11 @@ bool ChainstateManager::ActivateSnapshot(
 
     {
         LOCK(::cs_main);
+        // Coins are written straight to the database while loading, so a
+        // snapshot that failed to load before may have left some behind.
         snapshot_chainstate->InitCoinsDB(
             static_cast<size_t>(current_coinsdb_cache_size * SNAPSHOT_CACHE_PERC),
-            in_memory, false, "chainstate");
+            in_memory, /*should_wipe=*/true, "chainstate");
         snapshot_chainstate->InitCoinsCache(
             static_cast<size_t>(current_coinstip_cache_size * SNAPSHOT_CACHE_PERC));
     }
@@ -4816,6 +5412,124 @@ bool ChainstateManager::ActivateSnapshot(
     return true;
 }
 
+/** Coins of a UTXO snapshot parsed, written and hashed at a time; about 8 MiB of database writes. */
+static constexpr size_t SNAPSHOT_LOAD_CHUNK_COINS{150000};
+/** Chunks parsed ahead of the slower of the writing and hashing threads. */
+static constexpr size_t SNAPSHOT_LOAD_QUEUED_CHUNKS{4};
+
+namespace {
+/**
+ * Takes the coins of a UTXO snapshot in chunks, in file order, and processes
+ * each chunk on two threads: one writes it straight to the snapshot
+ * chainstate's coins database as a single batch, the other feeds it to the
+ * serialized UTXO set hash. The hash is a single stream, so it runs alongside
+ * parsing and writing rather than split up, and spares reading the whole
+ * database back to check the snapshot.
+ */
+class SnapshotCoinsLoader
+{
+public:
+    using Chunk = std::vector<std::pair<COutPoint, Coin>>;
+
+private:
+    CCoinsViewDB& m_db;
+    //! Only used by the hashing thread until it is stopped.
+    SerializedUTXOHasher m_hasher;
+
+    Mutex m_mutex;
+    std::condition_variable m_cv;
+    //! Chunks submitted to each pool and not processed yet.
+    size_t m_queued_writes GUARDED_BY(m_mutex){0};
+    size_t m_queued_hashes GUARDED_BY(m_mutex){0};
+    bool m_write_failed GUARDED_BY(m_mutex){false};
+    //! Set when the chunks still queued are no longer needed.
+    std::atomic<bool> m_abandon{false};
+
+    //! One thread each, so chunks are written and hashed in file order.
+    ThreadPool m_write_pool{"loadsnap.write"};
+    ThreadPool m_hash_pool{"loadsnap.hash"};
+
+    void Write(const Chunk& chunk) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        // Nothing more is written once a write failed.
+        const bool skip{m_abandon || WITH_LOCK(m_mutex, return m_write_failed)};
+        bool written{false};
+        if (!skip) {
+            try {
+                written = m_db.WriteCoins(chunk);
+            } catch (const std::exception& e) {
+                LogPrintf("[snapshot] error writing coins: %s\n", e.what());
+            }
+        }
+        {
+            LOCK(m_mutex);
+            if (!skip && !written) m_write_failed = true;
+            --m_queued_writes;
+        }
+        m_cv.notify_all();
+    }
+
+    void Hash(const Chunk& chunk) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        if (!m_abandon) {
+            for (const auto& [outpoint, coin] : chunk) {
+                if (!m_hasher.Add(outpoint, coin)) break;
+            }
+        }
+        WITH_LOCK(m_mutex, --m_queued_hashes);
+        m_cv.notify_all();
+    }
+
+public:
+    SnapshotCoinsLoader(CCoinsViewDB& db, const uint256& base_blockhash)
+        : m_db{db}, m_hasher{base_blockhash}
+    {
+        m_write_pool.Start(1);
+        m_hash_pool.Start(1);
+    }
+
+    /** Abandon whatever is still queued, e.g. when the snapshot turned out to be bad. */
+    ~SnapshotCoinsLoader()
+    {
+        m_abandon = true;
+        m_write_pool.Stop();
+        m_hash_pool.Stop();
+    }
+
+    /** Queue a chunk of coins, waiting while too many are queued. Returns false once a write failed. */
+    bool Push(Chunk&& chunk) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        const auto shared{std::make_shared<const Chunk>(std::move(chunk))};
+        {
+            WAIT_LOCK(m_mutex, lock);
+            m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) {
+                return m_write_failed || (m_queued_writes < SNAPSHOT_LOAD_QUEUED_CHUNKS && m_queued_hashes < SNAPSHOT_LOAD_QUEUED_CHUNKS);
+            });
+            if (m_write_failed) return false;
+            ++m_queued_writes;
+            ++m_queued_hashes;
+        }
+        m_write_pool.Submit([this, shared] { Write(*shared); });
+        m_hash_pool.Submit([this, shared] { Hash(*shared); });
+        return true;
+    }
+
+    /**
+     * Wait for all queued chunks to be written and hashed. Returns false if a
+     * write failed. Otherwise sets hash to the serialized UTXO set hash, or to
+     * nullopt if the coins were not in the order the hash needs.
+     */
+    bool Finish(std::optional<uint256>& hash) EXCLUSIVE_LOCKS_REQUIRED(!m_mutex)
+    {
+        m_write_pool.Stop();
+        m_hash_pool.Stop();
+        if (WITH_LOCK(m_mutex, return m_write_failed)) return false;
+        hash = m_hasher.Ordered() ? std::make_optional(m_hasher.Finalize()) : std::nullopt;
+        return true;
+    }
+};
+} // namespace
+
 bool ChainstateManager::PopulateAndValidateSnapshot(
     CChainState& snapshot_chainstate,
     CAutoFile& coins_file,
@@ -4853,9 +5567,14 @@ bool ChainstateManager::PopulateAndValidateSnapshot(
     uint64_t coins_left = metadata.m_coins_count;
 
     LogPrintf("[snapshot] loading coins from snapshot %s\n", base_blockhash.ToString());
-    int64_t flush_now{0};
     int64_t coins_processed{0};
 
+    // Coins bypass the cache and go straight to the (fresh) coins database; it
+    // only gets a best block once they are all in.
+    SnapshotCoinsLoader loader{*WITH_LOCK(::cs_main, return &snapshot_chainstate.CoinsDB()), base_blockhash};
+    SnapshotCoinsLoader::Chunk chunk;
+    chunk.reserve(std::min<uint64_t>(coins_count, SNAPSHOT_LOAD_CHUNK_COINS));
+
     while (coins_left > 0) {
         try {
             coins_file >> outpoint;
@@ -4866,6 +5585,7 @@ bool ChainstateManager::PopulateAndValidateSnapshot(
             return false;
         }
         if (coin.nHeight > base_height ||
+            coin.IsSpent() ||
             outpoint.n >= std::numeric_limits<decltype(outpoint.n)>::max() // Avoid integer wrap-around in coinstats.cpp:ApplyHash
         ) {
             LogPrintf("[snapshot] bad snapshot data after deserializing %d coins\n",
@@ -4873,54 +5593,30 @@ bool ChainstateManager::PopulateAndValidateSnapshot(
             return false;
         }
 
-        coins_cache.EmplaceCoinInternalDANGER(std::move(outpoint), std::move(coin));
+        chunk.emplace_back(std::move(outpoint), std::move(coin));
 
         --coins_left;
         ++coins_processed;
 
         if (coins_processed % 1000000 == 0) {
-            LogPrintf("[snapshot] %d coins loaded (%.2f%%, %.2f MB)\n",
+            LogPrintf("[snapshot] %d coins loaded (%.2f%%)\n",
                 coins_processed,
-                static_cast<float>(coins_processed) * 100 / static_cast<float>(coins_count),
-                coins_cache.DynamicMemoryUsage() / (1000 * 1000));
+                static_cast<float>(coins_processed) * 100 / static_cast<float>(coins_count));
         }
 
-        // Batch write and flush (if we need to) every so often.
-        //
-        // If our average Coin size is roughly 41 bytes, checking every 120,000 coins
-        // means <5MB of memory imprecision.
-        if (coins_processed % 120000 == 0) {
+        if (chunk.size() == SNAPSHOT_LOAD_CHUNK_COINS || coins_left == 0) {
             if (ShutdownRequested()) {
                 return false;
             }
-
-            const auto snapshot_cache_state = WITH_LOCK(::cs_main,
-                return snapshot_chainstate.GetCoinsCacheSizeState());
-
-            if (snapshot_cache_state >=
-                    CoinsCacheSizeState::CRITICAL) {
-                LogPrintf("[snapshot] flushing coins cache (%.2f MB)... ", /* Continued */
-                    coins_cache.DynamicMemoryUsage() / (1000 * 1000));
-                flush_now = GetTimeMillis();
-
-                // This is a hack - we don't know what the actual best block is, but that
-                // doesn't matter for the purposes of flushing the cache here. We'll set this
-                // to its correct value (`base_blockhash`) below after the coins are loaded.
-                coins_cache.SetBestBlock(GetRandHash());
-
-                coins_cache.Flush();
-                LogPrintf("done (%.2fms)\n", GetTimeMillis() - flush_now);
+            if (!loader.Push(std::move(chunk))) {
+                LogPrintf("[snapshot] failed to write coins to the snapshot chainstate\n");
+                return false;
             }
+            chunk = {};
+            chunk.reserve(std::min<uint64_t>(coins_left, SNAPSHOT_LOAD_CHUNK_COINS));
         }
     }
 
-    // Important that we set this. This and the coins_cache accesses above are
-    // sort of a layer violation, but either we reach into the innards of
-    // CCoinsViewCache here or we have to invert some of the CChainState to
-    // embed them in a snapshot-activation-specific CCoinsViewCache bulk load
-    // method.
-    coins_cache.SetBestBlock(base_blockhash);
-
     bool out_of_coins{false};
     try {
         coins_file >> outpoint;
@@ -4934,33 +5630,52 @@ bool ChainstateManager::PopulateAndValidateSnapshot(
         return false;
     }
 
-    LogPrintf("[snapshot] loaded %d (%.2f MB) coins from snapshot %s\n",
+    std::optional<uint256> streamed_hash;
+    if (!loader.Finish(streamed_hash)) {
+        LogPrintf("[snapshot] failed to write coins to the snapshot chainstate\n");
+        return false;
+    }
+
+    LogPrintf("[snapshot] loaded %d coins from snapshot %s\n",
         coins_count,
-        coins_cache.DynamicMemoryUsage() / (1000 * 1000),
         base_blockhash.ToString());
 
+    // The coins went straight to the database, so the cache on top of it is
+    // still empty and flushing it only sets the best block on the DB-backed
+    // view.
+    coins_cache.SetBestBlock(base_blockhash);
+
     LogPrintf("[snapshot] flushing snapshot chainstate to disk\n");
     // No need to acquire cs_main since this chainstate isn't being used yet.
-    coins_cache.Flush(); // TODO: if #17487 is merged, add erase=false here for better performance.
+    coins_cache.Flush();
 
     assert(coins_cache.GetBestBlock() == base_blockhash);
 
-    CCoinsStats stats{CoinStatsHashType::HASH_SERIALIZED};
-    auto breakpoint_fnc = [] { /* TODO insert breakpoint here? */ };
-
-    // As above, okay to immediately release cs_main here since no other context knows
-    // about the snapshot_chainstate.
-    CCoinsViewDB* snapshot_coinsdb = WITH_LOCK(::cs_main, return &snapshot_chainstate.CoinsDB());
-
-    if (!GetUTXOStats(snapshot_coinsdb, WITH_LOCK(::cs_main, return std::ref(m_blockman)), stats, breakpoint_fnc)) {
-        LogPrintf("[snapshot] failed to generate coins stats\n");
-        return false;
+    uint256 hash_serialized;
+    if (streamed_hash) {
+        hash_serialized = *streamed_hash;
+    } else {
+        // The coins were not sorted the way the database lists them, so hash
+        // what ended up in the database instead.
+        LogPrintf("[snapshot] coins out of order, hashing the snapshot chainstate\n");
+        CCoinsStats stats{CoinStatsHashType::HASH_SERIALIZED};
+        auto breakpoint_fnc = [] { /* TODO insert breakpoint here? */ };
+
+        // As above, okay to immediately release cs_main here since no other context knows
+        // about the snapshot_chainstate.
+        CCoinsViewDB* snapshot_coinsdb = WITH_LOCK(::cs_main, return &snapshot_chainstate.CoinsDB());
+
+        if (!GetUTXOStats(snapshot_coinsdb, WITH_LOCK(::cs_main, return std::ref(m_blockman)), stats, breakpoint_fnc)) {
+            LogPrintf("[snapshot] failed to generate coins stats\n");
+            return false;
+        }
+        hash_serialized = stats.hashSerialized;
     }
 
     // Assert that the deserialized chainstate contents match the expected assumeutxo value.
-    if (AssumeutxoHash{stats.hashSerialized} != au_data.hash_serialized) {
+    if (AssumeutxoHash{hash_serialized} != au_data.hash_serialized) {
         LogPrintf("[snapshot] bad snapshot content hash: expected %s, got %s\n",
-            au_data.hash_serialized.ToString(), stats.hashSerialized.ToString());
+            au_data.hash_serialized.ToString(), hash_serialized.ToString());
         return false;
     }
 
@@ -15,8 +15,10 @@
 #include <chain.h>
 #include <consensus/amount.h>
 #include <fs.h>
+#include <node/coins_prefetch.h>
 #include <policy/feerate.h>
 #include <policy/packages.h>
+#include <primitives/block.h>
 #include <script/script_error.h>
 #include <sync.h>
 #include <txdb.h>
@@ -27,8 +29,10 @@
 #include <util/translation.h>
 
 #include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <stdint.h>
@@ -39,11 +43,13 @@
 
 class CChainState;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
 struct CCheckpointData;
 class CTxMemPool;
 class ChainstateManager;
 class SnapshotMetadata;
+class ThreadPool;
 struct ChainTxData;
 struct DisconnectedBlockTransactions;
 struct PrecomputedTransactionData;
@@ -60,6 +66,8 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a mempool cluster, if clusters are tracked */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 100;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
 /** Maximum number of dedicated script-checking threads allowed */
@@ -73,6 +81,8 @@ static constexpr bool DEFAULT_COINSTATSINDEX{false};
 static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -mempoolclusters, tracking linearized clusters of mempool transactions */
+static const bool DEFAULT_MEMPOOL_CLUSTERS = false;
 /** Default for -stopatheight */
 static const int DEFAULT_STOPATHEIGHT = 0;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of ActiveChain().Tip() will not be pruned. */
@@ -133,6 +143,58 @@ void StartScriptCheckWorkerThreads(int threads_num);
 /** Stop all of the script checking worker threads */
 void StopScriptCheckWorkerThreads();
 
+/** Transactions and packages spending fewer inputs than this have their mempool script checks run on the calling thread only. */
+static constexpr size_t MIN_PARALLEL_MEMPOOL_SCRIPT_CHECKS{16};
+
+/** Worker threads shared by block validation work, running while the script check threads are. */
+ThreadPool& BlockWorkPool();
+
+/** Blocks with fewer transactions than this have their txids computed on the calling thread only. */
+static constexpr size_t MIN_PARALLEL_TX_HASHING_TXS{256};
+
+/**
+ * Turn a block's deserialized transactions into CTransactionRefs. Constructing a
+ * CTransaction computes its txid and wtxid; for blocks with at least
+ * MIN_PARALLEL_TX_HASHING_TXS transactions that work is shared between the
+ * calling thread and pool instead of being done serially inside the
+ * deserializer. Without a pool it is all done on the calling thread, which
+ * must not be one of the pool's.
+ */
+std::vector<CTransactionRef> MakeBlockTransactions(std::vector<CMutableTransaction>&& txs, ThreadPool* pool);
+
+/** Header batches smaller than this are hashed on the calling thread only. */
+static constexpr size_t MIN_PARALLEL_HEADER_HASHING{512};
+
+/**
+ * Compute the hashes of a batch of block headers with GetBlockHeaderHashes,
+ * sharing batches of at least MIN_PARALLEL_HEADER_HASHING headers between the
+ * calling thread and pool. Does not need cs_main.
+ */
+std::vector<uint256> HashBlockHeaders(Span<const CBlockHeader> headers, ThreadPool* pool = &BlockWorkPool());
+
+/**
+ * Deserialization wrapper for CBlock that defers hashing of its transactions to
+ * MakeBlockTransactions. Produces the same block as `s >> block`:
+ *
+ *     vRecv >> ParallelTxHashing{block};
+ *
+ * Meant for blocks received from peers; blocks read back from disk are hashed
+ * serially by their readers, which may run on the pool themselves.
+ */
+struct ParallelTxHashing {
+    CBlock& block;
+    ThreadPool* pool{&BlockWorkPool()};
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        s >> static_cast<CBlockHeader&>(block);
+        std::vector<CMutableTransaction> txs;
+        s >> txs;
+        block.vtx = MakeBlockTransactions(std::move(txs), pool);
+    }
+};
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 
 bool AbortNode(BlockValidationState& state, const std::string& strMessage, const bilingual_str& userMessage = bilingual_str{});
@@ -215,6 +277,15 @@ struct PackageMempoolAcceptResult
 MempoolAcceptResult AcceptToMemoryPool(CChainState& active_chainstate, CTxMemPool& pool, const CTransactionRef& tx,
                                        bool bypass_limits, bool test_accept=false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/**
+ * The checks of AcceptToMemoryPool() that only look at the transaction itself:
+ * consensus sanity, no coinbase, standardness (unless -acceptnonstdtxn) and
+ * minimum size. They need neither cs_main nor the mempool, so callers may run
+ * them up front to reject a transaction without taking any lock.
+ * AcceptToMemoryPool() always runs them again.
+ */
+bool CheckTransactionForMempool(const CTransaction& tx, TxValidationState& state);
+
 /**
 * Atomically test acceptance of a package. If the package only contains one tx, package rules still
 * apply. Package validation does not allow BIP125 replacements, so the transaction(s) cannot spend
@@ -273,6 +344,27 @@ bool CheckSequenceLocks(CBlockIndex* tip,
                         LockPoints* lp = nullptr,
                         bool useExistingLockPoints = false);
 
+/**
+ * Spent outputs of a transaction whose PrecomputedTransactionData is filled in
+ * by the first of its script checks to run, so that the sighash midstates are
+ * hashed on the script check threads rather than on the thread connecting the
+ * block.
+ */
+class DeferredTxData
+{
+private:
+    std::once_flag m_once;
+
+public:
+    std::vector<CTxOut> m_spent_outputs;
+
+    /** Initialize txdata from m_spent_outputs, exactly once across all threads. */
+    void Init(const CTransaction& tx, PrecomputedTransactionData& txdata)
+    {
+        std::call_once(m_once, [&] { txdata.Init(tx, std::move(m_spent_outputs)); });
+    }
+};
+
 /**
  * Closure representing one script verification
  * Note that this stores references to the spending transaction
@@ -287,11 +379,12 @@ private:
     bool cacheStore;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    DeferredTxData *deferred{nullptr};
 
 public:
     CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn, DeferredTxData* deferredIn = nullptr) :
+        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), deferred(deferredIn) { }
 
     bool operator()();
 
@@ -303,6 +396,7 @@ public:
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(deferred, check.deferred);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -398,8 +492,20 @@ private:
      */
     void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight, int chain_tip_height, int prune_height, bool is_ibd);
 
+    //! Number of entries allocated together for m_block_index.
+    static constexpr size_t BLOCK_INDEX_CHUNK_SIZE{1024};
+    //! Storage for the entries of m_block_index, which are only freed together by Unload().
+    std::vector<std::unique_ptr<CBlockIndex[]>> m_block_index_chunks GUARDED_BY(cs_main);
+    //! Entries used in the last chunk.
+    size_t m_block_index_chunk_used GUARDED_BY(cs_main){0};
+
+    //! Allocate a default-constructed entry for m_block_index.
+    CBlockIndex* NewBlockIndex() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 public:
     BlockMap m_block_index GUARDED_BY(cs_main);
+    //! Whether m_block_index holds everything in m_block_tree_db, e.g. to write it as a snapshot.
+    bool m_block_index_loaded GUARDED_BY(cs_main){false};
 
     /** In order to efficiently track invalidity of headers, we keep the set of
       * blocks which we tried to connect and found to be invalid here (ie which
@@ -447,7 +553,14 @@ public:
     /** Clear all data members. */
     void Unload() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
-    CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /**
+     * Write the block index to the block tree database's snapshot file, to be
+     * loaded at the next start instead of the database records. Only done
+     * when the index was loaded and everything in it has been flushed.
+     */
+    bool WriteBlockIndexSnapshot() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Create a new block index entry for a given block hash */
     CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -457,12 +570,17 @@ public:
     /**
      * If a block header hasn't already been seen, call CheckBlockHeader on it, ensure
      * that it doesn't descend from an invalid block, and then add it to m_block_index.
+     * hash must be block.GetHash(); it is passed in so callers can compute it in batches.
+     * Callers that already checked the header's proof of work outside cs_main pass
+     * check_pow = false.
      */
     bool AcceptBlockHeader(
         const CBlockHeader& block,
+        const uint256& hash,
         BlockValidationState& state,
         const CChainParams& chainparams,
-        CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+        CBlockIndex** ppindex,
+        bool check_pow = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     CBlockIndex* LookupBlockIndex(const uint256& hash) const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -503,6 +621,10 @@ public:
     //! This view wraps access to the leveldb instance and handles read errors gracefully.
     CCoinsViewErrorCatcher m_catcherview GUARDED_BY(cs_main);
 
+    //! This view serves coins that a background thread has read ahead of the
+    //! blocks about to be connected.
+    CCoinsViewPrefetch m_prefetchview;
+
     //! This is the top layer of the cache hierarchy - it keeps as many coins in memory as
     //! can fit per the dbcache setting.
     std::unique_ptr<CCoinsViewCache> m_cacheview GUARDED_BY(cs_main);
@@ -528,6 +650,23 @@ enum class CoinsCacheSizeState
     OK = 0
 };
 
+/** Statistics about the writes of the coins cache to disk, for getmemoryinfo. */
+struct CoinsFlushStats
+{
+    //! Writes that emptied the cache.
+    uint64_t full_flushes{0};
+    //! Writes that kept the unspent coins cached, evicting only clean ones
+    //! that had not been used recently, and only if the cache was large.
+    uint64_t partial_flushes{0};
+    //! Time taken by the last write, eviction included.
+    std::chrono::microseconds last_duration{0};
+    //! Cache entries and memory usage when the last write started.
+    size_t last_coins{0};
+    size_t last_usage_bytes{0};
+    //! Entries evicted after the last write.
+    size_t last_evicted{0};
+};
+
 /**
  * CChainState stores and provides an API to update our local knowledge of the
  * current best chain.
@@ -665,6 +804,9 @@ public:
     //! The cache size of the in-memory coins view.
     size_t m_coinstip_cache_size_bytes{0};
 
+    //! Statistics about the writes of the in-memory coins view to disk.
+    CoinsFlushStats m_coins_flush_stats GUARDED_BY(::cs_main);
+
     //! Resize the CoinsViews caches dynamically and flush state to disk.
     //! @returns true unless an error occurred during the flush.
     bool ResizeCoinsCaches(size_t coinstip_size, size_t coinsdb_size)
@@ -719,6 +861,8 @@ public:
 
     // Block (dis)connection on a given view:
     DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    /** Disconnect a block whose undo data has already been read. */
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CBlockUndo&& blockUndo);
     bool ConnectBlock(const CBlock& block, BlockValidationState& state, CBlockIndex* pindex,
                       CCoinsViewCache& view, bool fJustCheck = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -996,6 +1140,14 @@ public:
      */
     bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, BlockValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex = nullptr) LOCKS_EXCLUDED(cs_main);
 
+    /**
+     * As above, for callers that already computed the headers' hashes (e.g. with
+     * HashBlockHeaders). Proof of work is checked before taking cs_main.
+     *
+     * @param[in]  hashes The hashes of the block headers, in the same order
+     */
+    bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, const std::vector<uint256>& hashes, BlockValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex = nullptr) LOCKS_EXCLUDED(cs_main);
+
     /**
      * Try to add a transaction to the memory pool.
      *
@@ -2,7 +2,8 @@
 # Copyright (c) 2019-2020 The Bitcoin Core developers
 # Distributed under the MIT software license, see the accompanying
 # file COPYING or http://www.opensource.org/licenses/mit-license.php.
-"""Test the generation of UTXO snapshots using `dumptxoutset`.
+"""Test the generation of UTXO snapshots using `dumptxoutset`, and the
+checks `loadtxoutset` makes before loading one.
 """
 
 from test_framework.blocktools import COINBASE_MATURITY
@@ -49,5 +50,12 @@ class DumptxoutsetTest(BGLTestFramework):
         assert_raises_rpc_error(
             -8, '{} already exists'.format(FILENAME),  node.dumptxoutset, FILENAME)
 
+        self.log.info("Test loadtxoutset refuses snapshots it cannot load")
+        assert_raises_rpc_error(
+            -8, "Couldn't open file", node.loadtxoutset, 'missing.dat')
+        # Regtest has no assumeutxo data at height 100.
+        assert_raises_rpc_error(
+            -1, 'No assumeutxo data for snapshot base height 100', node.loadtxoutset, FILENAME)
+
 if __name__ == '__main__':
     DumptxoutsetTest().main()
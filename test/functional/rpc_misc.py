@@ -42,6 +42,10 @@ class RpcMiscTest(BGLTestFramework):
         assert_greater_than(memory['chunks_free'], 0)
         assert_equal(memory['used'] + memory['free'], memory['total'])
 
+        coins_cache = node.getmemoryinfo()['coins_cache']
+        assert_greater_than(coins_cache['max'], 0)
+        assert_greater_than_or_equal(coins_cache['usage'], coins_cache['free'])
+
         self.log.info("test mallocinfo")
         try:
             mallocinfo = node.getmemoryinfo(mode="mallocinfo")